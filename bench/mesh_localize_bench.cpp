@@ -0,0 +1,353 @@
+#include <iostream>
+#include <cstdlib>
+
+#include <benchmark/benchmark.h>
+#include <Eigen/Dense>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+#include "mesh_localize/ImageDbUtil.h"
+#include "mesh_localize/KeyframeContainer.h"
+#include "mesh_localize/ASiftDetector.h"
+#include "mesh_localize/PnPUtil.h"
+#include "mesh_localize/EdgeTrackingUtil.h"
+#include "mesh_localize/KLTTracker.h"
+#include "mesh_localize/PointCloudImageGenerator.h"
+#include "mesh_localize/Tracker.h"
+
+using namespace cv;
+
+/**
+ *  Microbenchmarks of the hot kernels of the tracker, each measured on its own with
+ *  inputs from the bundled keyframe database.
+ *
+ *  Usage: mesh_localize_bench [benchmark flags] [data_dir]
+ *
+ *  data_dir defaults to data/cheezit in the source tree.  Keyframe 0 is used as the query
+ *  image and keyframe 1 as the reference it is matched and tracked against.
+ */
+
+namespace
+{
+  std::string data_dir = MESH_LOCALIZE_BENCH_DATA_DIR;
+
+  // Every pixel at this stride of every depth map becomes a point of the render cloud
+  const int kCloudStride = 4;
+  const float kMatchRatio = 0.7;
+
+  struct Fixture
+  {
+    std::vector<KeyframeContainer*> keyframes;
+    Eigen::Matrix3f K;
+    Mat query, reference;
+    Mat query_depth, reference_depth;
+    Eigen::Matrix4f query_tf, reference_tf;
+    Mat query_mask;
+
+    // SURF correspondences between the two keyframes, with the reference points
+    // backprojected into the model
+    std::vector<Point2f> query_pts, reference_pts;
+    std::vector<Point3f> model_pts;
+
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud;
+  };
+
+  Mat ToGray(const Mat& img)
+  {
+    if(img.channels() == 1)
+      return img;
+    Mat gray;
+    cvtColor(img, gray, CV_BGR2GRAY);
+    return gray;
+  }
+
+  void RatioMatch(const Mat& query, const Mat& train, std::vector<DMatch>& good)
+  {
+    FlannBasedMatcher matcher;
+    std::vector<std::vector<DMatch> > matches;
+    matcher.knnMatch(query, train, matches, 2);
+    for(unsigned int i = 0; i < matches.size(); i++)
+    {
+      if(matches[i].size() == 2 && matches[i][0].distance < kMatchRatio*matches[i][1].distance)
+        good.push_back(matches[i][0]);
+    }
+  }
+
+  pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr BuildCloud(
+    const std::vector<KeyframeContainer*>& keyframes)
+  {
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud(
+      new pcl::PointCloud<pcl::PointXYZRGBNormal>);
+    for(unsigned int k = 0; k < keyframes.size(); k++)
+    {
+      Mat img = ToGray(keyframes[k]->GetImage());
+      Mat depth = keyframes[k]->GetDepth();
+      Eigen::Matrix4f tf = keyframes[k]->GetTf();
+      Eigen::Matrix3f Kinv = keyframes[k]->GetK().inverse();
+      for(int i = 0; i < depth.rows; i += kCloudStride)
+      {
+        for(int j = 0; j < depth.cols; j += kCloudStride)
+        {
+          float d = depth.at<float>(i, j);
+          if(d <= 0)
+            continue;
+          Eigen::Vector3f ray = Kinv*Eigen::Vector3f(j, i, 1);
+          Eigen::Vector4f pt = tf*Eigen::Vector4f(d*ray(0)/ray(2), d*ray(1)/ray(2), d, 1);
+          // Facing the camera that saw it
+          Eigen::Vector3f normal = -tf.block<3,3>(0,0)*ray.normalized();
+
+          pcl::PointXYZRGBNormal p;
+          p.x = pt(0);
+          p.y = pt(1);
+          p.z = pt(2);
+          p.r = p.g = p.b = img.at<uchar>(i, j);
+          p.normal_x = normal(0);
+          p.normal_y = normal(1);
+          p.normal_z = normal(2);
+          cloud->points.push_back(p);
+        }
+      }
+    }
+    cloud->width = cloud->points.size();
+    cloud->height = 1;
+    return cloud;
+  }
+
+  Fixture* LoadFixture()
+  {
+    Fixture* f = new Fixture;
+    if(!ImageDbUtil::LoadOgreDataDir(data_dir, f->keyframes) || f->keyframes.size() < 2)
+    {
+      std::cerr << "Could not load keyframes from " << data_dir << std::endl;
+      exit(1);
+    }
+
+    KeyframeContainer* q = f->keyframes[0];
+    KeyframeContainer* r = f->keyframes[1];
+    f->K = q->GetK();
+    f->query = ToGray(q->GetImage());
+    f->reference = ToGray(r->GetImage());
+    f->query_depth = q->GetDepth();
+    f->reference_depth = r->GetDepth();
+    f->query_tf = q->GetTf();
+    f->reference_tf = r->GetTf();
+    f->query_mask = f->query_depth > 0;
+
+    std::vector<DMatch> good;
+    RatioMatch(q->GetDescriptors(), r->GetDescriptors(), good);
+    for(unsigned int i = 0; i < good.size(); i++)
+    {
+      Point2f rp = r->GetKeypoints()[good[i].trainIdx].pt;
+      if(f->reference_depth.at<float>(rp.y, rp.x) <= 0)
+        continue;
+      f->query_pts.push_back(q->GetKeypoints()[good[i].queryIdx].pt);
+      f->reference_pts.push_back(rp);
+    }
+    f->model_pts = PnPUtil::BackprojectPts(f->reference_pts, f->reference_tf, f->K,
+      f->reference_depth);
+    f->cloud = BuildCloud(f->keyframes);
+    return f;
+  }
+
+  // Loaded on first use so that filtered runs only pay for what they need
+  Fixture& GetFixture()
+  {
+    static Fixture* fixture = LoadFixture();
+    return *fixture;
+  }
+
+  Mat EigenToCv(const Eigen::Matrix3f& K)
+  {
+    return (Mat_<double>(3,3) << K(0,0), K(0,1), K(0,2),
+                                 K(1,0), K(1,1), K(1,2),
+                                 K(2,0), K(2,1), K(2,2));
+  }
+}
+
+static void BM_ASiftDetectAndCompute(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  ASiftDetector detector;
+  std::vector<KeyPoint> keypoints;
+  Mat descriptors;
+  for(auto _ : state)
+  {
+    detector.detectAndCompute(f.query, keypoints, descriptors, ASiftDetector::SURF);
+    benchmark::DoNotOptimize(descriptors.data);
+  }
+  state.counters["keypoints"] = keypoints.size();
+}
+BENCHMARK(BM_ASiftDetectAndCompute)->Unit(benchmark::kMillisecond);
+
+static void BM_ExtractFeatures(benchmark::State& state, const char* desc_type)
+{
+  Fixture& f = GetFixture();
+  KeyframeContainer kf(f.query, desc_type, false);
+  for(auto _ : state)
+  {
+    kf.Reset(f.query, desc_type);
+    kf.ExtractFeatures();
+    benchmark::DoNotOptimize(kf.GetDescriptors().data);
+  }
+  state.counters["keypoints"] = kf.GetKeypoints().size();
+}
+BENCHMARK_CAPTURE(BM_ExtractFeatures, orb, "orb")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ExtractFeatures, surf, "surf")->Unit(benchmark::kMillisecond);
+
+static void BM_KnnMatch(benchmark::State& state, const char* desc_type)
+{
+  Fixture& f = GetFixture();
+  KeyframeContainer query(f.query, desc_type);
+  KeyframeContainer reference(f.reference, desc_type);
+  Ptr<DescriptorMatcher> matcher;
+  if(std::string(desc_type) == "orb")
+    matcher = new BFMatcher(NORM_HAMMING);
+  else
+    matcher = new FlannBasedMatcher;
+  std::vector<std::vector<DMatch> > matches;
+  for(auto _ : state)
+  {
+    matcher->knnMatch(query.GetDescriptors(), reference.GetDescriptors(), matches, 2);
+    benchmark::DoNotOptimize(matches.data());
+  }
+  state.counters["queries"] = query.GetDescriptors().rows;
+}
+BENCHMARK_CAPTURE(BM_KnnMatch, bf_orb, "orb")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_KnnMatch, flann_surf, "surf")->Unit(benchmark::kMillisecond);
+
+static void BM_RansacPnP(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  Mat Kcv = EigenToCv(f.K);
+  Eigen::Matrix4f tf;
+  std::vector<int> inliers;
+  for(auto _ : state)
+  {
+    PnPUtil::RansacPnP(f.model_pts, f.query_pts, Kcv, f.reference_tf.inverse(), tf, inliers);
+    benchmark::DoNotOptimize(tf.data());
+  }
+  state.counters["correspondences"] = f.query_pts.size();
+  state.counters["inliers"] = inliers.size();
+}
+BENCHMARK(BM_RansacPnP)->Unit(benchmark::kMillisecond);
+
+static void BM_BackprojectPts(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  for(auto _ : state)
+  {
+    std::vector<Point3f> pts = PnPUtil::BackprojectPts(f.reference_pts, f.reference_tf, f.K,
+      f.reference_depth);
+    benchmark::DoNotOptimize(pts.data());
+  }
+  state.SetItemsProcessed(state.iterations()*f.reference_pts.size());
+}
+BENCHMARK(BM_BackprojectPts);
+
+static void BM_GetEdgeMatches(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  Mat kf_mask(f.reference.size(), CV_8U, Scalar(255));
+  std::vector<EdgeTrackingUtil::SamplePoint> sps;
+  for(auto _ : state)
+  {
+    sps = EdgeTrackingUtil::getEdgeMatches(f.query, f.reference, f.K, f.K, f.query_depth,
+      kf_mask, f.query_tf);
+    benchmark::DoNotOptimize(sps.data());
+  }
+  state.counters["samples"] = sps.size();
+}
+BENCHMARK(BM_GetEdgeMatches)->Unit(benchmark::kMillisecond);
+
+static void BM_GetEstimatedPoseIRLS(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  Mat kf_mask(f.reference.size(), CV_8U, Scalar(255));
+  std::vector<EdgeTrackingUtil::SamplePoint> sps = EdgeTrackingUtil::getEdgeMatches(f.query,
+    f.reference, f.K, f.K, f.query_depth, kf_mask, f.query_tf);
+  Eigen::Matrix4f tf;
+  for(auto _ : state)
+  {
+    EdgeTrackingUtil::getEstimatedPoseIRLS(tf, f.query_tf.inverse(), sps, f.K);
+    benchmark::DoNotOptimize(tf.data());
+  }
+  state.counters["samples"] = sps.size();
+}
+BENCHMARK(BM_GetEstimatedPoseIRLS)->Unit(benchmark::kMillisecond);
+
+static void BM_KLTProcessFrame(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  // A small shift, like the motion between two frames
+  Mat next;
+  Mat shift = (Mat_<double>(2,3) << 1, 0, 2, 0, 1, 1);
+  warpAffine(f.query, next, shift, f.query.size());
+
+  KLTTracker tracker;
+  Mat output;
+  std::vector<Point2f> pts2d;
+  std::vector<Point3f> pts3d;
+  std::vector<int> ids;
+  for(auto _ : state)
+  {
+    state.PauseTiming();
+    tracker.init(f.query, f.query_depth, f.K, f.K, f.query_tf, f.query_mask);
+    state.ResumeTiming();
+    tracker.processFrame(next, output, pts2d, pts3d, ids);
+    benchmark::DoNotOptimize(pts2d.data());
+  }
+  state.counters["tracked"] = pts2d.size();
+}
+BENCHMARK(BM_KLTProcessFrame)->Unit(benchmark::kMillisecond);
+
+static void BM_ReprojectMask(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  // Into a half resolution frame, as when tracking on scaled images
+  Eigen::Matrix3f dstK = f.K;
+  dstK.block<2,3>(0,0) *= 0.5;
+  Mat dst(f.query_mask.rows/2, f.query_mask.cols/2, CV_8U);
+  for(auto _ : state)
+  {
+    dst.setTo(Scalar(0));
+    Tracker::ReprojectMask(dst, f.query_mask, dstK, f.K);
+    benchmark::DoNotOptimize(dst.data);
+  }
+}
+BENCHMARK(BM_ReprojectMask)->Unit(benchmark::kMillisecond);
+
+static void BM_TransformDepthFrame(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  Mat depth;
+  for(auto _ : state)
+  {
+    Tracker::TransformDepthFrame(f.query_depth, f.query_tf, f.K, depth, f.reference_tf, f.K,
+      f.query_depth.size());
+    benchmark::DoNotOptimize(depth.data);
+  }
+}
+BENCHMARK(BM_TransformDepthFrame)->Unit(benchmark::kMillisecond);
+
+static void BM_PointCloudGenerateVirtualImage(benchmark::State& state)
+{
+  Fixture& f = GetFixture();
+  PointCloudImageGenerator generator(f.cloud, f.K, f.query.rows, f.query.cols);
+  Mat img, depth, mask;
+  for(auto _ : state)
+  {
+    img = generator.GenerateVirtualImage(f.query_tf, depth, mask);
+    benchmark::DoNotOptimize(img.data);
+  }
+  state.counters["points"] = f.cloud->points.size();
+}
+BENCHMARK(BM_PointCloudGenerateVirtualImage)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+  if(argc > 1)
+    data_dir = argv[1];
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -19,5 +19,15 @@ public:
   void detectAndCompute(const Mat& img, std::vector< KeyPoint >& keypoints, Mat& descriptors, DescriptorType desc_type = SURF);
 
 private:
+  // One affine simulation and the features found in it
+  struct View
+  {
+    double tilt;
+    double phi;
+    std::vector<KeyPoint> keypoints;
+    Mat descriptors;
+  };
+
+  void detectView(const Mat& img, const Mat& mask, DescriptorType desc_type, std::vector<View>& views, int v);
   void affineSkew(double tilt, double phi, Mat& img, Mat& mask, Mat& Ai);  
 };
@@ -0,0 +1,84 @@
+#ifndef _ALLOC_PROFILE_H_
+#define _ALLOC_PROFILE_H_
+
+#include <boost/cstdint.hpp>
+
+/**
+ *  Heap allocation counters for the instrumentation build (MESH_LOCALIZER_ENABLE_ALLOC_PROFILE).
+ *  That build replaces the global operator new/delete and cv::fastMalloc/fastFree, which
+ *  every cv::Mat buffer comes from, with counting versions.  Counts are kept per thread and
+ *  recorded as Metrics counters named after the tracking stage they happened in.  In
+ *  normal builds every call compiles to nothing.
+ */
+class AllocProfile
+{
+public:
+  struct Counts
+  {
+    boost::uint64_t allocs;
+    boost::uint64_t bytes;
+    // cv::fastMalloc calls, mostly cv::Mat buffers
+    boost::uint64_t cv_buffers;
+    boost::uint64_t cv_bytes;
+  };
+
+  //! Heap bytes in use by the whole process and resident set size at a point in time
+  struct Memory
+  {
+    boost::int64_t heap_bytes;
+    boost::int64_t resident_bytes;
+  };
+
+#ifdef MESH_LOCALIZER_ENABLE_ALLOC_PROFILE
+  static bool IsEnabled() { return true; }
+
+  //! Cumulative counts of the calling thread
+  static Counts ThreadCounts();
+
+  //! Starts a frame on the calling thread
+  static void BeginFrame();
+  //! Records the allocations since the previous stage ended on the calling thread as the
+  //! <stage>_allocs, <stage>_alloc_bytes and <stage>_cv_buffers counters
+  static void EndStage(const char* stage);
+  //! Same for the allocations since BeginFrame
+  static void EndFrame(const char* stage);
+
+  static Memory CurrentMemory();
+  //! Records the growth of the heap and the resident set since start as the
+  //! <name>_heap_bytes and <name>_resident_bytes counters
+  static void RecordMemory(const char* name, const Memory& start);
+  //! Records the peak heap use and resident set size of the process as the
+  //! peak_heap_bytes and peak_resident_bytes counters.  Call once, before the report is
+  //! written.
+  static void RecordPeakMemory();
+
+  //! Records the memory growth from construction to destruction with RecordMemory
+  class ScopedMemory
+  {
+  public:
+    ScopedMemory(const char* name) : name(name), start(CurrentMemory()) {}
+    ~ScopedMemory() { RecordMemory(name, start); }
+
+  private:
+    const char* name;
+    Memory start;
+  };
+#else
+  static bool IsEnabled() { return false; }
+  static Counts ThreadCounts() { Counts c = {0, 0, 0, 0}; return c; }
+  static void BeginFrame() {}
+  static void EndStage(const char*) {}
+  static void EndFrame(const char*) {}
+  static Memory CurrentMemory() { Memory m = {0, 0}; return m; }
+  static void RecordMemory(const char*, const Memory&) {}
+  static void RecordPeakMemory() {}
+
+  class ScopedMemory
+  {
+  public:
+    ScopedMemory(const char*) {}
+  };
+#endif
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _ASYNC_RELOCALIZER_H_
+#define _ASYNC_RELOCALIZER_H_
+
+#include <Eigen/Dense>
+#include <opencv2/core/core.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include "MonocularLocalizer.h"
+#include "BoundedQueue.h"
+
+/**
+ *  Runs global localization on its own thread so that the tracking loop never waits for
+ *  it.  Frames are submitted latest-wins: while an attempt is running, only the newest
+ *  submitted frame is kept for the next one.  Successful results are handed back through
+ *  a single atomic slot that the tracking loop polls without blocking.
+ *
+ *  The localizer is not owned and must tolerate being called from this thread.
+ */
+class AsyncRelocalizer
+{
+public:
+  struct Result
+  {
+    // Stamp of the frame the pose was found on
+    double stamp;
+    Eigen::Matrix<float, 4, 4, Eigen::DontAlign> pose;
+    unsigned long generation;
+  };
+
+  AsyncRelocalizer(MonocularLocalizer* localizer);
+  ~AsyncRelocalizer();
+
+  //! Queues a frame, replacing a queued frame whose attempt hasn't started.  prior is the
+  //! last known pose, or NULL to search the whole database.
+  void submit(const cv::Mat& image, const cv::Mat& K, double stamp,
+    const Eigen::Matrix4f* prior = NULL);
+
+  //! Takes the newest successful result, if there is one that hasn't been cancelled
+  bool poll(Result& result);
+
+  //! Number of failed attempts since the last call
+  int takeFailures();
+
+  //! Drops queued frames, and the results of attempts that are already running
+  void cancel();
+
+private:
+  struct Request
+  {
+    cv::Mat image;
+    cv::Mat K;
+    double stamp;
+    bool has_prior;
+    Eigen::Matrix<float, 4, 4, Eigen::DontAlign> prior;
+    unsigned long generation;
+  };
+
+  void Loop();
+
+  MonocularLocalizer* localizer;
+  BoundedQueue<Request> requests;
+  boost::atomic<unsigned long> generation;
+  boost::atomic<Result*> slot;
+  boost::atomic<int> failures;
+  boost::thread thread;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef _BOUNDED_QUEUE_H_
+#define _BOUNDED_QUEUE_H_
+
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+/**
+ *  Fixed capacity queue for handing data between threads.  When the queue is
+ *  full Push either drops the oldest entry (latest-wins, used for camera frames)
+ *  or blocks until the consumer catches up.  Pop blocks on a condition variable
+ *  instead of polling.  Close() wakes up every waiter so worker threads can exit.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+  BoundedQueue(unsigned int capacity = 1, bool drop_oldest = true)
+    : capacity(capacity > 0 ? capacity : 1), drop_oldest(drop_oldest), closed(false),
+      num_dropped(0)
+  {
+  }
+
+  // Returns false if the queue has been closed
+  bool Push(const T& item)
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(!closed && !drop_oldest && items.size() >= capacity)
+    {
+      not_full.wait(lock);
+    }
+    if(closed)
+      return false;
+    if(items.size() >= capacity)
+    {
+      items.pop_front();
+      num_dropped++;
+    }
+    items.push_back(item);
+    lock.unlock();
+    not_empty.notify_one();
+    return true;
+  }
+
+  // Blocks until an item is available.  Returns false if the queue was closed.
+  bool Pop(T& item)
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(!closed && items.empty())
+    {
+      not_empty.wait(lock);
+    }
+    if(items.empty())
+      return false;
+    item = items.front();
+    items.pop_front();
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+  }
+
+  // Same as Pop, but gives up after timeout seconds
+  bool Pop(T& item, double timeout)
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    boost::system_time deadline = boost::get_system_time() +
+      boost::posix_time::microseconds(static_cast<long>(timeout*1e6));
+    while(!closed && items.empty())
+    {
+      if(!not_empty.timed_wait(lock, deadline))
+        break;
+    }
+    if(items.empty())
+      return false;
+    item = items.front();
+    items.pop_front();
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+  }
+
+  bool TryPop(T& item)
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if(items.empty())
+      return false;
+    item = items.front();
+    items.pop_front();
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+  }
+
+  void Close()
+  {
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      closed = true;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+
+  void Clear()
+  {
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      items.clear();
+    }
+    not_full.notify_all();
+  }
+
+  unsigned int Size()
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return items.size();
+  }
+
+  unsigned long NumDropped()
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return num_dropped;
+  }
+
+private:
+  std::deque<T> items;
+  unsigned int capacity;
+  bool drop_oldest;
+  bool closed;
+  unsigned long num_dropped;
+
+  boost::mutex mutex;
+  boost::condition_variable not_empty;
+  boost::condition_variable not_full;
+};
+
+#endif
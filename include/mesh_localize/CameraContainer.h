@@ -15,6 +15,7 @@ public:
   CameraContainer(Mat image, Eigen::Matrix4f tf = Eigen::Matrix4f(), Eigen::Matrix3f K = Eigen::Matrix3f());
   
   Mat GetImage();
+  void SetImage(Mat image);
   Eigen::Matrix4f GetTf();
   Eigen::Matrix3f GetK();
 private:
@@ -5,6 +5,7 @@
 #include "KeyframeMatch.h"
 #include "KeyframeContainer.h"
 
+
 class DepthFeatureMatchLocalizer : public MonocularLocalizer
 {
   struct KeyframePositionSorter
@@ -25,10 +26,13 @@ public:
     double max_reproj_error = 3, double ratio_test_thresh = 0.8);
   virtual bool localize(const cv::Mat& img, const cv::Mat& K, Eigen::Matrix4f* pose,
     Eigen::Matrix4f* pose_guess = NULL);
+  virtual const std::vector<KeyframeContainer*>* GetKeyframes();
 
 private:
 
   std::vector< KeyframeMatch > FindImageMatches(KeyframeContainer* img, int k, Eigen::Matrix4f* pose_guess = NULL, unsigned int search_bound = 0);
+  // Matches img against candidates[i], run in parallel for all candidates
+  void MatchKeyframe(KeyframeContainer* img, const std::vector<KeyframeContainer*>& candidates, double matchRatio, double numMatchThresh, std::vector< std::vector< KeyframeMatch > >& slots, int i);
 
   std::vector<KeyframeContainer*> keyframes; 
   int min_inliers;
@@ -7,6 +7,7 @@
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/nonfree/nonfree.hpp>
+#include <boost/thread/mutex.hpp>
 
 class FABMAPLocalizer : public MonocularLocalizer
 {
@@ -36,6 +37,8 @@ private:
   Ptr<DescriptorMatcher> matcher;
   Ptr<of2::FabMap> fabmap;
   Ptr<BOWImgDescriptorExtractor> bide;
+  // FabMap and the BOW extractor keep internal state, so queries are serialized
+  boost::mutex localize_mutex;
 };
 
 #endif
@@ -5,6 +5,7 @@
 #include "KeyframeMatch.h"
 #include "KeyframeContainer.h"
 
+
 class FeatureMatchLocalizer : public MonocularLocalizer
 {
   struct KeyframePositionSorter
@@ -21,9 +22,14 @@ class FeatureMatchLocalizer : public MonocularLocalizer
 public:
 
   FeatureMatchLocalizer(const std::vector<CameraContainer*>& train, std::string descriptor_type, bool show_matches = false, bool load_descriptors = false, std::string descriptor_filename = "");
+  // Keyframes with features already extracted, e.g. from a keyframe cache
+  FeatureMatchLocalizer(const std::vector<KeyframeContainer*>& train, std::string descriptor_type, bool show_matches = false);
   virtual bool localize(const cv::Mat& img, const cv::Mat& K, Eigen::Matrix4f* pose, Eigen::Matrix4f* pose_guess = NULL);
+  virtual const std::vector<KeyframeContainer*>* GetKeyframes();
 private:
   std::vector< KeyframeMatch > FindImageMatches(KeyframeContainer* img, int k, Eigen::Matrix4f* pose_guess = NULL, unsigned int search_bound = 0);
+  // Matches img against candidates[i], run in parallel for all candidates
+  void MatchKeyframe(KeyframeContainer* img, const std::vector<KeyframeContainer*>& candidates, double matchRatio, double numMatchThresh, std::vector< std::vector< KeyframeMatch > >& slots, int i);
   bool WriteDescriptorsToFile(std::string filename);
 
 
@@ -0,0 +1,67 @@
+#ifndef _FRAME_INGEST_H_
+#define _FRAME_INGEST_H_
+
+#include <vector>
+#include <iostream>
+#include <Eigen/Dense>
+#include <opencv2/core/core.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ *  Turns raw camera images into the scaled, undistorted grayscale frames the tracker
+ *  works on, in a single pass over the raw image.  One fixed-point remap table maps every
+ *  output pixel straight to its raw sensor position; the kernel samples the raw image
+ *  there, converting color to gray on the fly, and rows are split across threads.  The
+ *  table is rebuilt only when the raw size or the scale changes.
+ *
+ *  Output frames come from a small pool of buffers that are reused once nothing refers
+ *  to them anymore.  Thread safe.
+ */
+class FrameIngest
+{
+public:
+  FrameIngest(const Eigen::Matrix3f& K, const Eigen::VectorXf& distcoeff, bool undistort);
+
+  //! Converts a raw 8 bit gray, RGB or RGBA image (color is converted like CV_RGB2GRAY).
+  //! frame may share raw's data when there is nothing to do.
+  void process(const cv::Mat& raw, cv::Mat& frame, double scale);
+
+  //! Remap tables, for tracker snapshots.  Restored tables are used as long as the raw
+  //! size and scale match.  Tables are replaced rather than modified, so the ones returned
+  //! by getMaps can be written after the lock is released.
+  struct Maps
+  {
+    cv::Size raw_size;
+    cv::Size size;
+    cv::Mat xy;
+    cv::Mat a;
+  };
+  Maps getMaps();
+  static void WriteMaps(std::ostream& out, const Maps& maps);
+  bool readMaps(std::istream& in);
+
+  //! Size of a frame ingested at scale
+  static cv::Size ScaledSize(const cv::Size& raw_size, double scale);
+  //! Intrinsics of a frame resized from raw_size to size
+  static Eigen::Matrix3f ScaleIntrinsics(const Eigen::Matrix3f& K, const cv::Size& raw_size,
+    const cv::Size& size);
+
+private:
+  void GetMaps(const cv::Size& raw_size, const cv::Size& size, cv::Mat& map_xy,
+    cv::Mat& map_a);
+  cv::Mat GetBuffer(const cv::Size& size);
+
+  Eigen::Matrix3f K;
+  cv::Mat distcoeffcv;
+  bool undistort;
+
+  boost::mutex mutex;
+  cv::Size map_raw_size;
+  cv::Size map_size;
+  // Integer source positions (CV_16SC2) and interpolation table indices (CV_16UC1)
+  cv::Mat map_xy;
+  cv::Mat map_a;
+  std::vector<cv::Mat> buffers;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _FRAME_SCHEDULER_H_
+#define _FRAME_SCHEDULER_H_
+
+#include <boost/thread/mutex.hpp>
+
+#include "Tracker.h"
+
+/**
+ *  Admission control for a tracking loop that has to hold a target end-to-end latency
+ *  (capture stamp to pose) rather than track every frame at full quality.
+ *
+ *  Frames that are already older than the target when tracking could start are dropped.
+ *  Admitted frames get the time left until the target as their tracking budget.  The
+ *  measured latency is smoothed over recent frames, and when it drifts from the target
+ *  the processing resolution is moved within [min_image_scale, image_scale].  Tracking
+ *  cost grows with the pixel count, so the scale follows the square root of the latency
+ *  ratio.  Thread safe.
+ */
+class FrameScheduler
+{
+public:
+  FrameScheduler(const TrackerParams& params);
+
+  //! False if no target latency is set.  A disabled scheduler admits every frame with an
+  //! unlimited budget and never changes the scale.
+  bool isEnabled() const;
+
+  //! Decides whether a frame captured age seconds ago should still be tracked.  If so,
+  //! budget is set to the tracking time left for it (negative for unlimited).
+  bool admit(double age, double& budget);
+
+  //! Feeds back a tracked frame.  latency is the time from capture to the result.
+  void update(const Tracker::PoseResult& result, double latency);
+
+  //! Resolution the tracker should process frames at
+  double getImageScale();
+  unsigned long getNumDropped();
+
+private:
+  double target_latency;
+  double min_scale;
+  double max_scale;
+
+  boost::mutex mutex;
+  double scale;
+  double latency;
+  int frames_since_change;
+  int consecutive_drops;
+  unsigned long num_dropped;
+};
+
+#endif
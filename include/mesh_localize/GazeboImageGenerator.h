@@ -0,0 +1,43 @@
+#ifndef _GAZEBO_IMAGE_GENERATOR_
+#define _GAZEBO_IMAGE_GENERATOR_
+
+#include "VirtualImageGenerator.h"
+
+#include <ros/ros.h>
+#include "sensor_msgs/Image.h"
+#include <boost/thread.hpp>
+
+/**
+ *  Renders virtual views by moving a simulated camera in Gazebo and waiting for its next
+ *  image and depth map.  The subscriber callbacks must be serviced by a spinner running on
+ *  another thread than the one calling GenerateVirtualImage.
+ */
+class GazeboImageGenerator : public VirtualImageGenerator
+{
+public:
+  GazeboImageGenerator(ros::NodeHandle nh);
+  virtual cv::Mat GenerateVirtualImage(const Eigen::Matrix4f& pose, cv::Mat& depth, cv::Mat& mask);
+  virtual Eigen::Matrix3f GetK();
+
+private:
+  void SetCameraPose(const Eigen::Matrix4f& tf);
+  void HandleVirtualImage(const sensor_msgs::ImageConstPtr& msg);
+  void HandleVirtualDepth(const sensor_msgs::ImageConstPtr& msg);
+
+  ros::NodeHandle nh;
+  ros::ServiceClient gazebo_client;
+  ros::Subscriber virtual_image_sub;
+  ros::Subscriber virtual_depth_sub;
+
+  boost::mutex virtual_mutex;
+  boost::condition_variable virtual_cond;
+  bool get_virtual_image;
+  bool get_virtual_depth;
+  cv::Mat current_virtual_image;
+  sensor_msgs::ImageConstPtr current_virtual_depth_msg;
+
+  Eigen::Matrix3f virtual_K;
+  int virtual_width;
+  int virtual_height;
+};
+#endif
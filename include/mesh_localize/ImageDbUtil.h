@@ -19,5 +19,14 @@ public:
   static Eigen::Matrix4f StringToMatrix4f(std::string str);
   static bool LoadPhotoscanFile(std::string filename, std::vector<CameraContainer*>& cameras, Mat map_Kcv, Mat map_distcoeffcv);
   static bool LoadOgreDataDir(std::string data_dir, std::vector<KeyframeContainer*>& keyframes);
+
+  // Binary cache of a loaded keyframe database, with the keypoints and descriptors already
+  // extracted.  key identifies the source database and descriptor type; a cache written for
+  // a different key is rejected.
+  static bool WriteKeyframeCache(std::string filename, std::string key, const std::vector<KeyframeContainer*>& keyframes);
+  static bool ReadKeyframeCache(std::string filename, std::string key, std::vector<KeyframeContainer*>& keyframes);
+  // Number, total size and latest modification time of the files making up a database (a
+  // file, or the files in a directory), for cache keys.  Empty if path doesn't exist.
+  static std::string SourceStamp(std::string path);
 };
 #endif
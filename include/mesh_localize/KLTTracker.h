@@ -1,6 +1,8 @@
 #ifndef _KLTTracker_hpp
 #define _KLTTracker_hpp
 
+#include <iostream>
+#include <random>
 #include <opencv2/opencv.hpp>
 #include <Eigen/Dense>
 
@@ -9,15 +11,24 @@ class KLTTracker
   
 public:
   KLTTracker();
+  //! Keeps a random subset of the detected corners, drawn from rng
   void init(const cv::Mat& inputFrame, const cv::Mat& depth, const Eigen::Matrix3f& inputK, 
-    const Eigen::Matrix3f& depthK, const Eigen::Matrix4f& inputTf, const cv::Mat& mask);
+    const Eigen::Matrix3f& depthK, const Eigen::Matrix4f& inputTf, const cv::Mat& mask,
+    std::mt19937& rng);
   virtual bool processFrame(const cv::Mat& inputFrame, cv::Mat& outputFrame, 
     std::vector<cv::Point2f>& pts2d, std::vector<cv::Point3f>& pts3d, std::vector<int>& ptIDs);
   std::vector<unsigned char> filterMatchesEpipolarContraint(const std::vector<cv::Point2f>& pts1, 
     const std::vector<cv::Point2f>& pts2);
+  //! outputFrame is only drawn when enabled (default off)
+  void setDrawOutput(bool draw) { m_drawOutput = draw; }
+
+  //! Tracked points and the previous image, for tracker snapshots
+  void write(std::ostream& out) const;
+  bool read(std::istream& in);
 
 private:
   int m_maxNumberOfPoints;
+  bool m_drawOutput;
 
   cv::Mat m_prevImg;
   cv::Mat m_nextImg;
@@ -37,12 +37,16 @@ public:
 #ifdef MESH_LOCALIZER_ENABLE_GPU
   gpu::GpuMat GetGPUDescriptors();
 #endif
-  std::vector<KeyPoint> GetKeypoints();
+  const std::vector<KeyPoint>& GetKeypoints();
   Eigen::Matrix4f GetTf();
   Eigen::Matrix3f GetK();
+  bool HasDepth();
 
   void ExtractFeatures();
   void SetMask(Mat new_mask);
+  // Reuses the container for a new image, keeping the capacity of its buffers.  Features
+  // are extracted with ExtractFeatures.
+  void Reset(Mat img, std::string desc_type);
 private:
 
   void ExtractFeatures(std::string desc_type);
@@ -0,0 +1,48 @@
+#ifndef _LOST_MODE_GATE_H_
+#define _LOST_MODE_GATE_H_
+
+#include <opencv2/core/core.hpp>
+
+/**
+ *  Throttles global localization while the object is lost.  The first attempts after
+ *  losing the object run on every frame at full resolution.  Once those have failed, the
+ *  object is assumed to be out of view: attempts are limited to one per retry_period
+ *  seconds, run at image_scale, and are skipped altogether while the scene stays the same
+ *  as on the last attempt.  A frame that differs a lot from the last attempt (the camera
+ *  moved, something came into view) is tried right away at full resolution.
+ *
+ *  Scene changes are measured as the mean absolute difference between heavily
+ *  downsampled copies of the frames, in gray levels, which costs next to nothing compared
+ *  to feature extraction.  Times are frame stamps, so replays behave the same regardless
+ *  of processing speed.
+ */
+class LostModeGate
+{
+public:
+  //! A non-positive retry_period disables the gate, every frame is then admitted at full
+  //! resolution
+  LostModeGate(double retry_period, double image_scale, double change_thresh);
+
+  //! Called for every frame while the object is lost.  True if global localization should
+  //! be attempted on the frame, at the resolution scale.
+  bool admit(const cv::Mat& image, double stamp, double& scale);
+  //! Reports failed attempts
+  void recordFailures(int failures);
+  //! Back to full rate, called once the object is found again
+  void reset();
+
+  bool isBackingOff() const;
+
+private:
+  double ChangeFrom(const cv::Mat& thumb) const;
+
+  double retry_period;
+  double image_scale;
+  double change_thresh;
+
+  int failures;
+  double last_attempt_stamp;
+  cv::Mat last_attempt_thumb;
+};
+
+#endif
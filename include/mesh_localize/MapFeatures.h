@@ -19,7 +19,7 @@ public:
   MapFeatures(){};
   
   Mat GetDescriptors() const;
-  std::vector<pcl::PointXYZ> GetKeypoints() const;
+  const std::vector<pcl::PointXYZ>& GetKeypoints() const;
 private:
   std::vector<KeyframeContainer*> kcv;
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud;
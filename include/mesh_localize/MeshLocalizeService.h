@@ -0,0 +1,53 @@
+#ifndef _MESH_LOCALIZE_SERVICE_H_
+#define _MESH_LOCALIZE_SERVICE_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <ros/ros.h>
+#include "tf/transform_broadcaster.h"
+#include "sensor_msgs/Image.h"
+
+#include "TrackingService.h"
+
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ *  ROS front end for TrackingService.  The private param "streams" lists the camera
+ *  streams; stream <s> reads <s>/image and <s>/camera_info and publishes
+ *  /mesh_localize/<s>/estimated_pose and the tf frame <s>/object_pose relative to the
+ *  camera frame given by ~<s>/camera_frame (default <s>).  The tracker params are read
+ *  from the private namespace and shared by all streams.
+ */
+class MeshLocalizeService
+{
+public:
+  MeshLocalizeService(ros::NodeHandle nh, ros::NodeHandle nh_private);
+  ~MeshLocalizeService();
+
+private:
+  struct Stream
+  {
+    std::string name;
+    std::string camera_frame;
+    int index;
+    ros::Subscriber image_sub;
+    ros::Publisher pose_pub;
+    boost::mutex stamp_mutex;
+    std::deque<ros::Time> recent_stamps;
+  };
+
+  void HandleImage(const sensor_msgs::ImageConstPtr& msg, Stream* stream);
+  void HandleResult(int index, const Tracker::PoseResult& result);
+
+  ros::NodeHandle nh;
+  ros::NodeHandle nh_private;
+
+  boost::shared_ptr<TrackingService> service;
+  std::vector<boost::shared_ptr<Stream> > streams;
+  tf::TransformBroadcaster br;
+  boost::mutex br_mutex;
+};
+
+#endif
@@ -2,141 +2,90 @@
 #define _MAPLOCALIZER_H_
 
 #include <vector>
+#include <deque>
 #include <ros/ros.h>
 #include <Eigen/Dense>
 #include "tf/transform_broadcaster.h"
 #include "sensor_msgs/Image.h"
 #include "sensor_msgs/CameraInfo.h"
 
-#include "MonocularLocalizer.h"
-#include "VirtualImageGenerator.h"
-#include "KeyframeContainer.h"
-#include "KeyframeMatch.h"
-#include "MapFeatures.h"
-#include "EdgeTrackingUtil.h"
-//#include "IMUMotionModel.h"
-#include "KLTTracker.h"
+#include "Tracker.h"
+#include "FrameScheduler.h"
+#include "BoundedQueue.h"
+#include "Metrics.h"
+
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "pcl_ros/point_cloud.h"
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
-#include <pcl/PolygonMesh.h>
+
+/**
+ *  ROS front end for Tracker.  Reads the tracker configuration from private params,
+ *  feeds it camera images and publishes the estimated poses.
+ */
 class MeshLocalizer
 {
-
-  enum LocalizeState
-  {
-    INIT,
-    INIT_PNP,
-    LOCAL_INIT,
-    PNP,
-    EDGES,
-    KLT_INIT,
-    KLT
-  } localize_state;
-
 public:
 
-  MeshLocalizer(ros::NodeHandle nh, ros::NodeHandle nh_private);
+  // Waits for camera_info unless a snapshot has the camera.  Setting *stop (or shutting
+  // down ROS) abandons the wait and leaves the localizer uninitialized.
+  MeshLocalizer(ros::NodeHandle nh, ros::NodeHandle nh_private,
+    const boost::atomic<bool>* stop = NULL);
   ~MeshLocalizer();
 
+  // Runs the tracking loop until ROS shuts down or Stop() is called.  Must be called from
+  // the thread that created the virtual image generator (OGRE keeps its GL context on
+  // that thread).
+  void Run();
+  // Makes Run() return.  Thread safe.
+  void Stop();
+
 private:
-  Eigen::Matrix4f FindImageTfPnp(KeyframeContainer* kcv, const MapFeatures& mf);
-  bool FindImageTfVirtualPnp(KeyframeContainer* kcv, Eigen::Matrix4f vimgTf, Eigen::Matrix4f& out, std::string vdesc_type, bool mask_kf, Eigen::Matrix<float, 6, 6>& cov);
-  bool FindImageTfVirtualEdges(KeyframeContainer* kcv, Eigen::Matrix4f vimgTf, Eigen::Matrix4f& out, bool mask_kf);
-  std::vector<pcl::PointXYZ> GetPointCloudFromFrames(KeyframeContainer*, KeyframeContainer*);
-  std::vector<int> FindPlaneInPointCloud(const std::vector<pcl::PointXYZ>& pts);
-  Mat GetVirtualImageFromTopic(Mat& depths, Mat& mask);
-  Mat GenerateVirtualImage(Eigen::Matrix4f tf, Eigen::Matrix3f K, int height, int width, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud, Mat& depth, Mat& mask);
-
-  void UpdateMotionModel(const Eigen::Matrix4f& olfTf, const Eigen::Matrix4f& newTf, 
-    const Eigen::Matrix<float, 6, 6>& cov, double dt);
-  Eigen::Matrix4f ApplyMotionModel(double dt);
-  void ResetMotionModel();
+  struct TrackingFrame
+  {
+    Mat image;
+    ros::Time stamp;
+  };
 
   void PublishDepthMat(const Mat& depth, ros::Time stamp);
-  void PublishPose(Eigen::Matrix4f tf);
+  void PublishPose(Eigen::Matrix4f tf, ros::Time stamp);
   void PublishMap();
   void PublishPointCloud(const std::vector<pcl::PointXYZ>&);
   void PublishPointCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr pc);
   void PlotTf(Eigen::Matrix4f tf, std::string name);
+  void PublishProcessedImageAndDepth(const cv::Mat& image, const cv::Mat& depth,
+    const Eigen::Matrix3f& K, ros::Time stamp);
 
-  void spin(const ros::TimerEvent& e);
+  void PublishMapTimer(const ros::TimerEvent& e);
+  void PublishExtrapolatedPoseTimer(const ros::WallTimerEvent& e);
+  void PublishMetricsTimer(const ros::WallTimerEvent& e);
   void HandleImage(const sensor_msgs::ImageConstPtr& msg);
-  void HandleVirtualImage(const sensor_msgs::ImageConstPtr& msg);
-  void HandleVirtualDepth(const sensor_msgs::ImageConstPtr& msg);
-  void UpdateVirtualSensorState(Eigen::Matrix4f tf);
-
-  std::vector<Point3d> PCLToPoint3d(const std::vector<pcl::PointXYZ>& cpvec);
-  void PublishProcessedImageAndDepth(const cv::Mat& image, const cv::Mat& depth, ros::Time stamp);
-  void ReprojectMask(cv::Mat& dst, const cv::Mat& src, const Eigen::Matrix3f& dstK, 
-    const Eigen::Matrix3f& srcK, bool median_blur = true);
-  void TransformDepthFrame(const Mat& d1, const Eigen::Matrix4f& tf1, const Eigen::Matrix3f K1, 
-    Mat& d2, const Eigen::Matrix4f& tf2, const Eigen::Matrix3f& K2);
-  void CreateTfViz(Mat& src, Mat& dst, const Eigen::Matrix4f& tf,
-    const Eigen::Matrix3f& K);
-
-  std::vector<CameraContainer*> cameras;
-  
-  ros::Time img_time_stamp;
-  Mat current_image;
-  Mat current_virtual_image;
-  sensor_msgs::ImageConstPtr current_virtual_depth_msg;
-
-  Mat virtual_depth;
-  std::vector<Eigen::Vector3f> positionList;
-  Eigen::Matrix4f currentPose;
-  bool get_frame;
-  bool get_virtual_image;
-  bool get_virtual_depth;
-  int numPnpRetrys;
-  int numLocalizeRetrys;
-  double pnpReprojError;
-  double pixel_noise;
-  double virtual_fx;
-  double virtual_fy;
+  void HandleResult(const Tracker::PoseResult& result);
+  ros::Time LookupStamp(double stamp);
 
   MonocularLocalizer* localization_init;
   VirtualImageGenerator* vig;
+  boost::shared_ptr<Tracker> tracker;
+  boost::shared_ptr<FrameScheduler> scheduler;
+  TrackerParams params;
 
-  ros::Time spin_time;
-
-  MapFeatures map_features;
-
-  std::string ogre_data_dir;
-  std::string ogre_cfg_dir;
-  std::string ogre_model;
-  std::string pc_filename;
   std::string mesh_filename;
-  std::string photoscan_filename;
-  std::string virtual_image_source;
-  std::string pnp_descriptor_type;
-  std::string img_match_descriptor_type;
-  bool show_pnp_matches;
-  bool show_global_matches;
-  bool show_debug;
-  std::string tracking_mode;
-  std::string global_localization_alg;
-  double image_scale;
-  double canny_high_thresh;
-  double canny_low_thresh;
-  double canny_sigma;
-  bool autotune_canny;
-  double edge_tracking_dmax;
-  int edge_tracking_iterations;
-  double pnp_match_radius;
-  int min_pnp_inliers;
-  double max_pnp_reproj_error;
-  double ratio_test_thresh;
-  std::string motion_model;
-  bool do_undistort;
-  bool use_depth_shader;
+  bool headless;
+  double viz_rate;
+  // Tracker state is saved here every snapshot_period seconds and on shutdown, and
+  // restored on startup.  Empty disables.
+  std::string snapshot_file;
+  double snapshot_period;
 
   ros::NodeHandle nh;
   ros::NodeHandle nh_private;
 
-  ros::ServiceClient gazebo_client;
   ros::Publisher  estimated_pose_pub;
+  ros::Publisher  extrapolated_pose_pub;
+  ros::Publisher  metrics_pub;
   ros::Publisher  map_marker_pub;
   ros::Publisher  pointcloud_pub;
   ros::Publisher  image_pub;
@@ -145,35 +94,37 @@ private:
   tf::TransformBroadcaster br;
 
   ros::Subscriber image_sub;
-  ros::Subscriber virtual_image_sub;
-  ros::Subscriber virtual_depth_sub;
-
-  ros::Timer timer;
-
-  Eigen::Matrix4f camera_velocity;
-  ros::Time last_spin_time;
-
-  Eigen::Matrix3f K;
-  Eigen::Matrix3f K_scaled;
-  Eigen::Matrix3f map_K;
-  Eigen::Matrix3f virtual_K;
-  Eigen::VectorXf distcoeff;
-  Eigen::VectorXf map_distcoeff;
-  Mat Kcv;
-  Mat Kcv_undistort;
-  Mat map_Kcv;
-  Mat virtual_Kcv;
-  Mat distcoeffcv;
-  Mat map_distcoeffcv;
-  int virtual_height;
-  int virtual_width;
-  bool init_undistort;
-  Mat undistort_map1, undistort_map2;
-
-  //IMUMotionModel * imu_mm;
-
-  KLTTracker klt_tracker;
-  Mat klt_init_img;
+
+  ros::Timer map_timer;
+  double map_publish_rate;
+
+  // Poses extrapolated to the current time are published at this rate, independent of
+  // the frame rate.  Non-positive disables.
+  ros::WallTimer extrapolation_timer;
+  double extrapolation_rate;
+
+  // Latency histograms of the last metrics_period seconds go out on the metrics topic and
+  // the cumulative ones are written to metrics_file.  Non-positive period disables both.
+  ros::WallTimer metrics_timer;
+  double metrics_period;
+  std::string metrics_file;
+  // Cumulative metrics at the last publish, the next window is taken relative to these
+  std::map<std::string, LatencyHistogram> metrics_stages;
+  std::map<std::string, boost::uint64_t> metrics_counters;
+
+  // Timeline of the last spans of every thread, written in Chrome trace format on
+  // shutdown.  Empty disables tracing.
+  std::string trace_file;
+
+  BoundedQueue<TrackingFrame> frame_queue;
+
+  // The tracker keeps stamps in seconds.  The original stamps of the frames that may still
+  // be in flight are kept so results are published with the exact image stamp.
+  boost::mutex stamp_mutex;
+  std::deque<ros::Time> recent_stamps;
+
+  bool initialized;
+  boost::atomic<bool> running;
 };
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef _MESH_LOCALIZER_NODELET_H_
+#define _MESH_LOCALIZER_NODELET_H_
+
+#include <nodelet/nodelet.h>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "MeshLocalizer.h"
+
+/**
+ *  MeshLocalizer as a nodelet.  Loaded into the same manager as the camera driver, images
+ *  arrive as shared pointers instead of being serialized, and the published images reach
+ *  subscribers in the manager the same way.
+ *
+ *  The tracker runs on a thread of its own, which also creates and owns the render
+ *  context.  OGRE is a per-process singleton, so a manager can host only one instance that
+ *  renders with OGRE.
+ */
+class MeshLocalizerNodelet : public nodelet::Nodelet
+{
+public:
+  MeshLocalizerNodelet();
+  ~MeshLocalizerNodelet();
+
+private:
+  virtual void onInit();
+  void Run();
+
+  boost::mutex mutex;
+  boost::shared_ptr<MeshLocalizer> localizer;
+  boost::atomic<bool> shutdown;
+  boost::thread thread;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <boost/cstdint.hpp>
+
+/**
+ *  Latency histogram with HDR-style log-linear buckets: every power of two of
+ *  microseconds is split into kSubBuckets/2 linear buckets, so values from 1 us to a day
+ *  are kept to within ~3% in a fixed 8 KB.  Histograms add and subtract, so a window is
+ *  the difference of two cumulative snapshots.
+ */
+class LatencyHistogram
+{
+public:
+  static const int kSubBucketBits = 6;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  static const int kMagnitudes = 32;
+  static const int kNumBuckets = kSubBuckets + (kMagnitudes-1)*kSubBuckets/2;
+
+  static int BucketIndex(double seconds);
+  //! Midpoint of a bucket in seconds
+  static double BucketValue(int index);
+
+  LatencyHistogram();
+
+  void record(double seconds);
+  void add(const LatencyHistogram& other);
+  void subtract(const LatencyHistogram& other);
+
+  boost::uint64_t getCount() const;
+  double getMean() const;
+  //! Largest value ever recorded (not windowed by subtract)
+  double getMax() const;
+  //! p in [0, 1]
+  double getPercentile(double p) const;
+
+  std::vector<boost::uint64_t> counts;
+  boost::uint64_t count;
+  double sum;
+  double max;
+};
+
+/**
+ *  Process-wide latency and event metrics.  Stages and counters are named; recording
+ *  goes to histograms and counters owned by the recording thread and is lock free, the
+ *  mutex is only taken the first time a thread uses a name.  Collect() merges the
+ *  threads into one snapshot.
+ */
+class Metrics
+{
+public:
+  //! Records seconds spent in stage
+  static void Record(const std::string& stage, double seconds);
+  //! Adds n to a counter
+  static void Increment(const std::string& counter, boost::uint64_t n = 1);
+
+  //! Cumulative histograms and counters of all threads since the start of the process
+  static void Collect(std::map<std::string, LatencyHistogram>& stages,
+    std::map<std::string, boost::uint64_t>& counters);
+
+  //! CSV report: stage,count,mean,p50,p90,p99,max in seconds, then counter,value
+  static void WriteReport(std::ostream& out,
+    const std::map<std::string, LatencyHistogram>& stages,
+    const std::map<std::string, boost::uint64_t>& counters);
+  //! Writes the cumulative report to filename
+  static bool WriteFile(const std::string& filename);
+
+  //! Records the wall time from construction to destruction (or stop()) as a stage
+  class ScopedTimer
+  {
+  public:
+    ScopedTimer(const char* stage);
+    ~ScopedTimer();
+    //! Records now instead of at destruction and returns the elapsed seconds
+    double stop();
+
+  private:
+    const char* stage;
+    double start;
+    bool stopped;
+  };
+};
+
+#endif
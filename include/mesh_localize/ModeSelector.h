@@ -0,0 +1,58 @@
+#ifndef _MODE_SELECTOR_H_
+#define _MODE_SELECTOR_H_
+
+/**
+ *  Picks the frame to frame tracking mode when tracking_mode is AUTO.  Keeps the smoothed
+ *  cost, success rate and margin of every mode and selects the cheapest mode that is
+ *  currently reliable.  The margin is how far the last estimates were from the failure
+ *  threshold of the mode (1 at the threshold), e.g. inliers/min_pnp_inliers for PnP and
+ *  KLT, so a mode whose matches are thinning out is left before it fails.  PnP is the
+ *  fallback and is always considered reliable.
+ *
+ *  Modes that haven't been tried yet are optimistically assumed to be free, and modes
+ *  that became unreliable get another chance after a while, since scene conditions
+ *  change.
+ */
+class ModeSelector
+{
+public:
+  enum Mode
+  {
+    PNP,
+    KLT,
+    EDGE,
+    NUM_MODES
+  };
+
+  ModeSelector();
+
+  //! Records the outcome of one frame tracked in mode.  margin is ignored on failure.
+  void record(Mode mode, bool success, double margin, double seconds);
+
+  //! Mode to track the next frame in, given the mode the last frame was tracked in
+  Mode select(Mode current);
+
+  void reset();
+
+  static const char* Name(Mode mode);
+
+private:
+  struct Stats
+  {
+    Stats();
+
+    int samples;
+    double cost;
+    double success_rate;
+    double margin;
+    // Frames since the mode was found unreliable, -1 while it is reliable
+    int benched;
+  };
+
+  bool IsReliable(Mode mode) const;
+
+  Stats stats[NUM_MODES];
+  int frames_in_mode;
+};
+
+#endif
@@ -1,13 +1,20 @@
 #ifndef _MONOCULAR_LOCALIZER_H_
 #define _MONOCULAR_LOCALIZER_H_
 
+#include <vector>
 #include <Eigen/Dense>
 #include <opencv2/core/core.hpp>
 
+class KeyframeContainer;
+
 class MonocularLocalizer
 {
 public:
+  virtual ~MonocularLocalizer() {}
   virtual bool localize(const cv::Mat& img, const cv::Mat& K, Eigen::Matrix4f* pose, Eigen::Matrix4f* pose_guess = NULL) = 0; 
+  // Keyframe database, for localizers that can be rebuilt from a keyframe cache.  NULL
+  // for the others.
+  virtual const std::vector<KeyframeContainer*>* GetKeyframes() { return NULL; }
 };
 
 #endif
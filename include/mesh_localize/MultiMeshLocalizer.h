@@ -0,0 +1,46 @@
+#ifndef _MULTI_MESH_LOCALIZER_H_
+#define _MULTI_MESH_LOCALIZER_H_
+
+#include <map>
+#include <deque>
+#include <string>
+#include <ros/ros.h>
+#include "tf/transform_broadcaster.h"
+#include "sensor_msgs/Image.h"
+
+#include "MultiTracker.h"
+
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ *  ROS front end for MultiTracker.  The private param "objects" lists the object ids.
+ *  Each object reads its tracker params from the private namespace of its id, falling
+ *  back to the private params shared by all objects.  Poses are published on
+ *  /mesh_localize/<id>/estimated_pose and as the tf frame <id> relative to the camera.
+ */
+class MultiMeshLocalizer
+{
+public:
+  MultiMeshLocalizer(ros::NodeHandle nh, ros::NodeHandle nh_private);
+  ~MultiMeshLocalizer();
+
+private:
+  void HandleImage(const sensor_msgs::ImageConstPtr& msg);
+  void HandleResult(const std::string& id, const Tracker::PoseResult& result);
+  ros::Time LookupStamp(double stamp);
+
+  ros::NodeHandle nh;
+  ros::NodeHandle nh_private;
+
+  boost::shared_ptr<MultiTracker> tracker;
+  std::map<std::string, ros::Publisher> pose_pubs;
+  tf::TransformBroadcaster br;
+  boost::mutex br_mutex;
+  ros::Subscriber image_sub;
+
+  boost::mutex stamp_mutex;
+  std::deque<ros::Time> recent_stamps;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _MULTI_TRACKER_H_
+#define _MULTI_TRACKER_H_
+
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include <opencv2/core/core.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "Tracker.h"
+#include "RenderService.h"
+#include "TrackerPool.h"
+
+/**
+ *  Tracks several objects in the same camera stream.  Each frame is converted and
+ *  undistorted once and handed to one Tracker per object.  The trackers are scheduled on
+ *  a TrackerPool and the virtual views of all objects are rendered on a shared render
+ *  thread.
+ */
+class MultiTracker
+{
+public:
+  typedef boost::function<void (const std::string&, const Tracker::PoseResult&)> ResultCallback;
+
+  //! num_workers <= 0 uses one worker per core
+  MultiTracker(const Eigen::Matrix3f& K, const Eigen::VectorXf& distcoeff, int num_workers = 0);
+  ~MultiTracker();
+
+  //! Adds an object with its own keyframe database and model.  Frames are ingested with the
+  //! image_scale and do_undistort of the first object, later objects must use the same.
+  //! Must not be called while frames are being processed.
+  bool addObject(const std::string& id, const TrackerParams& params, int rows, int cols);
+
+  //! Called with every result from the worker or pipeline thread that produced it
+  void setResultCallback(const ResultCallback& cb);
+
+  //! Ingests a raw camera frame and queues it for every object.  Does not block on tracking.
+  void processFrame(const cv::Mat& image, double stamp);
+
+  //! Blocks until every queued frame has been tracked
+  void flush();
+
+  std::vector<std::string> getObjectIds();
+
+private:
+  struct Object
+  {
+    std::string id;
+    MonocularLocalizer* localizer;
+    boost::shared_ptr<Tracker> tracker;
+  };
+
+  void HandleResult(const std::string& id, const Tracker::PoseResult& result);
+
+  Eigen::Matrix3f K;
+  Eigen::VectorXf distcoeff;
+  RenderService render_service;
+  ResultCallback result_callback;
+  std::vector<Object> objects;
+  boost::shared_ptr<TrackerPool> pool;
+};
+
+#endif
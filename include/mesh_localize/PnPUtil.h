@@ -7,15 +7,19 @@
 #include <Eigen/Core>
 #include <Eigen/Dense>
 #include <vector>
+#include <random>
 
 class PnPUtil
 {
 public:
   static std::vector<cv::Point3f> BackprojectPts(const std::vector<cv::Point2f>& pts, 
     const Eigen::Matrix4f& camTf, const Eigen::Matrix3f& K, const cv::Mat& depth);
+  // Stops sampling hypotheses once max_time seconds have passed (negative for no limit).
+  // A minimum number of hypotheses is always tested.  Samples are drawn from rng, or from
+  // a generator with the default seed if NULL, never from global state.
   static bool RansacPnP(const std::vector<cv::Point3f>& matchPts3d, 
     const std::vector<cv::Point2f>& matchPts, cv::Mat Kcv, Eigen::Matrix4f tfguess, 
     Eigen::Matrix4f& tf, std::vector<int>& inlierIdx, double* avgReprojError = NULL, 
-    Eigen::Matrix<float, 6, 6>* cov = NULL);
+    Eigen::Matrix<float, 6, 6>* cov = NULL, double max_time = -1, std::mt19937* rng = NULL);
 };
 #endif
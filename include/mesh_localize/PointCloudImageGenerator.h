@@ -2,7 +2,6 @@
 #define _POINTCLOUD_IMAGE_GENERATOR_
 
 #include "VirtualImageGenerator.h"
-#include "pcl_ros/point_cloud.h"
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/PolygonMesh.h>
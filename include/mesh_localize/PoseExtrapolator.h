@@ -0,0 +1,42 @@
+#ifndef _POSE_EXTRAPOLATOR_H_
+#define _POSE_EXTRAPOLATOR_H_
+
+#include <Eigen/Dense>
+#include <boost/thread/mutex.hpp>
+
+/**
+ *  Predicts the camera pose at arbitrary times from the latest tracked estimate and the
+ *  constant velocity motion model, for consumers that need poses faster or sooner than
+ *  frames are tracked.  All times are image stamps in seconds.  Thread safe.
+ */
+class PoseExtrapolator
+{
+public:
+  //! Estimates older than max_age seconds are not extrapolated.  Non-positive disables
+  //! the limit.
+  PoseExtrapolator(double max_age);
+
+  //! Records the estimate for the frame taken at stamp.  velocity is the twist (in the
+  //! Lie algebra, per second) of the motion model, pose(t) = exp(t*velocity)*pose.
+  void update(double stamp, const Eigen::Matrix4f& pose, const Eigen::Matrix4f& velocity);
+  //! Drops the estimate, e.g. when tracking is lost
+  void reset();
+
+  //! Pose at stamp and the age of the estimate it was extrapolated from.  False if there
+  //! is no estimate or it is too old.
+  bool predict(double stamp, Eigen::Matrix4f& pose, double& age);
+
+private:
+  double max_age;
+
+  boost::mutex mutex;
+  bool valid;
+  double estimate_stamp;
+  Eigen::Matrix4f estimate;
+  Eigen::Matrix4f velocity;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+#endif
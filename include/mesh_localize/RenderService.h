@@ -0,0 +1,56 @@
+#ifndef _RENDER_SERVICE_H_
+#define _RENDER_SERVICE_H_
+
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "VirtualImageGenerator.h"
+
+/**
+ *  Owns a set of virtual image generators on one dedicated render thread.  OGRE keeps its
+ *  GL context on the thread that created it, so generators are created, used and destroyed
+ *  on that thread only.  AddGenerator returns a proxy generator that can be used from any
+ *  thread; render requests from all proxies are serialized in arrival order.
+ */
+class RenderService
+{
+public:
+  typedef boost::function<VirtualImageGenerator* ()> Factory;
+
+  RenderService();
+  ~RenderService();
+
+  //! Runs factory on the render thread.  Returns a proxy owned by the service, or NULL if
+  //! the factory failed.
+  VirtualImageGenerator* AddGenerator(const Factory& factory);
+
+private:
+  class Proxy;
+
+  struct Request
+  {
+    boost::function<void ()> work;
+    bool done;
+  };
+
+  void RenderLoop();
+  // Runs work on the render thread and waits for it to finish
+  void Execute(const boost::function<void ()>& work);
+  void CreateGenerator(const Factory& factory, VirtualImageGenerator** gen,
+    Eigen::Matrix3f* K);
+
+  boost::mutex mutex;
+  boost::condition_variable request_cond;
+  boost::condition_variable done_cond;
+  std::deque<Request*> requests;
+  bool running;
+  boost::thread render_thread;
+
+  // Only touched on the render thread
+  std::vector<VirtualImageGenerator*> generators;
+  std::vector<Proxy*> proxies;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _ROS_PARAMS_H_
+#define _ROS_PARAMS_H_
+
+#include <ros/ros.h>
+#include "Tracker.h"
+
+/**
+ *  Overrides the tracker params that are set on the given node handle.  Params that are
+ *  not set keep their current value, so a namespace can be layered on top of another.
+ */
+void ReadTrackerParams(const ros::NodeHandle& nh, TrackerParams& params);
+
+#endif
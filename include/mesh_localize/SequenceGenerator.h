@@ -0,0 +1,103 @@
+#ifndef _SEQUENCE_GENERATOR_H_
+#define _SEQUENCE_GENERATOR_H_
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <Eigen/Dense>
+
+#include "VirtualImageGenerator.h"
+
+struct SequenceParams
+{
+  SequenceParams();
+
+  //! "random_walk" moves and turns the camera randomly inside a box above the object,
+  //! "orbit" circles the object while looking at it
+  std::string trajectory;
+  double fps;
+  //! Model units per second
+  double speed;
+  //! Radians per second
+  double angular_speed;
+
+  //! Random walk box, the camera looks down on the object from z
+  double xy_bound;
+  double z_lower;
+  double z_upper;
+  //! Largest deviation of the random walk from looking straight down, in radians
+  double max_tilt;
+
+  double orbit_radius;
+  double orbit_height;
+
+  //! Standard deviation of the Gaussian pixel noise, in gray levels
+  double image_noise;
+  //! Fraction of the frame period the shutter is open.  The motion during the exposure is
+  //! rendered as blur.
+  double exposure;
+  int blur_samples;
+  //! Rectangles drifting across the image, occluder_size is their width as a fraction of
+  //! the image width
+  int num_occluders;
+  double occluder_size;
+
+  int seed;
+};
+
+/**
+ *  Renders reproducible synthetic sequences with known poses, for stress testing the
+ *  tracker at controlled speeds.  Every random choice comes from one seeded generator, so
+ *  the same params give the same sequence.
+ */
+class SequenceGenerator
+{
+public:
+  struct Frame
+  {
+    double stamp;
+    //! Camera pose in the model frame, as passed to the renderer, at the end of the
+    //! exposure
+    Eigen::Matrix4f pose;
+    cv::Mat image;
+    cv::Mat depth;
+  };
+
+  //! vig is not owned
+  SequenceGenerator(const SequenceParams& params, VirtualImageGenerator* vig);
+
+  void next(Frame& frame);
+  Eigen::Matrix3f GetK();
+
+private:
+  struct Occluder
+  {
+    cv::Rect_<float> rect;
+    cv::Point2f velocity;
+    int gray;
+  };
+
+  void Step();
+  void StepRandomWalk(double dt);
+  void StepOrbit(double dt);
+  static Eigen::Matrix4f Interpolate(const Eigen::Matrix4f& a, const Eigen::Matrix4f& b,
+    double t);
+  void Render(const Eigen::Matrix4f& prev, Frame& frame);
+  void DrawOccluders(cv::Mat& image);
+
+  SequenceParams params;
+  VirtualImageGenerator* vig;
+  cv::RNG rng;
+
+  int frame_index;
+  Eigen::Vector3f position;
+  Eigen::Vector3f direction;
+  // Roll, pitch and yaw relative to looking straight down
+  Eigen::Vector3f attitude;
+  double orbit_angle;
+  Eigen::Matrix4f pose;
+
+  std::vector<Occluder> occluders;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _SEQUENCE_UTIL_H_
+#define _SEQUENCE_UTIL_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <opencv2/core/core.hpp>
+#include <Eigen/Dense>
+
+#include "Tracker.h"
+
+/**
+ *  Loading of recorded image sequences and reading/writing of per-frame pose CSVs for the
+ *  offline tools.
+ */
+class SequenceUtil
+{
+public:
+  struct Frame
+  {
+    std::string path;
+    double stamp;
+    cv::Mat image;
+  };
+
+  // One row of a pose CSV.  Position and orientation follow the estimated_pose convention.
+  struct PoseRecord
+  {
+    PoseRecord();
+
+    int frame;
+    double stamp;
+    int state;
+    bool valid;
+    double x, y, z;
+    double qx, qy, qz, qw;
+  };
+
+  //! Reads camera_matrix and distortion_coefficients as written by the OpenCV calibration tools
+  static bool LoadIntrinsics(std::string filename, Eigen::Matrix3f& K, Eigen::VectorXf& distcoeff);
+  static bool WriteIntrinsics(std::string filename, const Eigen::Matrix3f& K,
+    const Eigen::VectorXf& distcoeff);
+
+  //! Lists a stream file ("stamp image_path" per line) or else a directory of jpg/png images
+  //! in name order, stamped at fps.  Images are not loaded.
+  static bool ListFrames(std::string source, double fps, std::vector<Frame>& frames);
+  static bool ListStreamFile(std::string filename, std::vector<Frame>& frames);
+  static bool ListImageDir(std::string dir, double fps, std::vector<Frame>& frames);
+  static bool LoadImages(std::vector<Frame>& frames);
+
+  static PoseRecord MakePoseRecord(int frame, const Tracker::PoseResult& result);
+  static Eigen::Matrix4f PoseRecordToMatrix(const PoseRecord& rec);
+  static void WritePoseHeader(std::ostream& out);
+  static void WritePose(std::ostream& out, const PoseRecord& rec);
+  static bool ReadPoses(std::string filename, std::vector<PoseRecord>& poses);
+};
+#endif
@@ -0,0 +1,65 @@
+#ifndef _SNAPSHOT_UTIL_H_
+#define _SNAPSHOT_UTIL_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <opencv2/core/core.hpp>
+#include <boost/function.hpp>
+
+/**
+ *  Binary serialization for tracker snapshots and keyframe database caches.  Values are
+ *  written in host byte order and layout, so files are only meant to be read back on the
+ *  machine (and build) that wrote them.  Every file starts with a magic string and a
+ *  version; readers reject anything else.
+ */
+class SnapshotUtil
+{
+public:
+  //! Plain data: numbers, fixed size Eigen matrices, cv::Point*, cv::Size, cv::KeyPoint
+  template<typename T>
+  static void Write(std::ostream& out, const T& value)
+  {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template<typename T>
+  static bool Read(std::istream& in, T& value)
+  {
+    return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+  }
+
+  template<typename T>
+  static void WriteVector(std::ostream& out, const std::vector<T>& values)
+  {
+    Write(out, (unsigned int)values.size());
+    if(!values.empty())
+      out.write(reinterpret_cast<const char*>(&values[0]), values.size()*sizeof(T));
+  }
+
+  template<typename T>
+  static bool ReadVector(std::istream& in, std::vector<T>& values)
+  {
+    unsigned int size;
+    if(!Read(in, size))
+      return false;
+    values.resize(size);
+    return size == 0 || bool(in.read(reinterpret_cast<char*>(&values[0]), size*sizeof(T)));
+  }
+
+  static void WriteString(std::ostream& out, const std::string& str);
+  static bool ReadString(std::istream& in, std::string& str);
+  static void WriteMat(std::ostream& out, const cv::Mat& mat);
+  static bool ReadMat(std::istream& in, cv::Mat& mat);
+
+  static void WriteHeader(std::ostream& out, const std::string& magic, int version);
+  static bool ReadHeader(std::istream& in, const std::string& magic, int version);
+
+  //! Writes through a temporary file that replaces filename only once write succeeded, so
+  //! a crash while saving leaves the previous file intact
+  static bool WriteFile(const std::string& filename,
+    const boost::function<bool (std::ostream&)>& write);
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef _TASK_SCHEDULER_H_
+#define _TASK_SCHEDULER_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <exception>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+class TaskGroup;
+
+/**
+ *  Process wide work-stealing thread pool that runs the data parallel parts of the
+ *  tracker (ASIFT views, keyframe matching, Canny).  Every worker owns a deque: tasks
+ *  spawned on a worker go to the back of its own deque and are run from there, idle
+ *  workers steal from the front of the others.  Tasks spawned from other threads go to a
+ *  shared queue.
+ *
+ *  Waiting for a TaskGroup runs the group's own queued tasks instead of blocking, so
+ *  parallel loops may be nested (e.g. keyframe matching inside relocalization inside a
+ *  TrackerPool worker) without oversubscribing the cores or deadlocking.  Tasks of other
+ *  groups are never run by a waiter, so a real-time wait (Canny on the tracking thread)
+ *  can't get stuck behind background work (relocalization).
+ *
+ *  The pool is created on first use.  Configure it before that.
+ */
+class TaskScheduler
+{
+public:
+  typedef boost::function<void ()> Task;
+
+  //! num_threads <= 0 uses one thread per core.  Worker i is pinned to cpus[i % cpus.size()]
+  //! unless cpus is empty.  Returns false if the pool is already running with a different
+  //! configuration, which is then left as it is.
+  static bool Configure(int num_threads, const std::vector<int>& cpus = std::vector<int>());
+  //! Parses a list like "0,2,4-7"
+  static std::vector<int> ParseCpuList(const std::string& list);
+  //! The pool lives until the process exits
+  static TaskScheduler& Instance();
+
+  int getNumThreads();
+
+  //! Runs body(i) for every i in [begin, end), using the calling thread as well, and
+  //! returns when all are done.  Rethrows the first exception thrown by body.
+  void parallelFor(int begin, int end, const boost::function<void (int)>& body);
+
+private:
+  friend class TaskGroup;
+
+  struct Item
+  {
+    Task task;
+    TaskGroup* group;
+  };
+
+  struct Worker
+  {
+    boost::mutex mutex;
+    std::deque<Item> items;
+    boost::thread thread;
+  };
+
+  TaskScheduler(int num_threads, const std::vector<int>& cpus);
+  void Spawn(const Task& task, TaskGroup* group);
+  // Takes the next task for the calling thread: its own newest, then a shared, then a
+  // stolen one
+  bool Take(Item& item);
+  // Takes a queued task of group from any queue
+  bool TakeGroup(Item& item, TaskGroup* group);
+  static bool TakeGroupFrom(std::deque<Item>& items, TaskGroup* group, Item& item);
+  void Run(Item& item);
+  void WorkerLoop(int index);
+
+  std::vector<Worker*> workers;
+  std::vector<int> cpus;
+
+  boost::mutex shared_mutex;
+  std::deque<Item> shared_items;
+
+  // Tasks waiting in any queue, for idle workers to sleep on
+  boost::atomic<int> num_queued;
+  boost::mutex sleep_mutex;
+  boost::condition_variable sleep_cond;
+
+  static boost::mutex instance_mutex;
+  static TaskScheduler* instance;
+  static int config_threads;
+  static std::vector<int> config_cpus;
+};
+
+/**
+ *  Set of tasks that are waited for together.  Tasks may spawn further tasks into the
+ *  same or a nested group.  The destructor waits.
+ */
+class TaskGroup
+{
+public:
+  TaskGroup(TaskScheduler& scheduler = TaskScheduler::Instance());
+  ~TaskGroup();
+
+  void run(const TaskScheduler::Task& task);
+  //! Runs the group's queued tasks until every task of the group has finished.  Rethrows
+  //! the first exception thrown by one of them.
+  void wait();
+
+private:
+  friend class TaskScheduler;
+
+  void Finish(std::exception_ptr error);
+
+  TaskScheduler& scheduler;
+  boost::mutex mutex;
+  int pending;
+  boost::condition_variable done_cond;
+  std::exception_ptr error;
+};
+
+#endif
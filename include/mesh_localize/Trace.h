@@ -0,0 +1,68 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <string>
+#include <boost/atomic.hpp>
+
+/**
+ *  Process-wide timeline tracer.  Spans are recorded into a fixed ring per thread, so a
+ *  long run keeps its last kRingSize spans per thread, and written out as Chrome
+ *  trace_event JSON (chrome://tracing or Perfetto) to see how the stages of the tracking
+ *  threads, the pipeline and the task workers overlap.
+ *
+ *  Span names must be string literals or otherwise outlive the process, only the pointer
+ *  is stored.  While tracing is off a span costs one relaxed load.
+ */
+class Tracer
+{
+public:
+  static const int kRingSize = 1 << 16;
+
+  static void Start();
+  static void Stop();
+  static bool IsEnabled()
+  {
+    return enabled.load(boost::memory_order_relaxed);
+  }
+
+  //! Monotonic seconds, the clock spans are measured with
+  static double Now();
+  //! Records a span of the calling thread.  Does nothing while tracing is off.
+  static void Complete(const char* name, double start, double end);
+  //! Names the calling thread in the trace.  May be called before tracing starts.
+  static void SetThreadName(const char* name);
+
+  //! Writes the spans in the rings as Chrome trace JSON.  Spans overwritten while
+  //! writing are left out, so this may be called while tracing is still on.
+  static bool WriteFile(const std::string& filename);
+
+private:
+  static boost::atomic<bool> enabled;
+};
+
+//! Records the lifetime of the scope as a span if tracing was on at its start
+class TraceScope
+{
+public:
+  TraceScope(const char* name) :
+    name(Tracer::IsEnabled() ? name : NULL),
+    start(this->name ? Tracer::Now() : 0)
+  {
+  }
+
+  ~TraceScope()
+  {
+    if(name)
+      Tracer::Complete(name, start, Tracer::Now());
+  }
+
+private:
+  const char* name;
+  double start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif
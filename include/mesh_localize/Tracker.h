@@ -0,0 +1,412 @@
+#ifndef _TRACKER_H_
+#define _TRACKER_H_
+
+#include <string>
+#include <vector>
+#include <random>
+#include <Eigen/Dense>
+#include <opencv2/core/core.hpp>
+
+#include "MonocularLocalizer.h"
+#include "VirtualImageGenerator.h"
+#include "KeyframeContainer.h"
+#include "MapFeatures.h"
+#include "EdgeTrackingUtil.h"
+#include "KLTTracker.h"
+#include "ModeSelector.h"
+#include "AsyncRelocalizer.h"
+#include "BoundedQueue.h"
+#include "FrameIngest.h"
+#include "PoseExtrapolator.h"
+#include "LostModeGate.h"
+
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/**
+ *  Tracking parameters.  The names and defaults match the private ROS params read by
+ *  MeshLocalizer.
+ */
+struct TrackerParams
+{
+  TrackerParams();
+
+  //! Overrides the params present in a cv::FileStorage map, keyed by the ROS param names
+  void Read(const cv::FileNode& node);
+  //! Reads the top level map of a YAML/XML file.  Returns false if it can't be opened.
+  bool Load(const std::string& filename);
+  //! Writes every param in the format Read takes, flags as ints
+  void Write(cv::FileStorage& fs) const;
+  //! Writes every param as a typed <param> element of a roslaunch node
+  void WriteLaunch(std::ostream& out) const;
+
+  // Global (re)initialization
+  std::string global_localization_alg;
+  std::string img_match_descriptor_type;
+  std::string photoscan_filename;
+  std::string ogre_data_dir;
+  bool load_descriptors;
+  std::string descriptor_filename;
+  bool show_global_matches;
+  // Binary cache of the keyframe database with its features extracted, written after the
+  // first load and read instead of the database after that.  Empty disables.
+  std::string keyframe_cache_filename;
+
+  // Virtual image generation
+  std::string virtual_image_source;
+  std::string pc_filename;
+  std::string ogre_cfg_dir;
+  std::string ogre_model;
+  double virtual_fx;
+  double virtual_fy;
+  bool use_depth_shader;
+
+  // Frame to frame tracking
+  // PNP, KLT, EDGE, or AUTO to let a ModeSelector switch between them
+  std::string tracking_mode;
+  std::string pnp_descriptor_type;
+  std::string motion_model;
+  double image_scale;
+  bool do_undistort;
+  int min_pnp_inliers;
+  double max_pnp_reproj_error;
+  double ratio_test_thresh;
+  double pnp_match_radius;
+  double pixel_noise;
+  int edge_tracking_iterations;
+  double edge_tracking_dmax;
+  double canny_high_thresh;
+  double canny_low_thresh;
+  double canny_sigma;
+  bool autotune_canny;
+  bool pipeline_tracking;
+  // Run global (re)localization on a background thread instead of in the tracking loop
+  bool async_relocalization;
+  // Lost mode (see LostModeGate).  Once global localization keeps failing, it is retried
+  // every lost_retry_period seconds at lost_image_scale, and only on frames that changed
+  // by at least lost_change_thresh gray levels.  A non-positive period disables.
+  double lost_retry_period;
+  double lost_image_scale;
+  double lost_change_thresh;
+  // Seed of the tracker's own generators for RANSAC and feature shuffling.  Negative seeds
+  // from the clock.
+  int random_seed;
+
+  // Latency control (see FrameScheduler).  target_latency is the capture to pose time in
+  // seconds that the scheduler holds by dropping stale frames, budgeting RANSAC and edge
+  // refinement and lowering the resolution down to min_image_scale.  Non-positive disables.
+  double target_latency;
+  double min_image_scale;
+
+  // Threads of the shared TaskScheduler (0 for one per core) and the cpus to pin them to,
+  // as a list like "0,2,4-7".  Empty leaves them unpinned.  Only the first tracker created
+  // in a process configures the scheduler.
+  int task_threads;
+  std::string task_cpus;
+
+  // Poses are extrapolated from estimates up to this many seconds old (see
+  // Tracker::extrapolatePose)
+  double pose_extrapolation_max_age;
+
+  // Debug output
+  bool show_pnp_matches;
+  bool show_debug;
+};
+
+/**
+ *  Model-based object tracker.  Runs the initialization/tracking state machine on
+ *  undistorted grayscale frames and has no ROS dependency, so it can be embedded
+ *  directly in another process.  The localizer and virtual image generator are not
+ *  owned by the tracker.  processFrame must be called from the thread that created the
+ *  virtual image generator (OGRE keeps its GL context on that thread).
+ */
+class Tracker
+{
+public:
+  enum LocalizeState
+  {
+    INIT,
+    INIT_PNP,
+    LOCAL_INIT,
+    PNP,
+    EDGES,
+    KLT_INIT,
+    KLT
+  };
+
+  // (stage name, seconds) in the order the stages ran
+  typedef std::vector<std::pair<std::string, double> > StageTimes;
+
+  struct PoseResult
+  {
+    PoseResult();
+
+    double stamp;
+    // True if the pose was estimated from this frame
+    bool valid;
+    // True if the frame was handed to the tracking pipeline.  Its result is delivered
+    // to the result callback once the pipeline finishes it.
+    bool pending;
+    LocalizeState state;
+    // Camera pose in the object frame
+    Eigen::Matrix<float, 4, 4, Eigen::DontAlign> pose;
+    // Scaled and undistorted frame the pose was estimated on
+    cv::Mat image;
+    // Intrinsics of image
+    Eigen::Matrix<float, 3, 3, Eigen::DontAlign> K;
+    // Rendered depth transformed into image, only filled in when requested with
+    // setOutputDepth() on PnP tracking frames
+    cv::Mat depth;
+    // Wall-clock time spent in each tracking stage on this frame
+    StageTimes timings;
+  };
+
+  typedef boost::function<void (const PoseResult&)> ResultCallback;
+
+  Tracker(const TrackerParams& params, const Eigen::Matrix3f& K, const Eigen::VectorXf& distcoeff,
+    MonocularLocalizer* localizer, VirtualImageGenerator* vig);
+  ~Tracker();
+
+  //! Converts, scales and undistorts a raw camera image and tracks it
+  PoseResult processFrame(const cv::Mat& image, double stamp);
+  //! Converts a raw camera image into the frame trackFrame expects.  Thread safe.
+  void prepareFrame(const cv::Mat& image, cv::Mat& frame);
+  //! Tracks a frame returned by prepareFrame.  budget is the time in seconds the frame may
+  //! take, RANSAC sampling and edge refinement stop early when it runs out.  Negative
+  //! budgets don't limit tracking.
+  PoseResult trackFrame(const cv::Mat& frame, double stamp, double budget = -1);
+
+  //! Changes the resolution frames are processed at.  Takes effect with the next frame
+  //! passed to prepareFrame; KLT tracking restarts from PnP on the first frame at the new
+  //! resolution.  Thread safe.
+  void setImageScale(double scale);
+  double getImageScale();
+
+  //! Blocks until every frame handed to the tracking pipeline has been delivered
+  void flush();
+
+  //! Writes the tracking state (pose, motion model, KLT tracks, undistortion maps) to
+  //! filename, so a restarted tracker can resume without global localization.  The state
+  //! is copied on the calling thread, which must be the tracking thread, and written in
+  //! the background; returns false without saving while the previous write is running.
+  //! With wait, the pipeline is flushed first and the file is written before returning.
+  bool saveSnapshot(const std::string& filename, bool wait = false);
+  //! Restores a snapshot written by a tracker for the same camera.  The motion model
+  //! restarts at the first frame tracked afterwards.  Call before tracking starts.
+  bool loadSnapshot(const std::string& filename);
+  //! Reads the camera a snapshot was taken with, so a tracker can be created for it before
+  //! the camera is up
+  static bool ReadSnapshotCamera(const std::string& filename, Eigen::Matrix3f& K,
+    Eigen::VectorXf& distcoeff, cv::Size& raw_size);
+
+  //! Called with the result of every tracked frame, from the thread that produced it
+  void setResultCallback(const ResultCallback& cb);
+  void setOutputDepth(bool output);
+
+  LocalizeState getState();
+  Eigen::Matrix4f getPose();
+  //! Latest estimate extrapolated with the motion model to stamp (in the time base of the
+  //! frame stamps), and how old the estimate is.  False while the object isn't tracked.
+  //! Thread safe and cheap, meant to be polled faster than frames arrive.
+  bool extrapolatePose(double stamp, Eigen::Matrix4f& pose, double& age);
+  //! Intrinsics of the frames being tracked
+  Eigen::Matrix3f getScaledK() const;
+  const TrackerParams& getParams() const;
+
+  static MonocularLocalizer* CreateLocalizer(const TrackerParams& params);
+  static VirtualImageGenerator* CreateImageGenerator(const TrackerParams& params,
+    const Eigen::Matrix3f& K, int rows, int cols);
+
+  static void ReprojectMask(cv::Mat& dst, const cv::Mat& src, const Eigen::Matrix3f& dstK,
+    const Eigen::Matrix3f& srcK, bool median_blur = true);
+  static void TransformDepthFrame(const Mat& d1, const Eigen::Matrix4f& tf1,
+    const Eigen::Matrix3f K1, Mat& d2, const Eigen::Matrix4f& tf2, const Eigen::Matrix3f& K2,
+    Size d2_size);
+  static void CreateTfViz(const Mat& src, Mat& dst, const Eigen::Matrix4f& tf,
+    const Eigen::Matrix3f& K);
+
+private:
+  // Rendered view of the model and the features extracted from it.  Views are queued in
+  // std containers, so the pose is stored unaligned.
+  struct VirtualView
+  {
+    Eigen::Matrix<float, 4, 4, Eigen::DontAlign> tf;
+    Eigen::Matrix3f K;
+    Mat image;
+    Mat depth;
+    Mat mask;
+    std::vector<KeyPoint> keypoints;
+    Mat descriptors;
+#ifdef MESH_LOCALIZER_ENABLE_GPU
+    gpu::GpuMat descriptors_gpu;
+#endif
+    bool valid;
+  };
+
+  // Work item passed between the stages of the PnP tracking pipeline
+  struct PipelineFrame
+  {
+    unsigned long seq;
+    Mat image;
+    double stamp;
+    Mat query_mask;
+    boost::shared_ptr<KeyframeContainer> kf;
+    VirtualView view;
+    StageTimes timings;
+    double deadline;
+  };
+
+  Eigen::Matrix4f FindImageTfPnp(KeyframeContainer* kcv, const MapFeatures& mf);
+  bool FindImageTfVirtualPnp(KeyframeContainer* kcv, Eigen::Matrix4f vimgTf, Eigen::Matrix4f& out, std::string vdesc_type, bool mask_kf, Eigen::Matrix<float, 6, 6>& cov);
+  bool RenderVirtualView(const Eigen::Matrix4f& vimgTf, VirtualView& view);
+  bool ExtractVirtualFeatures(VirtualView& view, std::string vdesc_type);
+  bool MatchVirtualPnp(KeyframeContainer* kfc, const VirtualView& view, std::string vdesc_type,
+    Eigen::Matrix4f& tf, Eigen::Matrix<float, 6, 6>& cov, double& reprojError,
+    int& numInliers, std::mt19937& rng, double deadline = -1);
+  // Dilated reprojection of a rendered mask, into a pooled mask no frame refers to anymore
+  void GetQueryMask(Mat& dst, const Mat& src, const Eigen::Matrix3f& srcK, int rows, int cols);
+  // Query keyframe for the current frame.  The container is reused from frame to frame.
+  KeyframeContainer* QueryKeyframe(const std::string& desc_type);
+  bool FindImageTfVirtualEdges(KeyframeContainer* kcv, Eigen::Matrix4f vimgTf, Eigen::Matrix4f& out, bool mask_kf);
+  std::vector<pcl::PointXYZ> GetPointCloudFromFrames(KeyframeContainer*, KeyframeContainer*);
+  std::vector<int> FindPlaneInPointCloud(const std::vector<pcl::PointXYZ>& pts);
+  std::vector<Point3d> PCLToPoint3d(const std::vector<pcl::PointXYZ>& cpvec);
+
+  void UpdateMotionModel(const Eigen::Matrix4f& olfTf, const Eigen::Matrix4f& newTf,
+    const Eigen::Matrix<float, 6, 6>& cov, double dt);
+  Eigen::Matrix4f ApplyMotionModel(double dt);
+  void ResetMotionModel();
+  // Velocity handed to the extrapolator, zero unless the motion model has one
+  Eigen::Matrix4f MotionModelVelocity();
+
+  void AddStageTime(const char* stage, double seconds);
+  LocalizeState NextTrackingState(ModeSelector::Mode current, const Mat& image);
+  void SetTrackingSize(const cv::Size& raw_size, const cv::Size& size);
+
+  PoseResult Step();
+  void StartPipeline();
+  void StopPipeline();
+  void FlushPipeline();
+  void PipelineProcess(const Mat& image, double stamp, double deadline);
+  // Query keyframe for a pipeline frame, from the pool of keyframes no frame refers to
+  boost::shared_ptr<KeyframeContainer> PipelineKeyframe(const Mat& image);
+  void PipelineExtractLoop();
+  void PipelineMatchLoop();
+
+  // Tracking state captured by saveSnapshot
+  struct Snapshot
+  {
+    Eigen::Matrix3f K;
+    Eigen::VectorXf distcoeff;
+    cv::Size raw_size;
+    double ingest_scale;
+    cv::Size tracking_size;
+    Eigen::Matrix3f K_scaled;
+    int state;
+    Eigen::Matrix4f pose;
+    Eigen::Matrix4f velocity;
+    Mat klt_init_img;
+    std::string klt_state;
+    FrameIngest::Maps maps;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  static bool WriteSnapshot(std::ostream& out, const Snapshot& snapshot);
+  void WriteSnapshotFile(const std::string& filename, boost::shared_ptr<Snapshot> snapshot);
+
+  void ShowTfViz(const Mat& img, const Eigen::Matrix4f& pose);
+  void ShowMasked(const std::string& name, const Mat& img, const Mat& mask);
+  void ShowMatches(const std::string& name, const Mat& img1, const std::vector<KeyPoint>& kps1,
+    const Mat& img2, const std::vector<KeyPoint>& kps2, const std::vector<DMatch>& matches);
+
+  TrackerParams params;
+  LocalizeState localize_state;
+
+  double img_time_stamp;
+  // Wall time the frame being processed by Step() has to be done by, negative for none
+  double frame_deadline;
+  // Stage timings of the frame being processed by Step()
+  StageTimes step_times;
+  Mat current_image;
+  Mat virtual_depth;
+  Eigen::Matrix4f currentPose;
+  double current_pose_stamp;
+  // Set by loadSnapshot, the next frame restarts the motion model from its own stamp
+  bool resume_pending;
+  int numPnpRetrys;
+  int numLocalizeRetrys;
+  double pnpReprojError;
+  int pnpNumInliers;
+  // Statistics of the last edge matching, for the mode selector
+  double edgeMatchError;
+  int edgeNumMatches;
+  ModeSelector mode_selector;
+  LostModeGate lost_gate;
+
+  MonocularLocalizer* localization_init;
+  VirtualImageGenerator* vig;
+  boost::shared_ptr<AsyncRelocalizer> relocalizer;
+
+  ResultCallback result_callback;
+  boost::atomic<bool> output_depth;
+
+  // PnP tracking pipeline.  The render stage runs on the tracking thread, query feature
+  // extraction and matching+PnP each get a worker.  pose_mutex guards the tracker state
+  // (currentPose, camera_velocity, localize_state) while the workers are running.
+  boost::mutex pose_mutex;
+  boost::mutex pipeline_mutex;
+  boost::condition_variable pipeline_cond;
+  unsigned int pipeline_in_flight;
+  unsigned long pipeline_seq;
+  Mat pipeline_query_mask;
+  BoundedQueue<PipelineFrame> extract_queue;
+  BoundedQueue<PipelineFrame> extracted_queue;
+  BoundedQueue<PipelineFrame> view_queue;
+  boost::thread extract_thread;
+  boost::thread match_thread;
+  // Reused query masks (tracking thread) and query keyframes (extract worker)
+  std::vector<Mat> pipeline_masks;
+  std::vector<boost::shared_ptr<KeyframeContainer> > pipeline_kfs;
+
+  Eigen::Matrix4f camera_velocity;
+  PoseExtrapolator extrapolator;
+
+  Eigen::Matrix3f K;
+  Eigen::Matrix3f K_scaled;
+  Eigen::VectorXf distcoeff;
+  Mat Kcv;
+  Mat Kcv_undistort;
+  Mat distcoeffcv;
+  // Size of the frames K_scaled and Kcv belong to
+  cv::Size tracking_size;
+
+  // Ingest state shared by prepareFrame and trackFrame
+  boost::mutex ingest_mutex;
+  double ingest_scale;
+  cv::Size raw_size;
+  FrameIngest ingest;
+
+  KLTTracker klt_tracker;
+  Mat klt_init_img;
+
+  // Writes the latest snapshot, snapshot_writing is set until it is done
+  boost::thread snapshot_thread;
+  boost::atomic<bool> snapshot_writing;
+
+  // Random samples for the tracking thread and the pipeline match thread, seeded from
+  // random_seed.  Nothing else touches them, so replays are repeatable.
+  std::mt19937 rng;
+  std::mt19937 pipeline_rng;
+  boost::scoped_ptr<KeyframeContainer> query_kf;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+#endif
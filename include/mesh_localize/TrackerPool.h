@@ -0,0 +1,68 @@
+#ifndef _TRACKER_POOL_H_
+#define _TRACKER_POOL_H_
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "Tracker.h"
+
+/**
+ *  Runs a set of independent trackers on a pool of worker threads.  Every tracker keeps
+ *  only its latest unprocessed frame, so a tracker that falls behind skips frames instead
+ *  of delaying the others.  Relocalizing trackers may occupy at most all but one worker,
+ *  so trackers that are tracking always have a worker available.  Results are delivered
+ *  through each tracker's own result callback.
+ */
+class TrackerPool
+{
+public:
+  //! num_workers <= 0 uses one worker per core
+  TrackerPool(int num_workers = 0);
+  ~TrackerPool();
+
+  //! Returns the slot of the tracker, used to submit frames to it
+  int add(const boost::shared_ptr<Tracker>& tracker);
+
+  //! Queues a prepared frame (see Tracker::prepareFrame) for one tracker or all of them.
+  //! Replaces a frame the tracker hasn't started on yet.
+  void submit(int slot, const cv::Mat& frame, double stamp);
+  void submitAll(const cv::Mat& frame, double stamp);
+
+  //! Blocks until every queued frame has been tracked
+  void flush();
+
+  //! Number of frames replaced before the tracker got to them
+  unsigned long getDropped(int slot);
+
+private:
+  struct Slot
+  {
+    boost::shared_ptr<Tracker> tracker;
+    cv::Mat frame;
+    double stamp;
+    bool has_frame;
+    bool busy;
+    unsigned long num_dropped;
+  };
+
+  void WorkerLoop();
+  // Picks the next slot to track, or returns NULL.  Called with mutex held.
+  Slot* NextSlot();
+  // Called with mutex held
+  void Queue(Slot& slot, const cv::Mat& frame, double stamp);
+  static bool IsRelocalizing(Tracker::LocalizeState state);
+
+  boost::mutex mutex;
+  boost::condition_variable work_cond;
+  boost::condition_variable idle_cond;
+  std::vector<boost::shared_ptr<Slot> > slots;
+  unsigned int next_slot;
+  int num_workers;
+  int num_relocalizing;
+  bool running;
+  boost::thread_group workers;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef _TRACKING_SERVICE_H_
+#define _TRACKING_SERVICE_H_
+
+#include <vector>
+#include <Eigen/Dense>
+#include <opencv2/core/core.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "Tracker.h"
+#include "RenderService.h"
+#include "TrackerPool.h"
+
+/**
+ *  Tracks the same object in several camera streams.  The keyframe database, localizer
+ *  and render context are loaded once and shared by every stream; each stream only adds
+ *  its own Tracker state.  The trackers are scheduled on a TrackerPool and all virtual
+ *  views are rendered on one render thread.
+ */
+class TrackingService
+{
+public:
+  typedef boost::function<void (int, const Tracker::PoseResult&)> ResultCallback;
+
+  //! num_workers <= 0 uses one worker per core
+  TrackingService(const TrackerParams& params, int num_workers = 0);
+  ~TrackingService();
+
+  //! False if the keyframe database could not be loaded
+  bool isReady() const;
+
+  //! Adds a camera stream and returns its index, or -1 on failure.  The virtual image
+  //! generator is created with the camera of the first stream.  Must not be called while
+  //! frames are being processed.
+  int addStream(const Eigen::Matrix3f& K, const Eigen::VectorXf& distcoeff, int rows, int cols);
+
+  //! Called with every result from the worker or pipeline thread that produced it
+  void setResultCallback(const ResultCallback& cb);
+
+  //! Converts a raw frame on the calling thread and queues it for its stream.  Streams may
+  //! be fed from different threads.
+  void processFrame(int stream, const cv::Mat& image, double stamp);
+
+  //! Blocks until every queued frame has been tracked
+  void flush();
+
+private:
+  void HandleResult(int stream, const Tracker::PoseResult& result);
+
+  TrackerParams params;
+  MonocularLocalizer* localizer;
+  RenderService render_service;
+  VirtualImageGenerator* vig;
+  ResultCallback result_callback;
+  std::vector<boost::shared_ptr<Tracker> > streams;
+  boost::shared_ptr<TrackerPool> pool;
+};
+
+#endif
@@ -8,6 +8,7 @@
 class VirtualImageGenerator
 {
 public:
+  virtual ~VirtualImageGenerator() {}
   virtual cv::Mat GenerateVirtualImage(const Eigen::Matrix4f& pose, cv::Mat& depth, cv::Mat& mask) = 0;  
   virtual Eigen::Matrix3f GetK() = 0;
 };
@@ -0,0 +1,52 @@
+#ifndef _VISUALIZATION_SINK_H_
+#define _VISUALIZATION_SINK_H_
+
+#include <map>
+#include <string>
+#include <opencv2/core/core.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+/**
+ *  Collects debug images from the tracking code and displays them on a separate thread
+ *  at a capped rate.  Producers hand over cheap (reference counted) Mats or a function
+ *  that draws the overlay, which is only run on the display thread.  Only the latest
+ *  image per window is kept.  Until Start() is called the sink is headless: nothing is
+ *  queued, and producers should check HasConsumer() before building overlays at all.
+ */
+class VisualizationSink
+{
+public:
+  typedef boost::function<void (cv::Mat&)> RenderFunction;
+
+  static VisualizationSink& Instance();
+
+  void Start(double max_rate = 15);
+  void Stop();
+  bool HasConsumer() const;
+
+  void Show(const std::string& name, const cv::Mat& img);
+  void Show(const std::string& name, const RenderFunction& render);
+
+private:
+  VisualizationSink();
+  ~VisualizationSink();
+
+  struct Item
+  {
+    cv::Mat img;
+    RenderFunction render;
+  };
+
+  void DisplayLoop();
+
+  std::map<std::string, Item> pending;
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  boost::thread display_thread;
+  double max_rate;
+  boost::atomic<bool> running;
+};
+
+#endif
@@ -1,6 +1,9 @@
 #include "mesh_localize/ASiftDetector.h"
+#include "mesh_localize/TaskScheduler.h"
+#include "mesh_localize/Trace.h"
 
 #include <iostream>
+#include <boost/bind.hpp>
 
 #include <opencv2/nonfree/features2d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -25,64 +28,80 @@ void ASiftDetector::detectAndCompute(const Mat& img, std::vector< KeyPoint >& ke
   keypoints.clear();
   descriptors = Mat(0, 128, CV_32F);
   
+  std::vector<View> views;
   for(int tl = 1; tl < 4/*6*/; tl++)
   {
     double t = pow(2, 0.5*tl);
     int lim = 1.8*t;
-    #pragma omp parallel for
     for(int phil = 0; phil < lim; phil ++)
     //for(int phi = 0; phi < 180; phi += 100.0/t /*72.0/t*/)
     {
-      double phi = phil*100.0/t;
-      std::vector<KeyPoint> kps;
-      Mat desc;
+      View view;
+      view.tilt = t;
+      view.phi = phil*100.0/t;
+      views.push_back(view);
+    }
+  }
+
+  // All views of all tilts at once.  Results are merged in view order, so the keypoint
+  // order doesn't depend on the scheduling.
+  TaskScheduler::Instance().parallelFor(0, views.size(), boost::bind(&ASiftDetector::detectView,
+    this, boost::cref(img), boost::cref(mask), desc_type, boost::ref(views), _1));
 
-      Mat timg, skew_mask, Ai;
-      img.copyTo(timg);
-      mask.copyTo(skew_mask);
-      affineSkew(t, phi, timg, skew_mask, Ai);
+  for(unsigned int v = 0; v < views.size(); v++)
+  {
+    keypoints.insert(keypoints.end(), views[v].keypoints.begin(), views[v].keypoints.end());
+    descriptors.push_back(views[v].descriptors);
+    //std::cout << "Added desc " << descriptors.cols << " " << descriptors.rows << " " << desc.cols << " " << desc.rows << std::endl;
+  }
+}
+
+void ASiftDetector::detectView(const Mat& img, const Mat& mask, ASiftDetector::DescriptorType desc_type, std::vector<View>& views, int v)
+{
+  TRACE_SCOPE("ASiftDetector::detectView");
+  double t = views[v].tilt;
+  double phi = views[v].phi;
+  std::vector<KeyPoint>& kps = views[v].keypoints;
+  Mat& desc = views[v].descriptors;
+
+  Mat timg, skew_mask, Ai;
+  img.copyTo(timg);
+  mask.copyTo(skew_mask);
+  affineSkew(t, phi, timg, skew_mask, Ai);
 
 #if 0
-      Mat img_disp;
-      bitwise_and(mask, timg, img_disp);
-      namedWindow( "Skew", WINDOW_AUTOSIZE );// Create a window for display.
-      imshow( "Skew", img_disp ); 
-      waitKey(0);
+  Mat img_disp;
+  bitwise_and(mask, timg, img_disp);
+  namedWindow( "Skew", WINDOW_AUTOSIZE );// Create a window for display.
+  imshow( "Skew", img_disp ); 
+  waitKey(0);
 #endif
-      if(desc_type == ASiftDetector::SIFT)
-      {
-        SiftFeatureDetector detector;
-        detector.detect(timg, kps, skew_mask);
-  
-        SiftDescriptorExtractor extractor;
-        extractor.compute(timg, kps, desc);
-      }
-      else if(desc_type == ASiftDetector::SURF)
-      {
-        SurfFeatureDetector detector(600);
-        detector.detect(timg, kps, skew_mask);
-  
-        SurfDescriptorExtractor extractor;
-        extractor.compute(timg, kps, desc);
-      }
-
-      for(unsigned int i = 0; i < kps.size(); i++)
-      {
-        Point3f kpt(kps[i].pt.x, kps[i].pt.y, 1);
-        //std::cout << Ai << std::endl;
-        //std::cout << Mat(kpt) << std::endl;
-        Mat kpt_t = Ai*Mat(kpt);
-        //std::cout << "Transformed kp" << std::endl;
-        kps[i].pt.x = kpt_t.at<float>(0,0);
-        kps[i].pt.y = kpt_t.at<float>(1,0);
-      }
-      #pragma omp critical
-      {
-        keypoints.insert(keypoints.end(), kps.begin(), kps.end());
-        descriptors.push_back(desc);
-      }
-      //std::cout << "Added desc " << descriptors.cols << " " << descriptors.rows << " " << desc.cols << " " << desc.rows << std::endl;
-    }   
+  if(desc_type == ASiftDetector::SIFT)
+  {
+    SiftFeatureDetector detector;
+    detector.detect(timg, kps, skew_mask);
+
+    SiftDescriptorExtractor extractor;
+    extractor.compute(timg, kps, desc);
+  }
+  else if(desc_type == ASiftDetector::SURF)
+  {
+    SurfFeatureDetector detector(600);
+    detector.detect(timg, kps, skew_mask);
+
+    SurfDescriptorExtractor extractor;
+    extractor.compute(timg, kps, desc);
+  }
+
+  for(unsigned int i = 0; i < kps.size(); i++)
+  {
+    Point3f kpt(kps[i].pt.x, kps[i].pt.y, 1);
+    //std::cout << Ai << std::endl;
+    //std::cout << Mat(kpt) << std::endl;
+    Mat kpt_t = Ai*Mat(kpt);
+    //std::cout << "Transformed kp" << std::endl;
+    kps[i].pt.x = kpt_t.at<float>(0,0);
+    kps[i].pt.y = kpt_t.at<float>(1,0);
   }
 }
    
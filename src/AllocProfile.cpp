@@ -0,0 +1,245 @@
+#include "mesh_localize/AllocProfile.h"
+
+#ifdef MESH_LOCALIZER_ENABLE_ALLOC_PROFILE
+
+#include <new>
+#include <string>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <malloc.h>
+#include <boost/atomic.hpp>
+#include <opencv2/core/core.hpp>
+
+#include "mesh_localize/Metrics.h"
+
+namespace
+{
+  // Plain data, so the first use on a thread (possibly from inside operator new) doesn't
+  // have to construct anything
+  thread_local AllocProfile::Counts counts;
+  thread_local AllocProfile::Counts stage_mark;
+  thread_local AllocProfile::Counts frame_mark;
+
+  // Usable sizes of the live blocks, frees may happen on any thread
+  boost::atomic<boost::int64_t> heap_bytes(0);
+  boost::atomic<boost::int64_t> peak_heap_bytes(0);
+
+  void AddHeap(void* p)
+  {
+    boost::int64_t size = malloc_usable_size(p);
+    boost::int64_t live = heap_bytes.fetch_add(size, boost::memory_order_relaxed) + size;
+    boost::int64_t peak = peak_heap_bytes.load(boost::memory_order_relaxed);
+    while(live > peak && !peak_heap_bytes.compare_exchange_weak(peak, live,
+      boost::memory_order_relaxed))
+    {
+    }
+  }
+
+  void RemoveHeap(void* p)
+  {
+    heap_bytes.fetch_sub(malloc_usable_size(p), boost::memory_order_relaxed);
+  }
+
+  void* CountedNew(std::size_t size)
+  {
+    void* p = malloc(size ? size : 1);
+    if(!p)
+      return NULL;
+    counts.allocs++;
+    counts.bytes += size;
+    AddHeap(p);
+    return p;
+  }
+
+  void CountedDelete(void* p)
+  {
+    if(!p)
+      return;
+    RemoveHeap(p);
+    free(p);
+  }
+
+  // VmRSS or VmHWM from /proc/self/status in bytes, 0 if unavailable
+  boost::int64_t ReadStatus(const std::string& field)
+  {
+    std::ifstream in("/proc/self/status");
+    std::string key;
+    boost::int64_t kb;
+    while(in >> key)
+    {
+      if(key == field + ":" && in >> kb)
+        return kb*1024;
+    }
+    return 0;
+  }
+
+  void RecordCounts(const char* stage, const AllocProfile::Counts& now,
+    const AllocProfile::Counts& mark)
+  {
+    std::string name(stage);
+    Metrics::Increment(name + "_allocs", now.allocs - mark.allocs);
+    Metrics::Increment(name + "_alloc_bytes", now.bytes - mark.bytes);
+    Metrics::Increment(name + "_cv_buffers", now.cv_buffers - mark.cv_buffers);
+    Metrics::Increment(name + "_cv_bytes", now.cv_bytes - mark.cv_bytes);
+  }
+
+  // Counters can't go down, shrinking counts as no growth
+  boost::uint64_t Growth(boost::int64_t start, boost::int64_t end)
+  {
+    return end > start ? end - start : 0;
+  }
+
+  void RaiseCounter(const std::string& counter, boost::uint64_t value)
+  {
+    std::map<std::string, LatencyHistogram> stages;
+    std::map<std::string, boost::uint64_t> counters;
+    Metrics::Collect(stages, counters);
+    if(value > counters[counter])
+      Metrics::Increment(counter, value - counters[counter]);
+  }
+
+  // The fastMalloc below only replaces OpenCV's if this library comes first in symbol
+  // lookup.  Checked once at load time with a throwaway Mat.
+  struct CheckFastMalloc
+  {
+    CheckFastMalloc()
+    {
+      boost::uint64_t before = counts.cv_buffers;
+      cv::Mat test(8, 8, CV_8UC1);
+      if(counts.cv_buffers == before)
+      {
+        std::cerr << "AllocProfile: cv::fastMalloc is not intercepted, link mesh_localize_core "
+          "ahead of libopencv_core.  The *_cv_buffers and *_cv_bytes counters will stay at 0."
+          << std::endl;
+      }
+    }
+  };
+  CheckFastMalloc check_fast_malloc;
+}
+
+void* operator new(std::size_t size)
+{
+  void* p = CountedNew(size);
+  if(!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](std::size_t size)
+{
+  void* p = CountedNew(size);
+  if(!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  return CountedNew(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  return CountedNew(size);
+}
+
+void operator delete(void* p) noexcept
+{
+  CountedDelete(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  CountedDelete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+  CountedDelete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+  CountedDelete(p);
+}
+
+// OpenCV 2.4 has no default MatAllocator to swap, but every Mat buffer comes from
+// fastMalloc.  This definition is only used when this library precedes libopencv_core in
+// symbol lookup, and calls bound inside libopencv_core itself may still reach OpenCV's;
+// CheckFastMalloc above reports when Mat buffers aren't intercepted.  The layout is the
+// same as OpenCV's own, so a buffer may be freed by either version.
+namespace cv
+{
+  void* fastMalloc(size_t size)
+  {
+    uchar* udata = (uchar*)malloc(size + sizeof(void*) + CV_MALLOC_ALIGN);
+    if(!udata)
+      CV_Error_(CV_StsNoMem, ("Failed to allocate %lu bytes", (unsigned long)size));
+    uchar** adata = alignPtr((uchar**)udata + 1, CV_MALLOC_ALIGN);
+    adata[-1] = udata;
+    counts.cv_buffers++;
+    counts.cv_bytes += size;
+    AddHeap(udata);
+    return adata;
+  }
+
+  void fastFree(void* ptr)
+  {
+    if(!ptr)
+      return;
+    uchar* udata = ((uchar**)ptr)[-1];
+    RemoveHeap(udata);
+    free(udata);
+  }
+}
+
+AllocProfile::Counts AllocProfile::ThreadCounts()
+{
+  return counts;
+}
+
+void AllocProfile::BeginFrame()
+{
+  stage_mark = counts;
+  frame_mark = counts;
+}
+
+void AllocProfile::EndStage(const char* stage)
+{
+  RecordCounts(stage, counts, stage_mark);
+  // Excludes the allocations of the recording itself
+  stage_mark = counts;
+}
+
+void AllocProfile::EndFrame(const char* stage)
+{
+  RecordCounts(stage, counts, frame_mark);
+  stage_mark = counts;
+  frame_mark = counts;
+}
+
+AllocProfile::Memory AllocProfile::CurrentMemory()
+{
+  Memory m;
+  m.heap_bytes = heap_bytes.load(boost::memory_order_relaxed);
+  m.resident_bytes = ReadStatus("VmRSS");
+  return m;
+}
+
+void AllocProfile::RecordMemory(const char* name, const Memory& start)
+{
+  Memory end = CurrentMemory();
+  Metrics::Increment(std::string(name) + "_heap_bytes",
+    Growth(start.heap_bytes, end.heap_bytes));
+  Metrics::Increment(std::string(name) + "_resident_bytes",
+    Growth(start.resident_bytes, end.resident_bytes));
+}
+
+void AllocProfile::RecordPeakMemory()
+{
+  RaiseCounter("peak_heap_bytes", peak_heap_bytes.load(boost::memory_order_relaxed));
+  RaiseCounter("peak_resident_bytes", ReadStatus("VmHWM"));
+}
+
+#endif
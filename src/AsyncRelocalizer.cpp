@@ -0,0 +1,95 @@
+#include "mesh_localize/AsyncRelocalizer.h"
+#include "mesh_localize/Trace.h"
+#include "mesh_localize/Metrics.h"
+
+#include <iostream>
+
+AsyncRelocalizer::AsyncRelocalizer(MonocularLocalizer* localizer) :
+  localizer(localizer),
+  requests(1, true),
+  generation(0),
+  slot(NULL),
+  failures(0)
+{
+  thread = boost::thread(&AsyncRelocalizer::Loop, this);
+}
+
+AsyncRelocalizer::~AsyncRelocalizer()
+{
+  requests.Close();
+  if(thread.joinable())
+    thread.join();
+  delete slot.exchange(NULL);
+}
+
+void AsyncRelocalizer::submit(const cv::Mat& image, const cv::Mat& K, double stamp,
+  const Eigen::Matrix4f* prior)
+{
+  Request request;
+  request.image = image;
+  request.K = K;
+  request.stamp = stamp;
+  request.has_prior = prior != NULL;
+  if(prior)
+    request.prior = *prior;
+  request.generation = generation.load();
+  requests.Push(request);
+}
+
+bool AsyncRelocalizer::poll(Result& result)
+{
+  Result* r = slot.exchange(NULL);
+  if(!r)
+    return false;
+  bool current = r->generation == generation.load();
+  if(current)
+    result = *r;
+  delete r;
+  return current;
+}
+
+int AsyncRelocalizer::takeFailures()
+{
+  return failures.exchange(0);
+}
+
+void AsyncRelocalizer::cancel()
+{
+  generation++;
+  requests.Clear();
+  delete slot.exchange(NULL);
+  failures = 0;
+}
+
+void AsyncRelocalizer::Loop()
+{
+  Tracer::SetThreadName("relocalizer");
+  Request request;
+  while(requests.Pop(request))
+  {
+    if(request.generation != generation.load())
+      continue;
+
+    double start = (double)cv::getTickCount()/cv::getTickFrequency();
+    Eigen::Matrix4f pose;
+    Eigen::Matrix4f prior = request.prior;
+    bool success = localizer->localize(request.image, request.K, &pose,
+      request.has_prior ? &prior : NULL);
+    Metrics::Record("relocalize", (double)cv::getTickCount()/cv::getTickFrequency() - start);
+
+    // The tracker may have recovered while this attempt was running
+    if(request.generation != generation.load())
+      continue;
+    if(!success)
+    {
+      failures++;
+      continue;
+    }
+
+    Result* result = new Result;
+    result->stamp = request.stamp;
+    result->pose = pose;
+    result->generation = request.generation;
+    delete slot.exchange(result);
+  }
+}
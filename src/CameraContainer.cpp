@@ -12,6 +12,11 @@ Mat CameraContainer::GetImage()
   return img;
 }
 
+void CameraContainer::SetImage(Mat image)
+{
+  img = image;
+}
+
 Eigen::Matrix4f CameraContainer::GetTf()
 {
   return tf;
@@ -1,9 +1,13 @@
 #include "mesh_localize/DepthFeatureMatchLocalizer.h"
 #include "mesh_localize/PnPUtil.h"
+#include "mesh_localize/VisualizationSink.h"
+#include "mesh_localize/TaskScheduler.h"
+#include "mesh_localize/Trace.h"
 
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <boost/bind.hpp>
 
 using namespace cv;
 using namespace std;
@@ -14,11 +18,16 @@ DepthFeatureMatchLocalizer::DepthFeatureMatchLocalizer(const std::vector<Keyfram
   : keyframes(train), desc_type(desc_type), show_matches(show_matches), min_inliers(min_inliers),
     max_reproj_error(max_reproj_error), ratio_test_thresh(ratio_test_thresh)
 {
-  namedWindow( "Match", WINDOW_NORMAL );
+}
+
+const std::vector<KeyframeContainer*>* DepthFeatureMatchLocalizer::GetKeyframes()
+{
+  return &keyframes;
 }
 
 bool DepthFeatureMatchLocalizer::localize(const Mat& img, const Mat& Kcv, Eigen::Matrix4f* pose, Eigen::Matrix4f* pose_guess)
 {
+  TRACE_SCOPE("DepthFeatureMatchLocalizer::localize");
   KeyframeContainer* kf = new KeyframeContainer(img, desc_type);
   std::vector< KeyframeMatch > matches;
 
@@ -98,7 +107,7 @@ bool DepthFeatureMatchLocalizer::localize(const Mat& img, const Mat& Kcv, Eigen:
   }
   if(bestMatch >= 0)
   {
-    if(show_matches)
+    if(show_matches && VisualizationSink::Instance().HasConsumer())
     {
       std::vector< DMatch > inlierMatches;
       for(int j = 0; j < bestInliers.size(); j++)
@@ -106,10 +115,13 @@ bool DepthFeatureMatchLocalizer::localize(const Mat& img, const Mat& Kcv, Eigen:
         inlierMatches.push_back(matches[bestMatch].matches[bestInliers[j]]);
       }
 
-      Mat img_matches;
-      drawMatches(img, kf->GetKeypoints(), matches[bestMatch].kfc->GetImage(), matches[bestMatch].kfc->GetKeypoints(), inlierMatches, img_matches);
-      imshow("Match", img_matches);
-      waitKey(1);
+      std::vector<KeyPoint> kps1 = kf->GetKeypoints();
+      std::vector<KeyPoint> kps2 = matches[bestMatch].kfc->GetKeypoints();
+      Mat match_img = matches[bestMatch].kfc->GetImage();
+      VisualizationSink::Instance().Show("Match", [img, kps1, match_img, kps2, inlierMatches](Mat& dst)
+      {
+        drawMatches(img, kps1, match_img, kps2, inlierMatches, dst);
+      });
     }
     std::cout << "DepthFeatureMatchLocalizer: Found consistent match (" << bestInliers.size() << " inliers).  Avg reproj error: " << bestReprojError << std::endl;
     return true;
@@ -127,67 +139,77 @@ std::vector< KeyframeMatch > DepthFeatureMatchLocalizer::FindImageMatches(Keyfra
   const double matchRatio = ratio_test_thresh;;
   std::vector< KeyframeMatch > kfMatches;
 
+  // The keyframe database may be shared by several trackers, so the candidates are
+  // ordered in a copy of the pointer list instead of sorting the database in place
+  std::vector<KeyframeContainer*> candidates(keyframes);
   if(pose_guess)
   {
-    if(search_bound >= keyframes.size())
+    if(search_bound >= candidates.size())
     {
-      search_bound = keyframes.size();
+      search_bound = candidates.size();
     }
     else 
     {
       KeyframePositionSorter kps(*pose_guess);
-      std::sort(keyframes.begin(), keyframes.end(), kps);
+      std::partial_sort(candidates.begin(), candidates.begin()+search_bound, candidates.end(), kps);
     }
   }
   else
   {
-    search_bound = keyframes.size();
+    search_bound = candidates.size();
   }
 
-  // Find potential frame matches
-  #pragma omp parallel for
-  for(unsigned int i = 0; i < search_bound; i++)
+  // Find potential frame matches.  Every candidate gets its own slot and the slots are
+  // merged in candidate order, so ties sort the same way however the tasks were scheduled.
+  std::vector< std::vector< KeyframeMatch > > slots(search_bound);
+  TaskScheduler::Instance().parallelFor(0, search_bound,
+    boost::bind(&DepthFeatureMatchLocalizer::MatchKeyframe, this, img, boost::cref(candidates), matchRatio,
+      numMatchThresh, boost::ref(slots), _1));
+  for(unsigned int i = 0; i < slots.size(); i++)
   {
-    //std::cout << i/double(keyframes.size()) << std::endl;
-
-    FlannBasedMatcher matcher;
-    std::vector < std::vector< DMatch > > matches;
-    if(keyframes[i]->GetDescriptors().rows == 0 || keyframes[i]->GetDescriptors().cols == 0)
-      continue;
-    matcher.knnMatch( img->GetDescriptors(), keyframes[i]->GetDescriptors(), matches, 2 );
-
-    std::vector< DMatch > goodMatches;
-    std::vector< DMatch > allMatches;
-    std::vector<Point2f> matchPts1;
-    std::vector<Point2f> matchPts2;
-    std::vector<KeyPoint> matchKps1;
-    std::vector<KeyPoint> matchKps2;
-    
-    // Use ratio test to find good keypoint matches
-    for(unsigned int j = 0; j < matches.size(); j++)
-    {
-      allMatches.push_back(matches[j][0]);
-      if(matches[j][0].distance < matchRatio*matches[j][1].distance)
-      {
-        goodMatches.push_back(matches[j][0]);
-        matchPts1.push_back(img->GetKeypoints()[matches[j][0].queryIdx].pt);
-        matchPts2.push_back(keyframes[i]->GetKeypoints()[matches[j][0].trainIdx].pt);
-        matchKps1.push_back(img->GetKeypoints()[matches[j][0].queryIdx]);
-        matchKps2.push_back(keyframes[i]->GetKeypoints()[matches[j][0].trainIdx]);
-      }
-    }
-    if(goodMatches.size() >= numMatchThresh*matches.size())
-    {
-      //std:: cout << "Found Match!" << std::endl;
-      #pragma omp critical
-      {
-        kfMatches.push_back(KeyframeMatch(keyframes[i], goodMatches, allMatches, matchPts1, matchPts2, matchKps1, matchKps2));
-      }
-    }
+    kfMatches.insert(kfMatches.end(), slots[i].begin(), slots[i].end());
   }
 
   k = (kfMatches.size() < k) ? kfMatches.size() : k;
-  std::sort(kfMatches.begin(), kfMatches.end());
+  std::stable_sort(kfMatches.begin(), kfMatches.end());
 
   return std::vector< KeyframeMatch > (kfMatches.begin(), kfMatches.begin()+k);
 }
+
+void DepthFeatureMatchLocalizer::MatchKeyframe(KeyframeContainer* img, const std::vector<KeyframeContainer*>& candidates, double matchRatio, double numMatchThresh, std::vector< std::vector< KeyframeMatch > >& slots, int i)
+{
+  TRACE_SCOPE("DepthFeatureMatchLocalizer::MatchKeyframe");
+  //std::cout << i/double(keyframes.size()) << std::endl;
+
+  FlannBasedMatcher matcher;
+  std::vector < std::vector< DMatch > > matches;
+  if(candidates[i]->GetDescriptors().rows == 0 || candidates[i]->GetDescriptors().cols == 0)
+    return;
+  matcher.knnMatch( img->GetDescriptors(), candidates[i]->GetDescriptors(), matches, 2 );
+
+  std::vector< DMatch > goodMatches;
+  std::vector< DMatch > allMatches;
+  std::vector<Point2f> matchPts1;
+  std::vector<Point2f> matchPts2;
+  std::vector<KeyPoint> matchKps1;
+  std::vector<KeyPoint> matchKps2;
+  
+  // Use ratio test to find good keypoint matches
+  for(unsigned int j = 0; j < matches.size(); j++)
+  {
+    allMatches.push_back(matches[j][0]);
+    if(matches[j][0].distance < matchRatio*matches[j][1].distance)
+    {
+      goodMatches.push_back(matches[j][0]);
+      matchPts1.push_back(img->GetKeypoints()[matches[j][0].queryIdx].pt);
+      matchPts2.push_back(candidates[i]->GetKeypoints()[matches[j][0].trainIdx].pt);
+      matchKps1.push_back(img->GetKeypoints()[matches[j][0].queryIdx]);
+      matchKps2.push_back(candidates[i]->GetKeypoints()[matches[j][0].trainIdx]);
+    }
+  }
+  if(goodMatches.size() >= numMatchThresh*matches.size())
+  {
+    //std:: cout << "Found Match!" << std::endl;
+    slots[i].push_back(KeyframeMatch(candidates[i], goodMatches, allMatches, matchPts1, matchPts2, matchKps1, matchKps2));
+  }
+}
@@ -1,13 +1,15 @@
 #include "mesh_localize/EdgeTrackingUtil.h"
 #include "mesh_localize/PnPUtil.h"
+#include "mesh_localize/VisualizationSink.h"
+#include "mesh_localize/TaskScheduler.h"
+#include "mesh_localize/Metrics.h"
 #include "TooN/TooN.h"
 #include "TooN/SVD.h"       // for SVD
 #include "TooN/so3.h"       // for special orthogonal group
 #include "TooN/se3.h"       // for special Euclidean group
 #include "TooN/wls.h"       // for weighted least square
 #include <opencv2/highgui/highgui.hpp>
-#include <ctime>
-#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 
 using namespace TooN;
@@ -429,11 +431,10 @@ std::vector<EdgeTrackingUtil::SamplePoint> EdgeTrackingUtil::getEdgeMatches(cons
   const Mat& kf, const Eigen::Matrix3f vimgK, const Eigen::Matrix3f K, const Mat& vdepth, 
   const Mat& kf_mask, const Eigen::Matrix4f& vimgTf)
 {
-  std::clock_t start;
   // Get edges from vimg and kf using canny
   Mat kf_detected_edges, vimg_detected_edges;
 
-  start = std::clock();
+  Metrics::ScopedTimer canny_timer("edge_canny");
   double canny_low_thresh1, canny_low_thresh2, canny_high_thresh1, canny_high_thresh2;
   if(autotune_canny)
   {
@@ -451,20 +452,15 @@ std::vector<EdgeTrackingUtil::SamplePoint> EdgeTrackingUtil::getEdgeMatches(cons
     canny_high_thresh1 = canny_high_thresh;
     canny_high_thresh2 = canny_high_thresh;
   }
-  std::cout << "Canny thresh time: " << (std::clock() - start) / (double)(CLOCKS_PER_SEC) << std::endl;
 
   // do both cannys at once since it's slow
-  start = std::clock();
-  boost::thread canny_thread = boost::thread(Canny, boost::ref(kf), boost::ref(kf_detected_edges), 
+  TaskGroup canny_tasks;
+  canny_tasks.run(boost::bind(Canny, boost::cref(kf), boost::ref(kf_detected_edges),
     canny_low_thresh1, 
-    canny_high_thresh1, 3, false);
+    canny_high_thresh1, 3, false));
     
   Canny(vimg, vimg_detected_edges, canny_low_thresh2, canny_high_thresh2, 3);
-  std::cout << "Canny 2 time: " << (std::clock() - start) / (double)(CLOCKS_PER_SEC) << std::endl;
-
-  start = std::clock();
-  canny_thread.join();
-  std::cout << "Canny 1 time: " << (std::clock() - start) / (double)(CLOCKS_PER_SEC) << std::endl;
+  canny_tasks.wait();
 
   //start = std::clock();
   //vector<Vec4i> vimg_detected_lines;
@@ -485,51 +481,37 @@ std::vector<EdgeTrackingUtil::SamplePoint> EdgeTrackingUtil::getEdgeMatches(cons
     if(kf_mask.at<uchar>(kf_edge_pts_mat.at<Point>(i).y, kf_edge_pts_mat.at<Point>(i).x) > 0)
       kf_edge_pts[i] = kf_edge_pts_mat.at<Point>(i);
   } 
-  std::cout << "Canny time: " << (std::clock() - start) / (double)(CLOCKS_PER_SEC) << std::endl;
+  canny_timer.stop();
 
   //Get all edge points in vimg and gradients
-  start = std::clock();
+  Metrics::ScopedTimer grad_timer("edge_gradient");
   Mat kf_edge_dir;
   std::vector<double> vimg_edge_dirs = calcImageGradientDirection(vimg, vimg_edge_pts);
-  start = std::clock();
   calcImageGradientDirection(kf_edge_dir, kf, kf_edge_pts);
   //std::vector<double> kf_edge_dirs = calcImageGradientDirection(kf, kf_edge_pts);
-  std::cout << "Edge grad time: " << (std::clock() - start) / (double)(CLOCKS_PER_SEC) << std::endl;
+  grad_timer.stop();
 
-  start = std::clock();
+  Metrics::ScopedTimer search_timer("edge_search");
   std::vector<SamplePoint> sps = getEdgeMatches(vimg_edge_pts, vimg_edge_dirs, kf_detected_edges, 
                                    kf_edge_dir, vimgK, K, vdepth, vimgTf);
   //std::vector<SamplePoint> sps = getWindowedEdgeMatches(vimg, vimg_edge_pts, vimg_edge_dirs, 
   //                                 kf,  kf_detected_edges, 
   //                                 kf_edge_dir, vimgK, K, vdepth, vimgTf);
-  std::cout << "Edge match time: " << (std::clock() - start) / (double)(CLOCKS_PER_SEC) << std::endl;
-  if(show_debug)
+  search_timer.stop();
+  if(show_debug && VisualizationSink::Instance().HasConsumer())
   {
-    Mat edge_dir_im;
-    drawGradientLines(edge_dir_im, vimg_detected_edges, vimg_edge_pts, vimg_edge_dirs); 
-
-    //Mat kf_edge_dir_im;
-    //drawGradientLines(kf_edge_dir_im, kf_detected_edges, kf_edge_pts, kf_edge_dirs);
-
-    Mat edge_matching_overlay;
-    drawEdgeMatching(edge_matching_overlay, kf, sps);
- 
-    //Mat vimg_detected_lines_overlay;
-    //drawLines(vimg_detected_lines_overlay, vimg, vimg_detected_lines);
-
-    namedWindow( "Query Edges", WINDOW_NORMAL );// Create a window for display.
-    imshow( "Query Edges", kf_detected_edges ); 
-    namedWindow( "Virtual Edges", WINDOW_NORMAL );// Create a window for display.
-    imshow( "Virtual Edges", vimg_detected_edges ); 
-    //namedWindow( "Virtual Lines", WINDOW_NORMAL );// Create a window for display.
-    //imshow( "Virtual Lines", vimg_detected_lines_overlay ); 
-    namedWindow( "Virtual Edge Directions", WINDOW_NORMAL );// Create a window for display.
-    imshow( "Virtual Edge Directions", edge_dir_im ); 
-    //namedWindow( "Query Edge Directions", WINDOW_NORMAL );// Create a window for display.
-    //imshow( "Query Edge Directions", kf_edge_dir_im ); 
-    namedWindow( "Edge Matching", WINDOW_NORMAL );// Create a window for display.
-    imshow( "Edge Matching", edge_matching_overlay ); 
-    waitKey(1);
+    // Overlays are drawn on the display thread
+    VisualizationSink& sink = VisualizationSink::Instance();
+    sink.Show("Query Edges", kf_detected_edges);
+    sink.Show("Virtual Edges", vimg_detected_edges);
+    sink.Show("Virtual Edge Directions", [vimg_detected_edges, vimg_edge_pts, vimg_edge_dirs](Mat& dst)
+    {
+      drawGradientLines(dst, vimg_detected_edges, vimg_edge_pts, vimg_edge_dirs); 
+    });
+    sink.Show("Edge Matching", [kf, sps](Mat& dst)
+    {
+      drawEdgeMatching(dst, kf, sps);
+    });
   }
   return sps;
 }  
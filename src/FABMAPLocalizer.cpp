@@ -1,4 +1,6 @@
 #include "mesh_localize/FABMAPLocalizer.h"
+#include "mesh_localize/Trace.h"
+#include "mesh_localize/VisualizationSink.h"
 
 #include <time.h>
 
@@ -149,6 +151,8 @@ FABMAPLocalizer::FABMAPLocalizer(const std::vector<CameraContainer*>& train, std
 
 bool FABMAPLocalizer::localize(const Mat& img, const Mat& K, Eigen::Matrix4f* pose, Eigen::Matrix4f* pose_guess)
 {
+  TRACE_SCOPE("FABMAPLocalizer::localize");
+  boost::lock_guard<boost::mutex> lock(localize_mutex);
   Mat bow;
   vector<KeyPoint> kpts;
   detector->detect(img, kpts);
@@ -176,12 +180,6 @@ bool FABMAPLocalizer::localize(const Mat& img, const Mat& K, Eigen::Matrix4f* po
       std::cout << "match likelihood = " << matches.at(i).likelihood << std::endl;
       std::cout << "imgIdx = " << matches.at(i).imgIdx << " queryIdx = " << matches.at(i).queryIdx << std::endl;
       std::cout << "# keyframes = " << keyframes.size() << std::endl;
-      if(matches.at(i).imgIdx > -1 && matches.at(i).match > 0.5)
-      {
-        namedWindow( "Match", WINDOW_AUTOSIZE );
-        imshow("Match", keyframes.at(matches.at(i).imgIdx)->GetImage());
-        waitKey(2000);
-      }
     }
   }
 
@@ -189,6 +187,8 @@ bool FABMAPLocalizer::localize(const Mat& img, const Mat& K, Eigen::Matrix4f* po
   {
     if(matches.at(i).imgIdx > -1 && matches.at(i).match > 0.5)
     {
+      if(show_matches && VisualizationSink::Instance().HasConsumer())
+        VisualizationSink::Instance().Show("Match", keyframes.at(matches.at(i).imgIdx)->GetImage());
       *pose = keyframes.at(matches.at(i).imgIdx)->GetTf();
       return true;
     }
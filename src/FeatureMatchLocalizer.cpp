@@ -1,6 +1,10 @@
 #include "mesh_localize/FeatureMatchLocalizer.h"
+#include "mesh_localize/VisualizationSink.h"
+#include "mesh_localize/TaskScheduler.h"
+#include "mesh_localize/Trace.h"
 
 #include <fstream>
+#include <boost/bind.hpp>
 
 using namespace cv;
 
@@ -66,6 +70,16 @@ FeatureMatchLocalizer::FeatureMatchLocalizer(const std::vector<CameraContainer*>
   }
 }
 
+FeatureMatchLocalizer::FeatureMatchLocalizer(const std::vector<KeyframeContainer*>& train, std::string descriptor_type, bool show_matches)
+  : keyframes(train), desc_type(descriptor_type), show_matches(show_matches)
+{
+}
+
+const std::vector<KeyframeContainer*>* FeatureMatchLocalizer::GetKeyframes()
+{
+  return &keyframes;
+}
+
 bool FeatureMatchLocalizer::WriteDescriptorsToFile(std::string filename)
 {
   std::ofstream file;
@@ -105,6 +119,7 @@ bool FeatureMatchLocalizer::WriteDescriptorsToFile(std::string filename)
 
 bool FeatureMatchLocalizer::localize(const Mat& img, const Mat& K, Eigen::Matrix4f* pose, Eigen::Matrix4f* pose_guess)
 {
+  TRACE_SCOPE("FeatureMatchLocalizer::localize");
   KeyframeContainer* kf = new KeyframeContainer(img, desc_type);
   std::vector< KeyframeMatch > matches;
 
@@ -117,14 +132,9 @@ bool FeatureMatchLocalizer::localize(const Mat& img, const Mat& K, Eigen::Matrix
     matches = FindImageMatches(kf, 5);  
   }
 
-  if(show_matches)
+  if(show_matches && matches.size() > 0)
   {
-    for(int i = 0; i < matches.size(); i++)
-    {
-      namedWindow( "Match", WINDOW_AUTOSIZE );
-      imshow("Match", matches[i].kfc->GetImage());
-      waitKey(0);
-    }
+    VisualizationSink::Instance().Show("Match", matches[0].kfc->GetImage());
   }
 
   if(matches[0].matchKps1.size() >= 40)
@@ -145,65 +155,75 @@ std::vector< KeyframeMatch > FeatureMatchLocalizer::FindImageMatches(KeyframeCon
   const double matchRatio = 0.7;
   std::vector< KeyframeMatch > kfMatches;
 
+  // The keyframe database may be shared by several trackers, so the candidates are
+  // ordered in a copy of the pointer list instead of sorting the database in place
+  std::vector<KeyframeContainer*> candidates(keyframes);
   if(pose_guess)
   {
-    if(search_bound >= keyframes.size())
+    if(search_bound >= candidates.size())
     {
-      search_bound = keyframes.size();
+      search_bound = candidates.size();
     }
     else 
     {
       KeyframePositionSorter kps(*pose_guess);
-      std::sort(keyframes.begin(), keyframes.end(), kps);
+      std::partial_sort(candidates.begin(), candidates.begin()+search_bound, candidates.end(), kps);
     }
   }
   else
   {
-    search_bound = keyframes.size();
+    search_bound = candidates.size();
   }
 
-  // Find potential frame matches
-  #pragma omp parallel for
-  for(unsigned int i = 0; i < search_bound; i++)
+  // Find potential frame matches.  Every candidate gets its own slot and the slots are
+  // merged in candidate order, so ties sort the same way however the tasks were scheduled.
+  std::vector< std::vector< KeyframeMatch > > slots(search_bound);
+  TaskScheduler::Instance().parallelFor(0, search_bound,
+    boost::bind(&FeatureMatchLocalizer::MatchKeyframe, this, img, boost::cref(candidates), matchRatio,
+      numMatchThresh, boost::ref(slots), _1));
+  for(unsigned int i = 0; i < slots.size(); i++)
   {
-    //std::cout << i/double(keyframes.size()) << std::endl;
-
-    FlannBasedMatcher matcher;
-    std::vector < std::vector< DMatch > > matches;
-    matcher.knnMatch( img->GetDescriptors(), keyframes[i]->GetDescriptors(), matches, 2 );
-
-    std::vector< DMatch > goodMatches;
-    std::vector< DMatch > allMatches;
-    std::vector<Point2f> matchPts1;
-    std::vector<Point2f> matchPts2;
-    std::vector<KeyPoint> matchKps1;
-    std::vector<KeyPoint> matchKps2;
-    
-    // Use ratio test to find good keypoint matches
-    for(unsigned int j = 0; j < matches.size(); j++)
-    {
-      allMatches.push_back(matches[j][0]);
-      if(matches[j][0].distance < matchRatio*matches[j][1].distance)
-      {
-        goodMatches.push_back(matches[j][0]);
-        matchPts1.push_back(img->GetKeypoints()[matches[j][0].queryIdx].pt);
-        matchPts2.push_back(keyframes[i]->GetKeypoints()[matches[j][0].trainIdx].pt);
-        matchKps1.push_back(img->GetKeypoints()[matches[j][0].queryIdx]);
-        matchKps2.push_back(keyframes[i]->GetKeypoints()[matches[j][0].trainIdx]);
-      }
-    }
-    if(goodMatches.size() >= numMatchThresh*matches.size())
-    {
-      //std:: cout << "Found Match!" << std::endl;
-      #pragma omp critical
-      {
-        kfMatches.push_back(KeyframeMatch(keyframes[i], goodMatches, allMatches, matchPts1, matchPts2, matchKps1, matchKps2));
-      }
-    }
+    kfMatches.insert(kfMatches.end(), slots[i].begin(), slots[i].end());
   }
 
   k = (kfMatches.size() < k) ? kfMatches.size() : k;
-  std::sort(kfMatches.begin(), kfMatches.end());
+  std::stable_sort(kfMatches.begin(), kfMatches.end());
 
   return std::vector< KeyframeMatch > (kfMatches.begin(), kfMatches.begin()+k);
 }
+
+void FeatureMatchLocalizer::MatchKeyframe(KeyframeContainer* img, const std::vector<KeyframeContainer*>& candidates, double matchRatio, double numMatchThresh, std::vector< std::vector< KeyframeMatch > >& slots, int i)
+{
+  TRACE_SCOPE("FeatureMatchLocalizer::MatchKeyframe");
+  //std::cout << i/double(keyframes.size()) << std::endl;
+
+  FlannBasedMatcher matcher;
+  std::vector < std::vector< DMatch > > matches;
+  matcher.knnMatch( img->GetDescriptors(), candidates[i]->GetDescriptors(), matches, 2 );
+
+  std::vector< DMatch > goodMatches;
+  std::vector< DMatch > allMatches;
+  std::vector<Point2f> matchPts1;
+  std::vector<Point2f> matchPts2;
+  std::vector<KeyPoint> matchKps1;
+  std::vector<KeyPoint> matchKps2;
+  
+  // Use ratio test to find good keypoint matches
+  for(unsigned int j = 0; j < matches.size(); j++)
+  {
+    allMatches.push_back(matches[j][0]);
+    if(matches[j][0].distance < matchRatio*matches[j][1].distance)
+    {
+      goodMatches.push_back(matches[j][0]);
+      matchPts1.push_back(img->GetKeypoints()[matches[j][0].queryIdx].pt);
+      matchPts2.push_back(candidates[i]->GetKeypoints()[matches[j][0].trainIdx].pt);
+      matchKps1.push_back(img->GetKeypoints()[matches[j][0].queryIdx]);
+      matchKps2.push_back(candidates[i]->GetKeypoints()[matches[j][0].trainIdx]);
+    }
+  }
+  if(goodMatches.size() >= numMatchThresh*matches.size())
+  {
+    //std:: cout << "Found Match!" << std::endl;
+    slots[i].push_back(KeyframeMatch(candidates[i], goodMatches, allMatches, matchPts1, matchPts2, matchKps1, matchKps2));
+  }
+}
@@ -0,0 +1,267 @@
+#include "mesh_localize/FrameIngest.h"
+#include "mesh_localize/SnapshotUtil.h"
+#include "mesh_localize/TaskScheduler.h"
+
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <boost/ref.hpp>
+
+using namespace cv;
+
+namespace
+{
+  // Buffers kept for reuse.  Frames are held by the frame queue, the tracker (current and
+  // KLT reference image) and the tracking pipeline, so a few are in use at any time.
+  const unsigned int kMaxBuffers = 8;
+
+  // CV_RGB2GRAY weights with 14 fractional bits
+  const unsigned int kR2Y = 4899;
+  const unsigned int kG2Y = 9617;
+  const unsigned int kB2Y = 1868;
+  const int kGrayBits = 14;
+  // Rows remapped per parallelFor index, so the per-index call overhead is negligible
+  const int kRowsPerBand = 16;
+
+  template<int cn>
+  inline unsigned int Gray(const uchar* p)
+  {
+    if(cn == 1)
+      return (unsigned int)p[0] << kGrayBits;
+    return kR2Y*p[0] + kG2Y*p[1] + kB2Y*p[2];
+  }
+
+  // Bilinear remap of a cn channel 8 bit image to gray, using fixed-point maps as made by
+  // initUndistortRectifyMap(..., CV_16SC2, ...).  Pixels outside the source are black.
+  template<int cn>
+  class RemapGrayBody
+  {
+  public:
+    RemapGrayBody(const Mat& src, Mat& dst, const Mat& map_xy, const Mat& map_a) :
+      src(src), dst(dst), map_xy(map_xy), map_a(map_a)
+    {
+    }
+
+    void operator()(int band) const
+    {
+      // The 2*INTER_BITS bits of the bilinear weights plus the gray weight bits, rounded
+      const int shift = 2*INTER_BITS + kGrayBits;
+      const unsigned int round = 1u << (shift-1);
+      int end = std::min((band+1)*kRowsPerBand, dst.rows);
+      for(int y = band*kRowsPerBand; y < end; y++)
+      {
+        const short* xy = map_xy.ptr<short>(y);
+        const ushort* a = map_a.ptr<ushort>(y);
+        uchar* out = dst.ptr<uchar>(y);
+        for(int x = 0; x < dst.cols; x++)
+        {
+          int sx = xy[2*x];
+          int sy = xy[2*x+1];
+          unsigned int fx = a[x] & (INTER_TAB_SIZE-1);
+          unsigned int fy = a[x] >> INTER_BITS;
+          unsigned int w00 = (INTER_TAB_SIZE-fx)*(INTER_TAB_SIZE-fy);
+          unsigned int w01 = fx*(INTER_TAB_SIZE-fy);
+          unsigned int w10 = (INTER_TAB_SIZE-fx)*fy;
+          unsigned int w11 = fx*fy;
+
+          unsigned int sum;
+          if(sx >= 0 && sy >= 0 && sx+1 < src.cols && sy+1 < src.rows)
+          {
+            const uchar* p0 = src.ptr<uchar>(sy) + sx*cn;
+            const uchar* p1 = p0 + src.step;
+            sum = w00*Gray<cn>(p0) + w01*Gray<cn>(p0+cn) + w10*Gray<cn>(p1) +
+              w11*Gray<cn>(p1+cn);
+          }
+          else
+          {
+            sum = w00*Sample(sx, sy) + w01*Sample(sx+1, sy) + w10*Sample(sx, sy+1) +
+              w11*Sample(sx+1, sy+1);
+          }
+          out[x] = (uchar)((sum + round) >> shift);
+        }
+      }
+    }
+
+  private:
+    unsigned int Sample(int x, int y) const
+    {
+      if(x < 0 || y < 0 || x >= src.cols || y >= src.rows)
+        return 0;
+      return Gray<cn>(src.ptr<uchar>(y) + x*cn);
+    }
+
+    const Mat& src;
+    Mat& dst;
+    const Mat& map_xy;
+    const Mat& map_a;
+  };
+
+  // Splits the rows over the shared TaskScheduler pool, like every other parallel kernel
+  template<int cn>
+  void RemapGray(const Mat& src, Mat& dst, const Mat& map_xy, const Mat& map_a)
+  {
+    RemapGrayBody<cn> body(src, dst, map_xy, map_a);
+    int bands = (dst.rows + kRowsPerBand - 1)/kRowsPerBand;
+    TaskScheduler::Instance().parallelFor(0, bands, boost::cref(body));
+  }
+
+  Mat EigenToCv(const Eigen::Matrix3f& K)
+  {
+    return (Mat_<double>(3,3) << K(0,0), K(0,1), K(0,2),
+                                 K(1,0), K(1,1), K(1,2),
+                                 K(2,0), K(2,1), K(2,2));
+  }
+}
+
+FrameIngest::FrameIngest(const Eigen::Matrix3f& K, const Eigen::VectorXf& distcoeff,
+  bool undistort) :
+    K(K),
+    undistort(undistort)
+{
+  distcoeffcv = Mat(distcoeff.size(), 1, CV_64F);
+  for(int i = 0; i < distcoeff.size(); i++)
+  {
+    distcoeffcv.at<double>(i) = distcoeff(i);
+  }
+}
+
+Size FrameIngest::ScaledSize(const Size& raw_size, double scale)
+{
+  return Size(cvRound(raw_size.width*scale), cvRound(raw_size.height*scale));
+}
+
+Eigen::Matrix3f FrameIngest::ScaleIntrinsics(const Eigen::Matrix3f& K, const Size& raw_size,
+  const Size& size)
+{
+  Eigen::Matrix3f K_scaled = K;
+  K_scaled.row(0) *= (float)size.width/raw_size.width;
+  K_scaled.row(1) *= (float)size.height/raw_size.height;
+  return K_scaled;
+}
+
+void FrameIngest::process(const Mat& input, Mat& frame, double scale)
+{
+  Mat raw = input;
+  if(raw.depth() != CV_8U)
+  {
+    raw.convertTo(raw, CV_8U);
+  }
+  Size size = ScaledSize(raw.size(), scale);
+  bool gray = raw.channels() == 1;
+  if(size == raw.size() && !undistort)
+  {
+    if(gray)
+    {
+      frame = raw;
+    }
+    else
+    {
+      Mat out = GetBuffer(size);
+      cvtColor(raw, out, CV_RGB2GRAY);
+      frame = out;
+    }
+    return;
+  }
+
+  Mat map_xy, map_a;
+  GetMaps(raw.size(), size, map_xy, map_a);
+  Mat out = GetBuffer(size);
+  switch(raw.channels())
+  {
+    case 1:
+      RemapGray<1>(raw, out, map_xy, map_a);
+      break;
+    case 3:
+      RemapGray<3>(raw, out, map_xy, map_a);
+      break;
+    case 4:
+      RemapGray<4>(raw, out, map_xy, map_a);
+      break;
+    default:
+    {
+      Mat raw_gray;
+      cvtColor(raw, raw_gray, CV_RGB2GRAY);
+      RemapGray<1>(raw_gray, out, map_xy, map_a);
+    }
+  }
+  frame = out;
+}
+
+void FrameIngest::GetMaps(const Size& raw_size, const Size& size, Mat& xy, Mat& a)
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  if(map_xy.empty() || map_raw_size != raw_size || map_size != size)
+  {
+    // Output pixels are projected with the scaled intrinsics and distorted with the raw
+    // ones, so a single lookup covers both the scaling and the undistortion
+    Mat K_raw = EigenToCv(K);
+    Mat K_out = EigenToCv(ScaleIntrinsics(K, raw_size, size));
+    Mat new_xy, new_a;
+    initUndistortRectifyMap(K_raw, undistort ? distcoeffcv : Mat(), Mat::eye(3, 3, CV_64F),
+      K_out, size, CV_16SC2, new_xy, new_a);
+    // Frames being ingested on other threads keep the old maps
+    map_xy = new_xy;
+    map_a = new_a;
+    map_raw_size = raw_size;
+    map_size = size;
+  }
+  xy = map_xy;
+  a = map_a;
+}
+
+FrameIngest::Maps FrameIngest::getMaps()
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  Maps maps;
+  maps.raw_size = map_raw_size;
+  maps.size = map_size;
+  maps.xy = map_xy;
+  maps.a = map_a;
+  return maps;
+}
+
+void FrameIngest::WriteMaps(std::ostream& out, const Maps& maps)
+{
+  SnapshotUtil::Write(out, maps.raw_size);
+  SnapshotUtil::Write(out, maps.size);
+  SnapshotUtil::WriteMat(out, maps.xy);
+  SnapshotUtil::WriteMat(out, maps.a);
+}
+
+bool FrameIngest::readMaps(std::istream& in)
+{
+  Size raw_size, size;
+  Mat xy, a;
+  if(!SnapshotUtil::Read(in, raw_size) || !SnapshotUtil::Read(in, size) ||
+    !SnapshotUtil::ReadMat(in, xy) || !SnapshotUtil::ReadMat(in, a))
+  {
+    return false;
+  }
+  if(xy.size() != size || a.size() != size || xy.type() != CV_16SC2 || a.type() != CV_16UC1)
+    return false;
+
+  boost::lock_guard<boost::mutex> lock(mutex);
+  map_raw_size = raw_size;
+  map_size = size;
+  map_xy = xy;
+  map_a = a;
+  return true;
+}
+
+Mat FrameIngest::GetBuffer(const Size& size)
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  for(unsigned int i = 0; i < buffers.size(); i++)
+  {
+    // Only the pool refers to it
+    if(buffers[i].refcount && *buffers[i].refcount == 1)
+    {
+      if(buffers[i].size() != size)
+        buffers[i].create(size, CV_8UC1);
+      return buffers[i];
+    }
+  }
+  Mat buffer(size, CV_8UC1);
+  if(buffers.size() < kMaxBuffers)
+    buffers.push_back(buffer);
+  return buffer;
+}
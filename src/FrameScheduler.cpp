@@ -0,0 +1,109 @@
+#include "mesh_localize/FrameScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+  // Weight of the newest sample in the smoothed latency
+  const double kSmoothing = 0.2;
+  // Frames to wait after a scale change before judging the new scale.  The first frames
+  // after a change also pay for restarting KLT tracking.
+  const int kSettleFrames = 10;
+  // The scale aims for this fraction of the target to leave room for jitter
+  const double kHeadroom = 0.8;
+  // Limits on a single scale step, and the smallest change worth making
+  const double kMaxStepDown = 0.75;
+  const double kMaxStepUp = 1.15;
+  const double kMinChange = 0.05;
+  // A camera clock running behind would otherwise get every frame dropped
+  const int kMaxConsecutiveDrops = 10;
+
+  void Smooth(double& value, double sample)
+  {
+    value = value < 0 ? sample : kSmoothing*sample + (1-kSmoothing)*value;
+  }
+}
+
+FrameScheduler::FrameScheduler(const TrackerParams& params) :
+  target_latency(params.target_latency),
+  min_scale(std::min(params.min_image_scale, params.image_scale)),
+  max_scale(params.image_scale),
+  scale(params.image_scale),
+  latency(-1),
+  frames_since_change(0),
+  consecutive_drops(0),
+  num_dropped(0)
+{
+}
+
+bool FrameScheduler::isEnabled() const
+{
+  return target_latency > 0;
+}
+
+bool FrameScheduler::admit(double age, double& budget)
+{
+  budget = -1;
+  if(!isEnabled())
+    return true;
+
+  boost::lock_guard<boost::mutex> lock(mutex);
+  if(age >= target_latency && consecutive_drops < kMaxConsecutiveDrops)
+  {
+    consecutive_drops++;
+    num_dropped++;
+    return false;
+  }
+  consecutive_drops = 0;
+  budget = std::max(target_latency - age, 0.0);
+  return true;
+}
+
+void FrameScheduler::update(const Tracker::PoseResult& result, double frame_latency)
+{
+  if(!isEnabled())
+    return;
+
+  boost::lock_guard<boost::mutex> lock(mutex);
+  bool localized = false;
+  for(unsigned int i = 0; i < result.timings.size(); i++)
+  {
+    if(result.timings[i].first == "localize")
+      localized = true;
+  }
+
+  // Global localization is slow at any resolution and doesn't say anything about the cost
+  // of tracking
+  if(localized || result.state == Tracker::INIT || result.state == Tracker::LOCAL_INIT)
+    return;
+
+  Smooth(latency, frame_latency);
+  if(++frames_since_change < kSettleFrames)
+    return;
+
+  double step = std::sqrt(kHeadroom*target_latency/latency);
+  step = std::max(kMaxStepDown, std::min(kMaxStepUp, step));
+  double new_scale = std::max(min_scale, std::min(max_scale, scale*step));
+  if(std::fabs(new_scale - scale) < kMinChange*scale)
+    return;
+
+  std::cout << "FrameScheduler: latency " << latency << " s for a target of " << target_latency
+    << " s, image scale " << scale << " -> " << new_scale << std::endl;
+  scale = new_scale;
+  frames_since_change = 0;
+  latency = -1;
+}
+
+double FrameScheduler::getImageScale()
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  return scale;
+}
+
+unsigned long FrameScheduler::getNumDropped()
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  return num_dropped;
+}
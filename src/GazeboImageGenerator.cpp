@@ -0,0 +1,141 @@
+#include "mesh_localize/GazeboImageGenerator.h"
+#include "mesh_localize/Metrics.h"
+
+#include <cv_bridge/cv_bridge.h>
+#include "sensor_msgs/CameraInfo.h"
+#include "gazebo_msgs/LinkState.h"
+#include "gazebo_msgs/SetLinkState.h"
+#include <Eigen/Geometry>
+
+using namespace cv;
+
+GazeboImageGenerator::GazeboImageGenerator(ros::NodeHandle nh) :
+  nh(nh),
+  get_virtual_image(false),
+  get_virtual_depth(false)
+{
+  gazebo_client = nh.serviceClient<gazebo_msgs::SetLinkState>("/gazebo/set_link_state");
+  virtual_image_sub = nh.subscribe<sensor_msgs::Image>("virtual_image", 1, &GazeboImageGenerator::HandleVirtualImage, this, ros::TransportHints().tcpNoDelay());
+  virtual_depth_sub = nh.subscribe<sensor_msgs::Image>("virtual_depth", 1, &GazeboImageGenerator::HandleVirtualDepth, this, ros::TransportHints().tcpNoDelay());
+
+  ROS_INFO("Waiting for camera calibration info...");
+  sensor_msgs::CameraInfoConstPtr msg = ros::topic::waitForMessage<sensor_msgs::CameraInfo>("virtual_caminfo", nh);
+  virtual_K << msg->K[0], msg->K[1], msg->K[2],
+               msg->K[3], msg->K[4], msg->K[5],
+               msg->K[6], msg->K[7], msg->K[8];
+  virtual_width = msg->width;
+  virtual_height = msg->height;
+  ROS_INFO("Calibration info received");
+}
+
+Eigen::Matrix3f GazeboImageGenerator::GetK()
+{
+  return virtual_K;
+}
+
+Mat GazeboImageGenerator::GenerateVirtualImage(const Eigen::Matrix4f& pose, Mat& depths, Mat& mask)
+{
+  SetCameraPose(pose);
+
+  // Wait for the first image and depth map rendered after the camera moved
+  {
+    boost::unique_lock<boost::mutex> lock(virtual_mutex);
+    get_virtual_image = true;
+    get_virtual_depth = true;
+    while(get_virtual_image || get_virtual_depth)
+    {
+      if(!ros::ok())
+        return Mat();
+      virtual_cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+    }
+  }
+
+  depths = Mat(virtual_height, virtual_width, CV_32F, Scalar(0));
+  mask = Mat(virtual_height, virtual_width, CV_8U, Scalar(0));
+
+  Metrics::ScopedTimer parse_timer("gazebo_parse_depth");
+  for(int i = 0; i < virtual_height; i++)
+  {
+    for(int j = 0; j < virtual_width; j++)
+    {
+      union{
+        float f;
+        uchar b[4];
+      } u;
+
+      int index = i*current_virtual_depth_msg->step + j*(current_virtual_depth_msg->step/current_virtual_depth_msg->width);
+      for(int k = 0; k < 4; k++)
+      {
+        u.b[k] = current_virtual_depth_msg->data[index+k];
+      }
+      if(u.f == u.f) // check if valid
+      {
+        depths.at<float>(i,j) = u.f;
+        mask.at<uchar>(i,j) = 255;
+      }
+    }
+  }
+  parse_timer.stop();
+
+  return current_virtual_image;
+}
+
+void GazeboImageGenerator::SetCameraPose(const Eigen::Matrix4f& tf)
+{
+  gazebo_msgs::SetLinkState vimg_state_srv;
+  gazebo_msgs::LinkState vimg_state_msg;
+  vimg_state_msg.link_name = "kinect::link";
+
+  vimg_state_msg.pose.position.x = tf(0,3);
+  vimg_state_msg.pose.position.y = tf(1,3);
+  vimg_state_msg.pose.position.z = tf(2,3);
+
+  Eigen::Matrix3f rot = tf.block<3,3>(0,0)*Eigen::AngleAxisf(-M_PI/2, Eigen::Vector3f::UnitY())*Eigen::AngleAxisf(M_PI/2, Eigen::Vector3f::UnitX());
+  Eigen::Quaternionf q(rot);
+  q.normalize();
+  vimg_state_msg.pose.orientation.x = q.x();
+  vimg_state_msg.pose.orientation.y = q.y();
+  vimg_state_msg.pose.orientation.z = q.z();
+  vimg_state_msg.pose.orientation.w = q.w();
+
+  vimg_state_msg.twist.linear.x = 0;
+  vimg_state_msg.twist.linear.y = 0;
+  vimg_state_msg.twist.linear.z = 0;
+  vimg_state_msg.twist.angular.x = 0;
+  vimg_state_msg.twist.angular.y = 0;
+  vimg_state_msg.twist.angular.z = 0;
+
+  vimg_state_srv.request.link_state = vimg_state_msg;
+
+  Metrics::ScopedTimer timer("gazebo_set_link_state");
+  if(!gazebo_client.call(vimg_state_srv))
+  {
+    ROS_ERROR("Failed to contact gazebo set_link_state service");
+  }
+  timer.stop();
+  usleep(1e4);
+}
+
+void GazeboImageGenerator::HandleVirtualImage(const sensor_msgs::ImageConstPtr& msg)
+{
+  boost::unique_lock<boost::mutex> lock(virtual_mutex);
+  if(get_virtual_image)
+  {
+    current_virtual_image = cv_bridge::toCvCopy(msg)->image;
+    get_virtual_image = false;
+    lock.unlock();
+    virtual_cond.notify_all();
+  }
+}
+
+void GazeboImageGenerator::HandleVirtualDepth(const sensor_msgs::ImageConstPtr& msg)
+{
+  boost::unique_lock<boost::mutex> lock(virtual_mutex);
+  if(get_virtual_depth)
+  {
+    current_virtual_depth_msg = msg;
+    get_virtual_depth = false;
+    lock.unlock();
+    virtual_cond.notify_all();
+  }
+}
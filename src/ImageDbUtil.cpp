@@ -1,8 +1,42 @@
 #include "mesh_localize/ImageDbUtil.h"
+#include "mesh_localize/SnapshotUtil.h"
 
 #include <iomanip>
 #include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <opencv2/core/eigen.hpp>
+#include <boost/bind.hpp>
+
+namespace
+{
+  const char* kKeyframeCacheMagic = "mesh_localize keyframe cache";
+  const int kKeyframeCacheVersion = 1;
+
+  bool WriteKeyframes(std::ostream& out, const std::string& key,
+    const std::vector<KeyframeContainer*>& keyframes)
+  {
+    SnapshotUtil::WriteHeader(out, kKeyframeCacheMagic, kKeyframeCacheVersion);
+    SnapshotUtil::WriteString(out, key);
+    SnapshotUtil::Write(out, (unsigned int)keyframes.size());
+    for(unsigned int i = 0; i < keyframes.size(); i++)
+    {
+      KeyframeContainer* kfc = keyframes[i];
+      Eigen::Matrix4f tf = kfc->GetTf();
+      Eigen::Matrix3f K = kfc->GetK();
+      SnapshotUtil::WriteMat(out, kfc->GetImage());
+      SnapshotUtil::Write(out, tf);
+      SnapshotUtil::Write(out, K);
+      SnapshotUtil::WriteVector(out, kfc->GetKeypoints());
+      SnapshotUtil::WriteMat(out, kfc->GetDescriptors());
+      SnapshotUtil::Write(out, kfc->HasDepth());
+      if(kfc->HasDepth())
+        SnapshotUtil::WriteMat(out, kfc->GetDepth());
+    }
+    return bool(out);
+  }
+}
 
 Eigen::Matrix4f ImageDbUtil::StringToMatrix4f(std::string str)
 {
@@ -114,6 +148,113 @@ bool ImageDbUtil::LoadOgreDataDir(std::string data_dir, std::vector<KeyframeCont
   return true;
 }
 
+std::string ImageDbUtil::SourceStamp(std::string path)
+{
+  struct stat st;
+  if(stat(path.c_str(), &st) != 0)
+    return "";
+
+  std::vector<std::string> files;
+  if(S_ISDIR(st.st_mode))
+  {
+    DIR* dir = opendir(path.c_str());
+    if(!dir)
+      return "";
+    while(dirent* entry = readdir(dir))
+    {
+      files.push_back(path + "/" + entry->d_name);
+    }
+    closedir(dir);
+  }
+  else
+  {
+    files.push_back(path);
+  }
+
+  unsigned long num_files = 0;
+  unsigned long long bytes = 0;
+  time_t mtime = 0;
+  long mtime_nsec = 0;
+  for(unsigned int i = 0; i < files.size(); i++)
+  {
+    if(stat(files[i].c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    num_files++;
+    bytes += st.st_size;
+    if(st.st_mtim.tv_sec > mtime || (st.st_mtim.tv_sec == mtime && st.st_mtim.tv_nsec > mtime_nsec))
+    {
+      mtime = st.st_mtim.tv_sec;
+      mtime_nsec = st.st_mtim.tv_nsec;
+    }
+  }
+  std::stringstream ss;
+  ss << num_files << " files, " << bytes << " bytes, modified " << mtime << "."
+    << std::setw(9) << std::setfill('0') << mtime_nsec;
+  return ss.str();
+}
+
+bool ImageDbUtil::WriteKeyframeCache(std::string filename, std::string key, const std::vector<KeyframeContainer*>& keyframes)
+{
+  if(!SnapshotUtil::WriteFile(filename, boost::bind(&WriteKeyframes, _1, key, boost::cref(keyframes))))
+    return false;
+  std::cout << "Wrote keyframe cache " << filename << std::endl;
+  return true;
+}
+
+bool ImageDbUtil::ReadKeyframeCache(std::string filename, std::string key, std::vector<KeyframeContainer*>& keyframes)
+{
+  std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+  if(!in.is_open())
+    return false;
+
+  std::string file_key;
+  unsigned int num_keyframes;
+  if(!SnapshotUtil::ReadHeader(in, kKeyframeCacheMagic, kKeyframeCacheVersion) ||
+    !SnapshotUtil::ReadString(in, file_key) || !SnapshotUtil::Read(in, num_keyframes))
+  {
+    return false;
+  }
+  if(file_key != key)
+  {
+    std::cout << "Keyframe cache " << filename << " was written for " << file_key << ", not " << key << std::endl;
+    return false;
+  }
+
+  std::vector<KeyframeContainer*> loaded;
+  bool ok = true;
+  for(unsigned int i = 0; i < num_keyframes && ok; i++)
+  {
+    Mat image, desc, depth;
+    Eigen::Matrix4f tf;
+    Eigen::Matrix3f K;
+    std::vector<KeyPoint> kps;
+    bool has_depth;
+    ok = SnapshotUtil::ReadMat(in, image) && SnapshotUtil::Read(in, tf) &&
+      SnapshotUtil::Read(in, K) && SnapshotUtil::ReadVector(in, kps) &&
+      SnapshotUtil::ReadMat(in, desc) && SnapshotUtil::Read(in, has_depth) &&
+      (!has_depth || SnapshotUtil::ReadMat(in, depth));
+    if(!ok)
+      break;
+
+    CameraContainer* cc = new CameraContainer(image, tf, K);
+    if(has_depth)
+      loaded.push_back(new KeyframeContainer(cc, kps, desc, depth));
+    else
+      loaded.push_back(new KeyframeContainer(cc, kps, desc));
+  }
+  if(!ok)
+  {
+    std::cerr << "Keyframe cache " << filename << " is truncated" << std::endl;
+    for(unsigned int i = 0; i < loaded.size(); i++)
+      delete loaded[i];
+    return false;
+  }
+
+  keyframes.insert(keyframes.end(), loaded.begin(), loaded.end());
+  std::cout << "Loaded " << loaded.size() << " keyframes from cache " << filename << std::endl;
+  return true;
+}
+
 bool ImageDbUtil::LoadPhotoscanFile(std::string filename, vector<CameraContainer*>& cameras, Mat map_Kcv, Mat map_distcoeffcv)
 {
   TiXmlDocument doc(filename);
@@ -1,5 +1,8 @@
 #include "mesh_localize/KLTTracker.h"
+#include "mesh_localize/SnapshotUtil.h"
+#include "mesh_localize/Trace.h"
 #include <iostream>
+#include <algorithm>
 
 using namespace Eigen;
 using namespace cv;
@@ -8,6 +11,7 @@ KLTTracker::KLTTracker()
 {
   m_nextID = 0;
   m_maxNumberOfPoints = 200;
+  m_drawOutput = false;
   m_fastDetector = cv::FastFeatureDetector::create(std::string("FAST"));
 }
 
@@ -21,7 +25,8 @@ std::vector<unsigned char> KLTTracker::filterMatchesEpipolarContraint(
 }
 
 void KLTTracker::init(const cv::Mat& inputFrame, const cv::Mat& depth, const Eigen::Matrix3f& inputK, 
-  const Eigen::Matrix3f& depthK, const Eigen::Matrix4f& inputTf, const cv::Mat& mask)
+  const Eigen::Matrix3f& depthK, const Eigen::Matrix4f& inputTf, const cv::Mat& mask,
+  std::mt19937& rng)
 {
   m_nextPts.clear();
   m_prevPts.clear();
@@ -33,7 +38,7 @@ void KLTTracker::init(const cv::Mat& inputFrame, const cv::Mat& depth, const Eig
   m_nextID = 0;
 
   m_fastDetector->detect(inputFrame, m_nextKeypoints, m_mask);
-  std::random_shuffle(m_nextKeypoints.begin(), m_nextKeypoints.end());
+  std::shuffle(m_nextKeypoints.begin(), m_nextKeypoints.end(), rng);
   m_nextKeypoints.resize(m_maxNumberOfPoints < m_nextKeypoints.size() ? 
     m_maxNumberOfPoints : m_nextKeypoints.size());
 
@@ -63,10 +68,14 @@ void KLTTracker::init(const cv::Mat& inputFrame, const cv::Mat& depth, const Eig
 bool KLTTracker::processFrame(const cv::Mat& inputFrame, cv::Mat& outputFrame, 
   std::vector<cv::Point2f>& pts2d, std::vector<cv::Point3f>& pts3d, std::vector<int>& ptIDs)
 {
+  TRACE_SCOPE("KLTTracker::processFrame");
   pts2d.clear();
   pts3d.clear();
   inputFrame.copyTo(m_nextImg);
-  cv::cvtColor(inputFrame, outputFrame, CV_GRAY2BGR);
+  if(m_drawOutput)
+    cv::cvtColor(inputFrame, outputFrame, CV_GRAY2BGR);
+  else
+    outputFrame.release();
 
   if (m_mask.rows != inputFrame.rows || m_mask.cols != inputFrame.cols)
     m_mask.create(inputFrame.rows, inputFrame.cols, CV_8UC1);
@@ -102,10 +111,13 @@ bool KLTTracker::processFrame(const cv::Mat& inputFrame, cv::Mat& outputFrame,
       trackedPts.push_back(lkNextPts[i]);
       trackedPtIDs.push_back(lkTrackedPtIDs[i]);
       cv::circle(m_mask, lkPrevPts[i], 15, cv::Scalar(0), -1);
-      cv::line(outputFrame, lkPrevPts[i], lkNextPts[i], cv::Scalar(0,250,0));
-      cv::circle(outputFrame, lkNextPts[i], 3, cv::Scalar(0,250,0), -1);
-      cv::putText(outputFrame, std::to_string(lkTrackedPtIDs[i]), lkNextPts[i], 
-        cv::FONT_HERSHEY_PLAIN, 2, cv::Scalar::all(255));
+      if(m_drawOutput)
+      {
+        cv::line(outputFrame, lkPrevPts[i], lkNextPts[i], cv::Scalar(0,250,0));
+        cv::circle(outputFrame, lkNextPts[i], 3, cv::Scalar(0,250,0), -1);
+        cv::putText(outputFrame, std::to_string(lkTrackedPtIDs[i]), lkNextPts[i], 
+          cv::FONT_HERSHEY_PLAIN, 2, cv::Scalar::all(255));
+      }
       pts2d.push_back(lkNextPts[i]);
       pts3d.push_back(lk3dPts[i]);
       ptIDs.push_back(lkTrackedPtIDs[i]);
@@ -117,3 +129,27 @@ bool KLTTracker::processFrame(const cv::Mat& inputFrame, cv::Mat& outputFrame,
   m_nextImg.copyTo(m_prevImg);
   return true;
 }
+
+void KLTTracker::write(std::ostream& out) const
+{
+  SnapshotUtil::WriteMat(out, m_prevImg);
+  SnapshotUtil::WriteMat(out, m_mask);
+  SnapshotUtil::WriteVector(out, m_prevPts);
+  SnapshotUtil::WriteVector(out, m_tracked3dPts);
+  SnapshotUtil::WriteVector(out, m_ptIDs);
+  SnapshotUtil::Write(out, m_nextID);
+}
+
+bool KLTTracker::read(std::istream& in)
+{
+  m_nextPts.clear();
+  m_nextKeypoints.clear();
+  m_prevKeypoints.clear();
+  if(!SnapshotUtil::ReadMat(in, m_prevImg) || !SnapshotUtil::ReadMat(in, m_mask) ||
+    !SnapshotUtil::ReadVector(in, m_prevPts) || !SnapshotUtil::ReadVector(in, m_tracked3dPts) ||
+    !SnapshotUtil::ReadVector(in, m_ptIDs) || !SnapshotUtil::Read(in, m_nextID))
+  {
+    return false;
+  }
+  return m_prevPts.size() == m_tracked3dPts.size() && m_prevPts.size() == m_ptIDs.size();
+}
@@ -7,10 +7,29 @@
   #include <opencv2/nonfree/gpu.hpp>
 #endif
 
+#include <boost/thread/mutex.hpp>
+
+namespace
+{
+  // The default mask lets everything through and is never written to, so all keyframes of
+  // the same size share one instead of allocating a full size image each
+  Mat DefaultMask(int rows, int cols)
+  {
+    static boost::mutex mutex;
+    static Mat mask;
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if(mask.rows != rows || mask.cols != cols)
+    {
+      mask = Mat(rows, cols, CV_8U, Scalar(255));
+    }
+    return mask;
+  }
+}
+
 KeyframeContainer::KeyframeContainer(Mat img, std::string desc_type, bool extract_now)
  : desc_type(desc_type), has_depth(false), delete_cc(true)
 {
-  mask = Mat(img.rows, img.cols, CV_8U, Scalar(255));
+  mask = DefaultMask(img.rows, img.cols);
   cc = new CameraContainer(img);
   if(extract_now)
     ExtractFeatures(desc_type);
@@ -21,7 +40,7 @@ KeyframeContainer::KeyframeContainer(Mat img, std::vector<KeyPoint>& keypoints,
   descriptors(descriptors)
 {
   cc = new CameraContainer(img);
-  mask = Mat(img.rows, img.cols, CV_8U, Scalar(255));
+  mask = DefaultMask(img.rows, img.cols);
   delete_cc = true;
   has_depth = false;
 }
@@ -32,7 +51,7 @@ KeyframeContainer::KeyframeContainer(Mat img, std::vector<KeyPoint>& keypoints,
   depth(depth)
 {
   cc = new CameraContainer(img);
-  mask = Mat(img.rows, img.cols, CV_8U, Scalar(255));
+  mask = DefaultMask(img.rows, img.cols);
   delete_cc = true;
   has_depth = true;
 }
@@ -40,7 +59,7 @@ KeyframeContainer::KeyframeContainer(CameraContainer* cc, std::string desc_type)
  cc(cc)
 {
   delete_cc = false;
-  mask = Mat(cc->GetImage().rows, cc->GetImage().cols, CV_8U, Scalar(255));
+  mask = DefaultMask(cc->GetImage().rows, cc->GetImage().cols);
   ExtractFeatures(desc_type);
   has_depth = false;
 }
@@ -50,7 +69,7 @@ KeyframeContainer::KeyframeContainer(CameraContainer* cc, std::vector<KeyPoint>&
   keypoints(keypoints),
   descriptors(descriptors)
 {
-  mask = Mat(cc->GetImage().rows, cc->GetImage().cols, CV_8U, Scalar(255));
+  mask = DefaultMask(cc->GetImage().rows, cc->GetImage().cols);
   delete_cc = false;
   has_depth = false;
 }
@@ -61,7 +80,7 @@ KeyframeContainer::KeyframeContainer(CameraContainer* cc, std::vector<KeyPoint>&
   descriptors(descriptors),
   depth(depth)
 {
-  mask = Mat(cc->GetImage().rows, cc->GetImage().cols, CV_8U, Scalar(255));
+  mask = DefaultMask(cc->GetImage().rows, cc->GetImage().cols);
   delete_cc = false;
   has_depth = true;
 }
@@ -92,6 +111,34 @@ void KeyframeContainer::SetMask(Mat new_mask)
   mask = new_mask;
 }
 
+bool KeyframeContainer::HasDepth()
+{
+  return has_depth;
+}
+
+void KeyframeContainer::Reset(Mat img, std::string desc_type)
+{
+  if(delete_cc)
+  {
+    cc->SetImage(img);
+  }
+  else
+  {
+    cc = new CameraContainer(img);
+    delete_cc = true;
+  }
+  this->desc_type = desc_type;
+  keypoints.clear();
+  // Extraction writes into the descriptors in place, unless they are still in use elsewhere
+  if(descriptors.refcount && *descriptors.refcount > 1)
+  {
+    descriptors.release();
+  }
+  depth.release();
+  has_depth = false;
+  mask = DefaultMask(img.rows, img.cols);
+}
+
 void KeyframeContainer::ExtractFeatures()
 {
   ExtractFeatures(desc_type);
@@ -162,7 +209,7 @@ Mat KeyframeContainer::GetDescriptors()
   return descriptors;
 }
 
-std::vector<KeyPoint> KeyframeContainer::GetKeypoints()
+const std::vector<KeyPoint>& KeyframeContainer::GetKeypoints()
 {
   return keypoints;
 }
@@ -0,0 +1,114 @@
+#include "mesh_localize/LostModeGate.h"
+
+#include <iostream>
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace
+{
+  // Failed attempts at full rate before backing off
+  const int kFullRateAttempts = 3;
+  // Changes this many times change_thresh make a frame worth an immediate full
+  // resolution attempt
+  const double kPromisingFactor = 4;
+  // A static scene is still retried this much less often than retry_period, in case the
+  // object came into view without changing the scene much
+  const double kStaticPeriodFactor = 5;
+  // Width of the thumbnails scene changes are measured on
+  const int kThumbWidth = 40;
+
+  void MakeThumb(const cv::Mat& image, cv::Mat& thumb)
+  {
+    int cols = std::min(kThumbWidth, image.cols);
+    int rows = std::max(1, image.rows*cols/std::max(image.cols, 1));
+    // INTER_AREA averages, which also suppresses sensor noise
+    cv::resize(image, thumb, cv::Size(cols, rows), 0, 0, cv::INTER_AREA);
+  }
+}
+
+LostModeGate::LostModeGate(double retry_period, double image_scale, double change_thresh) :
+  retry_period(retry_period),
+  image_scale(image_scale),
+  change_thresh(change_thresh),
+  failures(0),
+  last_attempt_stamp(0)
+{
+}
+
+bool LostModeGate::isBackingOff() const
+{
+  return retry_period > 0 && failures >= kFullRateAttempts;
+}
+
+void LostModeGate::reset()
+{
+  if(isBackingOff())
+    std::cout << "LostModeGate: object found, back to full rate" << std::endl;
+  failures = 0;
+  last_attempt_thumb.release();
+}
+
+void LostModeGate::recordFailures(int n)
+{
+  bool was_backing_off = isBackingOff();
+  failures += n;
+  if(!was_backing_off && isBackingOff())
+  {
+    std::cout << "LostModeGate: object lost, retrying every " << retry_period << " s at "
+      << image_scale << " scale" << std::endl;
+  }
+}
+
+double LostModeGate::ChangeFrom(const cv::Mat& thumb) const
+{
+  if(last_attempt_thumb.empty() || last_attempt_thumb.size() != thumb.size() ||
+    last_attempt_thumb.type() != thumb.type())
+  {
+    return -1;
+  }
+  cv::Mat diff;
+  cv::absdiff(thumb, last_attempt_thumb, diff);
+  return cv::mean(diff)[0];
+}
+
+bool LostModeGate::admit(const cv::Mat& image, double stamp, double& scale)
+{
+  scale = 1;
+  if(!isBackingOff())
+  {
+    MakeThumb(image, last_attempt_thumb);
+    last_attempt_stamp = stamp;
+    return true;
+  }
+
+  cv::Mat thumb;
+  MakeThumb(image, thumb);
+  double change = ChangeFrom(thumb);
+  double elapsed = stamp - last_attempt_stamp;
+
+  bool attempt;
+  if(change < 0 || change >= kPromisingFactor*change_thresh)
+  {
+    attempt = true;
+  }
+  else if(change >= change_thresh)
+  {
+    attempt = elapsed >= retry_period;
+    scale = image_scale;
+  }
+  else
+  {
+    attempt = elapsed >= kStaticPeriodFactor*retry_period;
+    scale = image_scale;
+  }
+  // A stamp going backwards means a new sequence, start over
+  if(elapsed < 0)
+    attempt = true;
+
+  if(attempt)
+  {
+    last_attempt_thumb = thumb;
+    last_attempt_stamp = stamp;
+  }
+  return attempt;
+}
@@ -79,7 +79,7 @@ Mat MapFeatures::GetDescriptors() const
   return descriptors;
 }
 
-std::vector<pcl::PointXYZ> MapFeatures::GetKeypoints() const
+const std::vector<pcl::PointXYZ>& MapFeatures::GetKeypoints() const
 {
   return keypoints;
 }
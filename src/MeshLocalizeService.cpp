@@ -0,0 +1,151 @@
+#include "mesh_localize/MeshLocalizeService.h"
+#include "mesh_localize/RosParams.h"
+
+#include <cv_bridge/cv_bridge.h>
+#include <Eigen/Geometry>
+#include "sensor_msgs/CameraInfo.h"
+#include "geometry_msgs/PoseStamped.h"
+
+MeshLocalizeService::MeshLocalizeService(ros::NodeHandle nh, ros::NodeHandle nh_private):
+    nh(nh),
+    nh_private(nh_private)
+{
+  std::vector<std::string> stream_names;
+  int num_workers;
+  if(!nh_private.getParam("streams", stream_names) || stream_names.empty())
+  {
+    ROS_ERROR("No camera streams, set the ~streams param");
+    return;
+  }
+  if(!nh_private.getParam("num_workers", num_workers))
+    num_workers = 0;
+
+  TrackerParams params;
+  ReadTrackerParams(nh_private, params);
+  if(params.virtual_image_source == "gazebo")
+  {
+    ROS_ERROR("gazebo virtual images are not supported by the tracking service");
+    return;
+  }
+
+  // The keyframe database is loaded once here and shared by every stream
+  service.reset(new TrackingService(params, num_workers));
+  if(!service->isReady())
+  {
+    ROS_ERROR("Could not create %s localizer", params.global_localization_alg.c_str());
+    service.reset();
+    return;
+  }
+
+  for(unsigned int i = 0; i < stream_names.size(); i++)
+  {
+    boost::shared_ptr<Stream> stream(new Stream);
+    stream->name = stream_names[i];
+    if(!nh_private.getParam(stream->name + "/camera_frame", stream->camera_frame))
+      stream->camera_frame = stream->name;
+
+    ros::NodeHandle stream_nh(nh, stream->name);
+    ROS_INFO("Waiting for %s/camera_info...", stream->name.c_str());
+    sensor_msgs::CameraInfoConstPtr msg = ros::topic::waitForMessage<sensor_msgs::CameraInfo>("camera_info", stream_nh);
+    if(!msg)
+      return;
+
+    Eigen::Matrix3f K;
+    K << msg->K[0], msg->K[1], msg->K[2],
+                   msg->K[3], msg->K[4], msg->K[5],
+                   msg->K[6], msg->K[7], msg->K[8];
+    Eigen::VectorXf distcoeff = Eigen::VectorXf(5);
+    distcoeff << msg->D[0], msg->D[1], msg->D[2], msg->D[3], msg->D[4];
+
+    stream->index = service->addStream(K, distcoeff, msg->height, msg->width);
+    if(stream->index < 0)
+    {
+      ROS_ERROR("Could not add stream %s", stream->name.c_str());
+      continue;
+    }
+    stream->pose_pub = nh.advertise<geometry_msgs::PoseStamped>("/mesh_localize/" + stream->name + "/estimated_pose", 1);
+    streams.push_back(stream);
+  }
+
+  service->setResultCallback(boost::bind(&MeshLocalizeService::HandleResult, this, _1, _2));
+  for(unsigned int i = 0; i < streams.size(); i++)
+  {
+    ros::NodeHandle stream_nh(nh, streams[i]->name);
+    streams[i]->image_sub = stream_nh.subscribe<sensor_msgs::Image>("image", 1,
+      boost::bind(&MeshLocalizeService::HandleImage, this, _1, streams[i].get()),
+      ros::VoidConstPtr(), ros::TransportHints().tcpNoDelay());
+  }
+  ROS_INFO("Initialized, serving %d streams", (int)streams.size());
+}
+
+MeshLocalizeService::~MeshLocalizeService()
+{
+  for(unsigned int i = 0; i < streams.size(); i++)
+  {
+    streams[i]->image_sub.shutdown();
+  }
+  service.reset();
+}
+
+void MeshLocalizeService::HandleImage(const sensor_msgs::ImageConstPtr& msg, Stream* stream)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(stream->stamp_mutex);
+    stream->recent_stamps.push_back(msg->header.stamp);
+    if(stream->recent_stamps.size() > 8)
+      stream->recent_stamps.pop_front();
+  }
+
+  cv_bridge::CvImageConstPtr cvImg = cv_bridge::toCvShare(msg);
+  service->processFrame(stream->index, cvImg->image, msg->header.stamp.toSec());
+}
+
+void MeshLocalizeService::HandleResult(int index, const Tracker::PoseResult& result)
+{
+  if(!result.valid || index < 0 || index >= (int)streams.size())
+    return;
+  Stream* stream = streams[index].get();
+
+  ros::Time stamp(result.stamp);
+  {
+    boost::lock_guard<boost::mutex> lock(stream->stamp_mutex);
+    for(std::deque<ros::Time>::reverse_iterator it = stream->recent_stamps.rbegin();
+      it != stream->recent_stamps.rend(); it++)
+    {
+      if(it->toSec() == result.stamp)
+      {
+        stamp = *it;
+        break;
+      }
+    }
+  }
+
+  Eigen::Matrix4f tf = result.pose;
+  Eigen::Matrix4f tf_inv = tf.inverse();
+
+  geometry_msgs::PoseStamped pose;
+  pose.header.stamp = stamp;
+  pose.header.frame_id = stream->camera_frame;
+  pose.pose.position.x = tf_inv(0,3);
+  pose.pose.position.y = tf_inv(1,3);
+  pose.pose.position.z = tf_inv(2,3);
+
+  Eigen::Matrix3f rot = tf_inv.block<3,3>(0,0);
+  Eigen::Quaternionf q(rot);
+  q.normalize();
+  pose.pose.orientation.x = q.x();
+  pose.pose.orientation.y = q.y();
+  pose.pose.orientation.z = q.z();
+  pose.pose.orientation.w = q.w();
+  stream->pose_pub.publish(pose);
+
+  tf::Transform tf_transform;
+  tf_transform.setOrigin(tf::Vector3(tf(0,3), tf(1,3), tf(2,3)));
+  tf_transform.setBasis(tf::Matrix3x3(tf(0,0), tf(0,1), tf(0,2),
+                                      tf(1,0), tf(1,1), tf(1,2),
+                                      tf(2,0), tf(2,1), tf(2,2)));
+  // Results arrive from several worker threads
+  boost::lock_guard<boost::mutex> lock(br_mutex);
+  br.sendTransform(tf::StampedTransform(tf_transform.inverse(), stamp, stream->camera_frame,
+    stream->name + "/object_pose"));
+}
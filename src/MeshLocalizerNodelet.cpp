@@ -0,0 +1,47 @@
+#include "mesh_localize/MeshLocalizerNodelet.h"
+
+#include <pluginlib/class_list_macros.h>
+
+MeshLocalizerNodelet::MeshLocalizerNodelet() :
+  shutdown(false)
+{
+}
+
+MeshLocalizerNodelet::~MeshLocalizerNodelet()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    shutdown = true;
+    if(localizer)
+      localizer->Stop();
+  }
+  if(thread.joinable())
+    thread.join();
+}
+
+void MeshLocalizerNodelet::onInit()
+{
+  // The constructor waits for camera_info and creates the render context, neither of which
+  // may happen on the manager's thread
+  thread = boost::thread(&MeshLocalizerNodelet::Run, this);
+}
+
+void MeshLocalizerNodelet::Run()
+{
+  // The constructor gives up waiting for camera_info once shutdown is set
+  boost::shared_ptr<MeshLocalizer> ml(new MeshLocalizer(getNodeHandle(),
+    getPrivateNodeHandle(), &shutdown));
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if(shutdown)
+      return;
+    localizer = ml;
+  }
+  ml->Run();
+
+  // Tear down on this thread, which owns the render context
+  boost::lock_guard<boost::mutex> lock(mutex);
+  localizer.reset();
+}
+
+PLUGINLIB_EXPORT_CLASS(MeshLocalizerNodelet, nodelet::Nodelet)
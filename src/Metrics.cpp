@@ -0,0 +1,332 @@
+#include "mesh_localize/Metrics.h"
+
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+namespace
+{
+  // Names are registered for the life of the process.  Each thread keeps one slot per
+  // name, so this bounds the number of distinct stages and counters.  Allocation profiling
+  // builds add four counters per stage.
+  const int kMaxNames = 256;
+
+  double MonotonicTime()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+  }
+
+  // Only the owning thread writes, so plain loads and stores suffice; the atomics make
+  // the concurrent reads in Collect well defined.
+  void Add(boost::atomic<boost::uint64_t>& value, boost::uint64_t n)
+  {
+    value.store(value.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed);
+  }
+
+  struct ThreadHistogram
+  {
+    ThreadHistogram() :
+      sum_ns(0),
+      max_ns(0)
+    {
+      for(int i = 0; i < LatencyHistogram::kNumBuckets; i++)
+        counts[i].store(0, boost::memory_order_relaxed);
+    }
+
+    boost::atomic<boost::uint64_t> counts[LatencyHistogram::kNumBuckets];
+    boost::atomic<boost::uint64_t> sum_ns;
+    boost::atomic<boost::uint64_t> max_ns;
+  };
+
+  struct ThreadMetrics
+  {
+    ThreadMetrics()
+    {
+      for(int i = 0; i < kMaxNames; i++)
+      {
+        histograms[i].store(NULL, boost::memory_order_relaxed);
+        counters[i].store(0, boost::memory_order_relaxed);
+      }
+    }
+
+    // Allocated by the owner on first use and published with a release store
+    boost::atomic<ThreadHistogram*> histograms[kMaxNames];
+    boost::atomic<boost::uint64_t> counters[kMaxNames];
+    // Name to id cache, only touched by the owner
+    std::map<std::string, int> ids;
+  };
+
+  struct Registry
+  {
+    boost::mutex mutex;
+    std::vector<std::string> names;
+    // Threads are never unregistered, so what exited threads recorded still counts
+    std::vector<ThreadMetrics*> threads;
+  };
+
+  // Leaked so that threads still recording during static destruction are safe
+  Registry& GetRegistry()
+  {
+    static Registry* registry = new Registry;
+    return *registry;
+  }
+
+  ThreadMetrics* CurrentThread()
+  {
+    thread_local ThreadMetrics* current = NULL;
+    if(!current)
+    {
+      current = new ThreadMetrics;
+      Registry& registry = GetRegistry();
+      boost::lock_guard<boost::mutex> lock(registry.mutex);
+      registry.threads.push_back(current);
+    }
+    return current;
+  }
+
+  // -1 once kMaxNames is exhausted
+  int NameId(ThreadMetrics* thread, const std::string& name)
+  {
+    std::map<std::string, int>::const_iterator it = thread->ids.find(name);
+    if(it != thread->ids.end())
+      return it->second;
+
+    Registry& registry = GetRegistry();
+    boost::lock_guard<boost::mutex> lock(registry.mutex);
+    int id = std::find(registry.names.begin(), registry.names.end(), name) -
+      registry.names.begin();
+    if(id == (int)registry.names.size())
+    {
+      if(id >= kMaxNames)
+      {
+        std::cerr << "Metrics: too many names, dropping " << name << std::endl;
+        id = -1;
+      }
+      else
+      {
+        registry.names.push_back(name);
+      }
+    }
+    thread->ids[name] = id;
+    return id;
+  }
+}
+
+int LatencyHistogram::BucketIndex(double seconds)
+{
+  if(!(seconds > 0))
+    return 0;
+  double us = seconds*1e6;
+  if(us >= std::ldexp(1.0, kMagnitudes + kSubBucketBits - 1))
+    return kNumBuckets-1;
+  boost::uint64_t v = (boost::uint64_t)us;
+  if(v < (boost::uint64_t)kSubBuckets)
+    return v;
+
+  // Shift v into [kSubBuckets/2, kSubBuckets), the shift is the magnitude
+  int shift = 0;
+  while((v >> shift) >= (boost::uint64_t)kSubBuckets)
+    shift++;
+  int index = kSubBuckets + (shift-1)*kSubBuckets/2 + (int)(v >> shift) - kSubBuckets/2;
+  return std::min(index, kNumBuckets-1);
+}
+
+double LatencyHistogram::BucketValue(int index)
+{
+  if(index < kSubBuckets)
+    return (index + 0.5)*1e-6;
+  int shift = (index - kSubBuckets)/(kSubBuckets/2) + 1;
+  int sub = (index - kSubBuckets)%(kSubBuckets/2) + kSubBuckets/2;
+  return std::ldexp(sub + 0.5, shift)*1e-6;
+}
+
+LatencyHistogram::LatencyHistogram() :
+  counts(kNumBuckets, 0),
+  count(0),
+  sum(0),
+  max(0)
+{
+}
+
+void LatencyHistogram::record(double seconds)
+{
+  counts[BucketIndex(seconds)]++;
+  count++;
+  sum += seconds;
+  max = std::max(max, seconds);
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+  for(int i = 0; i < kNumBuckets; i++)
+    counts[i] += other.counts[i];
+  count += other.count;
+  sum += other.sum;
+  max = std::max(max, other.max);
+}
+
+void LatencyHistogram::subtract(const LatencyHistogram& other)
+{
+  for(int i = 0; i < kNumBuckets; i++)
+    counts[i] -= std::min(counts[i], other.counts[i]);
+  count -= std::min(count, other.count);
+  sum = std::max(sum - other.sum, 0.0);
+}
+
+boost::uint64_t LatencyHistogram::getCount() const
+{
+  return count;
+}
+
+double LatencyHistogram::getMean() const
+{
+  return count > 0 ? sum/count : 0;
+}
+
+double LatencyHistogram::getMax() const
+{
+  return max;
+}
+
+double LatencyHistogram::getPercentile(double p) const
+{
+  if(count == 0)
+    return 0;
+  boost::uint64_t rank = (boost::uint64_t)std::ceil(std::min(std::max(p, 0.0), 1.0)*count);
+  rank = std::max(rank, (boost::uint64_t)1);
+  boost::uint64_t seen = 0;
+  for(int i = 0; i < kNumBuckets; i++)
+  {
+    seen += counts[i];
+    if(seen >= rank)
+      return std::min(BucketValue(i), max);
+  }
+  return max;
+}
+
+void Metrics::Record(const std::string& stage, double seconds)
+{
+  ThreadMetrics* thread = CurrentThread();
+  int id = NameId(thread, stage);
+  if(id < 0)
+    return;
+
+  ThreadHistogram* h = thread->histograms[id].load(boost::memory_order_relaxed);
+  if(!h)
+  {
+    h = new ThreadHistogram;
+    thread->histograms[id].store(h, boost::memory_order_release);
+  }
+  boost::uint64_t ns = seconds > 0 ? (boost::uint64_t)(seconds*1e9) : 0;
+  Add(h->counts[LatencyHistogram::BucketIndex(seconds)], 1);
+  Add(h->sum_ns, ns);
+  if(ns > h->max_ns.load(boost::memory_order_relaxed))
+    h->max_ns.store(ns, boost::memory_order_relaxed);
+}
+
+void Metrics::Increment(const std::string& counter, boost::uint64_t n)
+{
+  ThreadMetrics* thread = CurrentThread();
+  int id = NameId(thread, counter);
+  if(id >= 0)
+    Add(thread->counters[id], n);
+}
+
+void Metrics::Collect(std::map<std::string, LatencyHistogram>& stages,
+  std::map<std::string, boost::uint64_t>& counters)
+{
+  stages.clear();
+  counters.clear();
+  Registry& registry = GetRegistry();
+  boost::lock_guard<boost::mutex> lock(registry.mutex);
+  for(unsigned int t = 0; t < registry.threads.size(); t++)
+  {
+    ThreadMetrics* thread = registry.threads[t];
+    for(unsigned int id = 0; id < registry.names.size(); id++)
+    {
+      boost::uint64_t n = thread->counters[id].load(boost::memory_order_relaxed);
+      if(n > 0)
+        counters[registry.names[id]] += n;
+
+      ThreadHistogram* h = thread->histograms[id].load(boost::memory_order_acquire);
+      if(!h)
+        continue;
+      LatencyHistogram& out = stages[registry.names[id]];
+      for(int i = 0; i < LatencyHistogram::kNumBuckets; i++)
+      {
+        boost::uint64_t c = h->counts[i].load(boost::memory_order_relaxed);
+        out.counts[i] += c;
+        out.count += c;
+      }
+      out.sum += 1e-9*h->sum_ns.load(boost::memory_order_relaxed);
+      out.max = std::max(out.max, 1e-9*h->max_ns.load(boost::memory_order_relaxed));
+    }
+  }
+}
+
+void Metrics::WriteReport(std::ostream& out,
+  const std::map<std::string, LatencyHistogram>& stages,
+  const std::map<std::string, boost::uint64_t>& counters)
+{
+  std::streamsize precision = out.precision(6);
+  out << "stage,count,mean,p50,p90,p99,max" << std::endl;
+  for(std::map<std::string, LatencyHistogram>::const_iterator it = stages.begin();
+    it != stages.end(); it++)
+  {
+    const LatencyHistogram& h = it->second;
+    out << it->first << "," << h.getCount() << "," << h.getMean() << ","
+      << h.getPercentile(0.5) << "," << h.getPercentile(0.9) << "," << h.getPercentile(0.99)
+      << "," << h.getMax() << std::endl;
+  }
+  out << std::endl << "counter,value" << std::endl;
+  for(std::map<std::string, boost::uint64_t>::const_iterator it = counters.begin();
+    it != counters.end(); it++)
+  {
+    out << it->first << "," << it->second << std::endl;
+  }
+  out.precision(precision);
+}
+
+bool Metrics::WriteFile(const std::string& filename)
+{
+  std::map<std::string, LatencyHistogram> stages;
+  std::map<std::string, boost::uint64_t> counters;
+  Collect(stages, counters);
+  std::ofstream out(filename.c_str());
+  if(!out.is_open())
+  {
+    std::cerr << "Could not open " << filename << std::endl;
+    return false;
+  }
+  WriteReport(out, stages, counters);
+  return bool(out);
+}
+
+Metrics::ScopedTimer::ScopedTimer(const char* stage) :
+  stage(stage),
+  start(MonotonicTime()),
+  stopped(false)
+{
+}
+
+Metrics::ScopedTimer::~ScopedTimer()
+{
+  stop();
+}
+
+double Metrics::ScopedTimer::stop()
+{
+  double elapsed = MonotonicTime() - start;
+  if(!stopped)
+  {
+    Record(stage, elapsed);
+    stopped = true;
+  }
+  return elapsed;
+}
@@ -0,0 +1,124 @@
+#include "mesh_localize/ModeSelector.h"
+
+#include <iostream>
+
+namespace
+{
+  // Weight of the newest sample in the smoothed statistics
+  const double kSmoothing = 0.2;
+  // A mode is reliable while it succeeds this often, with this much margin
+  const double kMinSuccessRate = 0.8;
+  const double kMinMargin = 1.5;
+  // Frames before an unreliable mode is tried again
+  const int kRetryFrames = 150;
+  // Frames to stay in a reliable mode before switching to a cheaper one, and how much
+  // cheaper it has to be
+  const int kMinDwellFrames = 10;
+  const double kMinCostGain = 0.8;
+
+  void Smooth(double& value, double sample)
+  {
+    value = kSmoothing*sample + (1-kSmoothing)*value;
+  }
+}
+
+ModeSelector::Stats::Stats() :
+  samples(0),
+  cost(0),
+  success_rate(1),
+  margin(0),
+  benched(-1)
+{
+}
+
+ModeSelector::ModeSelector() :
+  frames_in_mode(0)
+{
+}
+
+const char* ModeSelector::Name(Mode mode)
+{
+  switch(mode)
+  {
+    case PNP: return "PNP";
+    case KLT: return "KLT";
+    case EDGE: return "EDGE";
+    default: return "?";
+  }
+}
+
+void ModeSelector::reset()
+{
+  for(int i = 0; i < NUM_MODES; i++)
+  {
+    stats[i] = Stats();
+  }
+  frames_in_mode = 0;
+}
+
+void ModeSelector::record(Mode mode, bool success, double margin, double seconds)
+{
+  Stats& s = stats[mode];
+  if(s.samples == 0)
+  {
+    s.cost = seconds;
+    s.margin = success ? margin : 0;
+  }
+  else
+  {
+    Smooth(s.cost, seconds);
+    Smooth(s.margin, success ? margin : 0);
+  }
+  Smooth(s.success_rate, success ? 1 : 0);
+  s.samples++;
+}
+
+bool ModeSelector::IsReliable(Mode mode) const
+{
+  const Stats& s = stats[mode];
+  if(mode == PNP || s.samples == 0)
+    return true;
+  return s.benched < 0 && s.success_rate >= kMinSuccessRate && s.margin >= kMinMargin;
+}
+
+ModeSelector::Mode ModeSelector::select(Mode current)
+{
+  frames_in_mode++;
+  for(int i = 0; i < NUM_MODES; i++)
+  {
+    Stats& s = stats[i];
+    if(s.benched >= 0 && ++s.benched > kRetryFrames)
+    {
+      // Start over, conditions may have changed
+      s = Stats();
+    }
+    else if(s.benched < 0 && s.samples > 0 && !IsReliable((Mode)i))
+    {
+      std::cout << "ModeSelector: " << Name((Mode)i) << " is unreliable (success rate "
+        << s.success_rate << ", margin " << s.margin << ")" << std::endl;
+      s.benched = 0;
+    }
+  }
+
+  Mode best = PNP;
+  for(int i = 0; i < NUM_MODES; i++)
+  {
+    if(IsReliable((Mode)i) && stats[i].cost < stats[best].cost)
+      best = (Mode)i;
+  }
+
+  // Leave a reliable mode only for a clearly cheaper one, so that noisy costs don't make
+  // the tracker flip back and forth
+  if(best != current && IsReliable(current) &&
+    (frames_in_mode < kMinDwellFrames || stats[best].cost > kMinCostGain*stats[current].cost))
+  {
+    return current;
+  }
+  if(best != current)
+  {
+    std::cout << "ModeSelector: switching from " << Name(current) << " to " << Name(best)
+      << std::endl;
+    frames_in_mode = 0;
+  }
+  return best;
+}
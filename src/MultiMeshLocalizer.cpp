@@ -0,0 +1,133 @@
+#include "mesh_localize/MultiMeshLocalizer.h"
+#include "mesh_localize/RosParams.h"
+
+#include <cv_bridge/cv_bridge.h>
+#include <Eigen/Geometry>
+#include "sensor_msgs/CameraInfo.h"
+#include "geometry_msgs/PoseStamped.h"
+
+MultiMeshLocalizer::MultiMeshLocalizer(ros::NodeHandle nh, ros::NodeHandle nh_private):
+    nh(nh),
+    nh_private(nh_private)
+{
+  std::vector<std::string> object_ids;
+  int num_workers;
+  if(!nh_private.getParam("objects", object_ids) || object_ids.empty())
+  {
+    ROS_ERROR("No objects to track, set the ~objects param");
+    return;
+  }
+  if(!nh_private.getParam("num_workers", num_workers))
+    num_workers = 0;
+
+  ROS_INFO("Waiting for camera_info...");
+  sensor_msgs::CameraInfoConstPtr msg = ros::topic::waitForMessage<sensor_msgs::CameraInfo>("camera_info", nh);
+  ROS_INFO("camera_info received");
+
+  Eigen::Matrix3f K;
+  K << msg->K[0], msg->K[1], msg->K[2],
+                 msg->K[3], msg->K[4], msg->K[5],
+                 msg->K[6], msg->K[7], msg->K[8];
+  Eigen::VectorXf distcoeff = Eigen::VectorXf(5);
+  distcoeff << msg->D[0], msg->D[1], msg->D[2], msg->D[3], msg->D[4];
+
+  tracker.reset(new MultiTracker(K, distcoeff, num_workers));
+  for(unsigned int i = 0; i < object_ids.size(); i++)
+  {
+    const std::string& id = object_ids[i];
+    TrackerParams params;
+    ReadTrackerParams(nh_private, params);
+    ReadTrackerParams(ros::NodeHandle(nh_private, id), params);
+    if(params.virtual_image_source == "gazebo")
+    {
+      ROS_ERROR("Object %s: gazebo virtual images are not supported with multiple objects", id.c_str());
+      continue;
+    }
+    ROS_INFO("Adding object %s", id.c_str());
+    if(!tracker->addObject(id, params, msg->height, msg->width))
+    {
+      ROS_ERROR("Could not create tracker for object %s", id.c_str());
+      continue;
+    }
+    pose_pubs[id] = nh.advertise<geometry_msgs::PoseStamped>("/mesh_localize/" + id + "/estimated_pose", 1);
+  }
+  if(pose_pubs.empty())
+  {
+    ROS_ERROR("No object could be tracked");
+    tracker.reset();
+    return;
+  }
+
+  tracker->setResultCallback(boost::bind(&MultiMeshLocalizer::HandleResult, this, _1, _2));
+  image_sub = nh.subscribe<sensor_msgs::Image>("image", 1, &MultiMeshLocalizer::HandleImage, this, ros::TransportHints().tcpNoDelay());
+  ROS_INFO("Initialized, tracking %d objects", (int)pose_pubs.size());
+}
+
+MultiMeshLocalizer::~MultiMeshLocalizer()
+{
+  image_sub.shutdown();
+  tracker.reset();
+}
+
+void MultiMeshLocalizer::HandleImage(const sensor_msgs::ImageConstPtr& msg)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(stamp_mutex);
+    recent_stamps.push_back(msg->header.stamp);
+    if(recent_stamps.size() > 8)
+      recent_stamps.pop_front();
+  }
+
+  // Converted and undistorted once here, then tracked on the worker pool
+  cv_bridge::CvImageConstPtr cvImg = cv_bridge::toCvShare(msg);
+  tracker->processFrame(cvImg->image, msg->header.stamp.toSec());
+}
+
+ros::Time MultiMeshLocalizer::LookupStamp(double stamp)
+{
+  boost::lock_guard<boost::mutex> lock(stamp_mutex);
+  for(std::deque<ros::Time>::reverse_iterator it = recent_stamps.rbegin();
+    it != recent_stamps.rend(); it++)
+  {
+    if(it->toSec() == stamp)
+      return *it;
+  }
+  return ros::Time(stamp);
+}
+
+void MultiMeshLocalizer::HandleResult(const std::string& id, const Tracker::PoseResult& result)
+{
+  if(!result.valid)
+    return;
+
+  ros::Time stamp = LookupStamp(result.stamp);
+  Eigen::Matrix4f tf = result.pose;
+  Eigen::Matrix4f tf_inv = tf.inverse();
+
+  geometry_msgs::PoseStamped pose;
+  pose.header.stamp = stamp;
+  pose.header.frame_id = "camera";
+  pose.pose.position.x = tf_inv(0,3);
+  pose.pose.position.y = tf_inv(1,3);
+  pose.pose.position.z = tf_inv(2,3);
+
+  Eigen::Matrix3f rot = tf_inv.block<3,3>(0,0);
+  Eigen::Quaternionf q(rot);
+  q.normalize();
+  pose.pose.orientation.x = q.x();
+  pose.pose.orientation.y = q.y();
+  pose.pose.orientation.z = q.z();
+  pose.pose.orientation.w = q.w();
+  std::map<std::string, ros::Publisher>::iterator pub = pose_pubs.find(id);
+  if(pub != pose_pubs.end())
+    pub->second.publish(pose);
+
+  tf::Transform tf_transform;
+  tf_transform.setOrigin(tf::Vector3(tf(0,3), tf(1,3), tf(2,3)));
+  tf_transform.setBasis(tf::Matrix3x3(tf(0,0), tf(0,1), tf(0,2),
+                                      tf(1,0), tf(1,1), tf(1,2),
+                                      tf(2,0), tf(2,1), tf(2,2)));
+  // Results arrive from several worker threads
+  boost::lock_guard<boost::mutex> lock(br_mutex);
+  br.sendTransform(tf::StampedTransform(tf_transform.inverse(), stamp, "camera", id));
+}
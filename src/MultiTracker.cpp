@@ -0,0 +1,102 @@
+#include "mesh_localize/MultiTracker.h"
+
+#include <iostream>
+#include <boost/bind.hpp>
+
+MultiTracker::MultiTracker(const Eigen::Matrix3f& K, const Eigen::VectorXf& distcoeff,
+  int num_workers) :
+    K(K),
+    distcoeff(distcoeff),
+    pool(new TrackerPool(num_workers))
+{
+}
+
+MultiTracker::~MultiTracker()
+{
+  // Workers first, then the trackers, which may still hold pipeline threads that render.
+  // The render service goes last.
+  pool.reset();
+  for(unsigned int i = 0; i < objects.size(); i++)
+  {
+    objects[i].tracker.reset();
+    delete objects[i].localizer;
+  }
+}
+
+bool MultiTracker::addObject(const std::string& id, const TrackerParams& params, int rows,
+  int cols)
+{
+  if(!objects.empty())
+  {
+    const TrackerParams& ingest = objects[0].tracker->getParams();
+    if(ingest.image_scale != params.image_scale || ingest.do_undistort != params.do_undistort)
+    {
+      std::cerr << "Object " << id << ": image_scale and do_undistort must match the other "
+        << "objects, frames are only ingested once" << std::endl;
+      return false;
+    }
+  }
+
+  MonocularLocalizer* localizer = Tracker::CreateLocalizer(params);
+  if(!localizer)
+    return false;
+  VirtualImageGenerator* vig = render_service.AddGenerator(
+    boost::bind(&Tracker::CreateImageGenerator, params, K, rows, cols));
+  if(!vig)
+  {
+    delete localizer;
+    return false;
+  }
+
+  Object object;
+  object.id = id;
+  object.localizer = localizer;
+  object.tracker.reset(new Tracker(params, K, distcoeff, localizer, vig));
+  object.tracker->setResultCallback(boost::bind(&MultiTracker::HandleResult, this, id, _1));
+  objects.push_back(object);
+  pool->add(object.tracker);
+  return true;
+}
+
+void MultiTracker::setResultCallback(const ResultCallback& cb)
+{
+  result_callback = cb;
+}
+
+std::vector<std::string> MultiTracker::getObjectIds()
+{
+  std::vector<std::string> ids;
+  for(unsigned int i = 0; i < objects.size(); i++)
+  {
+    ids.push_back(objects[i].id);
+  }
+  return ids;
+}
+
+void MultiTracker::processFrame(const cv::Mat& image, double stamp)
+{
+  if(objects.empty())
+    return;
+
+  // Converted once for all objects.  The trackers only read the frame, so they share it.
+  cv::Mat frame;
+  objects[0].tracker->prepareFrame(image, frame);
+  if(frame.data == image.data)
+  {
+    frame = frame.clone();
+  }
+  pool->submitAll(frame, stamp);
+}
+
+void MultiTracker::flush()
+{
+  pool->flush();
+}
+
+void MultiTracker::HandleResult(const std::string& id, const Tracker::PoseResult& result)
+{
+  if(result_callback)
+  {
+    result_callback(id, result);
+  }
+}
@@ -1,4 +1,5 @@
 #include "mesh_localize/PnPUtil.h"
+#include "mesh_localize/Metrics.h"
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <algorithm>
@@ -25,8 +26,12 @@ std::vector<Point3f> PnPUtil::BackprojectPts(const std::vector<Point2f>& pts, co
   return pts3d;
 }
 
-bool PnPUtil::RansacPnP(const std::vector<Point3f>& matchPts3d, const std::vector<Point2f>& matchPts, Mat Kcv, Eigen::Matrix4f tfguess, Eigen::Matrix4f& tf, std::vector<int>& bestInliersIdx, double* avgReprojError, Eigen::Matrix<float, 6, 6>* cov)
+bool PnPUtil::RansacPnP(const std::vector<Point3f>& matchPts3d, const std::vector<Point2f>& matchPts, Mat Kcv, Eigen::Matrix4f tfguess, Eigen::Matrix4f& tf, std::vector<int>& bestInliersIdx, double* avgReprojError, Eigen::Matrix<float, 6, 6>* cov, double max_time, std::mt19937* rng)
 {
+  Metrics::ScopedTimer timer("ransac_pnp");
+  std::mt19937 default_rng;
+  if(!rng)
+    rng = &default_rng;
   bestInliersIdx.clear();
   Mat distcoeffcvPnp = (Mat_<double>(4,1) << 0, 0, 0, 0);
   tf = Eigen::MatrixXf::Identity(4,4);
@@ -41,6 +46,7 @@ bool PnPUtil::RansacPnP(const std::vector<Point3f>& matchPts3d, const std::vecto
   const int niter = 50; // Assumes about 45% outliers
   const double reprojThresh = 5.0; // in pixels
   const int m = 4; // points per sample
+  const int min_iter = 10; // tested even when out of time
   const int inlier_ratio_cutoff = 0.4; 
   std::vector<int> ind;
   for(unsigned int i = 0; i < matchPts.size(); i++)
@@ -48,7 +54,16 @@ bool PnPUtil::RansacPnP(const std::vector<Point3f>& matchPts3d, const std::vecto
     ind.push_back(i);
   }
 
+  // Per hypothesis buffers, reused across iterations
+  std::vector<Point3f> rand_matchPts3d(m);
+  std::vector<Point2f> rand_matchPts(m);
+  std::vector<Point2f> reprojPts;
+  std::vector<int> inliersIdx;
+  inliersIdx.reserve(matchPts.size());
+  bestInliersIdx.reserve(matchPts.size());
+
   bool abort = false;
+  double start = (double)getTickCount()/getTickFrequency();
   //ros::Time start = ros::Time::now();
   //#pragma omp parallel for
   for(int i = 0; i < niter; i++)
@@ -58,18 +73,19 @@ bool PnPUtil::RansacPnP(const std::vector<Point3f>& matchPts3d, const std::vecto
     //{
     //  continue;
     //}
+    if(max_time >= 0 && i >= min_iter &&
+      (double)getTickCount()/getTickFrequency() - start > max_time)
+    {
+      break;
+    }
 
     Eigen::Matrix4f rand_tf;
     // Get m random points
-    std::random_shuffle(ind.begin(), ind.end());
-    std::vector<int> randInd(ind.begin(), ind.begin()+m);
-
-    std::vector<Point3f> rand_matchPts3d;
-    std::vector<Point2f> rand_matchPts;
+    std::shuffle(ind.begin(), ind.end(), *rng);
     for(int j = 0; j < m; j++)
     {
-      rand_matchPts3d.push_back(matchPts3d[randInd[j]]);
-      rand_matchPts.push_back(matchPts[randInd[j]]);
+      rand_matchPts3d[j] = matchPts3d[ind[j]];
+      rand_matchPts[j] = matchPts[ind[j]];
     }
 
     Mat ran_Rvec, ran_t;
@@ -79,9 +95,8 @@ bool PnPUtil::RansacPnP(const std::vector<Point3f>& matchPts3d, const std::vecto
     solvePnP(rand_matchPts3d, rand_matchPts, Kcv, distcoeffcvPnp, ran_Rvec, ran_t, true, CV_P3P);
 
     // Test for inliers
-    std::vector<Point2f> reprojPts;
     projectPoints(matchPts3d, ran_Rvec, ran_t, Kcv, distcoeffcvPnp, reprojPts);
-    std::vector<int> inliersIdx;
+    inliersIdx.clear();
     for(unsigned int j = 0; j < reprojPts.size(); j++)
     {
       double reprojError = sqrt((reprojPts[j].x-matchPts[j].x)*(reprojPts[j].x-matchPts[j].x) + (reprojPts[j].y-matchPts[j].y)*(reprojPts[j].y-matchPts[j].y));
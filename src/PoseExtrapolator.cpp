@@ -0,0 +1,53 @@
+#include "mesh_localize/PoseExtrapolator.h"
+
+#include <algorithm>
+#include <boost/thread/lock_guard.hpp>
+#include <unsupported/Eigen/MatrixFunctions>
+
+PoseExtrapolator::PoseExtrapolator(double max_age) :
+  max_age(max_age),
+  valid(false),
+  estimate_stamp(0),
+  estimate(Eigen::Matrix4f::Identity()),
+  velocity(Eigen::Matrix4f::Zero())
+{
+}
+
+void PoseExtrapolator::update(double stamp, const Eigen::Matrix4f& pose,
+  const Eigen::Matrix4f& vel)
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  // An estimate that arrives late doesn't replace a newer one
+  if(valid && stamp < estimate_stamp)
+    return;
+  valid = true;
+  estimate_stamp = stamp;
+  estimate = pose;
+  velocity = vel;
+}
+
+void PoseExtrapolator::reset()
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  valid = false;
+}
+
+bool PoseExtrapolator::predict(double stamp, Eigen::Matrix4f& pose, double& age)
+{
+  Eigen::Matrix4f last, vel;
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if(!valid)
+      return false;
+    age = stamp - estimate_stamp;
+    last = estimate;
+    vel = velocity;
+  }
+  if(max_age > 0 && age > max_age)
+    return false;
+
+  // Requests for times before the estimate (clock skew between the camera and the
+  // caller) get the estimate itself rather than a backwards prediction
+  pose = (std::max(age, 0.0)*vel).exp()*last;
+  return true;
+}
@@ -0,0 +1,137 @@
+#include "mesh_localize/RenderService.h"
+#include "mesh_localize/Trace.h"
+
+#include <boost/bind.hpp>
+
+class RenderService::Proxy : public VirtualImageGenerator
+{
+public:
+  Proxy(RenderService* service, VirtualImageGenerator* gen, const Eigen::Matrix3f& K) :
+    service(service),
+    gen(gen),
+    K(K)
+  {
+  }
+
+  virtual cv::Mat GenerateVirtualImage(const Eigen::Matrix4f& pose, cv::Mat& depth,
+    cv::Mat& mask)
+  {
+    cv::Mat img;
+    Eigen::Matrix4f render_pose = pose;
+    service->Execute([this, &img, &render_pose, &depth, &mask]()
+    {
+      img = gen->GenerateVirtualImage(render_pose, depth, mask);
+    });
+    return img;
+  }
+
+  // The intrinsics are fixed once the generator is created, so they are read on the
+  // render thread up front instead of round tripping for every call
+  virtual Eigen::Matrix3f GetK()
+  {
+    return K;
+  }
+
+private:
+  RenderService* service;
+  VirtualImageGenerator* gen;
+  Eigen::Matrix3f K;
+};
+
+RenderService::RenderService() :
+  running(true)
+{
+  render_thread = boost::thread(&RenderService::RenderLoop, this);
+}
+
+RenderService::~RenderService()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    running = false;
+  }
+  request_cond.notify_all();
+  render_thread.join();
+  for(unsigned int i = 0; i < proxies.size(); i++)
+  {
+    delete proxies[i];
+  }
+}
+
+VirtualImageGenerator* RenderService::AddGenerator(const Factory& factory)
+{
+  VirtualImageGenerator* gen = NULL;
+  Eigen::Matrix3f K;
+  Execute(boost::bind(&RenderService::CreateGenerator, this, factory, &gen, &K));
+  if(!gen)
+    return NULL;
+
+  Proxy* proxy = new Proxy(this, gen, K);
+  boost::lock_guard<boost::mutex> lock(mutex);
+  proxies.push_back(proxy);
+  return proxy;
+}
+
+void RenderService::CreateGenerator(const Factory& factory, VirtualImageGenerator** gen,
+  Eigen::Matrix3f* K)
+{
+  *gen = factory();
+  if(*gen)
+  {
+    *K = (*gen)->GetK();
+    generators.push_back(*gen);
+  }
+}
+
+void RenderService::Execute(const boost::function<void ()>& work)
+{
+  if(boost::this_thread::get_id() == render_thread.get_id())
+  {
+    work();
+    return;
+  }
+
+  Request request;
+  request.work = work;
+  request.done = false;
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+  if(!running)
+    return;
+  requests.push_back(&request);
+  request_cond.notify_one();
+  while(!request.done)
+  {
+    done_cond.wait(lock);
+  }
+}
+
+void RenderService::RenderLoop()
+{
+  Tracer::SetThreadName("render");
+  boost::unique_lock<boost::mutex> lock(mutex);
+  while(true)
+  {
+    while(running && requests.empty())
+    {
+      request_cond.wait(lock);
+    }
+    if(requests.empty())
+      break;
+
+    Request* request = requests.front();
+    requests.pop_front();
+    lock.unlock();
+    request->work();
+    lock.lock();
+    request->done = true;
+    done_cond.notify_all();
+  }
+
+  // Generators are torn down on the thread that owns their context
+  for(unsigned int i = 0; i < generators.size(); i++)
+  {
+    delete generators[i];
+  }
+  generators.clear();
+}
@@ -0,0 +1,49 @@
+#include "mesh_localize/RosParams.h"
+
+void ReadTrackerParams(const ros::NodeHandle& nh, TrackerParams& params)
+{
+  nh.param("global_localization_alg", params.global_localization_alg, params.global_localization_alg);
+  nh.param("img_match_descriptor_type", params.img_match_descriptor_type, params.img_match_descriptor_type);
+  nh.param("photoscan_filename", params.photoscan_filename, params.photoscan_filename);
+  nh.param("ogre_data_dir", params.ogre_data_dir, params.ogre_data_dir);
+  nh.param("load_descriptors", params.load_descriptors, params.load_descriptors);
+  nh.param("descriptor_filename", params.descriptor_filename, params.descriptor_filename);
+  nh.param("show_global_matches", params.show_global_matches, params.show_global_matches);
+  nh.param("keyframe_cache_filename", params.keyframe_cache_filename, params.keyframe_cache_filename);
+  nh.param("virtual_image_source", params.virtual_image_source, params.virtual_image_source);
+  nh.param("point_cloud_filename", params.pc_filename, params.pc_filename);
+  nh.param("ogre_cfg_dir", params.ogre_cfg_dir, params.ogre_cfg_dir);
+  nh.param("ogre_model", params.ogre_model, params.ogre_model);
+  nh.param("virtual_fx", params.virtual_fx, params.virtual_fx);
+  nh.param("virtual_fy", params.virtual_fy, params.virtual_fy);
+  nh.param("use_depth_shader", params.use_depth_shader, params.use_depth_shader);
+  nh.param("tracking_mode", params.tracking_mode, params.tracking_mode);
+  nh.param("pnp_descriptor_type", params.pnp_descriptor_type, params.pnp_descriptor_type);
+  nh.param("motion_model", params.motion_model, params.motion_model);
+  nh.param("image_scale", params.image_scale, params.image_scale);
+  nh.param("do_undistort", params.do_undistort, params.do_undistort);
+  nh.param("min_pnp_inliers", params.min_pnp_inliers, params.min_pnp_inliers);
+  nh.param("max_pnp_reproj_error", params.max_pnp_reproj_error, params.max_pnp_reproj_error);
+  nh.param("ratio_test_thresh", params.ratio_test_thresh, params.ratio_test_thresh);
+  nh.param("pnp_match_radius", params.pnp_match_radius, params.pnp_match_radius);
+  nh.param("pixel_noise", params.pixel_noise, params.pixel_noise);
+  nh.param("edge_tracking_iterations", params.edge_tracking_iterations, params.edge_tracking_iterations);
+  nh.param("edge_tracking_dmax", params.edge_tracking_dmax, params.edge_tracking_dmax);
+  nh.param("canny_high_thresh", params.canny_high_thresh, params.canny_high_thresh);
+  nh.param("canny_low_thresh", params.canny_low_thresh, params.canny_low_thresh);
+  nh.param("canny_sigma", params.canny_sigma, params.canny_sigma);
+  nh.param("autotune_canny", params.autotune_canny, params.autotune_canny);
+  nh.param("pipeline_tracking", params.pipeline_tracking, params.pipeline_tracking);
+  nh.param("async_relocalization", params.async_relocalization, params.async_relocalization);
+  nh.param("lost_retry_period", params.lost_retry_period, params.lost_retry_period);
+  nh.param("lost_image_scale", params.lost_image_scale, params.lost_image_scale);
+  nh.param("lost_change_thresh", params.lost_change_thresh, params.lost_change_thresh);
+  nh.param("random_seed", params.random_seed, params.random_seed);
+  nh.param("target_latency", params.target_latency, params.target_latency);
+  nh.param("min_image_scale", params.min_image_scale, params.min_image_scale);
+  nh.param("task_threads", params.task_threads, params.task_threads);
+  nh.param("task_cpus", params.task_cpus, params.task_cpus);
+  nh.param("pose_extrapolation_max_age", params.pose_extrapolation_max_age, params.pose_extrapolation_max_age);
+  nh.param("show_pnp_matches", params.show_pnp_matches, params.show_pnp_matches);
+  nh.param("show_debug", params.show_debug, params.show_debug);
+}
@@ -0,0 +1,229 @@
+#include "mesh_localize/SequenceGenerator.h"
+
+#include <cmath>
+#include <algorithm>
+#include <Eigen/Geometry>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace cv;
+
+namespace
+{
+  // How much the random walk changes direction per step
+  const float kDirectionNoise = 0.3;
+  // Occluders cross this many of their widths per second, at random between the two
+  const float kOccluderMinSpeed = 0.5;
+  const float kOccluderMaxSpeed = 2.0;
+
+  // Camera looking from position at target, z forward and y down as the renderer expects
+  Eigen::Matrix3f LookAt(const Eigen::Vector3f& position, const Eigen::Vector3f& target)
+  {
+    Eigen::Vector3f z = (target - position).normalized();
+    Eigen::Vector3f x = z.cross(Eigen::Vector3f::UnitZ());
+    if(x.norm() < 1e-6)
+      x = Eigen::Vector3f::UnitX();
+    x.normalize();
+    Eigen::Matrix3f R;
+    R.col(0) = x;
+    R.col(1) = z.cross(x);
+    R.col(2) = z;
+    return R;
+  }
+
+  // Tilts about the camera x and y axes, then turns about the optical axis
+  Eigen::Matrix3f Attitude(const Eigen::Vector3f& attitude)
+  {
+    return (Eigen::AngleAxisf(attitude(0), Eigen::Vector3f::UnitX()) *
+      Eigen::AngleAxisf(attitude(1), Eigen::Vector3f::UnitY()) *
+      Eigen::AngleAxisf(attitude(2), Eigen::Vector3f::UnitZ())).toRotationMatrix();
+  }
+}
+
+SequenceParams::SequenceParams() :
+  trajectory("random_walk"),
+  fps(30),
+  speed(3),
+  angular_speed(0.5),
+  xy_bound(4),
+  z_lower(8),
+  z_upper(12),
+  max_tilt(0.3),
+  orbit_radius(10),
+  orbit_height(5),
+  image_noise(0),
+  exposure(0),
+  blur_samples(8),
+  num_occluders(0),
+  occluder_size(0.2),
+  seed(0)
+{
+}
+
+SequenceGenerator::SequenceGenerator(const SequenceParams& params, VirtualImageGenerator* vig) :
+  params(params),
+  vig(vig),
+  rng(params.seed),
+  frame_index(0),
+  position(0, 0, 0.5*(params.z_lower + params.z_upper)),
+  attitude(0, 0, 0),
+  orbit_angle(0)
+{
+  direction = Eigen::Vector3f(rng.gaussian(1), rng.gaussian(1), rng.gaussian(1));
+  direction.normalize();
+  // Starts at rest, the first frame has no motion blur
+  Step();
+}
+
+Eigen::Matrix3f SequenceGenerator::GetK()
+{
+  return vig->GetK();
+}
+
+void SequenceGenerator::next(Frame& frame)
+{
+  Eigen::Matrix4f prev = pose;
+  if(frame_index > 0)
+    Step();
+  frame.stamp = frame_index/params.fps;
+  frame.pose = pose;
+  Render(prev, frame);
+  frame_index++;
+}
+
+void SequenceGenerator::Step()
+{
+  double dt = 1.0/params.fps;
+  if(params.trajectory == "orbit")
+    StepOrbit(frame_index > 0 ? dt : 0);
+  else
+    StepRandomWalk(frame_index > 0 ? dt : 0);
+}
+
+void SequenceGenerator::StepRandomWalk(double dt)
+{
+  direction += kDirectionNoise*Eigen::Vector3f(rng.gaussian(1), rng.gaussian(1),
+    rng.gaussian(1));
+  direction.normalize();
+  position += params.speed*dt*direction;
+
+  // Bounce off the walls of the box
+  Eigen::Vector3f lower(-params.xy_bound, -params.xy_bound, params.z_lower);
+  Eigen::Vector3f upper(params.xy_bound, params.xy_bound, params.z_upper);
+  for(int i = 0; i < 3; i++)
+  {
+    if(position(i) < lower(i) || position(i) > upper(i))
+    {
+      position(i) = std::min(std::max(position(i), lower(i)), upper(i));
+      direction(i) = -direction(i);
+    }
+  }
+
+  double max_turn = params.angular_speed*dt;
+  for(int i = 0; i < 3; i++)
+  {
+    attitude(i) += rng.uniform(-max_turn, max_turn);
+  }
+  attitude(0) = std::min(std::max(attitude(0), (float)-params.max_tilt), (float)params.max_tilt);
+  attitude(1) = std::min(std::max(attitude(1), (float)-params.max_tilt), (float)params.max_tilt);
+
+  // Looking straight down at the object, as the original random walk did
+  Eigen::Matrix3f down;
+  down << 1, 0, 0,
+          0, -1, 0,
+          0, 0, -1;
+  pose = Eigen::Matrix4f::Identity();
+  pose.block<3,3>(0,0) = down*Attitude(attitude);
+  pose.block<3,1>(0,3) = position;
+}
+
+void SequenceGenerator::StepOrbit(double dt)
+{
+  orbit_angle += params.speed*dt/params.orbit_radius;
+  attitude(2) += params.angular_speed*dt;
+  position = Eigen::Vector3f(params.orbit_radius*cos(orbit_angle),
+    params.orbit_radius*sin(orbit_angle), params.orbit_height);
+
+  pose = Eigen::Matrix4f::Identity();
+  pose.block<3,3>(0,0) = LookAt(position, Eigen::Vector3f::Zero())*Attitude(attitude);
+  pose.block<3,1>(0,3) = position;
+}
+
+Eigen::Matrix4f SequenceGenerator::Interpolate(const Eigen::Matrix4f& a,
+  const Eigen::Matrix4f& b, double t)
+{
+  Eigen::Quaternionf qa(Eigen::Matrix3f(a.block<3,3>(0,0)));
+  Eigen::Quaternionf qb(Eigen::Matrix3f(b.block<3,3>(0,0)));
+  Eigen::Matrix4f tf = Eigen::Matrix4f::Identity();
+  tf.block<3,3>(0,0) = qa.slerp(t, qb).toRotationMatrix();
+  tf.block<3,1>(0,3) = (1-t)*a.block<3,1>(0,3) + t*b.block<3,1>(0,3);
+  return tf;
+}
+
+void SequenceGenerator::Render(const Eigen::Matrix4f& prev, Frame& frame)
+{
+  Mat mask;
+  frame.image = vig->GenerateVirtualImage(pose, frame.depth, mask).clone();
+  frame.depth = frame.depth.clone();
+  int type = frame.image.type();
+
+  // Motion blur: the average of renders spread over the exposure, which ends at pose
+  Mat acc;
+  if(params.exposure > 0 && params.blur_samples > 1)
+  {
+    frame.image.convertTo(acc, CV_32F);
+    for(int s = 0; s < params.blur_samples-1; s++)
+    {
+      double t = 1 - params.exposure*(params.blur_samples-1-s)/(params.blur_samples-1);
+      Mat depth, sample;
+      vig->GenerateVirtualImage(Interpolate(prev, pose, t), depth, mask).convertTo(sample,
+        CV_32F);
+      acc += sample;
+    }
+    acc /= params.blur_samples;
+  }
+
+  DrawOccluders(acc.empty() ? frame.image : acc);
+
+  if(params.image_noise > 0)
+  {
+    if(acc.empty())
+      frame.image.convertTo(acc, CV_32F);
+    Mat noise(acc.size(), acc.type());
+    rng.fill(noise, RNG::NORMAL, 0, params.image_noise);
+    acc += noise;
+  }
+  if(!acc.empty())
+    acc.convertTo(frame.image, type);
+}
+
+void SequenceGenerator::DrawOccluders(Mat& image)
+{
+  float width = params.occluder_size*image.cols;
+  if(occluders.empty())
+  {
+    for(int i = 0; i < params.num_occluders; i++)
+    {
+      Occluder o;
+      float height = width*rng.uniform(0.5f, 1.5f);
+      o.rect = Rect_<float>(rng.uniform(0.f, (float)image.cols), rng.uniform(0.f,
+        (float)image.rows), width, height);
+      float angle = rng.uniform(0.f, (float)(2*M_PI));
+      float speed = width*rng.uniform(kOccluderMinSpeed, kOccluderMaxSpeed)/params.fps;
+      o.velocity = Point2f(speed*cos(angle), speed*sin(angle));
+      o.gray = rng.uniform(0, 256);
+      occluders.push_back(o);
+    }
+  }
+
+  for(unsigned int i = 0; i < occluders.size(); i++)
+  {
+    Occluder& o = occluders[i];
+    // Wrap around, so occluders keep crossing the image
+    o.rect.x = fmod(o.rect.x + o.velocity.x + image.cols + o.rect.width,
+      image.cols + o.rect.width) - o.rect.width;
+    o.rect.y = fmod(o.rect.y + o.velocity.y + image.rows + o.rect.height,
+      image.rows + o.rect.height) - o.rect.height;
+    rectangle(image, Point(o.rect.x, o.rect.y),
+      Point(o.rect.x + o.rect.width, o.rect.y + o.rect.height), Scalar::all(o.gray), CV_FILLED);
+  }
+}
@@ -0,0 +1,259 @@
+#include "mesh_localize/SequenceUtil.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <dirent.h>
+#include <opencv2/highgui/highgui.hpp>
+#include <Eigen/Geometry>
+
+using namespace cv;
+
+namespace
+{
+  bool HasImageExtension(std::string name)
+  {
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    size_t dot = name.find_last_of('.');
+    if(dot == std::string::npos)
+      return false;
+    std::string ext = name.substr(dot+1);
+    return ext == "jpg" || ext == "png";
+  }
+}
+
+SequenceUtil::PoseRecord::PoseRecord() :
+  frame(-1),
+  stamp(0),
+  state(0),
+  valid(false),
+  x(0), y(0), z(0),
+  qx(0), qy(0), qz(0), qw(1)
+{
+}
+
+bool SequenceUtil::LoadIntrinsics(std::string filename, Eigen::Matrix3f& K,
+  Eigen::VectorXf& distcoeff)
+{
+  FileStorage fs(filename, FileStorage::READ);
+  if(!fs.isOpened())
+  {
+    std::cerr << "Could not open intrinsics " << filename << std::endl;
+    return false;
+  }
+  Mat Kcv, dcv;
+  fs["camera_matrix"] >> Kcv;
+  fs["distortion_coefficients"] >> dcv;
+  if(Kcv.rows != 3 || Kcv.cols != 3)
+  {
+    std::cerr << filename << " has no 3x3 camera_matrix" << std::endl;
+    return false;
+  }
+  Kcv.convertTo(Kcv, CV_64F);
+  for(int i = 0; i < 3; i++)
+  {
+    for(int j = 0; j < 3; j++)
+    {
+      K(i,j) = Kcv.at<double>(i,j);
+    }
+  }
+
+  dcv.convertTo(dcv, CV_64F);
+  distcoeff = Eigen::VectorXf::Zero(std::max((int)dcv.total(), 5));
+  for(unsigned int i = 0; i < dcv.total(); i++)
+  {
+    distcoeff(i) = dcv.at<double>(i);
+  }
+  return true;
+}
+
+bool SequenceUtil::WriteIntrinsics(std::string filename, const Eigen::Matrix3f& K,
+  const Eigen::VectorXf& distcoeff)
+{
+  FileStorage fs(filename, FileStorage::WRITE);
+  if(!fs.isOpened())
+  {
+    std::cerr << "Could not open intrinsics " << filename << std::endl;
+    return false;
+  }
+  Mat Kcv(3, 3, CV_64F), dcv(1, distcoeff.size(), CV_64F);
+  for(int i = 0; i < 3; i++)
+  {
+    for(int j = 0; j < 3; j++)
+    {
+      Kcv.at<double>(i,j) = K(i,j);
+    }
+  }
+  for(int i = 0; i < distcoeff.size(); i++)
+  {
+    dcv.at<double>(i) = distcoeff(i);
+  }
+  fs << "camera_matrix" << Kcv;
+  fs << "distortion_coefficients" << dcv;
+  return true;
+}
+
+bool SequenceUtil::ListFrames(std::string source, double fps, std::vector<Frame>& frames)
+{
+  frames.clear();
+  DIR* dp = opendir(source.c_str());
+  if(dp != NULL)
+  {
+    closedir(dp);
+    return ListImageDir(source, fps, frames);
+  }
+  return ListStreamFile(source, frames);
+}
+
+bool SequenceUtil::ListStreamFile(std::string filename, std::vector<Frame>& frames)
+{
+  std::ifstream in(filename.c_str());
+  if(!in.is_open())
+  {
+    std::cerr << "Could not open " << filename << std::endl;
+    return false;
+  }
+  std::string base_dir;
+  size_t slash = filename.find_last_of('/');
+  if(slash != std::string::npos)
+  {
+    base_dir = filename.substr(0, slash+1);
+  }
+
+  std::string line;
+  while(std::getline(in, line))
+  {
+    if(line.empty() || line[0] == '#')
+      continue;
+    std::istringstream ss(line);
+    Frame frame;
+    if(!(ss >> frame.stamp >> frame.path))
+    {
+      std::cerr << "Skipping malformed line: " << line << std::endl;
+      continue;
+    }
+    if(frame.path[0] != '/')
+      frame.path = base_dir + frame.path;
+    frames.push_back(frame);
+  }
+  return frames.size() > 0;
+}
+
+bool SequenceUtil::ListImageDir(std::string dir, double fps, std::vector<Frame>& frames)
+{
+  DIR* dp = opendir(dir.c_str());
+  if(dp == NULL)
+  {
+    std::cerr << "Could not open directory " << dir << std::endl;
+    return false;
+  }
+  std::vector<std::string> names;
+  struct dirent* ep;
+  while((ep = readdir(dp)))
+  {
+    if(ep->d_name[0] != '.' && HasImageExtension(ep->d_name))
+      names.push_back(ep->d_name);
+  }
+  closedir(dp);
+
+  // readdir order is arbitrary
+  std::sort(names.begin(), names.end());
+  for(unsigned int i = 0; i < names.size(); i++)
+  {
+    Frame frame;
+    frame.path = dir + "/" + names[i];
+    frame.stamp = i/fps;
+    frames.push_back(frame);
+  }
+  return frames.size() > 0;
+}
+
+bool SequenceUtil::LoadImages(std::vector<Frame>& frames)
+{
+  for(unsigned int i = 0; i < frames.size(); i++)
+  {
+    frames[i].image = imread(frames[i].path);
+    if(frames[i].image.empty())
+    {
+      std::cerr << "Could not read " << frames[i].path << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+SequenceUtil::PoseRecord SequenceUtil::MakePoseRecord(int frame,
+  const Tracker::PoseResult& result)
+{
+  PoseRecord rec;
+  rec.frame = frame;
+  rec.stamp = result.stamp;
+  rec.state = result.state;
+  rec.valid = result.valid;
+
+  // Same convention as /mesh_localize/estimated_pose
+  Eigen::Matrix4f tf_inv = Eigen::Matrix4f(result.pose).inverse();
+  Eigen::Matrix3f rot = tf_inv.block<3,3>(0,0);
+  Eigen::Quaternionf q(rot);
+  q.normalize();
+  rec.x = tf_inv(0,3);
+  rec.y = tf_inv(1,3);
+  rec.z = tf_inv(2,3);
+  rec.qx = q.x();
+  rec.qy = q.y();
+  rec.qz = q.z();
+  rec.qw = q.w();
+  return rec;
+}
+
+Eigen::Matrix4f SequenceUtil::PoseRecordToMatrix(const PoseRecord& rec)
+{
+  Eigen::Quaternionf q(rec.qw, rec.qx, rec.qy, rec.qz);
+  Eigen::Matrix4f tf = Eigen::Matrix4f::Identity();
+  tf.block<3,3>(0,0) = q.normalized().toRotationMatrix();
+  tf(0,3) = rec.x;
+  tf(1,3) = rec.y;
+  tf(2,3) = rec.z;
+  return tf;
+}
+
+void SequenceUtil::WritePoseHeader(std::ostream& out)
+{
+  out << "frame,stamp,state,valid,x,y,z,qx,qy,qz,qw" << std::endl;
+}
+
+void SequenceUtil::WritePose(std::ostream& out, const PoseRecord& rec)
+{
+  std::streamsize precision = out.precision(9);
+  out << rec.frame << "," << rec.stamp << "," << rec.state << "," << rec.valid << ","
+    << rec.x << "," << rec.y << "," << rec.z << ","
+    << rec.qx << "," << rec.qy << "," << rec.qz << "," << rec.qw << std::endl;
+  out.precision(precision);
+}
+
+bool SequenceUtil::ReadPoses(std::string filename, std::vector<PoseRecord>& poses)
+{
+  std::ifstream in(filename.c_str());
+  if(!in.is_open())
+  {
+    std::cerr << "Could not open " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  std::getline(in, line); // header
+  while(std::getline(in, line))
+  {
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream ss(line);
+    PoseRecord rec;
+    int valid;
+    if(!(ss >> rec.frame >> rec.stamp >> rec.state >> valid >> rec.x >> rec.y >> rec.z
+      >> rec.qx >> rec.qy >> rec.qz >> rec.qw))
+    {
+      continue;
+    }
+    rec.valid = valid != 0;
+    poses.push_back(rec);
+  }
+  return true;
+}
@@ -0,0 +1,97 @@
+#include "mesh_localize/SnapshotUtil.h"
+
+#include <fstream>
+#include <cstdio>
+
+void SnapshotUtil::WriteString(std::ostream& out, const std::string& str)
+{
+  Write(out, (unsigned int)str.size());
+  out.write(str.data(), str.size());
+}
+
+bool SnapshotUtil::ReadString(std::istream& in, std::string& str)
+{
+  unsigned int size;
+  if(!Read(in, size))
+    return false;
+  str.resize(size);
+  return size == 0 || bool(in.read(&str[0], size));
+}
+
+void SnapshotUtil::WriteMat(std::ostream& out, const cv::Mat& mat)
+{
+  Write(out, mat.rows);
+  Write(out, mat.cols);
+  Write(out, mat.type());
+  size_t row_size = mat.cols*mat.elemSize();
+  for(int i = 0; i < mat.rows; i++)
+  {
+    out.write(reinterpret_cast<const char*>(mat.ptr(i)), row_size);
+  }
+}
+
+bool SnapshotUtil::ReadMat(std::istream& in, cv::Mat& mat)
+{
+  int rows, cols, type;
+  if(!Read(in, rows) || !Read(in, cols) || !Read(in, type) || rows < 0 || cols < 0)
+    return false;
+  if(rows == 0 || cols == 0)
+  {
+    mat = cv::Mat();
+    return true;
+  }
+  mat.create(rows, cols, type);
+  return bool(in.read(reinterpret_cast<char*>(mat.data), mat.total()*mat.elemSize()));
+}
+
+void SnapshotUtil::WriteHeader(std::ostream& out, const std::string& magic, int version)
+{
+  WriteString(out, magic);
+  Write(out, version);
+}
+
+bool SnapshotUtil::ReadHeader(std::istream& in, const std::string& magic, int version)
+{
+  std::string file_magic;
+  int file_version;
+  if(!ReadString(in, file_magic) || file_magic != magic || !Read(in, file_version))
+  {
+    std::cerr << "Not a " << magic << " file" << std::endl;
+    return false;
+  }
+  if(file_version != version)
+  {
+    std::cerr << magic << " file has version " << file_version << ", expected " << version
+      << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SnapshotUtil::WriteFile(const std::string& filename,
+  const boost::function<bool (std::ostream&)>& write)
+{
+  std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream out(tmp_filename.c_str(), std::ios::out | std::ios::binary);
+    if(!out.is_open())
+    {
+      std::cerr << "Could not open " << tmp_filename << std::endl;
+      return false;
+    }
+    if(!write(out) || !out.flush())
+    {
+      std::cerr << "Could not write " << tmp_filename << std::endl;
+      out.close();
+      std::remove(tmp_filename.c_str());
+      return false;
+    }
+  }
+  if(std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+  {
+    std::cerr << "Could not replace " << filename << std::endl;
+    std::remove(tmp_filename.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,387 @@
+#include "mesh_localize/TaskScheduler.h"
+#include "mesh_localize/Trace.h"
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <boost/bind.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+  // Parallel loops are split into this many chunks per thread, so that stealing can even
+  // out chunks of uneven cost
+  const int kChunksPerThread = 4;
+  // Waiting threads look for new tasks at least this often
+  const int kWaitPollMs = 1;
+
+  // Worker index of the calling thread, or -1 if it is not a worker
+  thread_local TaskScheduler* current_scheduler = NULL;
+  thread_local int current_worker = -1;
+  thread_local unsigned int steal_start = 0;
+
+  void PinThread(int cpu)
+  {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    {
+      std::cerr << "TaskScheduler: could not pin worker to cpu " << cpu << std::endl;
+    }
+#else
+    std::cerr << "TaskScheduler: pinning is only supported on Linux" << std::endl;
+#endif
+  }
+
+  void RunRange(const boost::function<void (int)>& body, int begin, int end)
+  {
+    for(int i = begin; i < end; i++)
+    {
+      body(i);
+    }
+  }
+
+  int NumThreads(int num_threads)
+  {
+    if(num_threads <= 0)
+      num_threads = boost::thread::hardware_concurrency();
+    return num_threads > 0 ? num_threads : 1;
+  }
+}
+
+boost::mutex TaskScheduler::instance_mutex;
+TaskScheduler* TaskScheduler::instance = NULL;
+int TaskScheduler::config_threads = 0;
+std::vector<int> TaskScheduler::config_cpus;
+
+bool TaskScheduler::Configure(int num_threads, const std::vector<int>& cpus)
+{
+  boost::lock_guard<boost::mutex> lock(instance_mutex);
+  num_threads = NumThreads(num_threads);
+  if(instance)
+  {
+    if((int)instance->workers.size() == num_threads && instance->cpus == cpus)
+      return true;
+    std::cerr << "TaskScheduler: already running with " << instance->workers.size()
+      << " threads, ignoring the new configuration" << std::endl;
+    return false;
+  }
+  config_threads = num_threads;
+  config_cpus = cpus;
+  return true;
+}
+
+std::vector<int> TaskScheduler::ParseCpuList(const std::string& list)
+{
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ','))
+  {
+    if(item.empty())
+      continue;
+    int first, last;
+    char dash;
+    std::istringstream range(item);
+    if(!(range >> first))
+    {
+      std::cerr << "TaskScheduler: bad cpu list entry " << item << std::endl;
+      continue;
+    }
+    last = first;
+    if(range >> dash && (dash != '-' || !(range >> last)))
+    {
+      std::cerr << "TaskScheduler: bad cpu list entry " << item << std::endl;
+      continue;
+    }
+    for(int cpu = first; cpu <= last; cpu++)
+    {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+TaskScheduler& TaskScheduler::Instance()
+{
+  boost::lock_guard<boost::mutex> lock(instance_mutex);
+  if(!instance)
+  {
+    instance = new TaskScheduler(NumThreads(config_threads), config_cpus);
+  }
+  return *instance;
+}
+
+TaskScheduler::TaskScheduler(int num_threads, const std::vector<int>& cpus) :
+  cpus(cpus),
+  num_queued(0)
+{
+  for(int i = 0; i < num_threads; i++)
+  {
+    workers.push_back(new Worker);
+  }
+  // Workers only start once every deque exists, they steal from all of them
+  for(int i = 0; i < num_threads; i++)
+  {
+    workers[i]->thread = boost::thread(boost::bind(&TaskScheduler::WorkerLoop, this, i));
+  }
+}
+
+int TaskScheduler::getNumThreads()
+{
+  return workers.size();
+}
+
+void TaskScheduler::parallelFor(int begin, int end, const boost::function<void (int)>& body)
+{
+  int n = end - begin;
+  if(n <= 0)
+    return;
+  int chunks = std::min(n, kChunksPerThread*(getNumThreads()+1));
+
+  TaskGroup group(*this);
+  for(int c = 1; c < chunks; c++)
+  {
+    group.run(boost::bind(RunRange, boost::cref(body), begin + (long)n*c/chunks,
+      begin + (long)n*(c+1)/chunks));
+  }
+  // The first chunk runs right away on the calling thread
+  std::exception_ptr error;
+  try
+  {
+    RunRange(body, begin, begin + n/chunks);
+  }
+  catch(...)
+  {
+    error = std::current_exception();
+  }
+  group.wait();
+  if(error)
+    std::rethrow_exception(error);
+}
+
+void TaskScheduler::Spawn(const Task& task, TaskGroup* group)
+{
+  Item item;
+  item.task = task;
+  item.group = group;
+  if(current_scheduler == this && current_worker >= 0)
+  {
+    Worker* worker = workers[current_worker];
+    boost::lock_guard<boost::mutex> lock(worker->mutex);
+    worker->items.push_back(item);
+  }
+  else
+  {
+    boost::lock_guard<boost::mutex> lock(shared_mutex);
+    shared_items.push_back(item);
+  }
+  num_queued++;
+  {
+    // Taking the lock orders the wakeup after a worker's check of num_queued
+    boost::lock_guard<boost::mutex> lock(sleep_mutex);
+  }
+  sleep_cond.notify_one();
+}
+
+bool TaskScheduler::Take(Item& item)
+{
+  int self = current_scheduler == this ? current_worker : -1;
+  if(self >= 0)
+  {
+    // Newest first, its data is most likely still in cache
+    Worker* worker = workers[self];
+    boost::lock_guard<boost::mutex> lock(worker->mutex);
+    if(!worker->items.empty())
+    {
+      item = worker->items.back();
+      worker->items.pop_back();
+      num_queued--;
+      return true;
+    }
+  }
+  {
+    boost::lock_guard<boost::mutex> lock(shared_mutex);
+    if(!shared_items.empty())
+    {
+      item = shared_items.front();
+      shared_items.pop_front();
+      num_queued--;
+      return true;
+    }
+  }
+  // Steal the oldest task, which usually stands for the most remaining work
+  unsigned int start = self >= 0 ? self + 1 : steal_start++;
+  for(unsigned int n = 0; n < workers.size(); n++)
+  {
+    int i = (start + n) % workers.size();
+    if(i == self)
+      continue;
+    boost::lock_guard<boost::mutex> lock(workers[i]->mutex);
+    if(!workers[i]->items.empty())
+    {
+      item = workers[i]->items.front();
+      workers[i]->items.pop_front();
+      num_queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TaskScheduler::TakeGroupFrom(std::deque<Item>& items, TaskGroup* group, Item& item)
+{
+  // Newest first, like a worker's own tasks
+  for(std::deque<Item>::reverse_iterator it = items.rbegin(); it != items.rend(); ++it)
+  {
+    if(it->group == group)
+    {
+      item = *it;
+      items.erase(--it.base());
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TaskScheduler::TakeGroup(Item& item, TaskGroup* group)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(shared_mutex);
+    if(TakeGroupFrom(shared_items, group, item))
+    {
+      num_queued--;
+      return true;
+    }
+  }
+  // Nested spawns of the group's tasks go to the deques of the workers running them
+  for(unsigned int i = 0; i < workers.size(); i++)
+  {
+    boost::lock_guard<boost::mutex> lock(workers[i]->mutex);
+    if(TakeGroupFrom(workers[i]->items, group, item))
+    {
+      num_queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::Run(Item& item)
+{
+  std::exception_ptr error;
+  try
+  {
+    item.task();
+  }
+  catch(...)
+  {
+    error = std::current_exception();
+  }
+  item.group->Finish(error);
+}
+
+void TaskScheduler::WorkerLoop(int index)
+{
+  Tracer::SetThreadName("task_worker");
+  current_scheduler = this;
+  current_worker = index;
+  if(!cpus.empty())
+    PinThread(cpus[index % cpus.size()]);
+
+  while(true)
+  {
+    Item item;
+    if(Take(item))
+    {
+      Run(item);
+      continue;
+    }
+    boost::unique_lock<boost::mutex> lock(sleep_mutex);
+    while(num_queued == 0)
+    {
+      sleep_cond.wait(lock);
+    }
+  }
+}
+
+TaskGroup::TaskGroup(TaskScheduler& scheduler) :
+  scheduler(scheduler),
+  pending(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+  try
+  {
+    wait();
+  }
+  catch(...)
+  {
+  }
+}
+
+void TaskGroup::run(const TaskScheduler::Task& task)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    pending++;
+  }
+  scheduler.Spawn(task, this);
+}
+
+void TaskGroup::Finish(std::exception_ptr task_error)
+{
+  // Notified under the lock, so wait() cannot return and destroy the group before this
+  // is done with it
+  boost::lock_guard<boost::mutex> lock(mutex);
+  if(task_error && !error)
+    error = task_error;
+  if(--pending == 0)
+    done_cond.notify_all();
+}
+
+void TaskGroup::wait()
+{
+  while(true)
+  {
+    {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      if(pending == 0)
+        break;
+    }
+    // Help out with this group's tasks instead of blocking, they may be queued behind
+    // others.  Other groups' tasks are left alone, they may be far longer than this wait.
+    TaskScheduler::Item item;
+    if(scheduler.TakeGroup(item, this))
+    {
+      scheduler.Run(item);
+      continue;
+    }
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if(pending == 0)
+      continue;
+    // Running tasks of the group may still spawn more of them, workers keep looking.
+    // Other threads only ever spawned into the shared queue, which they just emptied.
+    if(current_scheduler == &scheduler && current_worker >= 0)
+      done_cond.timed_wait(lock, boost::posix_time::milliseconds(kWaitPollMs));
+    else
+      done_cond.wait(lock);
+  }
+
+  boost::lock_guard<boost::mutex> lock(mutex);
+  if(error)
+  {
+    std::exception_ptr e = error;
+    error = std::exception_ptr();
+    std::rethrow_exception(e);
+  }
+}
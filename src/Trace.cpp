@@ -0,0 +1,191 @@
+#include "mesh_localize/Trace.h"
+
+#include <ctime>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+namespace
+{
+  // Written by the owning thread only.  The fields are atomic so that WriteFile may read
+  // them concurrently; it detects slots that were being overwritten from the ring
+  // position, like a seqlock.
+  struct Event
+  {
+    boost::atomic<const char*> name;
+    boost::atomic<boost::uint64_t> start_ns;
+    boost::atomic<boost::uint64_t> dur_ns;
+  };
+
+  struct ThreadTrace
+  {
+    ThreadTrace(int tid) :
+      tid(tid),
+      name(NULL),
+      events(NULL),
+      written(0)
+    {
+    }
+
+    int tid;
+    boost::atomic<const char*> name;
+    // Allocated on the first span, so threads that never trace cost nothing
+    boost::atomic<Event*> events;
+    boost::atomic<boost::uint64_t> written;
+  };
+
+  struct Registry
+  {
+    boost::mutex mutex;
+    // Threads are never unregistered, the spans of exited threads are still written
+    std::vector<ThreadTrace*> threads;
+  };
+
+  // Leaked so that threads still tracing during static destruction are safe
+  Registry& GetRegistry()
+  {
+    static Registry* registry = new Registry;
+    return *registry;
+  }
+
+  ThreadTrace* CurrentThread()
+  {
+    thread_local ThreadTrace* current = NULL;
+    if(!current)
+    {
+      Registry& registry = GetRegistry();
+      boost::lock_guard<boost::mutex> lock(registry.mutex);
+      current = new ThreadTrace(registry.threads.size() + 1);
+      registry.threads.push_back(current);
+    }
+    return current;
+  }
+
+  boost::uint64_t ToNs(double seconds)
+  {
+    return seconds > 0 ? (boost::uint64_t)(seconds*1e9) : 0;
+  }
+
+  void WriteString(std::ostream& out, const char* s)
+  {
+    out << '"';
+    for(; *s; s++)
+    {
+      if(*s == '"' || *s == '\\')
+        out << '\\';
+      out << *s;
+    }
+    out << '"';
+  }
+}
+
+boost::atomic<bool> Tracer::enabled(false);
+
+void Tracer::Start()
+{
+  enabled.store(true, boost::memory_order_relaxed);
+}
+
+void Tracer::Stop()
+{
+  enabled.store(false, boost::memory_order_relaxed);
+}
+
+double Tracer::Now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+void Tracer::Complete(const char* name, double start, double end)
+{
+  if(!IsEnabled())
+    return;
+
+  ThreadTrace* thread = CurrentThread();
+  Event* events = thread->events.load(boost::memory_order_relaxed);
+  if(!events)
+  {
+    events = new Event[kRingSize];
+    thread->events.store(events, boost::memory_order_release);
+  }
+  boost::uint64_t n = thread->written.load(boost::memory_order_relaxed);
+  Event& e = events[n % kRingSize];
+  // A reader that sees any of the new fields also sees that the slot was reused
+  boost::atomic_thread_fence(boost::memory_order_release);
+  e.name.store(name, boost::memory_order_relaxed);
+  e.start_ns.store(ToNs(start), boost::memory_order_relaxed);
+  e.dur_ns.store(ToNs(end - start), boost::memory_order_relaxed);
+  thread->written.store(n+1, boost::memory_order_release);
+}
+
+void Tracer::SetThreadName(const char* name)
+{
+  CurrentThread()->name.store(name, boost::memory_order_release);
+}
+
+bool Tracer::WriteFile(const std::string& filename)
+{
+  std::ofstream out(filename.c_str());
+  if(!out.is_open())
+  {
+    std::cerr << "Could not open " << filename << std::endl;
+    return false;
+  }
+
+  std::vector<ThreadTrace*> threads;
+  {
+    Registry& registry = GetRegistry();
+    boost::lock_guard<boost::mutex> lock(registry.mutex);
+    threads = registry.threads;
+  }
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+  bool first = true;
+  for(unsigned int t = 0; t < threads.size(); t++)
+  {
+    ThreadTrace* thread = threads[t];
+    const char* thread_name = thread->name.load(boost::memory_order_acquire);
+    if(thread_name)
+    {
+      out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->tid
+        << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+      WriteString(out, thread_name);
+      out << "}}";
+      first = false;
+    }
+
+    boost::uint64_t end = thread->written.load(boost::memory_order_acquire);
+    Event* events = thread->events.load(boost::memory_order_acquire);
+    if(!events)
+      continue;
+    boost::uint64_t begin = end > (boost::uint64_t)kRingSize ? end - kRingSize : 0;
+    for(boost::uint64_t i = begin; i < end; i++)
+    {
+      const Event& e = events[i % kRingSize];
+      const char* name = e.name.load(boost::memory_order_relaxed);
+      boost::uint64_t start_ns = e.start_ns.load(boost::memory_order_relaxed);
+      boost::uint64_t dur_ns = e.dur_ns.load(boost::memory_order_relaxed);
+      // Skip the slot if the owner may have started reusing it while it was read
+      boost::atomic_thread_fence(boost::memory_order_acquire);
+      boost::uint64_t written = thread->written.load(boost::memory_order_relaxed);
+      if(written >= i + kRingSize)
+        continue;
+
+      out << (first ? "" : ",\n") << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->tid
+        << ",\"name\":";
+      WriteString(out, name);
+      // Microseconds with ns resolution
+      out << ",\"ts\":" << start_ns/1000 << "." << (start_ns%1000)/100 << (start_ns%100)/10
+        << start_ns%10 << ",\"dur\":" << dur_ns/1000 << "." << (dur_ns%1000)/100
+        << (dur_ns%100)/10 << dur_ns%10 << "}";
+      first = false;
+    }
+  }
+  out << std::endl << "]}" << std::endl;
+  return bool(out);
+}
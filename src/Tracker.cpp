@@ -0,0 +1,2293 @@
+#include "mesh_localize/Tracker.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <ctime>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <unsupported/Eigen/MatrixFunctions>
+
+#ifdef MESH_LOCALIZER_ENABLE_GPU
+  #include <opencv2/gpu/gpu.hpp>
+  #include <opencv2/nonfree/gpu.hpp>
+#endif
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "mesh_localize/OgreImageGenerator.h"
+#include "mesh_localize/FindCameraMatrices.h"
+#include "mesh_localize/Triangulation.h"
+#include "mesh_localize/ASiftDetector.h"
+#include "mesh_localize/ImageDbUtil.h"
+#include "mesh_localize/PnPUtil.h"
+#include "mesh_localize/PointCloudImageGenerator.h"
+#include "mesh_localize/FeatureMatchLocalizer.h"
+#include "mesh_localize/FABMAPLocalizer.h"
+#include "mesh_localize/DepthFeatureMatchLocalizer.h"
+#include "mesh_localize/VisualizationSink.h"
+#include "mesh_localize/TaskScheduler.h"
+#include "mesh_localize/SnapshotUtil.h"
+#include "mesh_localize/AllocProfile.h"
+#include "mesh_localize/Metrics.h"
+#include "mesh_localize/Trace.h"
+
+#include <pcl/sample_consensus/ransac.h>
+#include <pcl/sample_consensus/sac_model_plane.h>
+#include <pcl/io/pcd_io.h>
+#include <boost/bind.hpp>
+
+namespace
+{
+  double WallTime()
+  {
+    return (double)getTickCount()/getTickFrequency();
+  }
+
+  // Seconds left until deadline, or -1 if there is none
+  double TimeLeft(double deadline)
+  {
+    if(deadline < 0)
+      return -1;
+    return std::max(deadline - WallTime(), 0.0);
+  }
+
+  // Adds a stage that ended now to timings and to the trace, and in profiling builds its
+  // allocations (or those of the whole frame) to the metrics
+  void AddTime(Tracker::StageTimes& timings, const char* stage, double seconds,
+    bool frame = false)
+  {
+    timings.push_back(std::make_pair(std::string(stage), seconds));
+    if(Tracer::IsEnabled())
+    {
+      double end = Tracer::Now();
+      Tracer::Complete(stage, end - seconds, end);
+    }
+    if(frame)
+      AllocProfile::EndFrame(stage);
+    else
+      AllocProfile::EndStage(stage);
+  }
+
+  // Adds the stage timings of a delivered result to the process-wide histograms
+  void RecordTimings(const Tracker::StageTimes& timings)
+  {
+    for(unsigned int i = 0; i < timings.size(); i++)
+    {
+      Metrics::Record(timings[i].first, timings[i].second);
+    }
+  }
+
+  Mat EigenToCv(const Eigen::Matrix3f& K)
+  {
+    return (Mat_<double>(3,3) << K(0,0), K(0,1), K(0,2),
+                                 K(1,0), K(1,1), K(1,2),
+                                 K(2,0), K(2,1), K(2,2));
+  }
+
+  // Query masks are dilated by this so as not to mask good features that may have moved
+  const int kMaskDilateSize = 15;
+
+  const Mat& MaskDilateElement()
+  {
+    static const Mat element = getStructuringElement(MORPH_RECT,
+      Size(2*kMaskDilateSize+1, 2*kMaskDilateSize+1), Point(kMaskDilateSize, kMaskDilateSize));
+    return element;
+  }
+
+  // Reuses the memory of buf unless something else still refers to it
+  void ReuseBuffer(Mat& buf, int rows, int cols, int type)
+  {
+    if(buf.refcount && *buf.refcount > 1)
+      buf.release();
+    buf.create(rows, cols, type);
+  }
+
+  // Per frame buffers of the masking and matching stages.  They are cleared, not freed,
+  // between frames, so in steady state tracking reuses their capacity instead of going to
+  // the heap.  One set per thread, since the pipeline stages run on their own threads.
+  struct FrameScratch
+  {
+    Mat reproj_mask;
+    Mat query_mask;
+    std::vector<std::vector<DMatch> > matches;
+    std::vector<DMatch> goodMatches;
+    std::vector<Point2f> matchPts;
+    std::vector<Point2f> matchPts3dProj;
+    std::vector<Point3f> matchPts3d;
+    std::vector<int> inlierIdx;
+  };
+
+  FrameScratch& GetFrameScratch()
+  {
+    thread_local FrameScratch scratch;
+    return scratch;
+  }
+
+  // Query keyframes and masks reused by the PnP pipeline.  Enough for every frame the
+  // pipeline queues can hold, beyond that frames get their own.
+  const unsigned int kMaxPipelineBuffers = 8;
+
+  const char* kSnapshotMagic = "mesh_localize tracker snapshot";
+  const int kSnapshotVersion = 1;
+
+  // Snapshots start with the camera, a restored tracker must use the same one
+  void WriteCamera(std::ostream& out, const Eigen::Matrix3f& K,
+    const Eigen::VectorXf& distcoeff, const Size& raw_size)
+  {
+    SnapshotUtil::WriteHeader(out, kSnapshotMagic, kSnapshotVersion);
+    SnapshotUtil::Write(out, K);
+    SnapshotUtil::WriteVector(out, std::vector<float>(distcoeff.data(),
+      distcoeff.data() + distcoeff.size()));
+    SnapshotUtil::Write(out, raw_size);
+  }
+
+  bool ReadCamera(std::istream& in, Eigen::Matrix3f& K, Eigen::VectorXf& distcoeff,
+    Size& raw_size)
+  {
+    std::vector<float> d;
+    if(!SnapshotUtil::ReadHeader(in, kSnapshotMagic, kSnapshotVersion) ||
+      !SnapshotUtil::Read(in, K) || !SnapshotUtil::ReadVector(in, d) ||
+      !SnapshotUtil::Read(in, raw_size))
+    {
+      return false;
+    }
+    distcoeff = Eigen::Map<Eigen::VectorXf>(d.data(), d.size());
+    return true;
+  }
+
+  // Frame and intrinsics for global localization at scale
+  void ScaleForLocalization(const Mat& image, const Mat& K, double scale, Mat& scaled_image,
+    Mat& scaled_K)
+  {
+    if(scale >= 1)
+    {
+      scaled_image = image;
+      scaled_K = K.clone();
+      return;
+    }
+    resize(image, scaled_image, Size(), scale, scale, INTER_AREA);
+    scaled_K = scale*K;
+    scaled_K.at<double>(2,2) = 1;
+  }
+
+  // FindImageTfVirtualEdges gives up beyond these
+  const double kMaxEdgeMatchError = 15;
+  const double kMinEdgeMatches = 15;
+
+  template<typename T>
+  void ReadParam(const FileNode& node, const char* name, T& value)
+  {
+    if(!node[name].empty())
+      node[name] >> value;
+  }
+
+  // FileStorage has no bool type, flags are stored as ints
+  void ReadParam(const FileNode& node, const char* name, bool& value)
+  {
+    if(!node[name].empty())
+      value = (int)node[name] != 0;
+  }
+
+  struct FileStorageWriter
+  {
+    FileStorageWriter(FileStorage& fs) : fs(fs) {}
+
+    template<typename T>
+    void operator()(const char* name, const T& value)
+    {
+      fs << name << value;
+    }
+
+    void operator()(const char* name, bool value)
+    {
+      fs << name << (int)value;
+    }
+
+    FileStorage& fs;
+  };
+
+  struct LaunchWriter
+  {
+    LaunchWriter(std::ostream& out) : out(out) {}
+
+    void Write(const char* name, const char* type, const std::string& value)
+    {
+      out << "    <param name=\"" << name << "\" type=\"" << type << "\" value=\"";
+      for(unsigned int i = 0; i < value.size(); i++)
+      {
+        switch(value[i])
+        {
+          case '&': out << "&amp;"; break;
+          case '<': out << "&lt;"; break;
+          case '>': out << "&gt;"; break;
+          case '"': out << "&quot;"; break;
+          default: out << value[i];
+        }
+      }
+      out << "\"/>" << std::endl;
+    }
+
+    void operator()(const char* name, const std::string& value)
+    {
+      Write(name, "string", value);
+    }
+
+    void operator()(const char* name, double value)
+    {
+      std::ostringstream ss;
+      ss.precision(9);
+      ss << value;
+      Write(name, "double", ss.str());
+    }
+
+    void operator()(const char* name, int value)
+    {
+      std::ostringstream ss;
+      ss << value;
+      Write(name, "int", ss.str());
+    }
+
+    void operator()(const char* name, bool value)
+    {
+      Write(name, "bool", value ? "true" : "false");
+    }
+
+    std::ostream& out;
+  };
+
+  // Same names and order as TrackerParams::Read
+  template<typename Writer>
+  void WriteParams(const TrackerParams& p, Writer& w)
+  {
+    w("global_localization_alg", p.global_localization_alg);
+    w("img_match_descriptor_type", p.img_match_descriptor_type);
+    w("photoscan_filename", p.photoscan_filename);
+    w("ogre_data_dir", p.ogre_data_dir);
+    w("load_descriptors", p.load_descriptors);
+    w("descriptor_filename", p.descriptor_filename);
+    w("show_global_matches", p.show_global_matches);
+    w("keyframe_cache_filename", p.keyframe_cache_filename);
+    w("virtual_image_source", p.virtual_image_source);
+    w("point_cloud_filename", p.pc_filename);
+    w("ogre_cfg_dir", p.ogre_cfg_dir);
+    w("ogre_model", p.ogre_model);
+    w("virtual_fx", p.virtual_fx);
+    w("virtual_fy", p.virtual_fy);
+    w("use_depth_shader", p.use_depth_shader);
+    w("tracking_mode", p.tracking_mode);
+    w("pnp_descriptor_type", p.pnp_descriptor_type);
+    w("motion_model", p.motion_model);
+    w("image_scale", p.image_scale);
+    w("do_undistort", p.do_undistort);
+    w("min_pnp_inliers", p.min_pnp_inliers);
+    w("max_pnp_reproj_error", p.max_pnp_reproj_error);
+    w("ratio_test_thresh", p.ratio_test_thresh);
+    w("pnp_match_radius", p.pnp_match_radius);
+    w("pixel_noise", p.pixel_noise);
+    w("edge_tracking_iterations", p.edge_tracking_iterations);
+    w("edge_tracking_dmax", p.edge_tracking_dmax);
+    w("canny_high_thresh", p.canny_high_thresh);
+    w("canny_low_thresh", p.canny_low_thresh);
+    w("canny_sigma", p.canny_sigma);
+    w("autotune_canny", p.autotune_canny);
+    w("pipeline_tracking", p.pipeline_tracking);
+    w("async_relocalization", p.async_relocalization);
+    w("lost_retry_period", p.lost_retry_period);
+    w("lost_image_scale", p.lost_image_scale);
+    w("lost_change_thresh", p.lost_change_thresh);
+    w("random_seed", p.random_seed);
+    w("target_latency", p.target_latency);
+    w("min_image_scale", p.min_image_scale);
+    w("task_threads", p.task_threads);
+    w("task_cpus", p.task_cpus);
+    w("pose_extrapolation_max_age", p.pose_extrapolation_max_age);
+    w("show_pnp_matches", p.show_pnp_matches);
+    w("show_debug", p.show_debug);
+  }
+}
+
+TrackerParams::TrackerParams() :
+  global_localization_alg("feature_match"),
+  img_match_descriptor_type("asurf"),
+  photoscan_filename("/home/matt/Documents/campus_doc.xml"),
+  ogre_data_dir(""),
+  load_descriptors(false),
+  descriptor_filename(""),
+  show_global_matches(false),
+  keyframe_cache_filename(""),
+  virtual_image_source("point_cloud"),
+  pc_filename("bin/map_points.pcd"),
+  ogre_cfg_dir(""),
+  ogre_model(""),
+  virtual_fx(400),
+  virtual_fy(400),
+  use_depth_shader(true),
+  tracking_mode("PNP"),
+  pnp_descriptor_type("orb"),
+  motion_model("CONSTANT"),
+  image_scale(1.0),
+  do_undistort(true),
+  min_pnp_inliers(10),
+  max_pnp_reproj_error(3),
+  ratio_test_thresh(0.7),
+  pnp_match_radius(-1),
+  pixel_noise(3),
+  edge_tracking_iterations(1),
+  edge_tracking_dmax(15),
+  canny_high_thresh(200),
+  canny_low_thresh(80),
+  canny_sigma(0.33),
+  autotune_canny(false),
+  pipeline_tracking(false),
+  async_relocalization(false),
+  lost_retry_period(2),
+  lost_image_scale(0.5),
+  lost_change_thresh(3),
+  random_seed(-1),
+  target_latency(-1),
+  min_image_scale(0.2),
+  task_threads(0),
+  pose_extrapolation_max_age(0.5),
+  show_pnp_matches(false),
+  show_debug(false)
+{
+}
+
+void TrackerParams::Read(const FileNode& node)
+{
+  ReadParam(node, "global_localization_alg", global_localization_alg);
+  ReadParam(node, "img_match_descriptor_type", img_match_descriptor_type);
+  ReadParam(node, "photoscan_filename", photoscan_filename);
+  ReadParam(node, "ogre_data_dir", ogre_data_dir);
+  ReadParam(node, "load_descriptors", load_descriptors);
+  ReadParam(node, "descriptor_filename", descriptor_filename);
+  ReadParam(node, "show_global_matches", show_global_matches);
+  ReadParam(node, "keyframe_cache_filename", keyframe_cache_filename);
+  ReadParam(node, "virtual_image_source", virtual_image_source);
+  ReadParam(node, "point_cloud_filename", pc_filename);
+  ReadParam(node, "ogre_cfg_dir", ogre_cfg_dir);
+  ReadParam(node, "ogre_model", ogre_model);
+  ReadParam(node, "virtual_fx", virtual_fx);
+  ReadParam(node, "virtual_fy", virtual_fy);
+  ReadParam(node, "use_depth_shader", use_depth_shader);
+  ReadParam(node, "tracking_mode", tracking_mode);
+  ReadParam(node, "pnp_descriptor_type", pnp_descriptor_type);
+  ReadParam(node, "motion_model", motion_model);
+  ReadParam(node, "image_scale", image_scale);
+  ReadParam(node, "do_undistort", do_undistort);
+  ReadParam(node, "min_pnp_inliers", min_pnp_inliers);
+  ReadParam(node, "max_pnp_reproj_error", max_pnp_reproj_error);
+  ReadParam(node, "ratio_test_thresh", ratio_test_thresh);
+  ReadParam(node, "pnp_match_radius", pnp_match_radius);
+  ReadParam(node, "pixel_noise", pixel_noise);
+  ReadParam(node, "edge_tracking_iterations", edge_tracking_iterations);
+  ReadParam(node, "edge_tracking_dmax", edge_tracking_dmax);
+  ReadParam(node, "canny_high_thresh", canny_high_thresh);
+  ReadParam(node, "canny_low_thresh", canny_low_thresh);
+  ReadParam(node, "canny_sigma", canny_sigma);
+  ReadParam(node, "autotune_canny", autotune_canny);
+  ReadParam(node, "pipeline_tracking", pipeline_tracking);
+  ReadParam(node, "async_relocalization", async_relocalization);
+  ReadParam(node, "lost_retry_period", lost_retry_period);
+  ReadParam(node, "lost_image_scale", lost_image_scale);
+  ReadParam(node, "lost_change_thresh", lost_change_thresh);
+  ReadParam(node, "random_seed", random_seed);
+  ReadParam(node, "target_latency", target_latency);
+  ReadParam(node, "min_image_scale", min_image_scale);
+  ReadParam(node, "task_threads", task_threads);
+  ReadParam(node, "task_cpus", task_cpus);
+  ReadParam(node, "pose_extrapolation_max_age", pose_extrapolation_max_age);
+  ReadParam(node, "show_pnp_matches", show_pnp_matches);
+  ReadParam(node, "show_debug", show_debug);
+}
+
+bool TrackerParams::Load(const std::string& filename)
+{
+  FileStorage fs(filename, FileStorage::READ);
+  if(!fs.isOpened())
+  {
+    std::cerr << "Could not open tracker params " << filename << std::endl;
+    return false;
+  }
+  Read(fs.root());
+  return true;
+}
+
+void TrackerParams::Write(FileStorage& fs) const
+{
+  FileStorageWriter writer(fs);
+  WriteParams(*this, writer);
+}
+
+void TrackerParams::WriteLaunch(std::ostream& out) const
+{
+  LaunchWriter writer(out);
+  WriteParams(*this, writer);
+}
+
+Tracker::PoseResult::PoseResult() :
+  stamp(0),
+  valid(false),
+  pending(false),
+  state(INIT),
+  pose(Eigen::Matrix4f::Identity()),
+  K(Eigen::Matrix3f::Identity())
+{
+}
+
+Tracker::Tracker(const TrackerParams& params, const Eigen::Matrix3f& K,
+  const Eigen::VectorXf& distcoeff, MonocularLocalizer* localizer, VirtualImageGenerator* vig) :
+    params(params),
+    localize_state(INIT),
+    img_time_stamp(0),
+    frame_deadline(-1),
+    current_pose_stamp(0),
+    resume_pending(false),
+    numPnpRetrys(0),
+    numLocalizeRetrys(0),
+    pnpReprojError(-1),
+    pnpNumInliers(0),
+    edgeMatchError(-1),
+    edgeNumMatches(0),
+    lost_gate(params.lost_retry_period, params.lost_image_scale, params.lost_change_thresh),
+    localization_init(localizer),
+    vig(vig),
+    output_depth(false),
+    pipeline_in_flight(0),
+    pipeline_seq(0),
+    extract_queue(2, false),
+    extracted_queue(2, false),
+    view_queue(2, false),
+    extrapolator(params.pose_extrapolation_max_age),
+    K(K),
+    distcoeff(distcoeff),
+    ingest_scale(params.image_scale),
+    ingest(K, distcoeff, params.do_undistort),
+    snapshot_writing(false)
+{
+  TaskScheduler::Configure(params.task_threads, TaskScheduler::ParseCpuList(params.task_cpus));
+
+  if(params.tracking_mode == "EDGE" || params.tracking_mode == "AUTO")
+  {
+    EdgeTrackingUtil::show_debug = params.show_debug;
+    EdgeTrackingUtil::canny_high_thresh = params.canny_high_thresh;
+    EdgeTrackingUtil::canny_low_thresh = params.canny_low_thresh;
+    EdgeTrackingUtil::canny_sigma = params.canny_sigma;
+    EdgeTrackingUtil::autotune_canny = params.autotune_canny;
+    EdgeTrackingUtil::dmax = params.edge_tracking_dmax;
+  }
+
+  K_scaled = params.image_scale * K;
+  K_scaled(2,2) = 1;
+  distcoeffcv = Mat(distcoeff.size(), 1, CV_64F);
+  for(int i = 0; i < distcoeff.size(); i++)
+  {
+    distcoeffcv.at<double>(i) = distcoeff(i);
+  }
+  Kcv_undistort = (Mat_<double>(3,3) << K(0,0), K(0,1), K(0,2),
+                                       K(1,0), K(1,1), K(1,2),
+                                       K(2,0), K(2,1), K(2,2));
+  Kcv = params.image_scale*Kcv_undistort;
+  Kcv.at<double>(2,2) = 1;
+
+  unsigned int seed = params.random_seed >= 0 ? params.random_seed : time(NULL);
+  rng.seed(seed);
+  pipeline_rng.seed(seed + 1);
+
+  currentPose = Eigen::Matrix4f::Identity();
+  ResetMotionModel();
+
+  if(params.pipeline_tracking)
+  {
+    std::cout << "Tracker: using pipelined PnP tracking" << std::endl;
+    StartPipeline();
+  }
+  if(params.async_relocalization)
+  {
+    std::cout << "Tracker: relocalizing in the background" << std::endl;
+    relocalizer.reset(new AsyncRelocalizer(localizer));
+  }
+}
+
+Tracker::~Tracker()
+{
+  StopPipeline();
+  if(snapshot_thread.joinable())
+    snapshot_thread.join();
+  relocalizer.reset();
+}
+
+MonocularLocalizer* Tracker::CreateLocalizer(const TrackerParams& params)
+{
+  AllocProfile::ScopedMemory memory("keyframe_db");
+  // Loading the keyframes already runs on the scheduler
+  TaskScheduler::Configure(params.task_threads, TaskScheduler::ParseCpuList(params.task_cpus));
+
+  //TODO: read from param file.  Hard-coded, based on DSLR
+  Eigen::Matrix3f map_K;
+  map_K << 1799.352269, 0, 1799.029749, 0, 1261.4382272, 957.3402899, 0, 0, 1;
+  Mat map_Kcv = (Mat_<double>(3,3) << map_K(0,0), map_K(0,1), map_K(0,2),
+              map_K(1,0), map_K(1,1), map_K(1,2),
+              map_K(2,0), map_K(2,1), map_K(2,2));
+  Mat map_distcoeffcv = (Mat_<double>(5,1) << 0, 0, 0, 0, 0);
+  //map_distcoeff << -.0066106, .04618129, -.00042169, -.004390247, -.048470351;
+
+  // The cache is only valid for the database and descriptor type it was built from, and
+  // only as long as the database isn't regenerated in place
+  std::string db_path = params.global_localization_alg == "depth_feature_match" ?
+    params.ogre_data_dir : params.photoscan_filename;
+  std::string cache_key = params.global_localization_alg + ":" +
+    params.img_match_descriptor_type + ":" + db_path + ":" +
+    ImageDbUtil::SourceStamp(db_path);
+  std::vector<KeyframeContainer*> cached_db;
+  bool cached = params.keyframe_cache_filename != "" &&
+    params.global_localization_alg != "fabmap" &&
+    ImageDbUtil::ReadKeyframeCache(params.keyframe_cache_filename, cache_key, cached_db);
+
+  MonocularLocalizer* localizer = NULL;
+  if(params.global_localization_alg == "feature_match")
+  {
+    std::cout << "Using Photoscan object feature matching for initialization" << std::endl;
+    if(cached)
+    {
+      return new FeatureMatchLocalizer(cached_db, params.img_match_descriptor_type,
+        params.show_global_matches);
+    }
+    std::vector<CameraContainer*> image_db;
+    if(!ImageDbUtil::LoadPhotoscanFile(params.photoscan_filename, image_db, map_Kcv, map_distcoeffcv))
+    {
+      return NULL;
+    }
+    localizer = new FeatureMatchLocalizer(image_db, params.img_match_descriptor_type,
+      params.show_global_matches, params.load_descriptors, params.descriptor_filename);
+  }
+  else if(params.global_localization_alg == "depth_feature_match")
+  {
+    std::cout << "Using Ogre object feature matching for initialization" << std::endl;
+    if(params.img_match_descriptor_type != "surf")
+    {
+      std::cerr << "img_match_descriptor_type must be 'surf' when using OGRE ImageDb" << std::endl;
+      return NULL;
+    }
+    if(cached)
+    {
+      return new DepthFeatureMatchLocalizer(cached_db, params.img_match_descriptor_type,
+        params.show_global_matches, params.min_pnp_inliers, params.max_pnp_reproj_error);
+    }
+    std::vector<KeyframeContainer*> image_db;
+    if(!ImageDbUtil::LoadOgreDataDir(params.ogre_data_dir, image_db))
+    {
+      std::cerr << "Could not load OGRE object pose database" << std::endl;
+      return NULL;
+    }
+    localizer = new DepthFeatureMatchLocalizer(image_db, params.img_match_descriptor_type,
+      params.show_global_matches, params.min_pnp_inliers, params.max_pnp_reproj_error);
+  }
+  else if(params.global_localization_alg == "fabmap")
+  {
+    std::vector<CameraContainer*> image_db;
+    if(!ImageDbUtil::LoadPhotoscanFile(params.photoscan_filename, image_db, map_Kcv, map_distcoeffcv))
+    {
+      return NULL;
+    }
+    std::cout << "Using OpenFABMAP for initialization" << std::endl;
+    if(params.img_match_descriptor_type != "surf")
+    {
+      std::cerr << "img_match_descriptor_type must be 'surf' when using OpenFABMAP" << std::endl;
+      return NULL;
+    }
+    // The vocabulary is rebuilt on every start, so FABMAP isn't cached
+    return new FABMAPLocalizer(image_db, params.img_match_descriptor_type,
+      params.show_global_matches, params.load_descriptors, params.descriptor_filename);
+  }
+  else
+  {
+    std::cerr << params.global_localization_alg << " is not a valid initialization option"
+      << std::endl;
+    return NULL;
+  }
+
+  const std::vector<KeyframeContainer*>* keyframes = localizer->GetKeyframes();
+  if(params.keyframe_cache_filename != "" && keyframes)
+  {
+    ImageDbUtil::WriteKeyframeCache(params.keyframe_cache_filename, cache_key, *keyframes);
+  }
+  return localizer;
+}
+
+VirtualImageGenerator* Tracker::CreateImageGenerator(const TrackerParams& params,
+  const Eigen::Matrix3f& K, int rows, int cols)
+{
+  AllocProfile::ScopedMemory memory("renderer");
+  if(params.virtual_image_source == "point_cloud")
+  {
+    std::cout << "Using PCL point cloud for virtual image generation" << std::endl;
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr map_cloud =
+      pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr(new pcl::PointCloud<pcl::PointXYZRGBNormal>);
+    std::cout << "Loading point cloud " << params.pc_filename << std::endl;
+    if(pcl::io::loadPCDFile<pcl::PointXYZRGBNormal> (params.pc_filename, *map_cloud) == -1)
+    {
+      std::cerr << "Could not open point cloud " << params.pc_filename << std::endl;
+      return NULL;
+    }
+    std::cout << "Successfully loaded point cloud" << std::endl;
+    return new PointCloudImageGenerator(map_cloud, K, rows, cols);
+  }
+  else if(params.virtual_image_source == "ogre")
+  {
+    std::cout << "Using Ogre for virtual image generation" << std::endl;
+    return new OgreImageGenerator(params.ogre_cfg_dir, params.ogre_model, params.virtual_fx,
+      params.virtual_fy, params.use_depth_shader);
+  }
+  std::cerr << params.virtual_image_source << " is not a valid virtual image source"
+    << std::endl;
+  return NULL;
+}
+
+void Tracker::setResultCallback(const ResultCallback& cb)
+{
+  result_callback = cb;
+}
+
+void Tracker::setOutputDepth(bool output)
+{
+  output_depth = output;
+}
+
+Tracker::LocalizeState Tracker::getState()
+{
+  boost::lock_guard<boost::mutex> lock(pose_mutex);
+  return localize_state;
+}
+
+Eigen::Matrix4f Tracker::getPose()
+{
+  boost::lock_guard<boost::mutex> lock(pose_mutex);
+  return currentPose;
+}
+
+Eigen::Matrix3f Tracker::getScaledK() const
+{
+  return K_scaled;
+}
+
+void Tracker::setImageScale(double scale)
+{
+  if(scale <= 0)
+    return;
+  boost::lock_guard<boost::mutex> lock(ingest_mutex);
+  ingest_scale = scale;
+}
+
+double Tracker::getImageScale()
+{
+  boost::lock_guard<boost::mutex> lock(ingest_mutex);
+  return ingest_scale;
+}
+
+bool Tracker::extrapolatePose(double stamp, Eigen::Matrix4f& pose, double& age)
+{
+  return extrapolator.predict(stamp, pose, age);
+}
+
+const TrackerParams& Tracker::getParams() const
+{
+  return params;
+}
+
+void Tracker::prepareFrame(const Mat& input, Mat& frame)
+{
+  double scale;
+  {
+    boost::lock_guard<boost::mutex> lock(ingest_mutex);
+    raw_size = input.size();
+    scale = ingest_scale;
+  }
+  // The intrinsics are scaled by the ratio of the frame sizes, see SetTrackingSize
+  ingest.process(input, frame, scale);
+}
+
+KeyframeContainer* Tracker::QueryKeyframe(const std::string& desc_type)
+{
+  if(!query_kf)
+  {
+    query_kf.reset(new KeyframeContainer(current_image, desc_type, false));
+  }
+  else
+  {
+    query_kf->Reset(current_image, desc_type);
+  }
+  return query_kf.get();
+}
+
+Tracker::PoseResult Tracker::processFrame(const Mat& image, double stamp)
+{
+  Mat frame;
+  prepareFrame(image, frame);
+  return trackFrame(frame, stamp);
+}
+
+Tracker::PoseResult Tracker::trackFrame(const Mat& frame, double stamp, double budget)
+{
+  double deadline = budget >= 0 ? WallTime() + budget : -1;
+  if(resume_pending)
+  {
+    // Don't extrapolate the motion model across the time the tracker was down
+    boost::lock_guard<boost::mutex> lock(pose_mutex);
+    current_pose_stamp = stamp;
+    resume_pending = false;
+  }
+  if(frame.size() != tracking_size)
+  {
+    Size input_size;
+    {
+      boost::lock_guard<boost::mutex> lock(ingest_mutex);
+      input_size = raw_size;
+    }
+    // Frames that weren't prepared by this tracker keep the intrinsics from image_scale
+    if(input_size.area() > 0)
+    {
+      FlushPipeline();
+      SetTrackingSize(input_size, frame.size());
+    }
+    tracking_size = frame.size();
+  }
+
+  bool pnp_tracking;
+  {
+    boost::lock_guard<boost::mutex> lock(pose_mutex);
+    pnp_tracking = (localize_state == PNP);
+  }
+  if(params.pipeline_tracking && pnp_tracking)
+  {
+    PipelineProcess(frame, stamp, deadline);
+    PoseResult result;
+    result.stamp = stamp;
+    result.pending = true;
+    result.state = PNP;
+    result.image = frame;
+    result.K = K_scaled;
+    return result;
+  }
+
+  // The pipeline only covers frame-to-frame PnP tracking.  Any other state needs the
+  // result of the previous frame, so wait for in-flight frames before running it.
+  FlushPipeline();
+  current_image = frame;
+  img_time_stamp = stamp;
+  frame_deadline = deadline;
+  PoseResult result = Step();
+  if(result.valid)
+  {
+    extrapolator.update(result.stamp, result.pose, MotionModelVelocity());
+  }
+  else if(result.state == INIT)
+  {
+    extrapolator.reset();
+  }
+  RecordTimings(result.timings);
+  if(result_callback)
+  {
+    result_callback(result);
+  }
+  return result;
+}
+
+void Tracker::SetTrackingSize(const Size& input_size, const Size& size)
+{
+  K_scaled = FrameIngest::ScaleIntrinsics(K, input_size, size);
+  Kcv = EigenToCv(K_scaled);
+  if(tracking_size.area() == 0)
+    return;
+
+  std::cout << "Tracker: processing resolution changed to " << size.width << "x"
+    << size.height << std::endl;
+  // The KLT tracks and its reference image are at the old resolution
+  boost::lock_guard<boost::mutex> lock(pose_mutex);
+  if(localize_state == KLT || localize_state == KLT_INIT)
+  {
+    localize_state = PNP;
+  }
+}
+
+bool Tracker::saveSnapshot(const std::string& filename, bool wait)
+{
+  if(snapshot_writing && !wait)
+  {
+    Metrics::Increment("snapshots_skipped");
+    return false;
+  }
+  if(snapshot_thread.joinable())
+    snapshot_thread.join();
+  if(wait)
+    FlushPipeline();
+
+  // Without waiting, frames still in the pipeline are left out and the snapshot has the
+  // last pose they delivered.  Images and remap tables are shared rather than copied, none
+  // of them is modified in place.
+  boost::shared_ptr<Snapshot> snapshot(new Snapshot);
+  snapshot->K = K;
+  snapshot->distcoeff = distcoeff;
+  {
+    boost::lock_guard<boost::mutex> lock(ingest_mutex);
+    snapshot->raw_size = raw_size;
+    snapshot->ingest_scale = ingest_scale;
+  }
+  snapshot->tracking_size = tracking_size;
+  snapshot->K_scaled = K_scaled;
+  {
+    boost::lock_guard<boost::mutex> lock(pose_mutex);
+    snapshot->state = localize_state;
+    snapshot->pose = currentPose;
+    snapshot->velocity = camera_velocity;
+    snapshot->klt_init_img = klt_init_img;
+  }
+  // Only the tracking thread updates the KLT tracks
+  std::stringstream klt_state;
+  klt_tracker.write(klt_state);
+  snapshot->klt_state = klt_state.str();
+  snapshot->maps = ingest.getMaps();
+
+  if(wait)
+  {
+    return SnapshotUtil::WriteFile(filename, boost::bind(&Tracker::WriteSnapshot, _1,
+      boost::cref(*snapshot)));
+  }
+  snapshot_writing = true;
+  snapshot_thread = boost::thread(boost::bind(&Tracker::WriteSnapshotFile, this, filename,
+    snapshot));
+  return true;
+}
+
+void Tracker::WriteSnapshotFile(const std::string& filename, boost::shared_ptr<Snapshot> snapshot)
+{
+  Tracer::SetThreadName("snapshot");
+  {
+    Metrics::ScopedTimer timer("snapshot_write");
+    SnapshotUtil::WriteFile(filename, boost::bind(&Tracker::WriteSnapshot, _1,
+      boost::cref(*snapshot)));
+  }
+  snapshot_writing = false;
+}
+
+bool Tracker::WriteSnapshot(std::ostream& out, const Snapshot& snapshot)
+{
+  WriteCamera(out, snapshot.K, snapshot.distcoeff, snapshot.raw_size);
+  SnapshotUtil::Write(out, snapshot.ingest_scale);
+  SnapshotUtil::Write(out, snapshot.tracking_size);
+  SnapshotUtil::Write(out, snapshot.K_scaled);
+  SnapshotUtil::Write(out, snapshot.state);
+  SnapshotUtil::Write(out, snapshot.pose);
+  SnapshotUtil::Write(out, snapshot.velocity);
+  SnapshotUtil::WriteMat(out, snapshot.klt_init_img);
+  out.write(snapshot.klt_state.data(), snapshot.klt_state.size());
+  FrameIngest::WriteMaps(out, snapshot.maps);
+  return bool(out);
+}
+
+bool Tracker::ReadSnapshotCamera(const std::string& filename, Eigen::Matrix3f& K,
+  Eigen::VectorXf& distcoeff, Size& raw_size)
+{
+  std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+  return in.is_open() && ReadCamera(in, K, distcoeff, raw_size);
+}
+
+bool Tracker::loadSnapshot(const std::string& filename)
+{
+  std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+  if(!in.is_open())
+    return false;
+
+  Eigen::Matrix3f snapshot_K, snapshot_K_scaled;
+  Eigen::VectorXf snapshot_distcoeff;
+  Size snapshot_raw_size, snapshot_tracking_size;
+  double snapshot_scale;
+  int state;
+  Eigen::Matrix4f pose, velocity;
+  Mat snapshot_klt_init_img;
+  if(!ReadCamera(in, snapshot_K, snapshot_distcoeff, snapshot_raw_size))
+    return false;
+  if(snapshot_K != K || snapshot_distcoeff.size() != distcoeff.size() ||
+    snapshot_distcoeff != distcoeff)
+  {
+    std::cerr << "Snapshot " << filename << " was taken with a different camera" << std::endl;
+    return false;
+  }
+  if(!SnapshotUtil::Read(in, snapshot_scale) || !SnapshotUtil::Read(in, snapshot_tracking_size) ||
+    !SnapshotUtil::Read(in, snapshot_K_scaled) || !SnapshotUtil::Read(in, state) ||
+    !SnapshotUtil::Read(in, pose) || !SnapshotUtil::Read(in, velocity) ||
+    !SnapshotUtil::ReadMat(in, snapshot_klt_init_img) || state < INIT || state > KLT ||
+    !klt_tracker.read(in))
+  {
+    std::cerr << "Snapshot " << filename << " is truncated" << std::endl;
+    return false;
+  }
+  // The maps are only an optimization, they are rebuilt if missing
+  ingest.readMaps(in);
+
+  {
+    boost::lock_guard<boost::mutex> lock(ingest_mutex);
+    raw_size = snapshot_raw_size;
+    ingest_scale = snapshot_scale;
+  }
+  tracking_size = snapshot_tracking_size;
+  K_scaled = snapshot_K_scaled;
+  Kcv = EigenToCv(K_scaled);
+
+  boost::lock_guard<boost::mutex> lock(pose_mutex);
+  localize_state = (LocalizeState)state;
+  currentPose = pose;
+  camera_velocity = velocity;
+  klt_init_img = snapshot_klt_init_img;
+  resume_pending = true;
+  std::cout << "Tracker: resuming from snapshot " << filename << std::endl;
+  return true;
+}
+
+void Tracker::StartPipeline()
+{
+  extract_thread = boost::thread(&Tracker::PipelineExtractLoop, this);
+  match_thread = boost::thread(&Tracker::PipelineMatchLoop, this);
+}
+
+void Tracker::StopPipeline()
+{
+  extract_queue.Close();
+  extracted_queue.Close();
+  view_queue.Close();
+  if(extract_thread.joinable())
+    extract_thread.join();
+  if(match_thread.joinable())
+    match_thread.join();
+}
+
+void Tracker::flush()
+{
+  FlushPipeline();
+}
+
+void Tracker::FlushPipeline()
+{
+  if(!params.pipeline_tracking)
+    return;
+
+  boost::unique_lock<boost::mutex> lock(pipeline_mutex);
+  while(pipeline_in_flight > 0)
+  {
+    pipeline_cond.wait(lock);
+  }
+  pipeline_query_mask = Mat();
+}
+
+void Tracker::PipelineProcess(const Mat& image, double stamp, double deadline)
+{
+  PipelineFrame pf;
+  pf.seq = ++pipeline_seq;
+  pf.image = image;
+  pf.stamp = stamp;
+  pf.deadline = deadline;
+  // The query image is masked with the reprojection of the previous render so that its
+  // feature extraction doesn't have to wait for the render of this frame.  The mask is
+  // dilated generously, so one frame of lag is covered.
+  pf.query_mask = pipeline_query_mask;
+  {
+    boost::lock_guard<boost::mutex> lock(pipeline_mutex);
+    pipeline_in_flight++;
+  }
+  if(!extract_queue.Push(pf))
+    return;
+
+  // Render stage.  The match stage may still be working on the previous frame, so the
+  // render pose is predicted forward from the latest estimate to this frame's stamp.
+  Eigen::Matrix4f predictedPose;
+  {
+    boost::lock_guard<boost::mutex> lock(pose_mutex);
+    predictedPose = ApplyMotionModel(stamp - current_pose_stamp);
+  }
+
+  AllocProfile::BeginFrame();
+  double start = WallTime();
+  bool rendered = RenderVirtualView(predictedPose, pf.view);
+  AddTime(pf.timings, "render", WallTime()-start);
+  if(rendered)
+  {
+    double extract_start = WallTime();
+    GetQueryMask(pipeline_query_mask, pf.view.mask, pf.view.K, image.rows, image.cols);
+    ExtractVirtualFeatures(pf.view, params.pnp_descriptor_type);
+    AddTime(pf.timings, "virtual_extract", WallTime()-extract_start);
+  }
+  view_queue.Push(pf);
+}
+
+boost::shared_ptr<KeyframeContainer> Tracker::PipelineKeyframe(const Mat& image)
+{
+  for(unsigned int i = 0; i < pipeline_kfs.size(); i++)
+  {
+    // Only the pool refers to it, the frame it was used for has been delivered
+    if(pipeline_kfs[i].use_count() == 1)
+    {
+      pipeline_kfs[i]->Reset(image, params.pnp_descriptor_type);
+      return pipeline_kfs[i];
+    }
+  }
+  boost::shared_ptr<KeyframeContainer> kf(new KeyframeContainer(image,
+    params.pnp_descriptor_type, false));
+  if(pipeline_kfs.size() < kMaxPipelineBuffers)
+    pipeline_kfs.push_back(kf);
+  return kf;
+}
+
+void Tracker::PipelineExtractLoop()
+{
+  Tracer::SetThreadName("pipeline_extract");
+  PipelineFrame pf;
+  while(extract_queue.Pop(pf))
+  {
+    AllocProfile::BeginFrame();
+    double start = WallTime();
+    pf.kf = PipelineKeyframe(pf.image);
+    if(!pf.query_mask.empty())
+    {
+      pf.kf->SetMask(pf.query_mask);
+    }
+    pf.kf->ExtractFeatures();
+    AddTime(pf.timings, "query_extract", WallTime()-start);
+    if(!extracted_queue.Push(pf))
+      break;
+  }
+}
+
+void Tracker::PipelineMatchLoop()
+{
+  Tracer::SetThreadName("pipeline_match");
+  PipelineFrame query, virt;
+  while(extracted_queue.Pop(query) && view_queue.Pop(virt))
+  {
+    assert(query.seq == virt.seq);
+
+    bool tracking;
+    {
+      boost::lock_guard<boost::mutex> lock(pose_mutex);
+      tracking = (localize_state == PNP);
+    }
+
+    PoseResult result;
+    result.stamp = query.stamp;
+    result.image = query.image;
+    result.K = K_scaled;
+    result.timings = virt.timings;
+    result.timings.insert(result.timings.end(), query.timings.begin(), query.timings.end());
+
+    // Frames dispatched before a failure or a mode switch are not matched, the tracking
+    // thread has taken over.  They are still reported, without a pose.
+    if(tracking)
+    {
+      AllocProfile::BeginFrame();
+      double start = WallTime();
+      Eigen::Matrix4f imgTf;
+      Eigen::Matrix<float, 6, 6> cov;
+      double reprojError;
+      int numInliers = 0;
+      bool success = virt.view.valid && query.kf->GetKeypoints().size() > 0 &&
+        MatchVirtualPnp(query.kf.get(), virt.view, params.pnp_descriptor_type, imgTf, cov,
+          reprojError, numInliers, pipeline_rng, virt.deadline);
+      AddTime(result.timings, "match_pnp", WallTime()-start);
+
+      boost::unique_lock<boost::mutex> lock(pose_mutex);
+      mode_selector.record(ModeSelector::PNP, success,
+        (double)numInliers/params.min_pnp_inliers, WallTime()-start);
+      if(success)
+      {
+        UpdateMotionModel(currentPose, imgTf, cov, query.stamp - current_pose_stamp);
+        numPnpRetrys = 0;
+        if(reprojError < params.max_pnp_reproj_error)
+        {
+          if(params.tracking_mode == "AUTO")
+            localize_state = NextTrackingState(ModeSelector::PNP, query.image);
+          else if(params.tracking_mode == "EDGE")
+            localize_state = EDGES;
+          else if(params.tracking_mode == "KLT")
+          {
+            klt_init_img = query.image;
+            localize_state = KLT_INIT;
+          }
+        }
+        currentPose = imgTf;
+        current_pose_stamp = query.stamp;
+        extrapolator.update(query.stamp, imgTf, MotionModelVelocity());
+        result.valid = true;
+        result.pose = imgTf;
+        result.state = localize_state;
+        lock.unlock();
+
+        if(output_depth)
+        {
+          TransformDepthFrame(virt.view.depth, virt.view.tf, virt.view.K, result.depth,
+            imgTf, K_scaled, query.image.size());
+        }
+        ShowTfViz(query.image, imgTf);
+      }
+      else
+      {
+        ResetMotionModel();
+        numPnpRetrys++;
+        if(numPnpRetrys > 1)
+        {
+          std::cout << "PnP failed, reinitializing using last known pose" << std::endl;
+          numPnpRetrys = 0;
+          localize_state = LOCAL_INIT;
+        }
+        result.pose = currentPose;
+        result.state = localize_state;
+        lock.unlock();
+      }
+    }
+    else
+    {
+      boost::lock_guard<boost::mutex> lock(pose_mutex);
+      result.pose = currentPose;
+      result.state = localize_state;
+    }
+    RecordTimings(result.timings);
+    if(result_callback)
+    {
+      result_callback(result);
+    }
+
+    {
+      boost::lock_guard<boost::mutex> lock(pipeline_mutex);
+      pipeline_in_flight--;
+    }
+    pipeline_cond.notify_all();
+  }
+}
+
+void Tracker::ShowTfViz(const Mat& img, const Eigen::Matrix4f& pose)
+{
+  if(!VisualizationSink::Instance().HasConsumer())
+    return;
+
+  // The overlay is drawn on the display thread
+  Eigen::Matrix<float, 4, 4, Eigen::DontAlign> tf = pose.inverse();
+  Eigen::Matrix3f K = K_scaled;
+  VisualizationSink::Instance().Show("Object Transform", [img, tf, K](Mat& dst)
+  {
+    CreateTfViz(img, dst, tf, K);
+  });
+}
+
+void Tracker::CreateTfViz(const Mat& src, Mat& dst, const Eigen::Matrix4f& tf,
+  const Eigen::Matrix3f& K)
+{
+  cvtColor(src, dst, CV_GRAY2RGB);
+  Eigen::Vector3f t = tf.block<3,1>(0,3);
+  Eigen::Vector3f xr = tf.block<3,1>(0,0);
+  Eigen::Vector3f yr = tf.block<3,1>(0,1);
+  Eigen::Vector3f zr = tf.block<3,1>(0,2);
+
+  Eigen::Vector3f x = t + xr/6*xr.norm();
+  Eigen::Vector3f y = t + yr/6*yr.norm();
+  Eigen::Vector3f z = t + zr/6*zr.norm();
+
+  Eigen::Vector3f origin = K*t;
+  Eigen::Vector3f xp = K*x;
+  Eigen::Vector3f yp = K*y;
+  Eigen::Vector3f zp = K*z;
+  Point o2d(origin(0)/origin(2), origin(1)/origin(2));
+  Point x2d(xp(0)/xp(2), xp(1)/xp(2));
+  Point y2d(yp(0)/yp(2), yp(1)/yp(2));
+  Point z2d(zp(0)/zp(2), zp(1)/zp(2));
+
+  line(dst, o2d, x2d, CV_RGB(255, 0, 0), 3, CV_AA);
+  line(dst, o2d, y2d, CV_RGB(0, 255, 0), 3, CV_AA);
+  line(dst, o2d, z2d, CV_RGB(0, 0, 255), 3, CV_AA);
+}
+
+// decaying velocity model
+void Tracker::UpdateMotionModel(const Eigen::Matrix4f& oldTf, const Eigen::Matrix4f& newTf,
+  const Eigen::Matrix<float, 6, 6>& cov, double dt)
+{
+  if(params.motion_model == "CONSTANT")
+  {
+    // Frames without increasing stamps carry no velocity information
+    if(dt <= 0)
+      return;
+    Eigen::Matrix4f new_from_old = newTf*oldTf.inverse();
+    Eigen::Matrix4f cam_motion = new_from_old.log()/dt;
+    Eigen::Matrix4f old_cam_vel = camera_velocity;
+    camera_velocity = 0.9 * (0.5 * cam_motion + 0.5 * old_cam_vel);
+  }
+  else if(params.motion_model == "IMU")
+  {
+    // Apply correction measurement.
+    //imu_mm->correct(newTf, cov);
+  }
+  else
+  {
+    camera_velocity = Eigen::MatrixXf::Zero(4,4);
+  }
+}
+
+Eigen::Matrix4f Tracker::ApplyMotionModel(double dt)
+{
+  if(params.motion_model == "IMU")
+  {
+    // Apply all IMU measurements since last ApplyMotionModel call
+    //return imu_mm->predict();
+  }
+  else if(params.motion_model == "CONSTANT")
+  {
+    return (dt*camera_velocity).exp()*currentPose;
+  }
+  return currentPose;
+}
+
+Eigen::Matrix4f Tracker::MotionModelVelocity()
+{
+  if(params.motion_model == "CONSTANT")
+    return camera_velocity;
+  return Eigen::Matrix4f::Zero();
+}
+
+Tracker::LocalizeState Tracker::NextTrackingState(ModeSelector::Mode current, const Mat& image)
+{
+  ModeSelector::Mode next = mode_selector.select(current);
+  if(next == ModeSelector::KLT)
+  {
+    if(current == ModeSelector::KLT)
+      return KLT;
+    // The KLT tracks start from this frame and its pose
+    klt_init_img = image;
+    return KLT_INIT;
+  }
+  else if(next == ModeSelector::EDGE)
+  {
+    return EDGES;
+  }
+  return PNP;
+}
+
+void Tracker::AddStageTime(const char* stage, double seconds)
+{
+  AddTime(step_times, stage, seconds);
+}
+
+void Tracker::ResetMotionModel()
+{
+  if(params.motion_model == "CONSTANT")
+  {
+    camera_velocity = Eigen::MatrixXf::Zero(4,4);
+  }
+  else if(params.motion_model == "IMU")
+  {
+    //imu_mm->reset();
+  }
+}
+
+Tracker::PoseResult Tracker::Step()
+{
+  double spin_start = WallTime();
+  double start = spin_start;
+  AllocProfile::BeginFrame();
+  // The motion model is driven by image stamps, not by when frames happen to be
+  // processed, so replays behave the same regardless of processing speed
+  double dt = img_time_stamp - current_pose_stamp;
+  step_times.clear();
+  // The lost mode only throttles full reinitialization
+  if(localize_state != INIT)
+    lost_gate.reset();
+
+  PoseResult result;
+  result.stamp = img_time_stamp;
+  result.image = current_image;
+  result.K = K_scaled;
+
+  if(localize_state == KLT_INIT)
+  {
+    // if init,
+    //   give last image (presumably from pnp) to video tracker
+    //   give depth map for this image (from the render engine)
+    //   backproject initial key points to 3D
+    std::cout << "Initializing KLT tracking..." << std::endl;
+    start = WallTime();
+    Mat vimg, depth, mask, reproj_mask;
+    Mat output_frame;
+    Eigen::Matrix3f vimgK = vig->GetK();
+    vimg = vig->GenerateVirtualImage(currentPose, depth, mask);
+
+    std::vector<cv::Point2f> pts2d;
+    std::vector<cv::Point3f> pts3d;
+    std::vector<int> ptIDs;
+    ReprojectMask(reproj_mask, mask, K_scaled, vimgK);
+    klt_tracker.setDrawOutput(params.show_debug && VisualizationSink::Instance().HasConsumer());
+    klt_tracker.init(klt_init_img, depth, K_scaled, vimgK, currentPose, reproj_mask, rng);
+    klt_tracker.processFrame(current_image, output_frame, pts2d, pts3d, ptIDs);
+
+    double pnpReprojError;
+    std::vector<int> inlierIdx;
+    Eigen::Matrix4f tfran;
+    Eigen::Matrix<float, 6, 6> cov;
+    if(!PnPUtil::RansacPnP(pts3d, pts2d, Kcv, currentPose.inverse(), tfran, inlierIdx, &pnpReprojError, &cov, TimeLeft(frame_deadline), &rng) || inlierIdx.size() < params.min_pnp_inliers)
+    {
+      ResetMotionModel();
+      localize_state = PNP;
+    }
+    else
+    {
+      currentPose = tfran.inverse();
+      result.valid = true;
+      localize_state = KLT;
+    }
+    mode_selector.record(ModeSelector::KLT, result.valid,
+      (double)inlierIdx.size()/params.min_pnp_inliers, WallTime()-start);
+  }
+  else if(localize_state == KLT)
+  {
+    // otherwise,
+    //   give current image to video tracker
+    //   get matched keypts
+    //   do that PnP to get pose, bro
+    Mat output_frame;
+    std::vector<cv::Point2f> pts2d;
+    std::vector<cv::Point3f> pts3d;
+    std::vector<int> ptIDs;
+    double klt_start = WallTime();
+    start = klt_start;
+    klt_tracker.setDrawOutput(params.show_debug && VisualizationSink::Instance().HasConsumer());
+    klt_tracker.processFrame(current_image, output_frame, pts2d, pts3d, ptIDs);
+    AddStageTime("klt", WallTime()-start);
+
+    double pnpReprojError;
+    std::vector<int> inlierIdx;
+    Eigen::Matrix4f tfran;
+    Eigen::Matrix<float, 6, 6> cov;
+    start = WallTime();
+    bool pnp_success = PnPUtil::RansacPnP(pts3d, pts2d, Kcv, currentPose.inverse(), tfran, inlierIdx, &pnpReprojError, &cov, TimeLeft(frame_deadline), &rng);
+    AddStageTime("klt_pnp", WallTime()-start);
+    if(!pnp_success || inlierIdx.size() < params.min_pnp_inliers)
+    {
+      std::cout << "KLT failed, reverting back to feature matching" << std::endl;
+      ResetMotionModel();
+      localize_state = PNP;
+    }
+    else
+    {
+      if(pnpReprojError < params.max_pnp_reproj_error && inlierIdx.size() >= params.min_pnp_inliers)
+      {
+        currentPose = tfran.inverse();
+        result.valid = true;
+        ShowTfViz(current_image, currentPose);
+        localize_state = KLT;
+        mode_selector.record(ModeSelector::KLT, true,
+          (double)inlierIdx.size()/params.min_pnp_inliers, WallTime()-klt_start);
+        if(params.tracking_mode == "AUTO")
+          localize_state = NextTrackingState(ModeSelector::KLT, current_image);
+      }
+      else
+      {
+        std::cout << "KLT failed (bad tracking), reverting back to feature matching" << std::endl;
+        ResetMotionModel();
+        localize_state = PNP;
+      }
+    }
+    if(!result.valid)
+    {
+      mode_selector.record(ModeSelector::KLT, false, 0, WallTime()-klt_start);
+    }
+
+    if(params.show_debug)
+    {
+      VisualizationSink::Instance().Show("KLT Tracking", output_frame);
+    }
+  }
+  else if(localize_state == EDGES)
+  {
+    double mode_start = WallTime();
+    KeyframeContainer* kf = QueryKeyframe(params.pnp_descriptor_type);
+    Eigen::Matrix4f imgTf;
+    if(FindImageTfVirtualEdges(kf, ApplyMotionModel(dt), imgTf, true))
+    //if(FindImageTfVirtualEdges(kf, currentPose, imgTf, true))
+    {
+      for(int i = 0; i < params.edge_tracking_iterations-1; i++)
+      {
+        if(frame_deadline >= 0 && WallTime() > frame_deadline)
+        {
+          Metrics::Increment("edge_refinement_out_of_time");
+          break;
+        }
+        Eigen::Matrix4f prevTf = imgTf;
+        FindImageTfVirtualEdges(kf, prevTf, imgTf, true);
+      }
+
+      Eigen::Matrix<float, 6, 6> cov;
+      UpdateMotionModel(currentPose, imgTf, cov, dt);
+
+      currentPose = imgTf;
+      result.valid = true;
+
+      ShowTfViz(current_image, currentPose);
+
+      mode_selector.record(ModeSelector::EDGE, true,
+        std::min(kMaxEdgeMatchError/edgeMatchError, edgeNumMatches/kMinEdgeMatches),
+        WallTime()-mode_start);
+      if(params.tracking_mode == "AUTO")
+        localize_state = NextTrackingState(ModeSelector::EDGE, current_image);
+    }
+    else
+    {
+      mode_selector.record(ModeSelector::EDGE, false, 0, WallTime()-mode_start);
+      ResetMotionModel();
+      localize_state = PNP;
+    }
+  }
+  else if(localize_state == PNP)
+  {
+    double mode_start = WallTime();
+    KeyframeContainer* kf = QueryKeyframe(params.pnp_descriptor_type);
+
+    Eigen::Matrix4f imgTf;
+
+    Eigen::Matrix<float, 6 ,6> cov;
+    Eigen::Matrix4f currentPoseMM = ApplyMotionModel(dt);
+    if(FindImageTfVirtualPnp(kf, currentPoseMM, imgTf, params.pnp_descriptor_type, true, cov))
+    {
+      UpdateMotionModel(currentPose, imgTf, cov, dt);
+      numPnpRetrys = 0;
+      mode_selector.record(ModeSelector::PNP, true,
+        (double)pnpNumInliers/params.min_pnp_inliers, WallTime()-mode_start);
+      if(pnpReprojError < params.max_pnp_reproj_error)
+      {
+        if(params.tracking_mode == "AUTO")
+          localize_state = NextTrackingState(ModeSelector::PNP, current_image);
+        else if(params.tracking_mode == "EDGE")
+          localize_state = EDGES;
+        else if(params.tracking_mode == "KLT")
+        {
+          klt_init_img = current_image;
+          localize_state = KLT_INIT;
+        }
+      }
+      if(output_depth)
+      {
+        TransformDepthFrame(virtual_depth, currentPoseMM, vig->GetK(), result.depth, imgTf,
+          K_scaled, current_image.size());
+      }
+      currentPose = imgTf;
+      result.valid = true;
+
+      ShowTfViz(current_image, currentPose);
+    }
+    else
+    {
+      mode_selector.record(ModeSelector::PNP, false, 0, WallTime()-mode_start);
+      ResetMotionModel();
+      numPnpRetrys++;
+      if(numPnpRetrys > 1)
+      {
+        std::cout << "PnP failed, reinitializing using last known pose" << std::endl;
+        numPnpRetrys = 0;
+        localize_state = LOCAL_INIT;
+      }
+    }
+  }
+  else if (localize_state == INIT_PNP)
+  {
+    std::cout << "Refining matched pose with PnP..." << std::endl;
+    Eigen::Matrix4f imgTf;
+
+    start = WallTime();
+    KeyframeContainer* kf = QueryKeyframe(params.img_match_descriptor_type);
+    kf->ExtractFeatures();
+    AddStageTime("query_extract", WallTime()-start);
+
+    Eigen::Matrix<float, 6 ,6> cov;
+    if(FindImageTfVirtualPnp(kf, currentPose, imgTf, params.img_match_descriptor_type, true, cov))
+    {
+      ResetMotionModel();
+      if(params.motion_model == "IMU")
+      {
+        //imu_mm->init(imgTf, cov);
+      }
+
+      numPnpRetrys = 0;
+      localize_state = PNP;
+      currentPose = imgTf;
+      result.valid = true;
+    }
+    else
+    {
+      std::cout << "PnP init failed, reinitializing using last known pose" << std::endl;
+      localize_state = LOCAL_INIT;
+    }
+  }
+  else if(relocalizer)
+  {
+    // Global localization runs on the relocalizer thread against the newest frame.  In the
+    // meantime frames are tracked from the last known pose, whichever succeeds first wins.
+    AsyncRelocalizer::Result reloc;
+    if(relocalizer->poll(reloc))
+    {
+      // The pose belongs to an older frame, so it is only the prior for refining on the
+      // next frame and is not reported for this one
+      std::cout << "Relocalized on the frame at " << reloc.stamp << std::endl;
+      relocalizer->cancel();
+      localize_state = INIT_PNP;
+      numLocalizeRetrys = 0;
+      currentPose = reloc.pose;
+    }
+    else
+    {
+      int failures = relocalizer->takeFailures();
+      numLocalizeRetrys += failures;
+      if(localize_state == INIT)
+        lost_gate.recordFailures(failures);
+      if(numLocalizeRetrys > 3 && localize_state == LOCAL_INIT)
+      {
+        std::cout << "Fully reinitializing" << std::endl;
+        localize_state = INIT;
+      }
+
+      if(localize_state == LOCAL_INIT)
+      {
+        KeyframeContainer* kf = QueryKeyframe(params.pnp_descriptor_type);
+        Eigen::Matrix4f imgTf;
+        Eigen::Matrix<float, 6 ,6> cov;
+        if(FindImageTfVirtualPnp(kf, currentPose, imgTf, params.pnp_descriptor_type, true, cov))
+        {
+          std::cout << "Recovered from the last known pose" << std::endl;
+          relocalizer->cancel();
+          ResetMotionModel();
+          numPnpRetrys = 0;
+          numLocalizeRetrys = 0;
+          localize_state = PNP;
+          currentPose = imgTf;
+          result.valid = true;
+        }
+      }
+      double scale;
+      if(!result.valid && localize_state == LOCAL_INIT)
+      {
+        relocalizer->submit(current_image, Kcv.clone(), img_time_stamp, &currentPose);
+      }
+      else if(!result.valid && lost_gate.admit(current_image, img_time_stamp, scale))
+      {
+        Mat image, K;
+        ScaleForLocalization(current_image, Kcv, scale, image, K);
+        relocalizer->submit(image, K, img_time_stamp);
+      }
+    }
+  }
+  else
+  {
+    double start = WallTime();
+    Eigen::Matrix4f pose;
+    bool localize_success = false;
+    bool attempted = true;
+    double scale;
+
+    if(localize_state == LOCAL_INIT)
+    {
+      localize_success = localization_init->localize(current_image, Kcv, &pose, &currentPose);
+    }
+    else if(localize_state == INIT &&
+      (attempted = lost_gate.admit(current_image, img_time_stamp, scale)))
+    {
+      Mat image, K;
+      ScaleForLocalization(current_image, Kcv, scale, image, K);
+      localize_success = localization_init->localize(image, K, &pose);
+    }
+
+    if(localize_success)
+    {
+      localize_state = INIT_PNP;
+      numLocalizeRetrys = 0;
+      currentPose = pose;
+      result.valid = true;
+    }
+    else if(attempted)
+    {
+      if(localize_state == INIT)
+        lost_gate.recordFailures(1);
+      numLocalizeRetrys++;
+      if(numLocalizeRetrys > 3)
+      {
+        std::cout << "Fully reinitializing" << std::endl;
+        localize_state = INIT;
+      }
+    }
+
+    AddStageTime("localize", WallTime()-start);
+  }
+  // currentPose always holds the estimate for the latest processed frame
+  current_pose_stamp = img_time_stamp;
+  result.pose = currentPose;
+  result.state = localize_state;
+
+  AddTime(step_times, "total", WallTime()-spin_start, true);
+  result.timings.swap(step_times);
+  return result;
+}
+
+std::vector<int> Tracker::FindPlaneInPointCloud(const std::vector<pcl::PointXYZ>& pts)
+{
+  std::vector<int> inliers;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);//, plane;
+
+  cloud->points.resize(pts.size());
+  for(unsigned int i = 0; i < pts.size(); i++)
+  {
+    cloud->points[i] = pts[i];
+  }
+
+  pcl::SampleConsensusModelPlane<pcl::PointXYZ>::Ptr model_p (new pcl::SampleConsensusModelPlane<pcl::PointXYZ> (cloud));
+  pcl::RandomSampleConsensus<pcl::PointXYZ> ransac (model_p);
+  ransac.setDistanceThreshold (.01);
+  ransac.computeModel();
+  ransac.getInliers(inliers);
+
+  //pcl::copyPointCloud<pcl::PointXYZ>(*cloud, inliers, *plane);
+  return inliers;
+}
+
+std::vector<pcl::PointXYZ> Tracker::GetPointCloudFromFrames(KeyframeContainer* kfc1, KeyframeContainer* kfc2)
+{
+  std::vector<CloudPoint> pcCv;
+  std::vector<pcl::PointXYZ> pc;
+  std::vector<KeyPoint> correspImg1Pt;
+  const double matchRatio = params.ratio_test_thresh;
+
+  Eigen::Matrix4f tf1 = kfc1->GetTf().inverse();
+  Eigen::Matrix4f tf2 = kfc2->GetTf().inverse();
+
+  Matx34d P(tf1(0,0), tf1(0,1), tf1(0,2), tf1(0,3),
+            tf1(1,0), tf1(1,1), tf1(1,2), tf1(1,3),
+            tf1(2,0), tf1(2,1), tf1(2,2), tf1(2,3));
+  Matx34d P1(tf2(0,0), tf2(0,1), tf2(0,2), tf2(0,3),
+             tf2(1,0), tf2(1,1), tf2(1,2), tf2(1,3),
+             tf2(2,0), tf2(2,1), tf2(2,2), tf2(2,3));
+  Matx33d Kcv33(Kcv.at<double>(0,0), Kcv.at<double>(0,1), Kcv.at<double>(0,2),
+                Kcv.at<double>(1,0), Kcv.at<double>(1,1), Kcv.at<double>(1,2),
+                Kcv.at<double>(2,0), Kcv.at<double>(2,1), Kcv.at<double>(2,2));
+
+  //Find matches between kfc1 and kfc2
+  FlannBasedMatcher matcher;
+  std::vector < std::vector< DMatch > > matches;
+  matcher.knnMatch( kfc1->GetDescriptors(), kfc2->GetDescriptors(), matches, 2 );
+
+  std::vector< DMatch > goodMatches;
+  std::vector< DMatch > allMatches;
+  std::vector<Point3d> triangulatedPts1;
+  std::vector<Point3d> triangulatedPts2;
+  std::vector<KeyPoint> matchKps1;
+  std::vector<KeyPoint> matchKps2;
+
+
+  double reprojError;
+  // Use ratio test to find good keypoint matches
+  for(unsigned int j = 0; j < matches.size(); j++)
+  {
+    allMatches.push_back(matches[j][0]);
+    if(matches[j][0].distance < matchRatio*matches[j][1].distance)
+    {
+      Point2f pt1 = kfc1->GetKeypoints()[matches[j][0].queryIdx].pt;
+      Point2f pt2 = kfc2->GetKeypoints()[matches[j][0].trainIdx].pt;
+      Mat_<double> triPt = LinearLSTriangulation(Point3d(pt1.x, pt1.y, 1), Kcv33*P, Point3d(pt2.x, pt2.y, 1), Kcv33*P1, &reprojError);
+      //std::cout << "Reproj Error: " << *reprojError << std::endl;
+
+      if(reprojError < 1.)
+      {
+        pc.push_back(pcl::PointXYZ(triPt(0), triPt(1), triPt(2)));
+
+        goodMatches.push_back(matches[j][0]);
+        matchKps1.push_back(kfc1->GetKeypoints()[matches[j][0].queryIdx]);
+        matchKps2.push_back(kfc2->GetKeypoints()[matches[j][0].trainIdx]);
+      }
+    }
+  }
+
+
+#if 0
+  namedWindow("matches", 1);
+  Mat img_matches;
+  drawMatches(kfc1->GetImage(), kfc1->GetKeypoints(), kfc2->GetImage(), kfc2->GetKeypoints(), goodMatches, img_matches);
+  imshow("matches", img_matches);
+  waitKey(0);
+#endif
+
+  return pc;
+}
+
+std::vector<Point3d> Tracker::PCLToPoint3d(const std::vector<pcl::PointXYZ>& cpvec)
+{
+  std::vector<Point3d> points;
+  for(unsigned int i = 0; i < cpvec.size(); i++)
+  {
+    Point3d pt(cpvec[i].x, cpvec[i].y, cpvec[i].z);
+    points.push_back(pt);
+  }
+  return points;
+}
+
+void Tracker::ReprojectMask(Mat& dst, const Mat& src, const Eigen::Matrix3f& dstK,
+  const Eigen::Matrix3f& srcK, bool median_blur)
+{
+  double fxs = srcK(0,0);
+  double fys = srcK(1,1);
+  double cxs = srcK(0,2);
+  double cys = srcK(1,2);
+  double fxd = dstK(0,0);
+  double fyd = dstK(1,1);
+  double cxd = dstK(0,2);
+  double cyd = dstK(1,2);
+  for(int i = 0; i < src.rows; i++)
+  {
+    for(int j = 0; j < src.cols; j++)
+    {
+      if(src.at<uchar>(i,j) != 255)
+        continue;
+      double px_un = (j - cxs)/fxs;
+      double py_un = (i - cys)/fys;
+
+      int dst_x = floor(px_un*fxd + cxd);
+      int dst_y = floor(py_un*fyd + cyd);
+      if(dst_x < 0 || dst_x >= dst.cols || dst_y < 0 || dst_y >= dst.rows)
+        continue;
+
+      dst.at<uchar>(dst_y, dst_x) = src.at<uchar>(i,j);
+    }
+  }
+
+  // Fill in any holes
+  if(median_blur)
+  {
+    medianBlur(dst, dst, 3);
+  }
+}
+
+bool Tracker::FindImageTfVirtualEdges(KeyframeContainer* kfc, Eigen::Matrix4f vimgTf, Eigen::Matrix4f& tf, bool mask_kf)
+{
+  TRACE_SCOPE("FindImageTfVirtualEdges");
+  tf = Eigen::MatrixXf::Identity(4,4);
+
+  // Get virtual image and depth map
+  Mat depth, mask;
+  Mat vimg, vimg_masked;
+  double start = WallTime();
+  Eigen::Matrix3f vimgK = vig->GetK();
+  vimg = vig->GenerateVirtualImage(vimgTf, depth, mask);
+  vimg.copyTo(vimg_masked, mask);
+  AddStageTime("render", WallTime()-start);
+
+  Mat kf_mask;
+  if(mask_kf)
+  {
+    start = WallTime();
+    FrameScratch& scratch = GetFrameScratch();
+    Mat& reproj_mask = scratch.reproj_mask;
+    ReuseBuffer(reproj_mask, kfc->GetImage().rows, kfc->GetImage().cols, CV_8U);
+    reproj_mask.setTo(Scalar(0));
+    ReprojectMask(reproj_mask, mask, K_scaled, vimgK);
+
+    //dilate mask so as not to mask good features that may have moved
+    ReuseBuffer(scratch.query_mask, reproj_mask.rows, reproj_mask.cols, CV_8U);
+    dilate(reproj_mask, scratch.query_mask, MaskDilateElement());
+    kf_mask = scratch.query_mask;
+    kfc->SetMask(kf_mask);
+
+    AddStageTime("query_mask", WallTime()-start);
+    if(params.show_debug)
+    {
+      ShowMasked("Query Masked", kfc->GetImage(), kf_mask);
+    }
+  }
+
+
+  start = WallTime();
+  std::vector<EdgeTrackingUtil::SamplePoint> sps =
+    EdgeTrackingUtil::getEdgeMatches(vimg_masked, kfc->GetImage(), vimgK, K_scaled, depth,
+      kf_mask, vimgTf);
+  AddStageTime("edge_match", WallTime()-start);
+
+  double avgError = 0;
+  for(int i = 0; i < sps.size(); i++)
+  {
+    avgError += sps[i].dist;
+  }
+  avgError /= sps.size();
+
+  edgeMatchError = avgError;
+  edgeNumMatches = sps.size();
+
+  // hacky way to detect failure
+  if(avgError > kMaxEdgeMatchError || sps.size() < kMinEdgeMatches)
+    return false;
+
+  start = WallTime();
+  //EdgeTrackingUtil::getEstimatedPosePnP(tf, vimgTf.inverse(), sps, Kcv);
+  EdgeTrackingUtil::getEstimatedPoseIRLS(tf, vimgTf.inverse(), sps, K_scaled);
+  tf = tf.inverse();
+  AddStageTime("edge_irls", WallTime()-start);
+
+  return true;
+}
+
+bool Tracker::RenderVirtualView(const Eigen::Matrix4f& vimgTf, VirtualView& view)
+{
+  view.valid = false;
+  view.tf = vimgTf;
+  view.keypoints.clear();
+  view.descriptors = Mat();
+  view.K = vig->GetK();
+  view.image = vig->GenerateVirtualImage(vimgTf, view.depth, view.mask);
+  return !view.image.empty();
+}
+
+void Tracker::GetQueryMask(Mat& dst, const Mat& src, const Eigen::Matrix3f& srcK, int rows,
+  int cols)
+{
+  FrameScratch& scratch = GetFrameScratch();
+  Mat& reproj_mask = scratch.reproj_mask;
+  ReuseBuffer(reproj_mask, rows, cols, CV_8U);
+  reproj_mask.setTo(Scalar(0));
+  ReprojectMask(reproj_mask, src, K_scaled, srcK, false);
+
+  //dilate mask so as not to mask good features that may have moved
+  // Masks of earlier frames may still be in flight in the pipeline, so masks come from a
+  // small pool instead of the scratch buffer
+  Mat mask;
+  for(unsigned int i = 0; i < pipeline_masks.size() && mask.empty(); i++)
+  {
+    if(pipeline_masks[i].refcount && *pipeline_masks[i].refcount == 1)
+    {
+      pipeline_masks[i].create(rows, cols, CV_8U);
+      mask = pipeline_masks[i];
+    }
+  }
+  if(mask.empty())
+  {
+    mask.create(rows, cols, CV_8U);
+    if(pipeline_masks.size() < kMaxPipelineBuffers)
+      pipeline_masks.push_back(mask);
+  }
+  dilate(reproj_mask, mask, MaskDilateElement());
+  dst = mask;
+}
+
+bool Tracker::ExtractVirtualFeatures(VirtualView& view, std::string vdesc_type)
+{
+  std::vector<KeyPoint>& vkps = view.keypoints;
+  Mat& vdesc = view.descriptors;
+  vkps.clear();
+
+  if(vdesc_type == "asift")
+  {
+    ASiftDetector detector;
+    detector.detectAndCompute(view.image, vkps, vdesc, view.mask, ASiftDetector::SIFT);
+  }
+  else if(vdesc_type == "asurf")
+  {
+    ASiftDetector detector;
+    detector.detectAndCompute(view.image, vkps, vdesc, view.mask, ASiftDetector::SURF);
+  }
+  else if(vdesc_type == "orb")
+  {
+    ORB orb(1000, 1.2f, 4);
+    orb(view.image, view.mask, vkps, vdesc);
+  }
+  else if(vdesc_type == "surf")
+  {
+    SurfFeatureDetector detector;
+    detector.detect(view.image, vkps, view.mask);
+
+    SurfDescriptorExtractor extractor;
+    extractor.compute(view.image, vkps, vdesc);
+  }
+#ifdef MESH_LOCALIZER_ENABLE_GPU
+  else if(vdesc_type == "surf_gpu")
+  {
+    gpu::SURF_GPU surf_gpu;
+
+    Mat vimg = view.image;
+    if(vimg.channels() == 3)
+      cvtColor(vimg, vimg, CV_BGR2GRAY);
+    gpu::GpuMat vkps_gpu, mask_gpu(view.mask), vimg_gpu(vimg);
+
+    surf_gpu(vimg_gpu, mask_gpu, vkps_gpu, view.descriptors_gpu);
+    surf_gpu.downloadKeypoints(vkps_gpu, vkps);
+  }
+#endif
+  if(vkps.size() <= 0)
+  {
+    std::cerr << "No keypoints found in virtual image" << std::endl;
+    return false;
+  }
+  view.valid = true;
+  return true;
+}
+
+bool Tracker::FindImageTfVirtualPnp(KeyframeContainer* kfc, Eigen::Matrix4f vimgTf, Eigen::Matrix4f& tf, std::string vdesc_type, bool mask_kf, Eigen::Matrix<float, 6, 6>& cov)
+{
+  TRACE_SCOPE("FindImageTfVirtualPnp");
+  tf = Eigen::MatrixXf::Identity(4,4);
+
+  // Get virtual image and depth map
+  VirtualView view;
+  double start = WallTime();
+  if(!RenderVirtualView(vimgTf, view))
+  {
+    return false;
+  }
+  virtual_depth = view.depth;
+  AddStageTime("render", WallTime()-start);
+
+  if(mask_kf)
+  {
+    Mat reproj_mask;
+    start = WallTime();
+    GetQueryMask(reproj_mask, view.mask, view.K, kfc->GetImage().rows, kfc->GetImage().cols);
+    AddStageTime("query_mask", WallTime()-start);
+    kfc->SetMask(reproj_mask);
+
+    start = WallTime();
+    kfc->ExtractFeatures();
+    AddStageTime("query_extract", WallTime()-start);
+    if(params.show_debug)
+    {
+      ShowMasked("Query Masked", kfc->GetImage(), reproj_mask);
+    }
+    if(kfc->GetKeypoints().size() == 0)
+    {
+      std::cerr << "Keyframe has no keypoints" << std::endl;
+      return false;
+    }
+  }
+  if(params.show_debug && VisualizationSink::Instance().HasConsumer())
+  {
+    Mat depth = view.depth;
+    VisualizationSink::Instance().Show("Query", kfc->GetImage());
+    VisualizationSink::Instance().Show("Virtual", view.image);
+    VisualizationSink::Instance().Show("Depth", [depth](Mat& depth_im)
+    {
+      double min_depth, max_depth;
+      minMaxLoc(depth, &min_depth, &max_depth);
+      depth.convertTo(depth_im, CV_8U, 255.0/(max_depth-min_depth), 0);// -min_depth*255.0/(max_depth-min_depth));
+    });
+  }
+
+  // Find features in virtual image
+  start = WallTime();
+  if(!ExtractVirtualFeatures(view, vdesc_type))
+  {
+    return false;
+  }
+  AddStageTime("virtual_extract", WallTime()-start);
+
+  start = WallTime();
+  bool success = MatchVirtualPnp(kfc, view, vdesc_type, tf, cov, pnpReprojError, pnpNumInliers,
+    rng, frame_deadline);
+  AddStageTime("match_pnp", WallTime()-start);
+  return success;
+}
+
+bool Tracker::MatchVirtualPnp(KeyframeContainer* kfc, const VirtualView& view,
+  std::string vdesc_type, Eigen::Matrix4f& tf, Eigen::Matrix<float, 6, 6>& cov,
+  double& reprojError, int& numInliers, std::mt19937& rng, double deadline)
+{
+  tf = Eigen::MatrixXf::Identity(4,4);
+  numInliers = 0;
+
+  const std::vector<KeyPoint>& vkps = view.keypoints;
+  const Mat& vdesc = view.descriptors;
+  const Mat& vimg = view.image;
+  const Mat& depth = view.depth;
+  const Eigen::Matrix3f& vimgK = view.K;
+  const Eigen::Matrix4f& vimgTf = view.tf;
+  Eigen::Matrix3f vimgK_inv = vimgK.inverse();
+
+  FrameScratch& scratch = GetFrameScratch();
+  std::vector < std::vector< DMatch > >& matches = scratch.matches;
+  matches.clear();
+
+  // Find image features matches between kfc and vimg
+  double matchRatio = params.ratio_test_thresh;
+
+  double start = WallTime();
+  if(params.pnp_match_radius > 0 && vdesc_type == "orb")
+  {
+    const std::vector<KeyPoint>& kf_kps = kfc->GetKeypoints();
+    Mat kf_desc = kfc->GetDescriptors();
+    int step = kf_desc.step / sizeof(kf_desc.ptr()[0]);
+    for(int i = 0; i < vkps.size(); i++)
+    {
+      int best_match_idx = -1;
+      int best_match_dist = -1;
+      Eigen::Vector3f vkp_in_kf(vkps[i].pt.x, vkps[i].pt.y, 1);
+      vkp_in_kf = K_scaled*vimgK_inv*vkp_in_kf;
+      vkp_in_kf /= vkp_in_kf(2);
+      for(int j = 0; j < kf_kps.size(); j++)
+      {
+        if(sqrt(pow(vkp_in_kf(0)-kf_kps[j].pt.x,2) + pow(vkp_in_kf(1)-kf_kps[j].pt.y,2)) > params.pnp_match_radius)
+        {
+          continue;
+        }
+        int dist = cv::normHamming(vdesc.ptr(i), kf_desc.ptr() + step*j, kf_desc.cols);
+        if(dist < best_match_dist || best_match_dist == -1)
+        {
+          best_match_dist = dist;
+          best_match_idx = j;
+        }
+      }
+      if(best_match_idx != -1)
+      {
+        std::vector<DMatch> pmatches(2);
+        pmatches[0] = DMatch(best_match_idx, i, best_match_dist);
+        pmatches[1] = DMatch(best_match_idx, i, std::numeric_limits<float>::max());
+        matches.push_back(pmatches);
+      }
+    }
+  }
+  else
+  {
+    // TODO: Add option to match all descriptors on GPU
+#ifdef MESH_LOCALIZER_ENABLE_GPU
+    if(vdesc_type == "surf_gpu")
+    {
+      gpu::BFMatcher_GPU matcher;
+      matcher.knnMatch(kfc->GetGPUDescriptors(), view.descriptors_gpu, matches, 2);
+    }
+    else
+#endif
+    if(vdesc_type == "orb")
+    {
+      BFMatcher matcher(NORM_HAMMING);
+      matcher.knnMatch( kfc->GetDescriptors(), vdesc, matches, 2 );
+    }
+    else
+    {
+      FlannBasedMatcher matcher;
+      matcher.knnMatch( kfc->GetDescriptors(), vdesc, matches, 2 );
+    }
+  }
+
+  Metrics::Record("match", WallTime()-start);
+
+  std::vector< DMatch >& goodMatches = scratch.goodMatches;
+  std::vector<Point2f>& matchPts = scratch.matchPts;
+  std::vector<Point2f>& matchPts3dProj = scratch.matchPts3dProj;
+  std::vector<Point3f>& matchPts3d = scratch.matchPts3d;
+  goodMatches.clear();
+  matchPts.clear();
+  matchPts3dProj.clear();
+  matchPts3d.clear();
+
+  start = WallTime();
+  const std::vector<KeyPoint>& kf_kps = kfc->GetKeypoints();
+  for(unsigned int j = 0; j < matches.size(); j++)
+  {
+    if(matches[j][0].distance < matchRatio*matches[j][1].distance)
+    {
+      // Back-project point to 3d
+      if(matches[j][0].trainIdx >= vkps.size() || matches[j][0].queryIdx >= kf_kps.size())
+      {
+        std::cout <<  "Index mismatch? AHH: " << matches[j][0].trainIdx << " " << matches[j][0].queryIdx << " " << vkps.size() << " " << kf_kps.size() << std::endl;
+      }
+
+      Point2f kp = vkps[matches[j][0].trainIdx].pt;
+      Eigen::Vector3f hkp(kp.x, kp.y, 1);
+      Eigen::Vector3f backproj = vimgK_inv*hkp;
+      backproj /= backproj(2);
+      backproj *= depth.at<float>(kp.y, kp.x);
+      Eigen::Vector4f backproj_h(backproj(0), backproj(1), backproj(2), 1);
+      backproj_h = vimgTf*backproj_h;
+
+      goodMatches.push_back(matches[j][0]);
+      matchPts3dProj.push_back(kp);
+      matchPts.push_back(kf_kps[matches[j][0].queryIdx].pt);
+      matchPts3d.push_back(Point3f(backproj_h(0), backproj_h(1), backproj_h(2)));
+    }
+  }
+  Metrics::Record("match_filter", WallTime()-start);
+
+  if(params.show_pnp_matches)
+  {
+    ShowMatches("PnP Matches", kfc->GetImage(), kfc->GetKeypoints(), vimg, vkps, goodMatches);
+  }
+
+  if(goodMatches.size() < 4)
+  {
+    std::cerr << "Not enough matches found in virtual image" << std::endl;
+    return false;
+  }
+
+  /**** Pnp on known correspondences from virtual image ****
+  Mat Rvec_true, t_true;
+  solvePnP(matchPts3d, matchPts3dProj, Kcv, distcoeffcv, Rvec_true, t_true);
+
+  Mat Rtrue;
+  Rodrigues(Rvec_true, Rtrue);
+  Eigen::Matrix4f true_tf;
+  true_tf << Rtrue.at<double>(0,0), Rtrue.at<double>(0,1), Rtrue.at<double>(0,2), t_true.at<double>(0),
+        Rtrue.at<double>(1,0), Rtrue.at<double>(1,1), Rtrue.at<double>(1,2), t_true.at<double>(1),
+        Rtrue.at<double>(2,0), Rtrue.at<double>(2,1), Rtrue.at<double>(2,2), t_true.at<double>(2),
+             0,      0,      0,    1;
+  std::cout << "Known: " << std::endl << vimgTf << std::endl << std::endl << true_tf.inverse() << std::endl;
+  *****/
+
+
+  Eigen::Matrix4f tfran;
+  //solvePnPRansac(matchPts3d, matchPts, Kcv,
+  std::vector<int>& inlierIdx = scratch.inlierIdx;
+  inlierIdx.clear();
+  bool found = PnPUtil::RansacPnP(matchPts3d, matchPts, Kcv, vimgTf.inverse(), tfran,
+    inlierIdx, &reprojError, &cov, TimeLeft(deadline), &rng);
+  numInliers = inlierIdx.size();
+  if(!found || inlierIdx.size() < params.min_pnp_inliers)
+  {
+    Metrics::Increment("virtual_pnp_failures");
+    return false;
+  }
+
+  // compute covariance of inverse transform from transform;
+  Eigen::Matrix<float, 6, 6> J;
+  J.setZero();
+  J.block<3,3>(0,0) = -Eigen::MatrixXf::Identity(3,3);
+  J.block<3,3>(3,3) = -tfran.block<3,3>(0,0).transpose();
+  Eigen::Vector3d Avec = (-tfran.block<3,3>(0,0).transpose()*tfran.block<3,1>(0,3)).cast<double>();
+  Eigen::Matrix3d A ;
+  A << 0, -Avec(2), Avec(1),
+       Avec(2), 0, -Avec(0),
+       -Avec(1), Avec(0), 0;
+  //gcop::SO3::Instance().hat(A, (-tfran.block<3,3>(0,0).transpose()*tfran.block<3,1>(0,3)).cast<double>()); // hat(-R^Tt)
+  J.block<3,3>(3,0) = A.cast<float>();
+
+  cov = J*params.pixel_noise*cov*J.transpose();
+  //std::cout << "R, t inv covariance:" << std::endl << cov << std::endl;
+
+  if(params.show_pnp_matches && VisualizationSink::Instance().HasConsumer())
+  {
+    std::vector< DMatch > inlierMatches;
+    for(int j = 0; j < inlierIdx.size(); j++)
+    {
+      inlierMatches.push_back(goodMatches[inlierIdx[j]]);
+    }
+    ShowMatches("PnP Match Inliers", kfc->GetImage(), kfc->GetKeypoints(), vimg, vkps,
+      inlierMatches);
+  }
+
+  tf = tfran.inverse();
+  return true;
+}
+
+void Tracker::ShowMasked(const std::string& name, const Mat& img, const Mat& mask)
+{
+  if(!VisualizationSink::Instance().HasConsumer())
+    return;
+
+  VisualizationSink::Instance().Show(name, [img, mask](Mat& dst)
+  {
+    img.copyTo(dst, mask);
+  });
+}
+
+void Tracker::ShowMatches(const std::string& name, const Mat& img1,
+  const std::vector<KeyPoint>& kps1, const Mat& img2, const std::vector<KeyPoint>& kps2,
+  const std::vector<DMatch>& matches)
+{
+  if(!VisualizationSink::Instance().HasConsumer())
+    return;
+
+  VisualizationSink::Instance().Show(name, [img1, kps1, img2, kps2, matches](Mat& dst)
+  {
+    drawMatches(img1, kps1, img2, kps2, matches, dst);
+  });
+}
+
+void Tracker::TransformDepthFrame(const Mat& d1, const Eigen::Matrix4f& tf1,
+  const Eigen::Matrix3f K1, Mat& d2,
+  const Eigen::Matrix4f& tf2, const Eigen::Matrix3f& K2, Size d2_size)
+{
+  d2 = Mat(d2_size, CV_32F, Scalar(0));
+  double fx1 = K1(0,0);
+  double fy1 = K1(1,1);
+  double cx1 = K1(0,2);
+  double cy1 = K1(1,2);
+  double fx2 = K2(0,0);
+  double fy2 = K2(1,1);
+  double cx2 = K2(0,2);
+  double cy2 = K2(1,2);
+
+  Eigen::Matrix4f tf2_inv = tf2.inverse();
+
+  for(int i = 0; i < d1.rows; i++)
+  {
+    for(int j = 0; j < d1.cols; j++)
+    {
+      if(d1.at<float>(i,j) == 0 || d1.at<float>(i,j) == -1)
+        continue;
+
+      Eigen::Vector3f pt2d((j-cx1)/fx1, (i-cy1)/fy1, 1);
+      Eigen::Vector3f pt3d = d1.at<float>(i,j)*pt2d;
+      Eigen::Vector3f pt3d_tf2 = (tf2_inv*tf1*Eigen::Vector4f(pt3d(0), pt3d(1), pt3d(2),1)).head<3>();
+      float depth = pt3d_tf2(2);
+      int d2x = round(fx2*pt3d_tf2(0)/depth + cx2);
+      int d2y = round(fy2*pt3d_tf2(1)/depth + cy2);
+
+      if(d2x < 0 || d2x >= d2.cols || d2y < 0 || d2y >= d2.rows)
+        continue;
+
+      d2.at<float>(d2y, d2x) = depth;
+    }
+  }
+  medianBlur(d2, d2, 5);
+}
+
+Eigen::Matrix4f Tracker::FindImageTfPnp(KeyframeContainer* kfc, const MapFeatures& mf)
+{
+  Eigen::Matrix4f tf;
+
+  // Find image features matches in map
+  const double matchRatio = params.ratio_test_thresh;
+
+  FlannBasedMatcher matcher;
+  std::vector < std::vector< DMatch > > matches;
+  matcher.knnMatch( kfc->GetDescriptors(), mf.GetDescriptors(), matches, 2 );
+
+  std::vector< DMatch > goodMatches;
+  std::vector< DMatch > allMatches;
+  std::vector<Point2f> matchPts;
+  std::vector<Point3f> matchPts3d;
+
+  for(unsigned int j = 0; j < matches.size(); j++)
+  {
+    allMatches.push_back(matches[j][0]);
+    if(matches[j][0].distance < matchRatio*matches[j][1].distance)
+    {
+      pcl::PointXYZ pt3d = mf.GetKeypoints()[matches[j][0].trainIdx];
+
+      goodMatches.push_back(matches[j][0]);
+      matchPts.push_back(kfc->GetKeypoints()[matches[j][0].queryIdx].pt);
+      matchPts3d.push_back(Point3f(pt3d.x, pt3d.y, pt3d.z));
+    }
+  }
+
+  if(goodMatches.size() <= 0)
+  {
+    std::cerr << "No matches found in map" << std::endl;
+    return tf;
+  }
+  // Solve for camera transform
+  Mat Rvec, t;
+  //solvePnP(matchPts3d, matchPts, Kcv, distcoeffcv, Rvec, t);
+  solvePnPRansac(matchPts3d, matchPts, Kcv, distcoeffcv, Rvec, t);
+
+  Mat R;
+  Rodrigues(Rvec, R);
+
+  tf << R.at<double>(0,0), R.at<double>(0,1), R.at<double>(0,2), t.at<double>(0),
+        R.at<double>(1,0), R.at<double>(1,1), R.at<double>(1,2), t.at<double>(1),
+        R.at<double>(2,0), R.at<double>(2,1), R.at<double>(2,2), t.at<double>(2),
+             0,      0,      0,    1;
+  return tf.inverse();
+}
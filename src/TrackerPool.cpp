@@ -0,0 +1,167 @@
+#include "mesh_localize/TrackerPool.h"
+#include "mesh_localize/Trace.h"
+
+#include <boost/bind.hpp>
+
+TrackerPool::TrackerPool(int num_workers) :
+  next_slot(0),
+  num_workers(num_workers > 0 ? num_workers : boost::thread::hardware_concurrency()),
+  num_relocalizing(0),
+  running(true)
+{
+  if(this->num_workers <= 0)
+    this->num_workers = 1;
+  for(int i = 0; i < this->num_workers; i++)
+  {
+    workers.create_thread(boost::bind(&TrackerPool::WorkerLoop, this));
+  }
+}
+
+TrackerPool::~TrackerPool()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    running = false;
+  }
+  work_cond.notify_all();
+  workers.join_all();
+}
+
+int TrackerPool::add(const boost::shared_ptr<Tracker>& tracker)
+{
+  boost::shared_ptr<Slot> slot(new Slot);
+  slot->tracker = tracker;
+  slot->stamp = 0;
+  slot->has_frame = false;
+  slot->busy = false;
+  slot->num_dropped = 0;
+
+  boost::lock_guard<boost::mutex> lock(mutex);
+  slots.push_back(slot);
+  return slots.size()-1;
+}
+
+void TrackerPool::Queue(Slot& slot, const cv::Mat& frame, double stamp)
+{
+  if(slot.has_frame)
+    slot.num_dropped++;
+  slot.frame = frame;
+  slot.stamp = stamp;
+  slot.has_frame = true;
+}
+
+void TrackerPool::submit(int slot, const cv::Mat& frame, double stamp)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if(slot < 0 || slot >= (int)slots.size())
+      return;
+    Queue(*slots[slot], frame, stamp);
+  }
+  work_cond.notify_one();
+}
+
+void TrackerPool::submitAll(const cv::Mat& frame, double stamp)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    for(unsigned int i = 0; i < slots.size(); i++)
+    {
+      Queue(*slots[i], frame, stamp);
+    }
+  }
+  work_cond.notify_all();
+}
+
+unsigned long TrackerPool::getDropped(int slot)
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  if(slot < 0 || slot >= (int)slots.size())
+    return 0;
+  return slots[slot]->num_dropped;
+}
+
+void TrackerPool::flush()
+{
+  std::vector<boost::shared_ptr<Slot> > current;
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(true)
+    {
+      bool idle = true;
+      for(unsigned int i = 0; i < slots.size(); i++)
+      {
+        if(slots[i]->has_frame || slots[i]->busy)
+          idle = false;
+      }
+      if(idle)
+        break;
+      idle_cond.wait(lock);
+    }
+    current = slots;
+  }
+
+  for(unsigned int i = 0; i < current.size(); i++)
+  {
+    current[i]->tracker->flush();
+  }
+}
+
+bool TrackerPool::IsRelocalizing(Tracker::LocalizeState state)
+{
+  return state == Tracker::INIT || state == Tracker::LOCAL_INIT || state == Tracker::INIT_PNP;
+}
+
+TrackerPool::Slot* TrackerPool::NextSlot()
+{
+  // Round robin over the trackers with a new frame.  Relocalization can take much longer
+  // than a tracking step, so one worker is always kept free for tracking.
+  bool allow_relocalize = num_workers == 1 || num_relocalizing < num_workers - 1;
+  for(unsigned int n = 0; n < slots.size(); n++)
+  {
+    unsigned int i = (next_slot + n) % slots.size();
+    Slot* slot = slots[i].get();
+    if(!slot->has_frame || slot->busy)
+      continue;
+    if(!allow_relocalize && IsRelocalizing(slot->tracker->getState()))
+      continue;
+    next_slot = i + 1;
+    return slot;
+  }
+  return NULL;
+}
+
+void TrackerPool::WorkerLoop()
+{
+  Tracer::SetThreadName("tracker_pool");
+  boost::unique_lock<boost::mutex> lock(mutex);
+  while(running)
+  {
+    Slot* slot = NextSlot();
+    if(!slot)
+    {
+      work_cond.wait(lock);
+      continue;
+    }
+
+    cv::Mat frame = slot->frame;
+    double stamp = slot->stamp;
+    slot->frame = cv::Mat();
+    slot->has_frame = false;
+    slot->busy = true;
+    bool relocalizing = IsRelocalizing(slot->tracker->getState());
+    if(relocalizing)
+      num_relocalizing++;
+    lock.unlock();
+
+    slot->tracker->trackFrame(frame, stamp);
+
+    lock.lock();
+    slot->busy = false;
+    if(relocalizing)
+      num_relocalizing--;
+    idle_cond.notify_all();
+    // Another worker may have skipped this slot or a relocalizing one while it was busy
+    work_cond.notify_all();
+  }
+}
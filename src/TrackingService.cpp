@@ -0,0 +1,79 @@
+#include "mesh_localize/TrackingService.h"
+
+#include <boost/bind.hpp>
+
+TrackingService::TrackingService(const TrackerParams& params, int num_workers) :
+  params(params),
+  localizer(NULL),
+  vig(NULL),
+  pool(new TrackerPool(num_workers))
+{
+  localizer = Tracker::CreateLocalizer(params);
+}
+
+TrackingService::~TrackingService()
+{
+  // Workers first, then the trackers, which may still hold pipeline threads that render.
+  // The render service goes last.
+  pool.reset();
+  streams.clear();
+  delete localizer;
+}
+
+bool TrackingService::isReady() const
+{
+  return localizer != NULL;
+}
+
+int TrackingService::addStream(const Eigen::Matrix3f& K, const Eigen::VectorXf& distcoeff,
+  int rows, int cols)
+{
+  if(!localizer)
+    return -1;
+  if(!vig)
+  {
+    vig = render_service.AddGenerator(
+      boost::bind(&Tracker::CreateImageGenerator, params, K, rows, cols));
+    if(!vig)
+      return -1;
+  }
+
+  int stream = streams.size();
+  boost::shared_ptr<Tracker> tracker(new Tracker(params, K, distcoeff, localizer, vig));
+  tracker->setResultCallback(boost::bind(&TrackingService::HandleResult, this, stream, _1));
+  streams.push_back(tracker);
+  pool->add(tracker);
+  return stream;
+}
+
+void TrackingService::setResultCallback(const ResultCallback& cb)
+{
+  result_callback = cb;
+}
+
+void TrackingService::processFrame(int stream, const cv::Mat& image, double stamp)
+{
+  if(stream < 0 || stream >= (int)streams.size())
+    return;
+
+  cv::Mat frame;
+  streams[stream]->prepareFrame(image, frame);
+  if(frame.data == image.data)
+  {
+    frame = frame.clone();
+  }
+  pool->submit(stream, frame, stamp);
+}
+
+void TrackingService::flush()
+{
+  pool->flush();
+}
+
+void TrackingService::HandleResult(int stream, const Tracker::PoseResult& result)
+{
+  if(result_callback)
+  {
+    result_callback(stream, result);
+  }
+}
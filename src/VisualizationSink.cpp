@@ -0,0 +1,117 @@
+#include "mesh_localize/VisualizationSink.h"
+
+#include <set>
+#include <opencv2/highgui/highgui.hpp>
+
+VisualizationSink& VisualizationSink::Instance()
+{
+  static VisualizationSink sink;
+  return sink;
+}
+
+VisualizationSink::VisualizationSink()
+  : max_rate(15), running(false)
+{
+}
+
+VisualizationSink::~VisualizationSink()
+{
+  Stop();
+}
+
+void VisualizationSink::Start(double rate)
+{
+  boost::lock_guard<boost::mutex> lock(mutex);
+  if(running)
+    return;
+  max_rate = rate > 0 ? rate : 15;
+  running = true;
+  display_thread = boost::thread(&VisualizationSink::DisplayLoop, this);
+}
+
+void VisualizationSink::Stop()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if(!running)
+      return;
+    running = false;
+    pending.clear();
+  }
+  cond.notify_all();
+  if(display_thread.joinable())
+    display_thread.join();
+}
+
+bool VisualizationSink::HasConsumer() const
+{
+  return running;
+}
+
+void VisualizationSink::Show(const std::string& name, const cv::Mat& img)
+{
+  if(!running || img.empty())
+    return;
+  boost::lock_guard<boost::mutex> lock(mutex);
+  Item& item = pending[name];
+  item.img = img;
+  item.render.clear();
+  cond.notify_one();
+}
+
+void VisualizationSink::Show(const std::string& name, const RenderFunction& render)
+{
+  if(!running)
+    return;
+  boost::lock_guard<boost::mutex> lock(mutex);
+  Item& item = pending[name];
+  item.img = cv::Mat();
+  item.render = render;
+  cond.notify_one();
+}
+
+void VisualizationSink::DisplayLoop()
+{
+  // All highgui calls happen on this thread
+  std::set<std::string> windows;
+  boost::posix_time::time_duration period = 
+    boost::posix_time::microseconds(static_cast<long>(1e6/max_rate));
+  while(true)
+  {
+    std::map<std::string, Item> items;
+    {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      if(!running)
+        break;
+      if(pending.empty())
+        cond.timed_wait(lock, period);
+      items.swap(pending);
+    }
+
+    boost::system_time next = boost::get_system_time() + period;
+    for(std::map<std::string, Item>::iterator it = items.begin(); it != items.end(); it++)
+    {
+      cv::Mat img = it->second.img;
+      if(it->second.render)
+      {
+        it->second.render(img);
+      }
+      if(img.empty())
+        continue;
+      if(windows.find(it->first) == windows.end())
+      {
+        cv::namedWindow(it->first, cv::WINDOW_NORMAL);
+        windows.insert(it->first);
+      }
+      cv::imshow(it->first, img);
+    }
+    cv::waitKey(1);
+    // Cap the display rate; anything that arrives meanwhile replaces older images
+    boost::this_thread::sleep(next);
+  }
+  if(!windows.empty())
+  {
+    cv::destroyAllWindows();
+    cv::waitKey(1);
+  }
+}
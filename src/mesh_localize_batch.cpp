@@ -0,0 +1,300 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <Eigen/Geometry>
+#include <opencv2/highgui/highgui.hpp>
+#include <boost/thread.hpp>
+
+#include "mesh_localize/Tracker.h"
+#include "mesh_localize/SequenceUtil.h"
+
+using namespace cv;
+
+/**
+ *  Offline batch tracking of long recorded sequences.  The sequence is split into chunks
+ *  that are tracked independently, each starting from global localization, by a pool of
+ *  worker processes.  Consecutive chunks overlap by a few frames; the overlap is used to
+ *  cross-check the chunks against each other when the results are stitched together.
+ *
+ *  Workers are processes rather than threads because the OGRE renderer is a per-process
+ *  singleton bound to the thread that created it.
+ *
+ *  Usage: mesh_localize_batch <params.yml> <intrinsics.yml> <images> <output_prefix>
+ *           [workers] [chunk_size] [overlap] [fps]
+ *
+ *  Inputs are the same as for mesh_localize_replay.  Writes <output_prefix>_poses.csv and
+ *  <output_prefix>_boundaries.csv, which lists the pose agreement at every chunk boundary.
+ */
+
+namespace
+{
+  // Chunks whose overlapping poses differ by more than this are reported as inconsistent
+  const double kMaxRelTransError = 0.05;
+  const double kMaxRotErrorDeg = 5.0;
+
+  struct Chunk
+  {
+    int begin;
+    // Frames [begin, own_end) are owned by the chunk, [own_end, end) overlap the next one
+    int own_end;
+    int end;
+  };
+
+  std::string ChunkFilename(const std::string& prefix, int chunk)
+  {
+    std::stringstream ss;
+    ss << prefix << "_chunk" << chunk << ".csv";
+    return ss.str();
+  }
+
+  // Tracks the chunks assigned to one worker process.  Returns the process exit status.
+  int RunWorker(int worker, int num_workers, const std::vector<Chunk>& chunks,
+    const std::vector<SequenceUtil::Frame>& frames, const TrackerParams& params,
+    const Eigen::Matrix3f& K, const Eigen::VectorXf& distcoeff, const std::string& prefix)
+  {
+    Mat first = imread(frames[0].path);
+    if(first.empty())
+    {
+      std::cerr << "Could not read " << frames[0].path << std::endl;
+      return 1;
+    }
+
+    MonocularLocalizer* localizer = Tracker::CreateLocalizer(params);
+    if(!localizer)
+      return 1;
+    VirtualImageGenerator* vig = Tracker::CreateImageGenerator(params, K, first.rows,
+      first.cols);
+    if(!vig)
+    {
+      delete localizer;
+      return 1;
+    }
+
+    int status = 0;
+    for(unsigned int c = worker; c < chunks.size(); c += num_workers)
+    {
+      std::ofstream out(ChunkFilename(prefix, c).c_str());
+      if(!out.is_open())
+      {
+        status = 1;
+        break;
+      }
+      SequenceUtil::WritePoseHeader(out);
+
+      // Every chunk starts from scratch, so it begins with global localization
+      Tracker tracker(params, K, distcoeff, localizer, vig);
+      for(int i = chunks[c].begin; i < chunks[c].end; i++)
+      {
+        Mat image = imread(frames[i].path);
+        if(image.empty())
+        {
+          std::cerr << "Could not read " << frames[i].path << std::endl;
+          status = 1;
+          break;
+        }
+        Tracker::PoseResult result = tracker.processFrame(image, frames[i].stamp);
+        SequenceUtil::WritePose(out, SequenceUtil::MakePoseRecord(i, result));
+      }
+      std::cout << "Worker " << worker << " finished chunk " << c << " (frames "
+        << chunks[c].begin << "-" << chunks[c].end-1 << ")" << std::endl;
+      if(status)
+        break;
+    }
+
+    delete vig;
+    delete localizer;
+    return status;
+  }
+
+  void ComparePoses(const SequenceUtil::PoseRecord& a, const SequenceUtil::PoseRecord& b,
+    double& rel_trans_error, double& rot_error_deg)
+  {
+    Eigen::Vector3d ta(a.x, a.y, a.z), tb(b.x, b.y, b.z);
+    rel_trans_error = (ta-tb).norm() / std::max(0.5*(ta.norm()+tb.norm()), 1e-6);
+    Eigen::Quaterniond qa(a.qw, a.qx, a.qy, a.qz), qb(b.qw, b.qx, b.qy, b.qz);
+    rot_error_deg = qa.normalized().angularDistance(qb.normalized())*180./M_PI;
+  }
+}
+
+int main (int argc, char **argv)
+{
+  if(argc < 5)
+  {
+    std::cerr << "Usage: " << argv[0]
+      << " <params.yml> <intrinsics.yml> <image_dir|stream_file> <output_prefix>"
+      << " [workers] [chunk_size] [overlap] [fps]" << std::endl;
+    return 1;
+  }
+
+  TrackerParams params;
+  if(!params.Load(argv[1]))
+    return 1;
+  if(params.random_seed < 0)
+    params.random_seed = 0;
+  // Every core already runs a worker process, the pipeline and task threads would only
+  // compete
+  params.pipeline_tracking = false;
+  params.task_threads = 1;
+
+  Eigen::Matrix3f K;
+  Eigen::VectorXf distcoeff;
+  if(!SequenceUtil::LoadIntrinsics(argv[2], K, distcoeff))
+    return 1;
+
+  std::string prefix = argv[4];
+  int num_workers = argc > 5 ? atoi(argv[5]) : boost::thread::hardware_concurrency();
+  int chunk_size = argc > 6 ? atoi(argv[6]) : 300;
+  int overlap = argc > 7 ? atoi(argv[7]) : 30;
+  double fps = argc > 8 ? atof(argv[8]) : 30;
+  if(num_workers <= 0 || chunk_size <= 0 || overlap < 0 || fps <= 0)
+  {
+    std::cerr << "workers, chunk_size and fps must be positive" << std::endl;
+    return 1;
+  }
+
+  std::vector<SequenceUtil::Frame> frames;
+  if(!SequenceUtil::ListFrames(argv[3], fps, frames))
+  {
+    std::cerr << "No images found in " << argv[3] << std::endl;
+    return 1;
+  }
+
+  std::vector<Chunk> chunks;
+  for(int begin = 0; begin < (int)frames.size(); begin += chunk_size)
+  {
+    Chunk chunk;
+    chunk.begin = begin;
+    chunk.own_end = std::min(begin + chunk_size, (int)frames.size());
+    chunk.end = std::min(chunk.own_end + overlap, (int)frames.size());
+    chunks.push_back(chunk);
+  }
+  num_workers = std::min(num_workers, (int)chunks.size());
+  std::cout << "Tracking " << frames.size() << " frames in " << chunks.size() << " chunks on "
+    << num_workers << " workers" << std::endl;
+
+  // Fork before anything creates threads or a render context
+  std::vector<pid_t> workers;
+  for(int w = 0; w < num_workers; w++)
+  {
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+      _exit(RunWorker(w, num_workers, chunks, frames, params, K, distcoeff, prefix));
+    }
+    else if(pid < 0)
+    {
+      perror("fork");
+      break;
+    }
+    workers.push_back(pid);
+  }
+
+  bool failed = (int)workers.size() != num_workers;
+  for(unsigned int w = 0; w < workers.size(); w++)
+  {
+    int status;
+    if(waitpid(workers[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+      std::cerr << "Worker " << w << " failed" << std::endl;
+      failed = true;
+    }
+  }
+  if(failed)
+    return 1;
+
+  // Stitch.  Chunks are merged in order, so frames in an overlap keep the pose of the
+  // earlier chunk, which has been tracking for a while, unless it lost the object there.
+  std::vector<SequenceUtil::PoseRecord> stitched(frames.size());
+  for(unsigned int i = 0; i < frames.size(); i++)
+  {
+    stitched[i].frame = i;
+    stitched[i].stamp = frames[i].stamp;
+  }
+  std::vector<std::vector<SequenceUtil::PoseRecord> > chunk_poses(chunks.size());
+  for(unsigned int c = 0; c < chunks.size(); c++)
+  {
+    std::string filename = ChunkFilename(prefix, c);
+    if(!SequenceUtil::ReadPoses(filename, chunk_poses[c]))
+      return 1;
+    std::remove(filename.c_str());
+    for(unsigned int i = 0; i < chunk_poses[c].size(); i++)
+    {
+      const SequenceUtil::PoseRecord& rec = chunk_poses[c][i];
+      if(rec.frame >= 0 && rec.frame < (int)stitched.size() && !stitched[rec.frame].valid)
+        stitched[rec.frame] = rec;
+    }
+  }
+
+  std::ofstream poses((prefix + "_poses.csv").c_str());
+  SequenceUtil::WritePoseHeader(poses);
+  int num_valid = 0;
+  for(unsigned int i = 0; i < stitched.size(); i++)
+  {
+    SequenceUtil::WritePose(poses, stitched[i]);
+    if(stitched[i].valid)
+      num_valid++;
+  }
+
+  // Cross-check each boundary on the frames both neighbouring chunks tracked
+  std::ofstream boundaries((prefix + "_boundaries.csv").c_str());
+  boundaries << "boundary,frame,compared,mean_rel_trans_error,max_rot_error_deg,consistent"
+    << std::endl;
+  int num_inconsistent = 0;
+  for(unsigned int c = 1; c < chunks.size(); c++)
+  {
+    std::vector<SequenceUtil::PoseRecord> prev(overlap), next(overlap);
+    for(unsigned int i = 0; i < chunk_poses[c-1].size(); i++)
+    {
+      int k = chunk_poses[c-1][i].frame - chunks[c].begin;
+      if(k >= 0 && k < overlap)
+        prev[k] = chunk_poses[c-1][i];
+    }
+    for(unsigned int i = 0; i < chunk_poses[c].size(); i++)
+    {
+      int k = chunk_poses[c][i].frame - chunks[c].begin;
+      if(k >= 0 && k < overlap)
+        next[k] = chunk_poses[c][i];
+    }
+
+    int compared = 0;
+    double sum_trans = 0, max_rot = 0;
+    for(int k = 0; k < overlap; k++)
+    {
+      if(!prev[k].valid || !next[k].valid)
+        continue;
+      double trans, rot;
+      ComparePoses(prev[k], next[k], trans, rot);
+      sum_trans += trans;
+      max_rot = std::max(max_rot, rot);
+      compared++;
+    }
+
+    double mean_trans = compared > 0 ? sum_trans/compared : 0;
+    std::string consistent = "unchecked";
+    if(compared > 0)
+    {
+      consistent = (mean_trans < kMaxRelTransError && max_rot < kMaxRotErrorDeg) ? "yes" : "no";
+      if(consistent == "no")
+      {
+        num_inconsistent++;
+        std::cout << "Chunks " << c-1 << " and " << c << " disagree at frame "
+          << chunks[c].begin << ": relative translation error " << mean_trans
+          << ", rotation error " << max_rot << " deg" << std::endl;
+      }
+    }
+    boundaries << c << "," << chunks[c].begin << "," << compared << "," << mean_trans << ","
+      << max_rot << "," << consistent << std::endl;
+  }
+
+  std::cout << num_valid << " of " << frames.size() << " frames have a pose, "
+    << num_inconsistent << " inconsistent chunk boundaries" << std::endl;
+  return 0;
+}
@@ -0,0 +1,364 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include <Eigen/Geometry>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/eigen.hpp>
+
+#include "mesh_localize/SequenceUtil.h"
+#include "mesh_localize/Metrics.h"
+
+/**
+ *  Accuracy and latency report of a mesh_localize_replay run against a ground truth
+ *  trajectory, so a change can be checked for speed and accuracy in one place.
+ *
+ *  Usage: mesh_localize_eval <run_prefix> <ground_truth.csv> [calibration.yml]
+ *
+ *  run_prefix        output prefix of the replay; <run_prefix>_poses.csv is required and
+ *                    <run_prefix>_timings.csv is used if present
+ *  ground_truth.csv  header line, then "stamp,x,y,z,qx,qy,qz,qw" per row.  Rows with
+ *                    non-finite values (dropped motion capture samples) are skipped.
+ *  calibration.yml   optional alignment of the two trajectories, see ReadCalibration
+ *
+ *  Prints the report and writes it to <run_prefix>_eval.csv as metric,value rows, and the
+ *  per-frame errors to <run_prefix>_errors.csv.
+ */
+
+namespace
+{
+  struct GroundTruth
+  {
+    double stamp;
+    Eigen::Matrix4d pose;
+  };
+
+  struct Calibration
+  {
+    Calibration() :
+      est_scale(1),
+      invert_estimate(false),
+      est_alignment(Eigen::Matrix4d::Identity()),
+      gt_alignment(Eigen::Matrix4d::Identity()),
+      time_offset(0),
+      max_dt(0.02),
+      max_trans_error(0.05),
+      max_rot_error_deg(5)
+    {
+    }
+
+    // Estimates are scaled (model units to ground truth units) and optionally inverted,
+    // then est_alignment*estimate is compared against ground_truth*gt_alignment
+    double est_scale;
+    bool invert_estimate;
+    Eigen::Matrix4d est_alignment;
+    Eigen::Matrix4d gt_alignment;
+    // Added to the estimate stamps before they are matched to the nearest ground truth
+    // stamp, matches further apart than max_dt are dropped
+    double time_offset;
+    double max_dt;
+    // Frames with a larger error count as wrong poses
+    double max_trans_error;
+    double max_rot_error_deg;
+  };
+
+  void ReadMatrix(const cv::FileNode& node, Eigen::Matrix4d& m)
+  {
+    if(node.empty())
+      return;
+    cv::Mat mat;
+    node >> mat;
+    if(mat.rows == 4 && mat.cols == 4)
+      cv::cv2eigen(mat, m);
+    else
+      std::cerr << "Ignoring " << node.name() << ", not a 4x4 matrix" << std::endl;
+  }
+
+  template<typename T>
+  void ReadValue(const cv::FileNode& node, T& value)
+  {
+    if(!node.empty())
+      node >> value;
+  }
+
+  bool ReadCalibration(const std::string& filename, Calibration& calib)
+  {
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if(!fs.isOpened())
+    {
+      std::cerr << "Could not open calibration " << filename << std::endl;
+      return false;
+    }
+    int invert = calib.invert_estimate;
+    ReadValue(fs["est_scale"], calib.est_scale);
+    ReadValue(fs["invert_estimate"], invert);
+    ReadMatrix(fs["est_alignment"], calib.est_alignment);
+    ReadMatrix(fs["gt_alignment"], calib.gt_alignment);
+    ReadValue(fs["time_offset"], calib.time_offset);
+    ReadValue(fs["max_dt"], calib.max_dt);
+    ReadValue(fs["max_trans_error"], calib.max_trans_error);
+    ReadValue(fs["max_rot_error_deg"], calib.max_rot_error_deg);
+    calib.invert_estimate = invert != 0;
+    return true;
+  }
+
+  bool ReadGroundTruth(const std::string& filename, std::vector<GroundTruth>& gt)
+  {
+    std::ifstream in(filename.c_str());
+    if(!in.is_open())
+    {
+      std::cerr << "Could not open " << filename << std::endl;
+      return false;
+    }
+    std::string line;
+    std::getline(in, line); // header
+    while(std::getline(in, line))
+    {
+      std::replace(line.begin(), line.end(), ',', ' ');
+      std::istringstream ss(line);
+      double v[8];
+      int n = 0;
+      while(n < 8 && ss >> v[n])
+        n++;
+      bool finite = n == 8;
+      for(int i = 0; i < n && finite; i++)
+        finite = std::isfinite(v[i]);
+      if(!finite)
+        continue;
+
+      GroundTruth sample;
+      sample.stamp = v[0];
+      sample.pose = Eigen::Matrix4d::Identity();
+      sample.pose.block<3,3>(0,0) =
+        Eigen::Quaterniond(v[7], v[4], v[5], v[6]).normalized().toRotationMatrix();
+      sample.pose.block<3,1>(0,3) = Eigen::Vector3d(v[1], v[2], v[3]);
+      gt.push_back(sample);
+    }
+    return true;
+  }
+
+  bool StampLess(const GroundTruth& a, const GroundTruth& b)
+  {
+    return a.stamp < b.stamp;
+  }
+
+  bool PoseStampLess(const SequenceUtil::PoseRecord& a, const SequenceUtil::PoseRecord& b)
+  {
+    return a.stamp < b.stamp;
+  }
+
+  // Index of the sample nearest to stamp, or -1 if none is within max_dt.  gt is sorted.
+  int MatchNearest(const std::vector<GroundTruth>& gt, double stamp, double max_dt)
+  {
+    GroundTruth key;
+    key.stamp = stamp;
+    std::vector<GroundTruth>::const_iterator it = std::lower_bound(gt.begin(), gt.end(), key,
+      StampLess);
+    int best = -1;
+    double best_dt = max_dt;
+    if(it != gt.end() && it->stamp - stamp <= best_dt)
+    {
+      best = it - gt.begin();
+      best_dt = it->stamp - stamp;
+    }
+    if(it != gt.begin() && stamp - (it-1)->stamp <= best_dt)
+    {
+      best = it - gt.begin() - 1;
+    }
+    return best;
+  }
+
+  // p in [0, 1], nearest rank
+  double Percentile(std::vector<double> values, double p)
+  {
+    if(values.empty())
+      return 0;
+    std::sort(values.begin(), values.end());
+    int rank = std::ceil(p*values.size());
+    return values[std::min(std::max(rank, 1), (int)values.size()) - 1];
+  }
+
+  double Mean(const std::vector<double>& values)
+  {
+    double sum = 0;
+    for(unsigned int i = 0; i < values.size(); i++)
+      sum += values[i];
+    return values.empty() ? 0 : sum/values.size();
+  }
+
+  class Report
+  {
+  public:
+    void Add(const std::string& metric, double value)
+    {
+      rows.push_back(std::make_pair(metric, value));
+    }
+
+    void AddDistribution(const std::string& metric, const std::vector<double>& values)
+    {
+      Add(metric + "_mean", Mean(values));
+      Add(metric + "_p50", Percentile(values, 0.5));
+      Add(metric + "_p90", Percentile(values, 0.9));
+      Add(metric + "_max", Percentile(values, 1));
+    }
+
+    void Write(std::ostream& out, const char* separator)
+    {
+      for(unsigned int i = 0; i < rows.size(); i++)
+      {
+        out << rows[i].first << separator << rows[i].second << std::endl;
+      }
+    }
+
+  private:
+    std::vector<std::pair<std::string, double> > rows;
+  };
+
+  bool ReadTimings(const std::string& filename, std::map<std::string, LatencyHistogram>& stages)
+  {
+    std::ifstream in(filename.c_str());
+    if(!in.is_open())
+      return false;
+    std::string line;
+    std::getline(in, line); // header
+    while(std::getline(in, line))
+    {
+      // frame,stamp,stage,seconds
+      std::replace(line.begin(), line.end(), ',', ' ');
+      std::istringstream ss(line);
+      int frame;
+      double stamp, seconds;
+      std::string stage;
+      if(ss >> frame >> stamp >> stage >> seconds)
+        stages[stage].record(seconds);
+    }
+    return true;
+  }
+}
+
+int main (int argc, char **argv)
+{
+  if(argc < 3)
+  {
+    std::cerr << "Usage: " << argv[0] << " <run_prefix> <ground_truth.csv> [calibration.yml]"
+      << std::endl;
+    return 1;
+  }
+  std::string prefix = argv[1];
+
+  Calibration calib;
+  if(argc > 3 && !ReadCalibration(argv[3], calib))
+    return 1;
+
+  std::vector<SequenceUtil::PoseRecord> poses;
+  if(!SequenceUtil::ReadPoses(prefix + "_poses.csv", poses))
+    return 1;
+  // Pipelined runs write results in completion order
+  std::stable_sort(poses.begin(), poses.end(), PoseStampLess);
+
+  std::vector<GroundTruth> gt;
+  if(!ReadGroundTruth(argv[2], gt))
+    return 1;
+  if(poses.empty() || gt.empty())
+  {
+    std::cerr << "No poses or no ground truth to compare" << std::endl;
+    return 1;
+  }
+  std::sort(gt.begin(), gt.end(), StampLess);
+
+  std::ofstream errors((prefix + "_errors.csv").c_str());
+  errors << "frame,stamp,gt_stamp,trans_error,rot_error_deg" << std::endl;
+  errors.precision(9);
+
+  std::vector<double> trans_errors, rot_errors, recover_times;
+  int num_valid = 0, num_compared = 0, num_wrong = 0;
+  int num_failures = 0, num_relocalizations = 0;
+  double first_pose_time = -1, lost_since = -1;
+  bool was_valid = false;
+  for(unsigned int i = 0; i < poses.size(); i++)
+  {
+    const SequenceUtil::PoseRecord& rec = poses[i];
+
+    // Failures and recoveries, from the first pose on
+    if(rec.valid && first_pose_time < 0)
+    {
+      first_pose_time = rec.stamp - poses[0].stamp;
+    }
+    else if(rec.valid && !was_valid)
+    {
+      num_relocalizations++;
+      recover_times.push_back(rec.stamp - lost_since);
+    }
+    else if(!rec.valid && was_valid)
+    {
+      num_failures++;
+      lost_since = rec.stamp;
+    }
+    was_valid = rec.valid;
+    if(!rec.valid)
+      continue;
+    num_valid++;
+
+    int g = MatchNearest(gt, rec.stamp + calib.time_offset, calib.max_dt);
+    if(g < 0)
+      continue;
+
+    Eigen::Matrix4d est = SequenceUtil::PoseRecordToMatrix(rec).cast<double>();
+    est.block<3,1>(0,3) *= calib.est_scale;
+    if(calib.invert_estimate)
+      est = est.inverse().eval();
+    est = calib.est_alignment*est;
+    Eigen::Matrix4d truth = gt[g].pose*calib.gt_alignment;
+
+    double trans_error = (est.block<3,1>(0,3) - truth.block<3,1>(0,3)).norm();
+    Eigen::Quaterniond qe(Eigen::Matrix3d(est.block<3,3>(0,0)));
+    Eigen::Quaterniond qt(Eigen::Matrix3d(truth.block<3,3>(0,0)));
+    double rot_error = qe.angularDistance(qt)*180./M_PI;
+    trans_errors.push_back(trans_error);
+    rot_errors.push_back(rot_error);
+    num_compared++;
+    if(trans_error > calib.max_trans_error || rot_error > calib.max_rot_error_deg)
+      num_wrong++;
+
+    errors << rec.frame << "," << rec.stamp << "," << gt[g].stamp << "," << trans_error << ","
+      << rot_error << std::endl;
+  }
+
+  Report report;
+  report.Add("frames", poses.size());
+  report.Add("frames_with_pose", num_valid);
+  report.Add("frames_compared", num_compared);
+  report.Add("frames_wrong", num_wrong);
+  report.Add("time_to_first_pose", first_pose_time);
+  report.Add("failures", num_failures);
+  report.Add("relocalizations", num_relocalizations);
+  report.AddDistribution("time_to_recover", recover_times);
+  report.AddDistribution("trans_error", trans_errors);
+  report.AddDistribution("rot_error_deg", rot_errors);
+
+  std::map<std::string, LatencyHistogram> stages;
+  if(ReadTimings(prefix + "_timings.csv", stages))
+  {
+    for(std::map<std::string, LatencyHistogram>::const_iterator it = stages.begin();
+      it != stages.end(); it++)
+    {
+      report.Add("latency_" + it->first + "_p50", it->second.getPercentile(0.5));
+      report.Add("latency_" + it->first + "_p90", it->second.getPercentile(0.9));
+      report.Add("latency_" + it->first + "_p99", it->second.getPercentile(0.99));
+    }
+    // Frames tracked per second of tracking time, the replay feeds frames back to back
+    std::map<std::string, LatencyHistogram>::const_iterator total = stages.find("total");
+    if(total != stages.end() && total->second.sum > 0)
+      report.Add("throughput_fps", total->second.getCount()/total->second.sum);
+  }
+
+  std::ofstream out((prefix + "_eval.csv").c_str());
+  out << "metric,value" << std::endl;
+  out.precision(9);
+  report.Write(out, ",");
+  report.Write(std::cout, "\t");
+  return 0;
+}
@@ -6,6 +6,12 @@ int main (int argc, char **argv)
   ros::NodeHandle nh;
   ros::NodeHandle nh_private("~");
   MeshLocalizer ml(nh, nh_private);
-  ros::spin ();
+
+  // Callbacks are serviced in the background; tracking runs on this thread, which also
+  // owns the render context
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+  ml.Run();
+  spinner.stop();
   return 0;
 }
@@ -0,0 +1,196 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <cstdlib>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include "mesh_localize/Tracker.h"
+#include "mesh_localize/SequenceUtil.h"
+#include "mesh_localize/Metrics.h"
+#include "mesh_localize/Trace.h"
+#include "mesh_localize/AllocProfile.h"
+
+using namespace cv;
+
+/**
+ *  Offline replay of an image sequence through the tracker, without ROS.  Frames are
+ *  loaded up front and fed back to back, stamped from the sequence instead of the clock,
+ *  so runs are repeatable and can be compared between builds.
+ *
+ *  Usage: mesh_localize_replay <params.yml> <intrinsics.yml> <images> <output_prefix> [fps]
+ *           [trace]
+ *
+ *  params.yml      tracker params, keyed by the mesh_localize ROS param names
+ *  intrinsics.yml  camera_matrix and distortion_coefficients, as written by the OpenCV
+ *                  calibration tools
+ *  images          a directory of jpg/png images, played in name order at fps (default 30),
+ *                  or a stream file with one "stamp image_path" line per frame.  Relative
+ *                  paths are relative to the stream file.
+ *
+ *  Writes <output_prefix>_poses.csv with one row per frame, <output_prefix>_timings.csv
+ *  with the time spent in each tracking stage and <output_prefix>_metrics.csv with the
+ *  latency percentiles of every stage over the whole run.  If trace is given (0 or 1,
+ *  default 0), a timeline of the stages on every thread is written to
+ *  <output_prefix>_trace.json in Chrome trace format.
+ */
+
+namespace
+{
+  class ResultWriter
+  {
+  public:
+    ResultWriter(const std::string& prefix) :
+      poses((prefix + "_poses.csv").c_str()),
+      timings((prefix + "_timings.csv").c_str()),
+      num_results(0),
+      num_valid(0),
+      total_time(0)
+    {
+      SequenceUtil::WritePoseHeader(poses);
+      timings << "frame,stamp,stage,seconds" << std::endl;
+      timings.precision(9);
+    }
+
+    bool IsOpen()
+    {
+      return poses.is_open() && timings.is_open();
+    }
+
+    void SetFrameIndex(double stamp, int index)
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      frame_index[stamp] = index;
+    }
+
+    // Called from the thread that finished the frame (the match stage in pipeline mode)
+    void Write(const Tracker::PoseResult& result)
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      int frame = frame_index.count(result.stamp) ? frame_index[result.stamp] : -1;
+      SequenceUtil::WritePose(poses, SequenceUtil::MakePoseRecord(frame, result));
+
+      for(unsigned int i = 0; i < result.timings.size(); i++)
+      {
+        timings << frame << "," << result.stamp << "," << result.timings[i].first << ","
+          << result.timings[i].second << std::endl;
+        if(result.timings[i].first == "total")
+          total_time += result.timings[i].second;
+      }
+
+      num_results++;
+      if(result.valid)
+        num_valid++;
+    }
+
+    void PrintSummary(double elapsed)
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      std::cout << "Replayed " << num_results << " frames in " << elapsed << " s, "
+        << num_valid << " with a pose";
+      if(num_results > 0 && total_time > 0)
+        std::cout << ", mean tracking time " << total_time/num_results << " s";
+      std::cout << std::endl;
+    }
+
+  private:
+    boost::mutex mutex;
+    std::ofstream poses;
+    std::ofstream timings;
+    std::map<double, int> frame_index;
+    int num_results;
+    int num_valid;
+    double total_time;
+  };
+}
+
+int main (int argc, char **argv)
+{
+  if(argc < 5)
+  {
+    std::cerr << "Usage: " << argv[0]
+      << " <params.yml> <intrinsics.yml> <image_dir|stream_file> <output_prefix> [fps]"
+      << " [trace]" << std::endl;
+    return 1;
+  }
+
+  TrackerParams params;
+  if(!params.Load(argv[1]))
+    return 1;
+  // Replays are meant to be repeatable, so only seed from the clock when asked to
+  if(params.random_seed < 0)
+    params.random_seed = 0;
+
+  Eigen::Matrix3f K;
+  Eigen::VectorXf distcoeff;
+  if(!SequenceUtil::LoadIntrinsics(argv[2], K, distcoeff))
+    return 1;
+
+  double fps = argc > 5 ? atof(argv[5]) : 30;
+  if(fps <= 0)
+  {
+    std::cerr << "fps must be positive" << std::endl;
+    return 1;
+  }
+
+  std::vector<SequenceUtil::Frame> frames;
+  if(!SequenceUtil::ListFrames(argv[3], fps, frames))
+  {
+    std::cerr << "No images found in " << argv[3] << std::endl;
+    return 1;
+  }
+  if(!SequenceUtil::LoadImages(frames))
+    return 1;
+  std::cout << "Loaded " << frames.size() << " frames" << std::endl;
+
+  bool trace = argc > 6 && atoi(argv[6]) != 0;
+  if(trace)
+  {
+    Tracer::SetThreadName("tracking");
+    Tracer::Start();
+  }
+
+  ResultWriter writer(argv[4]);
+  if(!writer.IsOpen())
+  {
+    std::cerr << "Could not open output files " << argv[4] << "_*.csv" << std::endl;
+    return 1;
+  }
+
+  MonocularLocalizer* localizer = Tracker::CreateLocalizer(params);
+  if(!localizer)
+    return 1;
+  VirtualImageGenerator* vig = Tracker::CreateImageGenerator(params, K, frames[0].image.rows,
+    frames[0].image.cols);
+  if(!vig)
+  {
+    delete localizer;
+    return 1;
+  }
+
+  {
+    Tracker tracker(params, K, distcoeff, localizer, vig);
+    tracker.setResultCallback(boost::bind(&ResultWriter::Write, &writer, _1));
+
+    double start = (double)getTickCount()/getTickFrequency();
+    for(unsigned int i = 0; i < frames.size(); i++)
+    {
+      writer.SetFrameIndex(frames[i].stamp, i);
+      tracker.processFrame(frames[i].image, frames[i].stamp);
+    }
+    tracker.flush();
+    writer.PrintSummary((double)getTickCount()/getTickFrequency() - start);
+  }
+
+  delete vig;
+  delete localizer;
+  AllocProfile::RecordPeakMemory();
+  Metrics::WriteFile(std::string(argv[4]) + "_metrics.csv");
+  if(trace)
+  {
+    Tracer::Stop();
+    Tracer::WriteFile(std::string(argv[4]) + "_trace.json");
+  }
+  return 0;
+}
@@ -0,0 +1,16 @@
+#include "mesh_localize/MeshLocalizeService.h"
+
+int main (int argc, char **argv)
+{
+  ros::init (argc, argv, "mesh_localize_service");
+  ros::NodeHandle nh;
+  ros::NodeHandle nh_private("~");
+  MeshLocalizeService service(nh, nh_private);
+
+  // Frames are converted on the callback threads, one per stream at a time, and tracked
+  // on the service workers
+  ros::AsyncSpinner spinner(0);
+  spinner.start();
+  ros::waitForShutdown();
+  return 0;
+}
@@ -0,0 +1,482 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <opencv2/core/core.hpp>
+#include <boost/thread.hpp>
+
+#include "mesh_localize/Tracker.h"
+
+using namespace cv;
+
+/**
+ *  Parameter sweep over tracker configurations.  Every combination of the swept values is
+ *  replayed with mesh_localize_replay and scored with mesh_localize_eval, several at a
+ *  time in worker processes.  The combinations on the Pareto frontier of latency, tracking
+ *  error and failure rate are reported, and the best one within a latency target is
+ *  written out as params for the replay tools and as a launch file.
+ *
+ *  Usage: mesh_localize_tune <params.yml> <sweep.yml> <intrinsics.yml> <images>
+ *           <ground_truth.csv> <output_prefix> [latency_target] [workers] [fps]
+ *           [calibration.yml]
+ *
+ *  params.yml      base tracker params, as for mesh_localize_replay
+ *  sweep.yml       the values to try for each swept param, keyed by param name, e.g.
+ *                  "image_scale: [ 0.3, 0.5 ]".  See analysis/tune_sweep.yml.
+ *  latency_target  p90 total tracking time per frame in seconds the chosen combination
+ *                  must stay under.  Non-positive (the default) picks the most accurate.
+ *
+ *  The other inputs are passed on to mesh_localize_replay and mesh_localize_eval, which
+ *  must be installed next to this tool.  Each combination leaves its params, replay and
+ *  eval output and a log under <output_prefix>_combo<N>.  Writes <output_prefix>_sweep.csv
+ *  with the scores of every combination, <output_prefix>_best.yml and
+ *  <output_prefix>_best.launch.
+ */
+
+namespace
+{
+  struct SweepParam
+  {
+    std::string name;
+    // As YAML scalars, strings quoted
+    std::vector<std::string> values;
+  };
+
+  struct Score
+  {
+    Score() :
+      ok(false),
+      latency_p50(0),
+      latency_p90(0),
+      trans_error(0),
+      rot_error(0),
+      failure_rate(1),
+      pareto(false)
+    {
+    }
+
+    bool ok;
+    double latency_p50;
+    double latency_p90;
+    double trans_error;
+    double rot_error;
+    // Fraction of frames without a pose or with a wrong one
+    double failure_rate;
+    bool pareto;
+  };
+
+  bool ReadScalar(const FileNode& node, std::string& value)
+  {
+    std::ostringstream ss;
+    ss.precision(9);
+    if(node.isString())
+      ss << '"' << (std::string)node << '"';
+    else if(node.isInt())
+      ss << (int)node;
+    else if(node.isReal())
+      ss << (double)node;
+    else
+      return false;
+    value = ss.str();
+    return true;
+  }
+
+  bool ReadSweep(const std::string& filename, std::vector<SweepParam>& sweep)
+  {
+    FileStorage fs(filename, FileStorage::READ);
+    if(!fs.isOpened())
+    {
+      std::cerr << "Could not open sweep " << filename << std::endl;
+      return false;
+    }
+    FileNode root = fs.root();
+    for(FileNodeIterator it = root.begin(); it != root.end(); ++it)
+    {
+      FileNode node = *it;
+      SweepParam param;
+      param.name = node.name();
+      std::string value;
+      if(node.isSeq())
+      {
+        for(FileNodeIterator v = node.begin(); v != node.end(); ++v)
+        {
+          if(!ReadScalar(*v, value))
+            break;
+          param.values.push_back(value);
+        }
+      }
+      else if(ReadScalar(node, value))
+      {
+        param.values.push_back(value);
+      }
+      if(param.values.empty() || (node.isSeq() && param.values.size() != node.size()))
+      {
+        std::cerr << param.name << " must be a value or a list of values" << std::endl;
+        return false;
+      }
+      sweep.push_back(param);
+    }
+    return !sweep.empty();
+  }
+
+  // Value index of every swept param in combination c
+  std::vector<int> ComboIndices(const std::vector<SweepParam>& sweep, int c)
+  {
+    std::vector<int> indices(sweep.size());
+    for(int i = sweep.size()-1; i >= 0; i--)
+    {
+      indices[i] = c % sweep[i].values.size();
+      c /= sweep[i].values.size();
+    }
+    return indices;
+  }
+
+  TrackerParams MakeComboParams(const TrackerParams& base, const std::vector<SweepParam>& sweep,
+    const std::vector<int>& indices)
+  {
+    std::ostringstream yaml;
+    yaml << "%YAML:1.0" << std::endl;
+    for(unsigned int i = 0; i < sweep.size(); i++)
+    {
+      yaml << sweep[i].name << ": " << sweep[i].values[indices[i]] << std::endl;
+    }
+    TrackerParams params = base;
+    FileStorage fs(yaml.str(), FileStorage::READ + FileStorage::MEMORY);
+    params.Read(fs.root());
+    return params;
+  }
+
+  std::string ComboPrefix(const std::string& prefix, int combo)
+  {
+    std::stringstream ss;
+    ss << prefix << "_combo" << combo;
+    return ss.str();
+  }
+
+  // Sibling of this executable, or looked up in PATH if it was started from there
+  std::string ToolPath(const std::string& self, const std::string& tool)
+  {
+    size_t slash = self.rfind('/');
+    return slash == std::string::npos ? tool : self.substr(0, slash+1) + tool;
+  }
+
+  int RunTool(std::vector<std::string> args)
+  {
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+      std::vector<char*> argv;
+      for(unsigned int i = 0; i < args.size(); i++)
+        argv.push_back(&args[i][0]);
+      argv.push_back(NULL);
+      execvp(argv[0], &argv[0]);
+      perror(argv[0]);
+      _exit(127);
+    }
+    int status;
+    if(pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+      return 1;
+    return WEXITSTATUS(status);
+  }
+
+  // Replays and scores one combination.  Runs in its own process with the output of both
+  // tools going to the combination's log.
+  int RunCombo(const std::string& replay, const std::string& eval,
+    const std::vector<std::string>& inputs, const std::string& combo_prefix)
+  {
+    int log = open((combo_prefix + ".log").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(log >= 0)
+    {
+      dup2(log, STDOUT_FILENO);
+      dup2(log, STDERR_FILENO);
+      close(log);
+    }
+
+    std::vector<std::string> args;
+    args.push_back(replay);
+    args.push_back(combo_prefix + "_params.yml");
+    args.push_back(inputs[0]); // intrinsics
+    args.push_back(inputs[1]); // images
+    args.push_back(combo_prefix);
+    args.push_back(inputs[3]); // fps
+    if(RunTool(args) != 0)
+      return 1;
+
+    args.clear();
+    args.push_back(eval);
+    args.push_back(combo_prefix);
+    args.push_back(inputs[2]); // ground truth
+    if(!inputs[4].empty())
+      args.push_back(inputs[4]); // calibration
+    return RunTool(args);
+  }
+
+  bool ReadEval(const std::string& filename, std::map<std::string, double>& metrics)
+  {
+    std::ifstream in(filename.c_str());
+    if(!in.is_open())
+      return false;
+    std::string line;
+    std::getline(in, line); // header
+    while(std::getline(in, line))
+    {
+      size_t comma = line.find(',');
+      if(comma != std::string::npos)
+        metrics[line.substr(0, comma)] = atof(line.c_str() + comma + 1);
+    }
+    return true;
+  }
+
+  Score ScoreCombo(const std::string& combo_prefix)
+  {
+    Score score;
+    std::map<std::string, double> m;
+    if(!ReadEval(combo_prefix + "_eval.csv", m) || m["frames"] <= 0)
+      return score;
+    score.ok = true;
+    score.latency_p50 = m["latency_total_p50"];
+    score.latency_p90 = m["latency_total_p90"];
+    // A combination that never produced a comparable pose has no error to speak of
+    score.trans_error = m["frames_compared"] > 0 ? m["trans_error_p50"] :
+      std::numeric_limits<double>::infinity();
+    score.rot_error = m["frames_compared"] > 0 ? m["rot_error_deg_p50"] :
+      std::numeric_limits<double>::infinity();
+    score.failure_rate = (m["frames"] - m["frames_with_pose"] + m["frames_wrong"])/m["frames"];
+    return score;
+  }
+
+  // At least as good in every objective and better in one
+  bool Dominates(const Score& a, const Score& b)
+  {
+    bool no_worse = a.latency_p90 <= b.latency_p90 && a.trans_error <= b.trans_error &&
+      a.failure_rate <= b.failure_rate;
+    bool better = a.latency_p90 < b.latency_p90 || a.trans_error < b.trans_error ||
+      a.failure_rate < b.failure_rate;
+    return no_worse && better;
+  }
+
+  // Fewest failures, then the smallest error, then the fastest
+  bool MoreAccurate(const Score& a, const Score& b)
+  {
+    if(a.failure_rate != b.failure_rate)
+      return a.failure_rate < b.failure_rate;
+    if(a.trans_error != b.trans_error)
+      return a.trans_error < b.trans_error;
+    return a.latency_p90 < b.latency_p90;
+  }
+
+  std::string Unquote(const std::string& value)
+  {
+    if(value.size() >= 2 && value[0] == '"')
+      return value.substr(1, value.size()-2);
+    return value;
+  }
+}
+
+int main (int argc, char **argv)
+{
+  if(argc < 7)
+  {
+    std::cerr << "Usage: " << argv[0] << " <params.yml> <sweep.yml> <intrinsics.yml>"
+      << " <image_dir|stream_file> <ground_truth.csv> <output_prefix> [latency_target]"
+      << " [workers] [fps] [calibration.yml]" << std::endl;
+    return 1;
+  }
+
+  TrackerParams base;
+  if(!base.Load(argv[1]))
+    return 1;
+  std::vector<SweepParam> sweep;
+  if(!ReadSweep(argv[2], sweep))
+  {
+    std::cerr << "Nothing to sweep in " << argv[2] << std::endl;
+    return 1;
+  }
+  std::string prefix = argv[6];
+  double latency_target = argc > 7 ? atof(argv[7]) : -1;
+  int num_workers = argc > 8 ? atoi(argv[8]) : boost::thread::hardware_concurrency();
+  std::string fps = argc > 9 ? argv[9] : "30";
+  // intrinsics, images, ground truth, fps, calibration
+  std::vector<std::string> inputs;
+  inputs.push_back(argv[3]);
+  inputs.push_back(argv[4]);
+  inputs.push_back(argv[5]);
+  inputs.push_back(fps);
+  inputs.push_back(argc > 10 ? argv[10] : "");
+  if(num_workers <= 0 || atof(fps.c_str()) <= 0)
+  {
+    std::cerr << "workers and fps must be positive" << std::endl;
+    return 1;
+  }
+
+  int num_combos = 1;
+  for(unsigned int i = 0; i < sweep.size(); i++)
+    num_combos *= sweep[i].values.size();
+
+  for(int c = 0; c < num_combos; c++)
+  {
+    TrackerParams params = MakeComboParams(base, sweep, ComboIndices(sweep, c));
+    std::string filename = ComboPrefix(prefix, c) + "_params.yml";
+    FileStorage fs(filename, FileStorage::WRITE);
+    if(!fs.isOpened())
+    {
+      std::cerr << "Could not write " << filename << std::endl;
+      return 1;
+    }
+    params.Write(fs);
+  }
+
+  // Latencies are measured while the workers compete for the cores, use fewer workers than
+  // cores for numbers that carry over to a dedicated machine
+  std::string replay = ToolPath(argv[0], "mesh_localize_replay");
+  std::string eval = ToolPath(argv[0], "mesh_localize_eval");
+  std::cout << "Replaying " << num_combos << " combinations on " << num_workers << " workers"
+    << std::endl;
+  std::map<pid_t, int> running;
+  std::vector<bool> succeeded(num_combos, false);
+  int next = 0, num_done = 0;
+  while(next < num_combos || !running.empty())
+  {
+    while((int)running.size() < num_workers && next < num_combos)
+    {
+      std::cout.flush();
+      std::cerr.flush();
+      pid_t pid = fork();
+      if(pid == 0)
+        _exit(RunCombo(replay, eval, inputs, ComboPrefix(prefix, next)));
+      if(pid < 0)
+      {
+        perror("fork");
+        break;
+      }
+      running[pid] = next++;
+    }
+    if(running.empty())
+      return 1;
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if(pid < 0)
+    {
+      perror("waitpid");
+      return 1;
+    }
+    if(!running.count(pid))
+      continue;
+    int c = running[pid];
+    running.erase(pid);
+    num_done++;
+    succeeded[c] = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if(!succeeded[c])
+      std::cerr << "Combination " << c << " failed, see " << ComboPrefix(prefix, c) << ".log"
+        << std::endl;
+    std::cout << num_done << "/" << num_combos << " done" << std::endl;
+  }
+
+  std::vector<Score> scores(num_combos);
+  for(int c = 0; c < num_combos; c++)
+  {
+    if(succeeded[c])
+      scores[c] = ScoreCombo(ComboPrefix(prefix, c));
+  }
+  for(int a = 0; a < num_combos; a++)
+  {
+    scores[a].pareto = scores[a].ok;
+    for(int b = 0; b < num_combos && scores[a].pareto; b++)
+    {
+      if(scores[b].ok && Dominates(scores[b], scores[a]))
+        scores[a].pareto = false;
+    }
+  }
+
+  // The most accurate frontier combination within the latency target, else the fastest
+  int best = -1;
+  bool meets_target = false;
+  for(int c = 0; c < num_combos; c++)
+  {
+    if(!scores[c].pareto)
+      continue;
+    bool within = latency_target <= 0 || scores[c].latency_p90 <= latency_target;
+    if(best >= 0)
+    {
+      if(within != meets_target && !within)
+        continue;
+      if(within == meets_target && (within ? !MoreAccurate(scores[c], scores[best]) :
+        scores[c].latency_p90 >= scores[best].latency_p90))
+        continue;
+    }
+    best = c;
+    meets_target = within;
+  }
+  if(best < 0)
+  {
+    std::cerr << "No combination could be scored" << std::endl;
+    return 1;
+  }
+
+  std::ofstream csv((prefix + "_sweep.csv").c_str());
+  csv.precision(9);
+  csv << "combo";
+  for(unsigned int i = 0; i < sweep.size(); i++)
+    csv << "," << sweep[i].name;
+  csv << ",latency_p50,latency_p90,trans_error_p50,rot_error_deg_p50,failure_rate,pareto"
+    << std::endl;
+  std::cout << "Pareto frontier (p90 latency, p50 translation error, failure rate):"
+    << std::endl;
+  for(int c = 0; c < num_combos; c++)
+  {
+    const Score& s = scores[c];
+    if(!s.ok)
+      continue;
+    std::vector<int> indices = ComboIndices(sweep, c);
+    std::ostringstream values;
+    for(unsigned int i = 0; i < sweep.size(); i++)
+    {
+      values << (i > 0 ? " " : "") << sweep[i].name << "="
+        << Unquote(sweep[i].values[indices[i]]);
+    }
+
+    csv << c;
+    for(unsigned int i = 0; i < sweep.size(); i++)
+      csv << "," << Unquote(sweep[i].values[indices[i]]);
+    csv << "," << s.latency_p50 << "," << s.latency_p90 << "," << s.trans_error << ","
+      << s.rot_error << "," << s.failure_rate << "," << s.pareto << std::endl;
+    if(s.pareto)
+    {
+      std::cout << (c == best ? "* " : "  ") << c << "\t" << s.latency_p90 << "\t"
+        << s.trans_error << "\t" << s.failure_rate << "\t" << values.str() << std::endl;
+    }
+  }
+  if(!meets_target)
+    std::cerr << "No combination is within " << latency_target << " s, chose the fastest"
+      << std::endl;
+
+  TrackerParams params = MakeComboParams(base, sweep, ComboIndices(sweep, best));
+  {
+    FileStorage fs(prefix + "_best.yml", FileStorage::WRITE);
+    params.Write(fs);
+  }
+  std::ofstream launch((prefix + "_best.launch").c_str());
+  launch << "<launch>" << std::endl
+    << "  <!-- Combination " << best << " of " << argv[2] << " -->" << std::endl
+    << "  <arg name=\"image\" default=\"/camera/image_mono\"/>" << std::endl
+    << "  <arg name=\"camera_info\" default=\"/camera/camera_info\"/>" << std::endl
+    << "  <node name=\"mesh_localize\" pkg=\"mesh_localize\" type=\"mesh_localize_node\""
+    << " output=\"screen\">" << std::endl
+    << "    <remap from=\"image\" to=\"$(arg image)\"/>" << std::endl
+    << "    <remap from=\"camera_info\" to=\"$(arg camera_info)\"/>" << std::endl;
+  params.WriteLaunch(launch);
+  launch << "  </node>" << std::endl << "</launch>" << std::endl;
+  std::cout << "Wrote combination " << best << " to " << prefix << "_best.yml and " << prefix
+    << "_best.launch" << std::endl;
+  return 0;
+}
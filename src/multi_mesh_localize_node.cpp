@@ -0,0 +1,13 @@
+#include "mesh_localize/MultiMeshLocalizer.h"
+
+int main (int argc, char **argv)
+{
+  ros::init (argc, argv, "multi_mesh_localize");
+  ros::NodeHandle nh;
+  ros::NodeHandle nh_private("~");
+  MultiMeshLocalizer ml(nh, nh_private);
+
+  // Tracking runs on the MultiTracker workers, callbacks only ingest frames
+  ros::spin();
+  return 0;
+}
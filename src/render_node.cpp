@@ -1,92 +1,217 @@
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 
 #include <ros/ros.h>
 #include <ros/package.h>
+#include <ros/callback_queue.h>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/CameraInfo.h>
 #include <sensor_msgs/image_encodings.h>
+#include <geometry_msgs/PoseStamped.h>
 #include <cv_bridge/cv_bridge.h>
+#include <opencv2/highgui/highgui.hpp>
 #include "mesh_localize/OgreImageGenerator.h"
+#include "mesh_localize/SequenceGenerator.h"
+#include "mesh_localize/SequenceUtil.h"
 
 using namespace cv;
 
+/**
+ *  Renders a synthetic sequence of the model with known poses.  With ~output_dir set the
+ *  frames are written to disk for mesh_localize_replay and mesh_localize_eval, otherwise
+ *  they are published on /virtual_camera.
+ */
+
+// Same convention as /mesh_localize/estimated_pose
+void PoseToRecord(const Eigen::Matrix4f& pose, SequenceUtil::PoseRecord& rec)
+{
+  Eigen::Matrix4f tf_inv = pose.inverse();
+  Eigen::Quaternionf q(Eigen::Matrix3f(tf_inv.block<3,3>(0,0)));
+  q.normalize();
+  rec.x = tf_inv(0,3);
+  rec.y = tf_inv(1,3);
+  rec.z = tf_inv(2,3);
+  rec.qx = q.x();
+  rec.qy = q.y();
+  rec.qz = q.z();
+  rec.qw = q.w();
+}
+
+// Stamp of the newest pose the tracker reported
+ros::Time last_ack;
+
+void HandleEstimatedPose(const geometry_msgs::PoseStampedConstPtr& msg)
+{
+  if(msg->header.stamp > last_ack)
+    last_ack = msg->header.stamp;
+}
+
+// Waits until the tracker reported a pose for the frame at stamp, or for timeout seconds,
+// since lost frames get no pose
+void WaitForTracker(const ros::Time& stamp, double timeout)
+{
+  ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(timeout);
+  while(ros::ok() && last_ack < stamp && ros::WallTime::now() < deadline)
+  {
+    ros::getGlobalCallbackQueue()->callAvailable(ros::WallDuration(0.01));
+  }
+}
+
+int WriteSequence(SequenceGenerator& generator, std::string output_dir, int num_frames)
+{
+  std::ofstream stream((output_dir + "/stream.txt").c_str());
+  std::ofstream ground_truth((output_dir + "/ground_truth.csv").c_str());
+  if(!stream.is_open() || !ground_truth.is_open())
+  {
+    ROS_ERROR("Could not write to %s", output_dir.c_str());
+    return 1;
+  }
+  if(!SequenceUtil::WriteIntrinsics(output_dir + "/intrinsics.yml", generator.GetK(),
+    Eigen::VectorXf::Zero(5)))
+    return 1;
+
+  stream.precision(9);
+  ground_truth.precision(9);
+  ground_truth << "stamp,x,y,z,qx,qy,qz,qw" << std::endl;
+  for(int i = 0; i < num_frames && ros::ok(); i++)
+  {
+    SequenceGenerator::Frame frame;
+    generator.next(frame);
+
+    char name[32];
+    snprintf(name, sizeof(name), "frame%06d.png", i);
+    if(!imwrite(output_dir + "/" + name, frame.image))
+    {
+      ROS_ERROR("Could not write %s", name);
+      return 1;
+    }
+    stream << frame.stamp << " " << name << std::endl;
+
+    SequenceUtil::PoseRecord rec;
+    PoseToRecord(frame.pose, rec);
+    ground_truth << frame.stamp << "," << rec.x << "," << rec.y << "," << rec.z << ","
+      << rec.qx << "," << rec.qy << "," << rec.qz << "," << rec.qw << std::endl;
+  }
+  ROS_INFO("Wrote %d frames to %s", num_frames, output_dir.c_str());
+  return 0;
+}
+
 int main (int argc, char **argv)
 {
   ros::init (argc, argv, "render");
   ros::NodeHandle nh;
   ros::NodeHandle nh_private("~");
 
-  double step_size;
-
-  if(!nh_private.getParam("step_size", step_size))
-    step_size = 0.1;
+  SequenceParams params;
+  std::string mesh, output_dir;
+  int num_frames;
+  double rate, ack_timeout;
+  nh_private.param<std::string>("mesh", mesh, "box.mesh");
+  nh_private.param<std::string>("output_dir", output_dir, "");
+  // 0 renders until shutdown, which is only allowed when publishing
+  nh_private.param("num_frames", num_frames, 0);
+  // Frames per second published.  If not positive, every frame waits for the tracker's
+  // estimated pose of the previous one, or for ack_timeout seconds when it is lost.
+  nh_private.param("rate", rate, 0.0);
+  nh_private.param("ack_timeout", ack_timeout, 1.0);
+  nh_private.param<std::string>("trajectory", params.trajectory, params.trajectory);
+  nh_private.param("fps", params.fps, params.fps);
+  nh_private.param("speed", params.speed, params.speed);
+  nh_private.param("angular_speed", params.angular_speed, params.angular_speed);
+  nh_private.param("max_tilt", params.max_tilt, params.max_tilt);
+  nh_private.param("orbit_radius", params.orbit_radius, params.orbit_radius);
+  nh_private.param("orbit_height", params.orbit_height, params.orbit_height);
+  nh_private.param("image_noise", params.image_noise, params.image_noise);
+  nh_private.param("exposure", params.exposure, params.exposure);
+  nh_private.param("blur_samples", params.blur_samples, params.blur_samples);
+  nh_private.param("occluders", params.num_occluders, params.num_occluders);
+  nh_private.param("occluder_size", params.occluder_size, params.occluder_size);
+  nh_private.param("seed", params.seed, params.seed);
 
   std::string resource_path = ros::package::getPath("mesh_localize");
   resource_path += "/ogre_cfg/";
-  OgreImageGenerator oig(resource_path,"box.mesh");
-  Eigen::Matrix3f K = oig.GetK();
+  OgreImageGenerator oig(resource_path, mesh);
+  SequenceGenerator generator(params, &oig);
+  Eigen::Matrix3f K = generator.GetK();
+
+  if(!output_dir.empty())
+  {
+    if(num_frames <= 0)
+    {
+      ROS_ERROR("~num_frames must be set when writing to ~output_dir");
+      return 1;
+    }
+    return WriteSequence(generator, output_dir, num_frames);
+  }
 
   ros::Publisher image_pub = nh.advertise<sensor_msgs::Image>("/virtual_camera/image",1000);
   ros::Publisher depth_pub = nh.advertise<sensor_msgs::Image>("/virtual_camera/depth",1000);
   ros::Publisher info_pub = nh.advertise<sensor_msgs::CameraInfo>("/virtual_camera/camera_info",1000);
-  ros::Rate loop_rate(60);
-
-  double x = 0;
-  double y = 0;
-  double z = 10;
-  double xybound = 4;
-  double zubound = 12;
-  double zlbound = 8;
-  while(ros::ok())
+  ros::Publisher pose_pub = nh.advertise<geometry_msgs::PoseStamped>("/virtual_camera/pose",1000);
+  ros::Subscriber ack_sub = nh.subscribe("/mesh_localize/estimated_pose", 10,
+    &HandleEstimatedPose);
+
+  // Frames published before the tracker subscribes would be lost from the sequence
+  while(ros::ok() && image_pub.getNumSubscribers() == 0)
   {
-    Mat depth, mask;
-    Eigen::Matrix4f pose;
-
-    x += (double(rand())/RAND_MAX)*step_size - step_size/2;    
-    y += (double(rand())/RAND_MAX)*step_size - step_size/2;    
-    z += (double(rand())/RAND_MAX)*step_size - step_size/2;    
-    x = std::max(x, -xybound);
-    y = std::max(y, -xybound);
-    z = std::max(z, zlbound);
-    x = std::min(x, xybound);
-    y = std::min(y, xybound);
-    z = std::max(z, zubound);
-    pose << 1, 0, 0, x,
-            0, -1, 0, y,
-           0, 0, -1, z,
-          0, 0, 0, 1;
-    //pose <<   0.97152, -0.0578314,   0.229792,    0.29792,
-    //     -3.78345e-10,    0.96976,   0.244059,    2.6059,
-    //        -0.236957,  -0.237108,   0.942142,    -9.42142,
-    //                0,          0,          0,          1;
-    Mat img = oig.GenerateVirtualImage(pose, depth, mask);
+    ros::Duration(0.1).sleep();
+  }
+
+  // Frames are stamped with their sequence time, so the tracker's motion model sees the
+  // frame period whatever the publishing speed
+  ros::Time base = ros::Time::now();
+  ros::Rate loop_rate(rate > 0 ? rate : 1);
+  for(int i = 0; ros::ok() && (num_frames <= 0 || i < num_frames); i++)
+  {
+    SequenceGenerator::Frame frame;
+    generator.next(frame);
+    ros::Time stamp = base + ros::Duration(frame.stamp);
+
     cv_bridge::CvImage cv_img;
-    cv_img.image = img;
+    cv_img.header.stamp = stamp;
+    cv_img.image = frame.image;
     cv_img.encoding = sensor_msgs::image_encodings::MONO8;
 
     cv_bridge::CvImage cv_depth;
-    cv_depth.image = depth;
+    cv_depth.header.stamp = stamp;
+    cv_depth.image = frame.depth;
     cv_depth.encoding = sensor_msgs::image_encodings::TYPE_32FC1;
 
     sensor_msgs::CameraInfo ci_msg;
-    ci_msg.header.stamp = ros::Time::now();
-    ci_msg.height = img.rows;
-    ci_msg.width = img.cols;
+    ci_msg.header.stamp = stamp;
+    ci_msg.height = frame.image.rows;
+    ci_msg.width = frame.image.cols;
     ci_msg.distortion_model = "plumb_bob";
     for(int i = 0; i < 5; i++)
     {
-      ci_msg.D.push_back(0); 
+      ci_msg.D.push_back(0);
     }
     ci_msg.K[0] = K(0,0); ci_msg.K[1] = K(0,1); ci_msg.K[2] = K(0,2);
     ci_msg.K[3] = K(1,0); ci_msg.K[4] = K(1,1); ci_msg.K[5] = K(1,2);
     ci_msg.K[6] = K(2,0); ci_msg.K[7] = K(2,1); ci_msg.K[8] = K(2,2);
 
+    SequenceUtil::PoseRecord rec;
+    PoseToRecord(frame.pose, rec);
+    geometry_msgs::PoseStamped pose_msg;
+    pose_msg.header.stamp = stamp;
+    pose_msg.pose.position.x = rec.x;
+    pose_msg.pose.position.y = rec.y;
+    pose_msg.pose.position.z = rec.z;
+    pose_msg.pose.orientation.x = rec.qx;
+    pose_msg.pose.orientation.y = rec.qy;
+    pose_msg.pose.orientation.z = rec.qz;
+    pose_msg.pose.orientation.w = rec.qw;
+
     info_pub.publish(ci_msg);
     image_pub.publish(cv_img.toImageMsg());
     depth_pub.publish(cv_depth.toImageMsg());
-    img.release();
+    pose_pub.publish(pose_msg);
     ros::spinOnce();
-    loop_rate.sleep();
+    if(rate > 0)
+      loop_rate.sleep();
+    else
+      WaitForTracker(stamp, ack_timeout);
   }
 
   return 0;
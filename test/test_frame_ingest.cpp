@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include "mesh_localize/FrameIngest.h"
+
+using namespace cv;
+
+namespace
+{
+  const int kWidth = 320;
+  const int kHeight = 240;
+
+  Eigen::Matrix3f Intrinsics()
+  {
+    Eigen::Matrix3f K;
+    K << 300, 0, 160,
+         0, 300, 120,
+         0, 0, 1;
+    return K;
+  }
+
+  Eigen::VectorXf Distortion()
+  {
+    Eigen::VectorXf d(5);
+    d << -0.1, 0.01, 0, 0, 0;
+    return d;
+  }
+
+  // Smooth random image, so that the per-pixel rounding is all that differs
+  Mat RandomImage(int type)
+  {
+    Mat image(kHeight, kWidth, type);
+    RNG rng(7);
+    rng.fill(image, RNG::UNIFORM, 0, 256);
+    GaussianBlur(image, image, Size(0, 0), 2);
+    return image;
+  }
+
+  // cvtColor, then the same fixed-point remap with OpenCV's own kernel
+  Mat Reference(const Mat& raw, double scale, bool undistort)
+  {
+    Mat gray;
+    if(raw.channels() == 1)
+      gray = raw;
+    else if(raw.channels() == 3)
+      cvtColor(raw, gray, CV_RGB2GRAY);
+    else
+      cvtColor(raw, gray, CV_RGBA2GRAY);
+
+    Size size = FrameIngest::ScaledSize(raw.size(), scale);
+    Eigen::Matrix3f K = Intrinsics();
+    Eigen::Matrix3f K_out = FrameIngest::ScaleIntrinsics(K, raw.size(), size);
+    Mat K_raw = (Mat_<double>(3,3) << K(0,0), K(0,1), K(0,2),
+                                      K(1,0), K(1,1), K(1,2),
+                                      K(2,0), K(2,1), K(2,2));
+    Mat K_scaled = (Mat_<double>(3,3) << K_out(0,0), K_out(0,1), K_out(0,2),
+                                         K_out(1,0), K_out(1,1), K_out(1,2),
+                                         K_out(2,0), K_out(2,1), K_out(2,2));
+    Mat distcoeff;
+    if(undistort)
+    {
+      Eigen::VectorXf d = Distortion();
+      distcoeff = (Mat_<double>(5,1) << d(0), d(1), d(2), d(3), d(4));
+    }
+    Mat map_xy, map_a, out;
+    initUndistortRectifyMap(K_raw, distcoeff, Mat::eye(3, 3, CV_64F), K_scaled, size,
+      CV_16SC2, map_xy, map_a);
+    remap(gray, out, map_xy, map_a, INTER_LINEAR, BORDER_CONSTANT, Scalar(0));
+    return out;
+  }
+
+  void ExpectMatches(const Mat& raw, double scale, bool undistort)
+  {
+    FrameIngest ingest(Intrinsics(), Distortion(), undistort);
+    Mat frame;
+    ingest.process(raw, frame, scale);
+    Mat expected = Reference(raw, scale, undistort);
+
+    ASSERT_EQ(CV_8UC1, frame.type());
+    ASSERT_EQ(expected.size(), frame.size());
+    EXPECT_LE(norm(frame, expected, NORM_INF), 1) << raw.channels() << " channels, scale "
+      << scale << (undistort ? ", undistorted" : "");
+  }
+}
+
+TEST(FrameIngest, GrayScaled)
+{
+  ExpectMatches(RandomImage(CV_8UC1), 0.5, false);
+}
+
+TEST(FrameIngest, RgbScaled)
+{
+  ExpectMatches(RandomImage(CV_8UC3), 0.75, false);
+}
+
+TEST(FrameIngest, RgbUndistorted)
+{
+  ExpectMatches(RandomImage(CV_8UC3), 1, true);
+  ExpectMatches(RandomImage(CV_8UC3), 0.5, true);
+}
+
+TEST(FrameIngest, RgbaUndistorted)
+{
+  ExpectMatches(RandomImage(CV_8UC4), 0.6, true);
+}
+
+TEST(FrameIngest, UnchangedSizeIsColorConversionOnly)
+{
+  Mat raw = RandomImage(CV_8UC3);
+  FrameIngest ingest(Intrinsics(), Distortion(), false);
+  Mat frame, expected;
+  ingest.process(raw, frame, 1);
+  cvtColor(raw, expected, CV_RGB2GRAY);
+  EXPECT_EQ(0, norm(frame, expected, NORM_INF));
+
+  Mat gray = RandomImage(CV_8UC1);
+  ingest.process(gray, frame, 1);
+  EXPECT_EQ(gray.data, frame.data);
+}
+
+TEST(FrameIngest, BuffersAreReused)
+{
+  Mat raw = RandomImage(CV_8UC3);
+  FrameIngest ingest(Intrinsics(), Distortion(), true);
+  Mat frame;
+  ingest.process(raw, frame, 0.5);
+  const uchar* data = frame.data;
+  frame.release();
+  ingest.process(raw, frame, 0.5);
+  EXPECT_EQ(data, frame.data);
+}
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include "mesh_localize/LostModeGate.h"
+
+namespace
+{
+  const double kRetryPeriod = 1.0;
+  const double kImageScale = 0.5;
+  const double kChangeThresh = 10;
+
+  cv::Mat Gray(int level)
+  {
+    return cv::Mat(120, 160, CV_8UC1, cv::Scalar(level));
+  }
+}
+
+TEST(LostModeGate, DisabledAdmitsEverything)
+{
+  LostModeGate gate(0, kImageScale, kChangeThresh);
+  gate.recordFailures(100);
+  EXPECT_FALSE(gate.isBackingOff());
+  for(int i = 0; i < 10; i++)
+  {
+    double scale = 0;
+    EXPECT_TRUE(gate.admit(Gray(100), 0.01*i, scale));
+    EXPECT_EQ(1, scale);
+  }
+}
+
+TEST(LostModeGate, FullRateUntilAttemptsFail)
+{
+  LostModeGate gate(kRetryPeriod, kImageScale, kChangeThresh);
+  double scale = 0;
+  for(int i = 0; i < 3; i++)
+  {
+    EXPECT_TRUE(gate.admit(Gray(100), 0.01*i, scale));
+    EXPECT_EQ(1, scale);
+    EXPECT_FALSE(gate.isBackingOff());
+    gate.recordFailures(1);
+  }
+  EXPECT_TRUE(gate.isBackingOff());
+  EXPECT_FALSE(gate.admit(Gray(100), 0.03, scale));
+}
+
+TEST(LostModeGate, StaticSceneIsRetriedRarely)
+{
+  LostModeGate gate(kRetryPeriod, kImageScale, kChangeThresh);
+  double scale = 0;
+  ASSERT_TRUE(gate.admit(Gray(100), 0, scale));
+  gate.recordFailures(3);
+
+  EXPECT_FALSE(gate.admit(Gray(100), 0.5*kRetryPeriod, scale));
+  EXPECT_FALSE(gate.admit(Gray(102), 2*kRetryPeriod, scale));
+  EXPECT_TRUE(gate.admit(Gray(100), 6*kRetryPeriod, scale));
+  EXPECT_EQ(kImageScale, scale);
+}
+
+TEST(LostModeGate, ChangedSceneIsRetriedEveryPeriod)
+{
+  LostModeGate gate(kRetryPeriod, kImageScale, kChangeThresh);
+  double scale = 0;
+  ASSERT_TRUE(gate.admit(Gray(100), 0, scale));
+  gate.recordFailures(3);
+
+  EXPECT_FALSE(gate.admit(Gray(120), 0.5*kRetryPeriod, scale));
+  EXPECT_TRUE(gate.admit(Gray(120), 1.5*kRetryPeriod, scale));
+  EXPECT_EQ(kImageScale, scale);
+}
+
+TEST(LostModeGate, LargeChangeIsTriedRightAway)
+{
+  LostModeGate gate(kRetryPeriod, kImageScale, kChangeThresh);
+  double scale = 0;
+  ASSERT_TRUE(gate.admit(Gray(100), 0, scale));
+  gate.recordFailures(3);
+
+  EXPECT_TRUE(gate.admit(Gray(200), 0.1*kRetryPeriod, scale));
+  EXPECT_EQ(1, scale);
+  // Compared against the new frame from now on
+  EXPECT_FALSE(gate.admit(Gray(200), 0.2*kRetryPeriod, scale));
+}
+
+TEST(LostModeGate, StampGoingBackwardsStartsOver)
+{
+  LostModeGate gate(kRetryPeriod, kImageScale, kChangeThresh);
+  double scale = 0;
+  ASSERT_TRUE(gate.admit(Gray(100), 100, scale));
+  gate.recordFailures(3);
+  EXPECT_TRUE(gate.admit(Gray(100), 0, scale));
+}
+
+TEST(LostModeGate, ResetRestoresFullRate)
+{
+  LostModeGate gate(kRetryPeriod, kImageScale, kChangeThresh);
+  double scale = 0;
+  ASSERT_TRUE(gate.admit(Gray(100), 0, scale));
+  gate.recordFailures(3);
+  ASSERT_TRUE(gate.isBackingOff());
+
+  gate.reset();
+  EXPECT_FALSE(gate.isBackingOff());
+  EXPECT_TRUE(gate.admit(Gray(100), 0.01, scale));
+  EXPECT_EQ(1, scale);
+}
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include "mesh_localize/Metrics.h"
+
+TEST(LatencyHistogram, BucketIndexBoundaries)
+{
+  EXPECT_EQ(0, LatencyHistogram::BucketIndex(0));
+  EXPECT_EQ(0, LatencyHistogram::BucketIndex(-1));
+  EXPECT_EQ(0, LatencyHistogram::BucketIndex(NAN));
+
+  // Microsecond resolution below kSubBuckets us
+  EXPECT_EQ(5, LatencyHistogram::BucketIndex(5.5e-6));
+  EXPECT_EQ(63, LatencyHistogram::BucketIndex(63.5e-6));
+
+  // Then kSubBuckets/2 buckets per power of two
+  EXPECT_EQ(64, LatencyHistogram::BucketIndex(64.5e-6));
+  EXPECT_EQ(64, LatencyHistogram::BucketIndex(65.5e-6));
+  EXPECT_EQ(95, LatencyHistogram::BucketIndex(127.5e-6));
+  EXPECT_EQ(96, LatencyHistogram::BucketIndex(128.5e-6));
+  EXPECT_EQ(127, LatencyHistogram::BucketIndex(255.5e-6));
+  EXPECT_EQ(128, LatencyHistogram::BucketIndex(256.5e-6));
+
+  // Everything too large for the table ends up in the last bucket
+  EXPECT_EQ(LatencyHistogram::kNumBuckets-1, LatencyHistogram::BucketIndex(1e9));
+}
+
+TEST(LatencyHistogram, BucketValueIsWithinResolution)
+{
+  int prev = -1;
+  for(double seconds = 1e-6; seconds < 3600; seconds *= 1.07)
+  {
+    int index = LatencyHistogram::BucketIndex(seconds);
+    ASSERT_GE(index, prev);
+    ASSERT_LT(index, (int)LatencyHistogram::kNumBuckets);
+    EXPECT_NEAR(seconds, LatencyHistogram::BucketValue(index),
+      std::max(1e-6, 0.032*seconds));
+    prev = index;
+  }
+}
+
+TEST(LatencyHistogram, Percentiles)
+{
+  LatencyHistogram h;
+  EXPECT_EQ(0, h.getPercentile(0.5));
+
+  for(int i = 1; i <= 100; i++)
+  {
+    h.record(i*1e-3);
+  }
+  EXPECT_EQ(100u, h.getCount());
+  EXPECT_NEAR(50.5e-3, h.getMean(), 1e-9);
+  EXPECT_NEAR(1e-3, h.getPercentile(0), 0.03*1e-3);
+  EXPECT_NEAR(50e-3, h.getPercentile(0.5), 0.03*50e-3);
+  EXPECT_NEAR(90e-3, h.getPercentile(0.9), 0.03*90e-3);
+  EXPECT_NEAR(99e-3, h.getPercentile(0.99), 0.03*99e-3);
+  EXPECT_NEAR(100e-3, h.getPercentile(1), 0.03*100e-3);
+  // Never beyond the largest value recorded
+  EXPECT_LE(h.getPercentile(1), h.getMax());
+  EXPECT_EQ(h.getPercentile(1), h.getPercentile(2));
+
+  // A single value is reported as itself rather than its bucket's midpoint
+  LatencyHistogram single;
+  single.record(10e-6);
+  EXPECT_DOUBLE_EQ(10e-6, single.getPercentile(0.5));
+}
+
+TEST(LatencyHistogram, SubtractGivesWindow)
+{
+  LatencyHistogram start;
+  for(int i = 0; i < 10; i++)
+  {
+    start.record(1e-3);
+  }
+  LatencyHistogram end = start;
+  for(int i = 0; i < 10; i++)
+  {
+    end.record(10e-3);
+  }
+
+  LatencyHistogram window = end;
+  window.subtract(start);
+  EXPECT_EQ(10u, window.getCount());
+  EXPECT_NEAR(10e-3, window.getMean(), 1e-9);
+  EXPECT_NEAR(10e-3, window.getPercentile(0), 0.03*10e-3);
+
+  window.add(start);
+  EXPECT_EQ(end.getCount(), window.getCount());
+  EXPECT_EQ(end.counts, window.counts);
+}
+
+TEST(Metrics, CollectMergesThreads)
+{
+  Metrics::Record("test_metrics_stage", 2e-3);
+  Metrics::Record("test_metrics_stage", 4e-3);
+  Metrics::Increment("test_metrics_counter");
+  Metrics::Increment("test_metrics_counter", 2);
+
+  std::map<std::string, LatencyHistogram> stages;
+  std::map<std::string, boost::uint64_t> counters;
+  Metrics::Collect(stages, counters);
+  ASSERT_EQ(1u, stages.count("test_metrics_stage"));
+  EXPECT_EQ(2u, stages["test_metrics_stage"].getCount());
+  EXPECT_NEAR(3e-3, stages["test_metrics_stage"].getMean(), 1e-6);
+  EXPECT_EQ(3u, counters["test_metrics_counter"]);
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include "mesh_localize/ModeSelector.h"
+
+TEST(ModeSelector, StartsInPnp)
+{
+  ModeSelector selector;
+  EXPECT_EQ(ModeSelector::PNP, selector.select(ModeSelector::PNP));
+}
+
+TEST(ModeSelector, MovesToCheaperModeAfterDwelling)
+{
+  ModeSelector selector;
+  selector.record(ModeSelector::PNP, true, 3, 0.05);
+
+  // Untried modes are assumed free, but a reliable mode is kept for a while first
+  int frames = 0;
+  ModeSelector::Mode mode = ModeSelector::PNP;
+  while(mode == ModeSelector::PNP && frames < 100)
+  {
+    mode = selector.select(mode);
+    frames++;
+  }
+  EXPECT_EQ(ModeSelector::KLT, mode);
+  EXPECT_GT(frames, 1);
+  EXPECT_LE(frames, 10);
+}
+
+TEST(ModeSelector, KeepsReliableModeWhenCostsAreClose)
+{
+  ModeSelector selector;
+  selector.record(ModeSelector::PNP, true, 3, 0.010);
+  selector.record(ModeSelector::KLT, true, 3, 0.009);
+  selector.record(ModeSelector::EDGE, true, 3, 0.011);
+
+  for(int i = 0; i < 50; i++)
+  {
+    EXPECT_EQ(ModeSelector::PNP, selector.select(ModeSelector::PNP));
+  }
+}
+
+TEST(ModeSelector, LeavesFailingModeRightAway)
+{
+  ModeSelector selector;
+  selector.record(ModeSelector::PNP, true, 3, 0.05);
+  selector.record(ModeSelector::EDGE, true, 3, 0.2);
+  selector.record(ModeSelector::KLT, true, 3, 0.01);
+  EXPECT_EQ(ModeSelector::KLT, selector.select(ModeSelector::KLT));
+
+  selector.record(ModeSelector::KLT, false, 0, 0.01);
+  selector.record(ModeSelector::KLT, false, 0, 0.01);
+  EXPECT_EQ(ModeSelector::PNP, selector.select(ModeSelector::KLT));
+}
+
+TEST(ModeSelector, LeavesModeLosingMargin)
+{
+  ModeSelector selector;
+  selector.record(ModeSelector::PNP, true, 3, 0.05);
+  selector.record(ModeSelector::EDGE, true, 3, 0.2);
+  selector.record(ModeSelector::KLT, true, 3, 0.01);
+
+  // Still succeeding, but close to the failure threshold
+  for(int i = 0; i < 20; i++)
+  {
+    selector.record(ModeSelector::KLT, true, 1.1, 0.01);
+  }
+  EXPECT_EQ(ModeSelector::PNP, selector.select(ModeSelector::KLT));
+}
+
+TEST(ModeSelector, PnpIsAlwaysReliable)
+{
+  ModeSelector selector;
+  selector.record(ModeSelector::KLT, false, 0, 0.01);
+  selector.record(ModeSelector::EDGE, false, 0, 0.01);
+  for(int i = 0; i < 5; i++)
+  {
+    selector.record(ModeSelector::PNP, false, 0, 0.05);
+  }
+  EXPECT_EQ(ModeSelector::PNP, selector.select(ModeSelector::KLT));
+  EXPECT_EQ(ModeSelector::PNP, selector.select(ModeSelector::PNP));
+}
+
+TEST(ModeSelector, ResetForgetsStatistics)
+{
+  ModeSelector selector;
+  selector.record(ModeSelector::PNP, true, 3, 0.05);
+  selector.record(ModeSelector::KLT, false, 0, 0.01);
+  selector.record(ModeSelector::EDGE, false, 0, 0.01);
+  selector.select(ModeSelector::PNP);
+
+  selector.reset();
+  EXPECT_EQ(ModeSelector::PNP, selector.select(ModeSelector::PNP));
+  selector.record(ModeSelector::PNP, true, 3, 0.05);
+  ModeSelector::Mode mode = ModeSelector::PNP;
+  for(int i = 0; i < 10; i++)
+  {
+    mode = selector.select(mode);
+  }
+  EXPECT_EQ(ModeSelector::KLT, mode);
+}
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include "mesh_localize/PoseExtrapolator.h"
+
+namespace
+{
+  Eigen::Matrix4f Translation(float x, float y, float z)
+  {
+    Eigen::Matrix4f tf = Eigen::Matrix4f::Identity();
+    tf(0,3) = x;
+    tf(1,3) = y;
+    tf(2,3) = z;
+    return tf;
+  }
+
+  // Twist of a pure translation at v per second
+  Eigen::Matrix4f Velocity(float vx, float vy, float vz)
+  {
+    Eigen::Matrix4f vel = Eigen::Matrix4f::Zero();
+    vel(0,3) = vx;
+    vel(1,3) = vy;
+    vel(2,3) = vz;
+    return vel;
+  }
+}
+
+TEST(PoseExtrapolator, NothingToPredictFrom)
+{
+  PoseExtrapolator extrapolator(1.0);
+  Eigen::Matrix4f pose;
+  double age;
+  EXPECT_FALSE(extrapolator.predict(0, pose, age));
+}
+
+TEST(PoseExtrapolator, ConstantVelocity)
+{
+  PoseExtrapolator extrapolator(1.0);
+  extrapolator.update(10, Translation(1, 2, 3), Velocity(1, 0, -2));
+
+  Eigen::Matrix4f pose;
+  double age;
+  ASSERT_TRUE(extrapolator.predict(10.5, pose, age));
+  EXPECT_DOUBLE_EQ(0.5, age);
+  EXPECT_TRUE(pose.isApprox(Translation(1.5, 2, 2), 1e-5));
+}
+
+TEST(PoseExtrapolator, Rotation)
+{
+  PoseExtrapolator extrapolator(-1);
+  // Quarter turn about z per second
+  Eigen::Matrix4f vel = Eigen::Matrix4f::Zero();
+  vel(0,1) = -M_PI/2;
+  vel(1,0) = M_PI/2;
+  extrapolator.update(0, Eigen::Matrix4f::Identity(), vel);
+
+  Eigen::Matrix4f pose;
+  double age;
+  ASSERT_TRUE(extrapolator.predict(1, pose, age));
+  Eigen::Matrix4f expected = Eigen::Matrix4f::Identity();
+  expected.block<2,2>(0,0) << 0, -1,
+                              1, 0;
+  EXPECT_TRUE(pose.isApprox(expected, 1e-5));
+}
+
+TEST(PoseExtrapolator, EarlierStampGetsEstimate)
+{
+  PoseExtrapolator extrapolator(1.0);
+  extrapolator.update(10, Translation(1, 2, 3), Velocity(1, 0, 0));
+
+  Eigen::Matrix4f pose;
+  double age;
+  ASSERT_TRUE(extrapolator.predict(9.9, pose, age));
+  EXPECT_LT(age, 0);
+  EXPECT_TRUE(pose.isApprox(Translation(1, 2, 3)));
+}
+
+TEST(PoseExtrapolator, TooOld)
+{
+  PoseExtrapolator extrapolator(0.2);
+  extrapolator.update(10, Translation(1, 2, 3), Velocity(1, 0, 0));
+
+  Eigen::Matrix4f pose;
+  double age;
+  EXPECT_TRUE(extrapolator.predict(10.1, pose, age));
+  EXPECT_FALSE(extrapolator.predict(10.3, pose, age));
+}
+
+TEST(PoseExtrapolator, LateUpdateIsIgnored)
+{
+  PoseExtrapolator extrapolator(1.0);
+  extrapolator.update(10, Translation(1, 2, 3), Velocity(0, 0, 0));
+  extrapolator.update(9, Translation(4, 5, 6), Velocity(0, 0, 0));
+
+  Eigen::Matrix4f pose;
+  double age;
+  ASSERT_TRUE(extrapolator.predict(10, pose, age));
+  EXPECT_TRUE(pose.isApprox(Translation(1, 2, 3)));
+}
+
+TEST(PoseExtrapolator, Reset)
+{
+  PoseExtrapolator extrapolator(1.0);
+  extrapolator.update(10, Translation(1, 2, 3), Velocity(0, 0, 0));
+  extrapolator.reset();
+
+  Eigen::Matrix4f pose;
+  double age;
+  EXPECT_FALSE(extrapolator.predict(10, pose, age));
+}
@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "mesh_localize/TaskScheduler.h"
+#include "mesh_localize/BoundedQueue.h"
+
+namespace
+{
+  void Count(boost::atomic<int>* counter)
+  {
+    counter->fetch_add(1);
+  }
+
+  void Mark(std::vector<boost::atomic<int> >* visits, int i)
+  {
+    (*visits)[i].fetch_add(1);
+  }
+
+  void ThrowAt(int at, int i)
+  {
+    if(i == at)
+      throw std::runtime_error("task failed");
+  }
+
+  void Throw()
+  {
+    throw std::runtime_error("task failed");
+  }
+
+  // Runs a nested group from inside a task
+  void Nested(boost::atomic<int>* counter)
+  {
+    TaskGroup group;
+    for(int i = 0; i < 8; i++)
+    {
+      group.run(boost::bind(&Count, counter));
+    }
+    group.wait();
+  }
+
+  // Flags the task if it runs on waiter while waiter is waiting for another group
+  void CheckThread(boost::thread::id waiter, boost::atomic<bool>* waiting,
+    boost::atomic<int>* stolen)
+  {
+    if(waiting->load() && boost::this_thread::get_id() == waiter)
+      stolen->fetch_add(1);
+    boost::this_thread::sleep(boost::posix_time::microseconds(200));
+  }
+
+  void PopInto(BoundedQueue<int>* queue, int* item, bool* result)
+  {
+    *result = queue->Pop(*item);
+  }
+}
+
+TEST(TaskScheduler, ParseCpuList)
+{
+  std::vector<int> cpus = TaskScheduler::ParseCpuList("0,2,4-7");
+  int expected[] = {0, 2, 4, 5, 6, 7};
+  EXPECT_EQ(std::vector<int>(expected, expected + 6), cpus);
+  EXPECT_TRUE(TaskScheduler::ParseCpuList("").empty());
+}
+
+TEST(TaskScheduler, ParallelForVisitsEveryIndexOnce)
+{
+  std::vector<boost::atomic<int> > visits(1000);
+  for(unsigned int i = 0; i < visits.size(); i++)
+  {
+    visits[i].store(0);
+  }
+  TaskScheduler::Instance().parallelFor(0, visits.size(), boost::bind(&Mark, &visits, _1));
+  for(unsigned int i = 0; i < visits.size(); i++)
+  {
+    EXPECT_EQ(1, visits[i].load()) << "index " << i;
+  }
+
+  // Empty ranges are fine
+  TaskScheduler::Instance().parallelFor(5, 5, boost::bind(&Mark, &visits, _1));
+}
+
+TEST(TaskScheduler, ParallelForRethrows)
+{
+  EXPECT_THROW(TaskScheduler::Instance().parallelFor(0, 100, boost::bind(&ThrowAt, 37, _1)),
+    std::runtime_error);
+}
+
+TEST(TaskGroup, WaitRunsEveryTask)
+{
+  boost::atomic<int> counter(0);
+  TaskGroup group;
+  for(int i = 0; i < 500; i++)
+  {
+    group.run(boost::bind(&Count, &counter));
+  }
+  group.wait();
+  EXPECT_EQ(500, counter.load());
+}
+
+TEST(TaskGroup, NestedGroups)
+{
+  boost::atomic<int> counter(0);
+  TaskGroup group;
+  for(int i = 0; i < 50; i++)
+  {
+    group.run(boost::bind(&Nested, &counter));
+  }
+  group.wait();
+  EXPECT_EQ(50*8, counter.load());
+}
+
+TEST(TaskGroup, WaitRethrowsAfterTheOtherTasks)
+{
+  boost::atomic<int> counter(0);
+  TaskGroup group;
+  for(int i = 0; i < 100; i++)
+  {
+    group.run(boost::bind(&Count, &counter));
+    if(i == 50)
+      group.run(&Throw);
+  }
+  EXPECT_THROW(group.wait(), std::runtime_error);
+  EXPECT_EQ(100, counter.load());
+
+  // The error is reported once
+  group.wait();
+}
+
+TEST(TaskGroup, WaitOnlyRunsItsOwnTasks)
+{
+  boost::atomic<bool> waiting(false);
+  boost::atomic<int> stolen(0);
+  boost::atomic<int> counter(0);
+
+  TaskGroup background;
+  for(int i = 0; i < 200; i++)
+  {
+    background.run(boost::bind(&CheckThread, boost::this_thread::get_id(), &waiting, &stolen));
+  }
+
+  TaskGroup group;
+  for(int i = 0; i < 10; i++)
+  {
+    group.run(boost::bind(&Count, &counter));
+  }
+  waiting.store(true);
+  group.wait();
+  waiting.store(false);
+  EXPECT_EQ(10, counter.load());
+
+  background.wait();
+  EXPECT_EQ(0, stolen.load());
+}
+
+TEST(BoundedQueue, DropsOldest)
+{
+  BoundedQueue<int> queue(2, true);
+  EXPECT_TRUE(queue.Push(1));
+  EXPECT_TRUE(queue.Push(2));
+  EXPECT_TRUE(queue.Push(3));
+  EXPECT_EQ(2u, queue.Size());
+  EXPECT_EQ(1u, queue.NumDropped());
+
+  int item;
+  ASSERT_TRUE(queue.TryPop(item));
+  EXPECT_EQ(2, item);
+  ASSERT_TRUE(queue.Pop(item));
+  EXPECT_EQ(3, item);
+  EXPECT_FALSE(queue.TryPop(item));
+}
+
+TEST(BoundedQueue, BlockingPushWaitsForPop)
+{
+  BoundedQueue<int> queue(1, false);
+  ASSERT_TRUE(queue.Push(1));
+
+  boost::thread producer(boost::bind(&BoundedQueue<int>::Push, &queue, 2));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+  EXPECT_EQ(1u, queue.Size());
+
+  int item;
+  ASSERT_TRUE(queue.Pop(item));
+  EXPECT_EQ(1, item);
+  producer.join();
+  ASSERT_TRUE(queue.Pop(item));
+  EXPECT_EQ(2, item);
+  EXPECT_EQ(0u, queue.NumDropped());
+}
+
+TEST(BoundedQueue, TimedPopTimesOut)
+{
+  BoundedQueue<int> queue;
+  int item;
+  EXPECT_FALSE(queue.Pop(item, 0.01));
+}
+
+TEST(BoundedQueue, CloseWakesWaiters)
+{
+  BoundedQueue<int> queue;
+  int item = 0;
+  bool result = true;
+  boost::thread consumer(boost::bind(&PopInto, &queue, &item, &result));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+  queue.Close();
+  consumer.join();
+  EXPECT_FALSE(result);
+  EXPECT_FALSE(queue.Push(1));
+}